@@ -13,6 +13,7 @@
 #
 
 pillow_no_ssl: DEFINES += PILLOW_NO_SSL
+!linux*: DEFINES += PILLOW_NO_UNIX_SERVER # Pillow::HttpUnixServer relies on Linux specific socket options.
 
 PILLOWCORE_LIB_NAME = pillowcore
 CONFIG(debug, debug|release) {
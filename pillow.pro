@@ -1,9 +1,13 @@
 include(config.pri)
 
 TEMPLATE = subdirs
-SUBDIRS = pillowcore tests examples
+SUBDIRS = pillowcore tests allocations benchmarks examples
 
 tests.depends = pillowcore
+allocations.subdir = tests/allocations
+allocations.depends = pillowcore
+benchmarks.subdir = tests/benchmarks
+benchmarks.depends = pillowcore
 examples.depends = pillowcore
 
 OTHER_FILES += README pillow.qbs
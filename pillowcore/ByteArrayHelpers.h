@@ -11,6 +11,14 @@
 #include <QtCore/QStringBuilder>
 #endif // QSTRINGBUILDER_H
 
+#if !defined(PILLOW_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PILLOW_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 namespace Pillow
 {
 	//
@@ -93,6 +101,13 @@ namespace Pillow
 			}
 		}
 
+		// A deep copy that owns its data, for keeping a connection's request members, which are raw data over
+		// its buffers, past the request or for handing them to another thread. Unlike detach(), leaves data alone.
+		inline QByteArray detachedCopy(const QByteArray& data)
+		{
+			return QByteArray(data.constData(), data.size());
+		}
+
 		template <typename Integer, int Base>
 		inline void appendNumber(QByteArray& target, const Integer number)
 		{
@@ -114,61 +129,94 @@ namespace Pillow
 			}
 		}
 
-		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const QByteArray& second)
+		// Scalar reference implementation; also handles the tails of the vectorized one.
+		inline bool asciiEqualsCaseInsensitiveScalar(const char* first, const char* second, int size)
 		{
-			if (first.size() != second.size()) return false;
-			for (register int i = 0; i < first.size(); ++i)
+			for (register int i = 0; i < size; ++i)
 			{
-				register char f = first.at(i), s = second.at(i);
+				register char f = first[i], s = second[i];
 				bool good = (f == s) || ((f - s) == 32 && f >= 'a' && f <= 'z') || ((f - s) == -32 && f >= 'A' && f <= 'Z');
 				if (!good) return false;
 			}
 			return true;
 		}
 
-		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const QLatin1Literal& second)
+#ifdef PILLOW_SSE2
+		inline __m128i toLowerSse2(__m128i chars)
 		{
-			if (first.size() != second.size()) return false;
-			const char* sec = second.data();
-			for (register int i = 0; i < first.size(); ++i)
+			// Set bit 0x20 on the bytes that are within 'A'..'Z'.
+			const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('Z' + 1)));
+			return _mm_or_si128(chars, _mm_and_si128(isUpper, _mm_set1_epi8(0x20)));
+		}
+
+		inline int countTrailingZeros(unsigned int mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index; _BitScanForward(&index, mask); return static_cast<int>(index);
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+#endif
+
+		// Compares 16 bytes at a time with SSE2 when available.
+		inline bool asciiEqualsCaseInsensitive(const char* first, const char* second, int size)
+		{
+#ifdef PILLOW_SSE2
+			int i = 0;
+			for (; i + 16 <= size; i += 16)
 			{
-				register char f = first.at(i), s = sec[i];
-				bool good = (f == s) || ((f - s) == 32 && f >= 'a' && f <= 'z') || ((f - s) == -32 && f >= 'A' && f <= 'Z');
-				if (!good) return false;
+				const __m128i f = toLowerSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i)));
+				const __m128i s = toLowerSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i)));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(f, s)) != 0xFFFF) return false;
 			}
-			return true;
+			return asciiEqualsCaseInsensitiveScalar(first + i, second + i, size - i);
+#else
+			return asciiEqualsCaseInsensitiveScalar(first, second, size);
+#endif
+		}
+
+		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const QByteArray& second)
+		{
+			if (first.size() != second.size()) return false;
+			return asciiEqualsCaseInsensitive(first.constData(), second.constData(), first.size());
+		}
+
+		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const QLatin1Literal& second)
+		{
+			if (first.size() != second.size()) return false;
+			return asciiEqualsCaseInsensitive(first.constData(), second.data(), first.size());
 		}
 
 		inline bool asciiEqualsCaseInsensitive(const char* first, int firstSize, const char* second, int secondSize)
 		{
 			if (firstSize != secondSize) return false;
-			for (register int i = 0; i < firstSize; ++i)
-			{
-				register char f = first[i], s = second[i];
-				bool good = (f == s) || ((f - s) == 32 && f >= 'a' && f <= 'z') || ((f - s) == -32 && f >= 'A' && f <= 'Z');
-				if (!good) return false;
-			}
-			return true;
+			return asciiEqualsCaseInsensitive(first, second, firstSize);
 		}
 
 		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const Pillow::Token& second)
 		{
 			if (first.size() != second.size()) return false;
-			for (register int i = 0; i < first.size(); ++i)
-			{
-				register char f = first.at(i), s = second.at(i);
-				bool good = (f == s) || ((f - s) == 32 && f >= 'a' && f <= 'z') || ((f - s) == -32 && f >= 'A' && f <= 'Z');
-				if (!good) return false;
-			}
-			return true;
+			return asciiEqualsCaseInsensitive(first.constData(), second.data(), first.size());
 		}
 
 		inline bool asciiEqualsCaseInsensitive(const QByteArray& first, const Pillow::LowerCaseToken& second)
 		{
 			if (first.size() != second.size()) return false;
-			for (register int i = 0; i < first.size(); ++i)
+			const char* fir = first.constData(); const char* sec = second.data();
+			int i = 0;
+#ifdef PILLOW_SSE2
+			for (; i + 16 <= first.size(); i += 16)
+			{
+				// The token is already lowercase; only fold the first operand.
+				const __m128i f = toLowerSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(fir + i)));
+				const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sec + i));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(f, s)) != 0xFFFF) return false;
+			}
+#endif
+			for (; i < first.size(); ++i)
 			{
-				register char f = first.at(i), s = second.at(i);
+				register char f = fir[i], s = sec[i];
 				bool good = (f == s) || ((f - s) == -32 && f >= 'A' && f <= 'Z');
 				if (!good) return false;
 			}
@@ -183,26 +231,79 @@ namespace Pillow
 			return 0;
 		}
 
-		inline int percentDecodeInPlace(char* data, int size)
+		inline bool isHexDigit(const char c)
+		{
+			return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+		}
+
+		// Decode the percent-encoded sequence at in, which must start with '%'. Returns the number of input bytes used:
+		// 3 for a valid sequence, or 1 if it is not a valid sequence (in which case the '%' is kept as is).
+		inline int percentDecodeSequence(char* out, const char* in, const char* inE)
 		{
+			if (in + 2 < inE && isHexDigit(in[1]) && isHexDigit(in[2]))
+			{
+				*out = static_cast<char>(unhex(in[1]) << 4 | unhex(in[2]));
+				return 3;
+			}
+			*out = '%';
+			return 1;
+		}
+
+		// Scalar reference implementation.
+		inline int percentDecodeInPlaceScalar(char* data, int size)
+		{
+			char* out = data;
 			const char* inData = data;
 			const char* inDataE = data + size;
 			while (inData < inDataE)
 			{
-				if (inData[0] == '%' && inData + 2 < inDataE)
+				if (inData[0] == '%')
+					inData += percentDecodeSequence(out++, inData, inDataE);
+				else
+					*out++ = *inData++;
+			}
+			return static_cast<int>(out - data);
+		}
+
+		// Decodes the percent-encoded sequences of data in place and returns the decoded size.
+		// Invalid sequences (not followed by two hex digits) are kept as is. With SSE2, the input
+		// is scanned for '%' 16 bytes at a time.
+		inline int percentDecodeInPlace(char* data, int size)
+		{
+#ifdef PILLOW_SSE2
+			char* out = data;
+			const char* inData = data;
+			const char* inDataE = data + size;
+			const __m128i percent = _mm_set1_epi8('%');
+			while (inData + 16 <= inDataE)
+			{
+				const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inData));
+				const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, percent)));
+				if (mask == 0)
 				{
-					// Percent-encoded sequence.
-					*data = static_cast<char>(unhex(inData[1]) << 4 | unhex(inData[2]));
-					++data; inData += 3;
-					size -= 2;
+					// No escapes: move the whole block (the output never runs ahead of the input).
+					if (out != inData) _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+					out += 16; inData += 16;
 				}
 				else
 				{
-					*data = *inData;
-					++data; ++inData;
+					const int prefix = countTrailingZeros(mask);
+					if (out != inData) memmove(out, inData, prefix);
+					out += prefix; inData += prefix;
+					inData += percentDecodeSequence(out++, inData, inDataE);
 				}
 			}
-			return size;
+			while (inData < inDataE)
+			{
+				if (inData[0] == '%')
+					inData += percentDecodeSequence(out++, inData, inDataE);
+				else
+					*out++ = *inData++;
+			}
+			return static_cast<int>(out - data);
+#else
+			return percentDecodeInPlaceScalar(data, size);
+#endif
 		}
 
 		inline QString percentDecode(const QByteArray& byteArray)
@@ -0,0 +1,299 @@
+#include "Http2Hpack.h"
+#include <string.h>
+using namespace Pillow;
+
+namespace
+{
+	struct StaticTableEntry { const char* name; int nameSize; const char* value; int valueSize; };
+	#define ENTRY(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+	static const StaticTableEntry staticTable[] =
+	{
+		ENTRY(":authority", ""), ENTRY(":method", "GET"), ENTRY(":method", "POST"), ENTRY(":path", "/"), ENTRY(":path", "/index.html"),
+		ENTRY(":scheme", "http"), ENTRY(":scheme", "https"), ENTRY(":status", "200"), ENTRY(":status", "204"), ENTRY(":status", "206"),
+		ENTRY(":status", "304"), ENTRY(":status", "400"), ENTRY(":status", "404"), ENTRY(":status", "500"), ENTRY("accept-charset", ""),
+		ENTRY("accept-encoding", "gzip, deflate"), ENTRY("accept-language", ""), ENTRY("accept-ranges", ""), ENTRY("accept", ""),
+		ENTRY("access-control-allow-origin", ""), ENTRY("age", ""), ENTRY("allow", ""), ENTRY("authorization", ""), ENTRY("cache-control", ""),
+		ENTRY("content-disposition", ""), ENTRY("content-encoding", ""), ENTRY("content-language", ""), ENTRY("content-length", ""),
+		ENTRY("content-location", ""), ENTRY("content-range", ""), ENTRY("content-type", ""), ENTRY("cookie", ""), ENTRY("date", ""),
+		ENTRY("etag", ""), ENTRY("expect", ""), ENTRY("expires", ""), ENTRY("from", ""), ENTRY("host", ""), ENTRY("if-match", ""),
+		ENTRY("if-modified-since", ""), ENTRY("if-none-match", ""), ENTRY("if-range", ""), ENTRY("if-unmodified-since", ""),
+		ENTRY("last-modified", ""), ENTRY("link", ""), ENTRY("location", ""), ENTRY("max-forwards", ""), ENTRY("proxy-authenticate", ""),
+		ENTRY("proxy-authorization", ""), ENTRY("range", ""), ENTRY("referer", ""), ENTRY("refresh", ""), ENTRY("retry-after", ""),
+		ENTRY("server", ""), ENTRY("set-cookie", ""), ENTRY("strict-transport-security", ""), ENTRY("transfer-encoding", ""),
+		ENTRY("user-agent", ""), ENTRY("vary", ""), ENTRY("via", ""), ENTRY("www-authenticate", "")
+	};
+	#undef ENTRY
+	enum { StaticTableCount = sizeof(staticTable) / sizeof(staticTable[0]) }; // 61 entries, indexed from 1.
+	enum { EntryOverhead = 32 };
+
+	// The Huffman code of RFC 7541 appendix B is canonical: codes are assigned in increasing order
+	// of length, then of symbol. The symbols in that order and the number of codes of each length
+	// are enough to decode it.
+	static const short huffmanSymbols[257] =
+	{
+		48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+		52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+		110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+		77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+		119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+		43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+		195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+		179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+		163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+		233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+		158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+		144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+		200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+		212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+		2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+		21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+		256
+	};
+	enum { HuffmanMaximumCodeLength = 30, HuffmanEos = 256 };
+	static const uchar huffmanCodeCounts[HuffmanMaximumCodeLength + 1] =
+	{
+		0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+	};
+
+	bool decodeInteger(const uchar*& p, const uchar* e, int prefixBits, quint32& value)
+	{
+		const uchar prefixMask = uchar((1 << prefixBits) - 1);
+		value = *p++ & prefixMask;
+		if (value < prefixMask) return true;
+
+		for (int shift = 0; p < e; shift += 7)
+		{
+			if (shift > 21) return false; // Way larger than anything valid.
+			const uchar byte = *p++;
+			value += quint32(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+
+	bool decodeString(const uchar*& p, const uchar* e, QByteArray& target)
+	{
+		if (p >= e) return false;
+		const bool huffman = (*p & 0x80) != 0;
+		quint32 size;
+		if (!decodeInteger(p, e, 7, size) || size > quint32(e - p)) return false;
+
+		const char* data = reinterpret_cast<const char*>(p);
+		p += size;
+		if (huffman)
+		{
+			target = QByteArray();
+			return HpackDecoder::decodeHuffman(data, int(size), target);
+		}
+		target = QByteArray(data, int(size));
+		return true;
+	}
+
+	int findStaticTableEntry(const char* name, int nameSize, const char* value, int valueSize, bool& valueMatches)
+	{
+		int nameIndex = 0;
+		for (int i = 0; i < StaticTableCount; ++i)
+		{
+			const StaticTableEntry& entry = staticTable[i];
+			if (entry.nameSize != nameSize || entry.name[0] != name[0] || memcmp(entry.name, name, nameSize) != 0) continue;
+			if (entry.valueSize == valueSize && valueSize > 0 && memcmp(entry.value, value, valueSize) == 0)
+			{
+				valueMatches = true;
+				return i + 1;
+			}
+			if (nameIndex == 0) nameIndex = i + 1;
+		}
+		valueMatches = false;
+		return nameIndex;
+	}
+}
+
+//
+// Pillow::HpackDecoder
+//
+
+HpackDecoder::HpackDecoder(int maximumDynamicTableSize)
+	: _dynamicTableSize(0), _dynamicTableCapacity(maximumDynamicTableSize), _maximumDynamicTableSize(maximumDynamicTableSize),
+	  _maximumHeaderListSize(DefaultMaximumHeaderListSize)
+{
+}
+
+void HpackDecoder::setMaximumDynamicTableSize(int size)
+{
+	_maximumDynamicTableSize = size;
+	if (_dynamicTableCapacity > size)
+	{
+		_dynamicTableCapacity = size;
+		evict(size);
+	}
+}
+
+bool HpackDecoder::header(int index, Pillow::HttpHeader& header) const
+{
+	if (index <= 0) return false;
+	if (index <= StaticTableCount)
+	{
+		const StaticTableEntry& entry = staticTable[index - 1];
+		header.first = QByteArray::fromRawData(entry.name, entry.nameSize);
+		header.second = QByteArray::fromRawData(entry.value, entry.valueSize);
+		return true;
+	}
+	index -= StaticTableCount + 1;
+	if (index >= _dynamicTable.size()) return false;
+	header = _dynamicTable.at(index);
+	return true;
+}
+
+void HpackDecoder::add(const Pillow::HttpHeader& header)
+{
+	const int size = header.first.size() + header.second.size() + EntryOverhead;
+	if (size > _dynamicTableCapacity)
+	{
+		// Not an error: the table just ends up empty.
+		evict(0);
+		return;
+	}
+	evict(_dynamicTableCapacity - size);
+
+	// Deep copies: static table names are raw data, and values may be shared with much larger buffers.
+	_dynamicTable.prepend(HttpHeader(QByteArray(header.first.constData(), header.first.size()), QByteArray(header.second.constData(), header.second.size())));
+	_dynamicTableSize += size;
+}
+
+void HpackDecoder::evict(int capacity)
+{
+	while (_dynamicTableSize > capacity && !_dynamicTable.isEmpty())
+	{
+		const HttpHeader& last = _dynamicTable.last();
+		_dynamicTableSize -= last.first.size() + last.second.size() + EntryOverhead;
+		_dynamicTable.removeLast();
+	}
+}
+
+bool HpackDecoder::decode(const char* data, int size, Pillow::HttpHeaderCollection& headers)
+{
+	const uchar* p = reinterpret_cast<const uchar*>(data), *e = p + size;
+	int headerListSize = 0;
+	bool acceptsTableSizeUpdate = true; // Only at the beginning of a block.
+
+	while (p < e)
+	{
+		const uchar byte = *p;
+		HttpHeader field;
+		quint32 index;
+
+		if (byte & 0x80)
+		{
+			// Indexed header field.
+			if (!decodeInteger(p, e, 7, index) || !header(int(index), field)) return false;
+		}
+		else if ((byte & 0xE0) == 0x20)
+		{
+			// Dynamic table size update.
+			if (!acceptsTableSizeUpdate || !decodeInteger(p, e, 5, index) || index > quint32(_maximumDynamicTableSize)) return false;
+			_dynamicTableCapacity = int(index);
+			evict(_dynamicTableCapacity);
+			continue;
+		}
+		else
+		{
+			// Literal header field: with incremental indexing (01), without indexing (0000) or never indexed (0001).
+			const bool indexing = (byte & 0xC0) == 0x40;
+			if (!decodeInteger(p, e, indexing ? 6 : 4, index)) return false;
+			if (index > 0) { if (!header(int(index), field)) return false; }
+			else if (!decodeString(p, e, field.first)) return false;
+			if (!decodeString(p, e, field.second)) return false;
+			if (indexing) add(field);
+		}
+
+		acceptsTableSizeUpdate = false;
+		headerListSize += field.first.size() + field.second.size() + EntryOverhead;
+		if (headerListSize > _maximumHeaderListSize) return false;
+		headers.append(field);
+	}
+	return true;
+}
+
+bool HpackDecoder::decodeHuffman(const char* data, int size, QByteArray& target)
+{
+	target.reserve(target.size() + size * 8 / 5);
+
+	quint32 code = 0; // Bits of the code being decoded.
+	int codeLength = 0, first = 0, firstSymbol = 0;
+	for (const uchar* p = reinterpret_cast<const uchar*>(data), *e = p + size; p < e; ++p)
+	{
+		for (int bit = 7; bit >= 0; --bit)
+		{
+			code = (code << 1) | ((*p >> bit) & 1);
+			++codeLength;
+
+			// Canonical decoding: the codes of a given length are consecutive, starting at first.
+			const int count = huffmanCodeCounts[codeLength];
+			if (code - first < quint32(count))
+			{
+				const int symbol = huffmanSymbols[firstSymbol + int(code - first)];
+				if (symbol == HuffmanEos) return false; // EOS must not appear in a string.
+				target.append(char(symbol));
+				code = 0; codeLength = 0; first = 0; firstSymbol = 0;
+			}
+			else
+			{
+				if (codeLength == HuffmanMaximumCodeLength) return false;
+				first = (first + count) << 1;
+				firstSymbol += count;
+			}
+		}
+	}
+
+	// Padding: at most 7 bits, all ones (the most significant bits of EOS).
+	return codeLength <= 7 && code == (1u << codeLength) - 1;
+}
+
+//
+// Pillow::HpackEncoder
+//
+
+void HpackEncoder::encodeInteger(quint32 value, int prefixBits, uchar flags, QByteArray& target)
+{
+	const quint32 prefixMask = (1u << prefixBits) - 1;
+	if (value < prefixMask)
+	{
+		target.append(char(flags | value));
+		return;
+	}
+	target.append(char(flags | prefixMask));
+	value -= prefixMask;
+	while (value >= 0x80)
+	{
+		target.append(char((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	target.append(char(value));
+}
+
+void HpackEncoder::encode(const char* name, int nameSize, const char* value, int valueSize, QByteArray& target)
+{
+	bool valueMatches;
+	const int index = findStaticTableEntry(name, nameSize, value, valueSize, valueMatches);
+	if (valueMatches)
+	{
+		encodeInteger(index, 7, 0x80, target); // Indexed header field.
+		return;
+	}
+
+	// Literal header field without indexing, with an indexed name if there is one.
+	encodeInteger(index, 4, 0x00, target);
+	if (index == 0)
+	{
+		encodeInteger(nameSize, 7, 0x00, target);
+		target.append(name, nameSize);
+	}
+	encodeInteger(valueSize, 7, 0x00, target);
+	target.append(value, valueSize);
+}
+
+void HpackEncoder::encode(const Pillow::HttpHeaderCollection& headers, QByteArray& target)
+{
+	for (const HttpHeader* header = headers.constBegin(), *headerE = headers.constEnd(); header != headerE; ++header)
+		encode(header->first.constData(), header->first.size(), header->second.constData(), header->second.size(), target);
+}
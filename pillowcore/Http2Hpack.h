@@ -0,0 +1,78 @@
+#ifndef PILLOW_HTTP2HPACK_H
+#define PILLOW_HTTP2HPACK_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHEADER_H
+#include "HttpHeader.h"
+#endif // PILLOW_HTTPHEADER_H
+#ifndef QLIST_H
+#include <QtCore/QList>
+#endif // QLIST_H
+
+namespace Pillow
+{
+	//
+	// Pillow::HpackDecoder
+	//
+	// Decodes Http/2 header blocks (HPACK, RFC 7541), keeping the dynamic table of one direction of a connection.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HpackDecoder
+	{
+		QList<Pillow::HttpHeader> _dynamicTable; // Newest entry first.
+		int _dynamicTableSize, _dynamicTableCapacity, _maximumDynamicTableSize;
+		int _maximumHeaderListSize;
+
+	public:
+		enum { DefaultDynamicTableSize = 4096 };
+		enum { DefaultMaximumHeaderListSize = 64 * 1024 };
+
+	public:
+		HpackDecoder(int maximumDynamicTableSize = DefaultDynamicTableSize);
+
+		// Decode a complete header block, appending the headers to the collection. Returns false on a compression error, which
+		// leaves the decoder out of sync with the peer's encoder: the connection has to be dropped. Blocks that decode to more
+		// than maximumHeaderListSize (names, values and 32 bytes of overhead per header) count as errors too.
+		bool decode(const char* data, int size, Pillow::HttpHeaderCollection& headers);
+
+		// The size the peer's encoder is allowed to use, as advertised by SETTINGS_HEADER_TABLE_SIZE.
+		inline int maximumDynamicTableSize() const { return _maximumDynamicTableSize; }
+		void setMaximumDynamicTableSize(int size);
+		inline int dynamicTableSize() const { return _dynamicTableSize; }
+		inline int dynamicTableCount() const { return _dynamicTable.size(); }
+
+		inline int maximumHeaderListSize() const { return _maximumHeaderListSize; }
+		inline void setMaximumHeaderListSize(int size) { _maximumHeaderListSize = size; }
+
+		// Decode a Huffman encoded string (RFC 7541 section 5.2), appending it to target.
+		static bool decodeHuffman(const char* data, int size, QByteArray& target);
+
+	private:
+		bool header(int index, Pillow::HttpHeader& header) const;
+		void add(const Pillow::HttpHeader& header);
+		void evict(int capacity);
+	};
+
+	//
+	// Pillow::HpackEncoder
+	//
+	// Encodes Http/2 header blocks. Does not use a dynamic table: fields are sent as indexed entries
+	// of the static table when they fully match one, as literals without indexing otherwise. Since the
+	// encoder keeps no state, its output does not depend on the peer's SETTINGS_HEADER_TABLE_SIZE.
+	//
+	// Reentrant.
+	//
+	class PILLOWCORE_EXPORT HpackEncoder
+	{
+	public:
+		// Field names must be lowercase.
+		static void encode(const Pillow::HttpHeaderCollection& headers, QByteArray& target);
+		static void encode(const char* name, int nameSize, const char* value, int valueSize, QByteArray& target);
+		static void encodeInteger(quint32 value, int prefixBits, uchar flags, QByteArray& target);
+	};
+}
+
+#endif // PILLOW_HTTP2HPACK_H
@@ -0,0 +1,990 @@
+#include "Http2Session.h"
+#include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QIODevice>
+#include <QtCore/QTimer>
+#include <QtCore/QDebug>
+#include <string.h>
+using namespace Pillow;
+
+namespace
+{
+	const char connectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+	enum { ConnectionPrefaceSize = sizeof(connectionPreface) - 1, PriorKnowledgeRequestSize = 18 }; // The request line and empty line of the preface.
+	enum { FrameHeaderSize = 9 };
+	enum { MaximumWindowSize = 0x7FFFFFFF };
+	enum { MaximumHeaderBlockSize = Pillow::HttpConnection::MaximumRequestHeaderLength * 2 }; // Compressed, while waiting for CONTINUATION frames.
+	enum SettingId { HeaderTableSizeSetting = 0x1, EnablePushSetting = 0x2, MaxConcurrentStreamsSetting = 0x3, InitialWindowSizeSetting = 0x4,
+					 MaxFrameSizeSetting = 0x5, MaxHeaderListSizeSetting = 0x6 };
+
+	inline quint32 readUInt32(const char* data)
+	{
+		const uchar* d = reinterpret_cast<const uchar*>(data);
+		return (quint32(d[0]) << 24) | (quint32(d[1]) << 16) | (quint32(d[2]) << 8) | quint32(d[3]);
+	}
+
+	inline void appendUInt32(char* target, quint32 value)
+	{
+		target[0] = char(value >> 24); target[1] = char(value >> 16); target[2] = char(value >> 8); target[3] = char(value);
+	}
+
+	inline bool isConnectionSpecificField(const QByteArray& name)
+	{
+		using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+		switch (name.size())
+		{
+		case 7: return asciiEqualsCaseInsensitive(name.constData(), "upgrade", 7);
+		case 10: return asciiEqualsCaseInsensitive(name.constData(), "connection", 10) || asciiEqualsCaseInsensitive(name.constData(), "keep-alive", 10);
+		case 16: return asciiEqualsCaseInsensitive(name.constData(), "proxy-connection", 16);
+		case 17: return asciiEqualsCaseInsensitive(name.constData(), "transfer-encoding", 17);
+		default: return false;
+		}
+	}
+
+	inline bool isValidFieldValue(const QByteArray& value)
+	{
+		for (const char* c = value.constData(), *cE = c + value.size(); c < cE; ++c)
+			if (*c == '\r' || *c == '\n' || *c == '\0') return false;
+		return true;
+	}
+
+	inline bool isValidFieldName(const QByteArray& name)
+	{
+		if (name.isEmpty()) return false;
+		for (const char* c = name.constData(), *cE = c + name.size(); c < cE; ++c)
+			if (*c <= ' ' || *c == ':' || *c >= 0x7F || (*c >= 'A' && *c <= 'Z')) return false; // Http/2 field names are lowercase.
+		return true;
+	}
+
+	inline void appendField(QByteArray& target, const QByteArray& name, const QByteArray& value)
+	{
+		target.append(name).append(": ", 2).append(value).append("\r\n", 2);
+	}
+}
+
+namespace Pillow
+{
+	//
+	// Pillow::Http2Stream
+	//
+	// The device of the Pillow::HttpConnection serving a stream. The request is read from it as Http/1.1, and the
+	// Http/1.1 response written to it gets parsed back into header fields and content for the session to frame.
+	//
+	class Http2Stream : public QIODevice
+	{
+	public:
+		enum ResponseState { ResponseHead, ResponseContent, ResponseChunkSize, ResponseChunkData, ResponseChunkDataEnd, ResponseTrailers, ResponseUntilClose, ResponseDone };
+
+		Http2Session* session;
+		quint32 id;
+		Pillow::HttpConnection* connection;
+
+		QByteArray input; int inputPos;  // Request data not yet read by the connection.
+		QByteArray requestHead;          // When the request has no content-length: held until the content is complete.
+		QByteArray requestContent;
+		bool requestHeadDelivered, headRequest;
+		int receiveWindow;
+
+		ResponseState responseState;
+		QByteArray responseLine;         // The response head or chunk line being received.
+		qint64 responseRemaining;        // Bytes left in the content or chunk.
+		QByteArray pendingOutput; int pendingOutputPos; // Response content waiting for flow control.
+		bool pendingEndStream;
+		qint64 sendWindow;
+
+		bool remoteClosed, localClosed, reset;
+
+	public:
+		Http2Stream(Http2Session* session, quint32 id)
+			: QIODevice(session), session(session), id(id), connection(0), inputPos(0), requestHeadDelivered(false), headRequest(false),
+			  receiveWindow(Http2Session::InitialWindowSize), responseState(ResponseHead), responseRemaining(0), pendingOutputPos(0),
+			  pendingEndStream(false), sendWindow(session->_peerInitialWindowSize), remoteClosed(false), localClosed(false), reset(false)
+		{
+			open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+		}
+
+		virtual bool isSequential() const { return true; }
+		virtual qint64 bytesAvailable() const { return input.size() - inputPos + QIODevice::bytesAvailable(); }
+		virtual qint64 bytesToWrite() const { return pendingOutput.size() - pendingOutputPos; }
+
+		virtual void close()
+		{
+			if (!isOpen()) return;
+			QIODevice::close();
+			session->streamDeviceClosed(this);
+		}
+
+		void appendInput(const char* data, int size)
+		{
+			if (size <= 0 || !isOpen()) return;
+			input.append(data, size);
+			emit readyRead();
+		}
+
+		void notifyBytesWritten(qint64 bytes) { emit bytesWritten(bytes); }
+
+		void takePendingOutput(int size)
+		{
+			pendingOutputPos += size;
+			if (pendingOutputPos == pendingOutput.size())
+			{
+				if (pendingOutput.capacity() > 64 * 1024) pendingOutput.clear();
+				else pendingOutput.data_ptr()->size = 0;
+				pendingOutputPos = 0;
+			}
+			else if (pendingOutputPos > 64 * 1024 && pendingOutputPos > pendingOutput.size() / 2)
+			{
+				pendingOutput.remove(0, pendingOutputPos);
+				pendingOutputPos = 0;
+			}
+		}
+
+	protected:
+		virtual qint64 readData(char* data, qint64 maxSize)
+		{
+			const int size = int(qMin<qint64>(maxSize, input.size() - inputPos));
+			memcpy(data, input.constData() + inputPos, size);
+			inputPos += size;
+			if (inputPos == input.size())
+			{
+				if (input.capacity() > 64 * 1024) input.clear();
+				else input.data_ptr()->size = 0;
+				inputPos = 0;
+			}
+			return size;
+		}
+
+		virtual qint64 writeData(const char* data, qint64 maxSize)
+		{
+			if (!reset && !localClosed) processResponse(data, int(maxSize));
+			return maxSize;
+		}
+
+	private:
+		void appendContent(const char* data, int size)
+		{
+			if (size > 0) pendingOutput.append(data, size);
+		}
+
+		void finishContent()
+		{
+			responseState = ResponseDone;
+			pendingEndStream = true;
+		}
+
+		// Scan for the end of a line (or, for the response head, of the empty line ending it), buffering what comes before.
+		// Returns the number of bytes consumed, and whether the end was found.
+		int takeLine(const char* data, int size, const char* terminator, int terminatorSize, bool& found)
+		{
+			const int oldSize = responseLine.size();
+			const int consumed = qMin(size, HttpConnection::MaximumRequestHeaderLength + 4);
+			responseLine.append(data, consumed);
+			const int index = responseLine.indexOf(QByteArray::fromRawData(terminator, terminatorSize), qMax(0, oldSize - terminatorSize + 1));
+			found = index >= 0;
+			if (!found) return consumed;
+			responseLine.truncate(index);
+			return index + terminatorSize - oldSize;
+		}
+
+		void processResponse(const char* data, int size)
+		{
+			while (size > 0 && responseState != ResponseDone)
+			{
+				int consumed = size;
+				bool found;
+				switch (responseState)
+				{
+				case ResponseHead:
+					consumed = takeLine(data, size, "\r\n\r\n", 4, found);
+					if (found) processResponseHead();
+					break;
+				case ResponseContent:
+				case ResponseChunkData:
+					consumed = int(qMin<qint64>(size, responseRemaining));
+					appendContent(data, consumed);
+					responseRemaining -= consumed;
+					if (responseRemaining == 0)
+					{
+						if (responseState == ResponseContent) finishContent();
+						else responseState = ResponseChunkDataEnd;
+					}
+					break;
+				case ResponseUntilClose:
+					appendContent(data, size);
+					break;
+				case ResponseChunkDataEnd:
+					consumed = takeLine(data, size, "\n", 1, found);
+					if (found) { responseLine.clear(); responseState = ResponseChunkSize; }
+					break;
+				case ResponseChunkSize:
+					consumed = takeLine(data, size, "\n", 1, found);
+					if (found)
+					{
+						int extension = responseLine.indexOf(';');
+						bool ok;
+						responseRemaining = (extension >= 0 ? responseLine.left(extension) : responseLine).trimmed().toLongLong(&ok, 16);
+						responseLine.clear();
+						if (!ok || responseRemaining < 0) { session->resetStream(this, Http2Session::InternalError); return; }
+						responseState = responseRemaining == 0 ? ResponseTrailers : ResponseChunkData;
+					}
+					break;
+				case ResponseTrailers:
+					consumed = takeLine(data, size, "\n", 1, found);
+					if (found)
+					{
+						// Trailer fields are dropped; the empty line ends the content.
+						const bool emptyLine = responseLine.isEmpty() || responseLine == "\r";
+						responseLine.clear();
+						if (emptyLine) finishContent();
+					}
+					break;
+				case ResponseDone:
+					break;
+				}
+
+				if (reset) return;
+				if (responseLine.size() > HttpConnection::MaximumRequestHeaderLength) { session->resetStream(this, Http2Session::InternalError); return; }
+				data += consumed; size -= consumed;
+			}
+
+			session->flushStream(this);
+		}
+
+		void processResponseHead()
+		{
+			const QByteArray head = responseLine;
+			responseLine.clear();
+
+			// Status line, as written by Pillow::HttpConnection: "HTTP/1.1 200 OK".
+			int lineEnd = head.indexOf("\r\n");
+			if (lineEnd < 0) lineEnd = head.size();
+			const int statusStart = head.indexOf(' ') + 1;
+			bool ok = statusStart > 0;
+			const int statusCode = ok ? head.mid(statusStart, 3).toInt(&ok) : 0;
+			if (!ok || statusCode < 100) { session->resetStream(this, Http2Session::InternalError); return; }
+
+			HttpHeaderCollection headers; headers.reserve(8);
+			headers << HttpHeader(":status", QByteArray::number(statusCode));
+			qint64 contentLength = -1;
+			bool chunked = false;
+			for (int pos = lineEnd + 2; pos < head.size();)
+			{
+				int end = head.indexOf("\r\n", pos);
+				if (end < 0) end = head.size();
+				const int colon = head.indexOf(':', pos);
+				if (colon > pos && colon < end)
+				{
+					QByteArray name = head.mid(pos, colon - pos).trimmed().toLower();
+					QByteArray value = head.mid(colon + 1, end - colon - 1).trimmed();
+					if (name == "content-length") contentLength = value.toLongLong();
+					else if (name == "transfer-encoding") chunked = value.toLower().contains("chunked");
+					if (!isConnectionSpecificField(name)) headers << HttpHeader(name, value);
+				}
+				pos = end + 2;
+			}
+
+			if (statusCode < 200)
+			{
+				// Interim response, such as 100 Continue. The final one follows.
+				session->writeHeaders(this, headers, false);
+				return;
+			}
+
+			const bool noContent = headRequest || statusCode == 204 || statusCode == 304 || (contentLength == 0 && !chunked);
+			if (noContent)
+			{
+				responseState = ResponseDone;
+				session->writeHeaders(this, headers, true);
+				return;
+			}
+
+			session->writeHeaders(this, headers, false);
+			if (chunked) responseState = ResponseChunkSize;
+			else if (contentLength > 0) { responseState = ResponseContent; responseRemaining = contentLength; }
+			else responseState = ResponseUntilClose;
+		}
+	};
+}
+
+//
+// Pillow::Http2Session
+//
+
+bool Http2Session::isPriorKnowledgeRequest(Pillow::HttpConnection* connection)
+{
+	return connection->requestMethod() == "PRI" && connection->requestUri() == "*" && connection->requestHttpVersion() == "HTTP/2.0";
+}
+
+bool Http2Session::isUpgradeRequest(Pillow::HttpConnection* connection)
+{
+	const QByteArray& upgrade = connection->requestHeaderValue(HttpHeaderId::Upgrade);
+	if (!ByteArrayHelpers::asciiEqualsCaseInsensitive(upgrade.trimmed(), QByteArray("h2c"))) return false;
+	if (connection->isRequestContentStreamed()) return false; // The content is gone already.
+	return connection->requestHttpVersion() == "HTTP/1.1" && connection->requestHeaders().getFieldValues("HTTP2-Settings").size() == 1;
+}
+
+Http2Session* Http2Session::upgrade(Pillow::HttpConnection* connection, QObject* parent)
+{
+	if (connection->state() != HttpConnection::SendingHeaders)
+	{
+		qWarning() << "Http2Session::upgrade: the connection is not in the SendingHeaders state.";
+		return 0;
+	}
+
+	QIODevice* inputDevice = connection->inputDevice();
+	QIODevice* outputDevice = connection->outputDevice();
+
+	if (isPriorKnowledgeRequest(connection))
+	{
+		// The request line was the start of the connection preface: put it back for the session to check the whole preface.
+		QByteArray bufferedData = connection->upgrade();
+		return new Http2Session(inputDevice, outputDevice, QByteArray(connectionPreface, PriorKnowledgeRequestSize) + bufferedData, parent);
+	}
+
+	if (!isUpgradeRequest(connection)) return 0;
+
+	// The upgrade request becomes stream 1, half closed on the client's side.
+	QByteArray settings = connection->requestHeaderValue(QByteArray("HTTP2-Settings"));
+	settings = QByteArray::fromBase64(settings.replace('-', '+').replace('_', '/'));
+
+	QByteArray head; head.reserve(512);
+	head.append(connection->requestMethod()).append(' ').append(connection->requestUri()).append(" HTTP/1.1\r\n", 11);
+	const HttpHeaderCollection& headers = connection->requestHeaders();
+	for (const HttpHeader* header = headers.constBegin(), *headerE = headers.constEnd(); header != headerE; ++header)
+	{
+		if (isConnectionSpecificField(header->first) || ByteArrayHelpers::asciiEqualsCaseInsensitive(header->first, QByteArray("HTTP2-Settings"))
+			|| ByteArrayHelpers::asciiEqualsCaseInsensitive(header->first, QByteArray("Content-Length")))
+			continue;
+		appendField(head, header->first, header->second);
+	}
+	head.append("Connection: close\r\n", 19);
+	const QByteArray content(connection->requestContent().constData(), connection->requestContent().size());
+	const bool headRequest = connection->requestMethod() == "HEAD";
+
+	HttpHeaderCollection upgradeHeaders; upgradeHeaders.reserve(2);
+	upgradeHeaders << HttpHeader("Connection", "Upgrade") << HttpHeader("Upgrade", "h2c");
+	QByteArray bufferedData = connection->upgrade(upgradeHeaders);
+
+	Http2Session* session = new Http2Session(inputDevice, outputDevice, bufferedData, parent);
+	if (!session->applySettings(settings.constData(), settings.size() - settings.size() % 6))
+		qWarning() << "Http2Session::upgrade: ignoring invalid HTTP2-Settings.";
+	session->_upgradeRequestHead = head;
+	session->_upgradeRequestContent = content;
+	session->_upgradeHeadRequest = headRequest;
+	session->_lastStreamId = 1;
+	return session;
+}
+
+Http2Session::Http2Session(QIODevice* inputDevice, QIODevice* outputDevice, const QByteArray& bufferedData, QObject* parent)
+	: QObject(parent), _inputDevice(inputDevice), _outputDevice(outputDevice ? outputDevice : inputDevice), _buffer(bufferedData),
+	  _lastStreamId(0), _headerBlockStreamId(0), _headerBlockEndStream(false), _upgradeHeadRequest(false),
+	  _sendWindow(InitialWindowSize), _peerInitialWindowSize(InitialWindowSize), _peerMaximumFrameSize(MaximumFrameSize), _receiveWindow(InitialWindowSize),
+	  _prefaceReceived(false), _settingsReceived(false), _processingInput(false), _outputBlocked(false), _goingAway(false), _closed(false)
+{
+	_inputDevice->setParent(this);
+	if (_outputDevice != _inputDevice) _outputDevice->setParent(this);
+
+	connect(_inputDevice, SIGNAL(readyRead()), this, SLOT(processInput()));
+	if (_inputDevice->metaObject()->indexOfSignal("disconnected()") >= 0) // QAbstractSocket, QLocalSocket and Pillow::UnixSocket.
+		connect(_inputDevice, SIGNAL(disconnected()), this, SLOT(close()));
+	connect(_inputDevice, SIGNAL(readChannelFinished()), this, SLOT(close()));
+	connect(_inputDevice, SIGNAL(aboutToClose()), this, SLOT(close()));
+	connect(_outputDevice, SIGNAL(bytesWritten(qint64)), this, SLOT(outputDevice_bytesWritten()));
+
+	// The server connection preface.
+	char settings[12];
+	settings[0] = 0; settings[1] = char(MaxConcurrentStreamsSetting); appendUInt32(settings + 2, MaximumConcurrentStreams);
+	settings[6] = 0; settings[7] = char(MaxHeaderListSizeSetting); appendUInt32(settings + 8, HpackDecoder::DefaultMaximumHeaderListSize);
+	writeFrame(SettingsFrame, 0, 0, settings, sizeof(settings));
+
+	// Also serves the request of an h2c upgrade, once whoever upgraded got a chance to connect to the signals.
+	QTimer::singleShot(0, this, SLOT(processInput()));
+}
+
+Http2Session::~Http2Session()
+{
+}
+
+void Http2Session::processInput()
+{
+	if (_closed || _processingInput) return;
+
+	if (!_upgradeRequestHead.isEmpty())
+	{
+		QByteArray head; qSwap(head, _upgradeRequestHead);
+		Http2Stream* stream = openStream(1, head, false, false, _upgradeHeadRequest);
+		qSwap(stream->requestContent, _upgradeRequestContent);
+		stream->remoteClosed = true;
+		deliverRequestHead(stream);
+		if (_closed) return;
+	}
+
+	qint64 bytesAvailable = _inputDevice->bytesAvailable();
+	if (bytesAvailable > 0)
+	{
+		int oldSize = _buffer.size();
+		_buffer.resize(oldSize + int(bytesAvailable));
+		qint64 bytesRead = _inputDevice->read(_buffer.data() + oldSize, bytesAvailable);
+		_buffer.resize(oldSize + int(qMax<qint64>(bytesRead, 0)));
+	}
+
+	int pos = 0;
+	if (!_prefaceReceived)
+	{
+		const int size = qMin<int>(_buffer.size(), ConnectionPrefaceSize);
+		if (memcmp(_buffer.constData(), connectionPreface, size) != 0) return connectionError(ProtocolError);
+		if (size < ConnectionPrefaceSize) return;
+		_prefaceReceived = true;
+		pos = ConnectionPrefaceSize;
+	}
+
+	_processingInput = true;
+	const char* data = _buffer.constData();
+	while (!_closed)
+	{
+		const int available = _buffer.size() - pos;
+		if (available < FrameHeaderSize) break;
+
+		const uchar* header = reinterpret_cast<const uchar*>(data + pos);
+		const int size = (int(header[0]) << 16) | (int(header[1]) << 8) | int(header[2]);
+		const int type = header[3], flags = header[4];
+		const quint32 streamId = readUInt32(data + pos + 5) & 0x7FFFFFFF;
+		if (size > MaximumFrameSize) { _processingInput = false; return connectionError(FrameSizeError); }
+		if (available < FrameHeaderSize + size) break;
+
+		const char* payload = data + pos + FrameHeaderSize;
+		pos += FrameHeaderSize + size;
+		if (!processFrame(type, flags, streamId, payload, size)) { _processingInput = false; return; }
+	}
+	_processingInput = false;
+	if (_closed) return;
+
+	if (pos == _buffer.size())
+	{
+		if (_buffer.capacity() > 64 * 1024) _buffer.clear();
+		else _buffer.data_ptr()->size = 0;
+	}
+	else if (pos > 0)
+		_buffer.remove(0, pos);
+}
+
+bool Http2Session::processFrame(int type, int flags, quint32 streamId, const char* payload, int size)
+{
+	if (!_settingsReceived && type != SettingsFrame) { connectionError(ProtocolError); return false; } // The client preface ends with a SETTINGS frame.
+	if (_headerBlockStreamId != 0 && (type != ContinuationFrame || streamId != _headerBlockStreamId)) { connectionError(ProtocolError); return false; }
+
+	switch (type)
+	{
+	case DataFrame:
+	{
+		if (streamId == 0) { connectionError(ProtocolError); return false; }
+		int padding = 0;
+		if (flags & PaddedFlag)
+		{
+			if (size < 1 || (padding = uchar(payload[0])) >= size) { connectionError(ProtocolError); return false; }
+			++payload; --size; size -= padding;
+		}
+
+		// The whole frame counts against the windows, padding included.
+		const int frameSize = size + padding + ((flags & PaddedFlag) ? 1 : 0);
+		_receiveWindow -= frameSize;
+		if (_receiveWindow < 0) { connectionError(FlowControlError); return false; }
+		if (_receiveWindow <= InitialWindowSize / 2)
+		{
+			writeWindowUpdate(0, InitialWindowSize - _receiveWindow);
+			_receiveWindow = InitialWindowSize;
+		}
+
+		Http2Stream* stream = _streams.value(streamId);
+		if (stream == 0)
+		{
+			if (streamId > _lastStreamId) { connectionError(ProtocolError); return false; } // Idle stream.
+			return true; // Closed or reset meanwhile: what the client sent before knowing is dropped.
+		}
+		if (stream->remoteClosed) { connectionError(StreamClosed); return false; }
+
+		stream->receiveWindow -= frameSize;
+		if (stream->receiveWindow < 0) { resetStream(stream, FlowControlError); return !_closed; }
+		const bool endStream = (flags & EndStreamFlag) != 0;
+		if (endStream) stream->remoteClosed = true;
+
+		if (stream->requestHeadDelivered)
+			stream->appendInput(payload, size);
+		else
+		{
+			// No content-length: the content gets buffered so that the connection can be told its length.
+			stream->requestContent.append(payload, size);
+			if (stream->requestContent.size() > HttpConnection::MaximumRequestContentLength)
+			{
+				HttpHeaderCollection headers; headers << HttpHeader(":status", "413");
+				writeHeaders(stream, headers, true);
+				resetStream(stream, NoError, false);
+				return !_closed;
+			}
+			if (endStream) deliverRequestHead(stream);
+		}
+		if (_closed) return false;
+
+		if (!endStream && !stream->reset && stream->receiveWindow <= InitialWindowSize / 2)
+		{
+			writeWindowUpdate(streamId, InitialWindowSize - stream->receiveWindow);
+			stream->receiveWindow = InitialWindowSize;
+		}
+		return true;
+	}
+
+	case HeadersFrame:
+	{
+		if (streamId == 0) { connectionError(ProtocolError); return false; }
+		int offset = 0, padding = 0;
+		if (flags & PaddedFlag)
+		{
+			if (size < 1) { connectionError(ProtocolError); return false; }
+			padding = uchar(payload[0]);
+			offset = 1;
+		}
+		if (flags & PriorityFlag) offset += 5; // Stream dependency and weight: priorities are not used.
+		if (offset + padding > size) { connectionError(ProtocolError); return false; }
+
+		_headerBlock = QByteArray(payload + offset, size - offset - padding);
+		_headerBlockEndStream = (flags & EndStreamFlag) != 0;
+		if (flags & EndHeadersFlag)
+			return processHeaderBlock(streamId);
+		_headerBlockStreamId = streamId;
+		return true;
+	}
+
+	case ContinuationFrame:
+		if (_headerBlockStreamId == 0) { connectionError(ProtocolError); return false; }
+		_headerBlock.append(payload, size);
+		if (_headerBlock.size() > MaximumHeaderBlockSize) { connectionError(EnhanceYourCalm); return false; }
+		if (flags & EndHeadersFlag)
+		{
+			_headerBlockStreamId = 0;
+			return processHeaderBlock(streamId);
+		}
+		return true;
+
+	case PriorityFrame:
+		if (streamId == 0) { connectionError(ProtocolError); return false; }
+		if (size != 5) { connectionError(FrameSizeError); return false; }
+		return true;
+
+	case RstStreamFrame:
+	{
+		if (size != 4) { connectionError(FrameSizeError); return false; }
+		if (streamId == 0 || streamId > _lastStreamId) { connectionError(ProtocolError); return false; }
+		Http2Stream* stream = _streams.value(streamId);
+		if (stream) resetStream(stream, int(readUInt32(payload)), false);
+		return !_closed;
+	}
+
+	case SettingsFrame:
+		if (streamId != 0) { connectionError(ProtocolError); return false; }
+		if (flags & AckFlag)
+		{
+			if (size != 0) { connectionError(FrameSizeError); return false; }
+			return true;
+		}
+		if (size % 6 != 0) { connectionError(FrameSizeError); return false; }
+		if (!applySettings(payload, size)) return false;
+		_settingsReceived = true;
+		writeFrame(SettingsFrame, AckFlag, 0);
+		flushStreams(); // The initial window size might have grown.
+		return !_closed;
+
+	case PushPromiseFrame:
+		connectionError(ProtocolError); // Clients cannot push.
+		return false;
+
+	case PingFrame:
+		if (streamId != 0) { connectionError(ProtocolError); return false; }
+		if (size != 8) { connectionError(FrameSizeError); return false; }
+		if ((flags & AckFlag) == 0) writeFrame(PingFrame, AckFlag, 0, payload, size);
+		return true;
+
+	case GoAwayFrame:
+		if (streamId != 0) { connectionError(ProtocolError); return false; }
+		if (size < 8) { connectionError(FrameSizeError); return false; }
+		_goingAway = true;
+		if (_streams.isEmpty()) { close(); return false; }
+		return true;
+
+	case WindowUpdateFrame:
+	{
+		if (size != 4) { connectionError(FrameSizeError); return false; }
+		const quint32 increment = readUInt32(payload) & 0x7FFFFFFF;
+		if (streamId == 0)
+		{
+			if (increment == 0) { connectionError(ProtocolError); return false; }
+			_sendWindow += increment;
+			if (_sendWindow > MaximumWindowSize) { connectionError(FlowControlError); return false; }
+			flushStreams();
+			return !_closed;
+		}
+
+		if (streamId > _lastStreamId) { connectionError(ProtocolError); return false; }
+		Http2Stream* stream = _streams.value(streamId);
+		if (stream == 0) return true; // Closed meanwhile.
+		if (increment == 0) { resetStream(stream, ProtocolError); return !_closed; }
+		stream->sendWindow += increment;
+		if (stream->sendWindow > MaximumWindowSize) { resetStream(stream, FlowControlError); return !_closed; }
+		flushStream(stream);
+		return !_closed;
+	}
+
+	default:
+		return true; // Unknown frame types are ignored.
+	}
+}
+
+bool Http2Session::processHeaderBlock(quint32 streamId)
+{
+	HttpHeaderCollection headers;
+	const bool decoded = _decoder.decode(_headerBlock.constData(), _headerBlock.size(), headers);
+	_headerBlock.clear();
+	if (!decoded) { connectionError(CompressionError); return false; }
+	const bool endStream = _headerBlockEndStream;
+
+	if (streamId <= _lastStreamId)
+	{
+		// Trailers, which end the request. Their fields are dropped.
+		Http2Stream* stream = _streams.value(streamId);
+		if (stream == 0) return true; // Closed or reset meanwhile.
+		if (stream->remoteClosed) { connectionError(StreamClosed); return false; }
+		if (!endStream) { resetStream(stream, ProtocolError); return !_closed; }
+		stream->remoteClosed = true;
+		if (!stream->requestHeadDelivered) deliverRequestHead(stream);
+		return !_closed;
+	}
+
+	if ((streamId & 1) == 0) { connectionError(ProtocolError); return false; } // Client streams have odd ids.
+	_lastStreamId = streamId;
+	if (_goingAway || _streams.size() >= MaximumConcurrentStreams)
+	{
+		char code[4]; appendUInt32(code, RefusedStream);
+		writeFrame(RstStreamFrame, 0, streamId, code, sizeof(code));
+		return true;
+	}
+
+	// Build the equivalent Http/1.1 request head.
+	QByteArray method, scheme, path, authority, cookie;
+	QByteArray fields; fields.reserve(512);
+	bool hasHost = false, hasContentLength = false, regularFieldSeen = false, malformed = false;
+	qint64 contentLength = 0;
+	for (const HttpHeader* header = headers.constBegin(), *headerE = headers.constEnd(); header != headerE && !malformed; ++header)
+	{
+		const QByteArray& name = header->first;
+		const QByteArray& value = header->second;
+		if (!isValidFieldValue(value)) { malformed = true; break; }
+
+		if (name.startsWith(':'))
+		{
+			QByteArray* target = 0;
+			if (regularFieldSeen) malformed = true; // Pseudo-header fields come first.
+			else if (name == ":method") target = &method;
+			else if (name == ":scheme") target = &scheme;
+			else if (name == ":path") target = &path;
+			else if (name == ":authority") target = &authority;
+			else malformed = true;
+			if (target && !target->isNull()) malformed = true; // Repeated.
+			if (target && !malformed) *target = value.isNull() ? QByteArray("") : value;
+			continue;
+		}
+
+		regularFieldSeen = true;
+		if (!isValidFieldName(name)) { malformed = true; break; }
+		if (isConnectionSpecificField(name)) { malformed = true; break; } // Http/2 has no use for them (RFC 7540, 8.1.2.2).
+		if (name == "cookie")
+		{
+			// Cookies may be split across fields for better compression: Http/1.1 wants them in one.
+			if (!cookie.isEmpty()) cookie.append("; ", 2);
+			cookie.append(value);
+			continue;
+		}
+		if (name == "host") hasHost = true;
+		else if (name == "content-length")
+		{
+			bool ok; contentLength = value.toLongLong(&ok);
+			if (!ok || contentLength < 0 || (hasContentLength)) { malformed = true; break; }
+			hasContentLength = true;
+		}
+		else if (name == "te" && value != "trailers") { malformed = true; break; }
+		appendField(fields, name, value);
+	}
+	if (!malformed)
+		malformed = method.isEmpty() || method == "CONNECT" || scheme.isEmpty() || path.isEmpty() || (endStream && hasContentLength && contentLength != 0);
+	if (malformed)
+	{
+		char code[4]; appendUInt32(code, ProtocolError);
+		writeFrame(RstStreamFrame, 0, streamId, code, sizeof(code));
+		return true;
+	}
+
+	QByteArray head; head.reserve(method.size() + path.size() + fields.size() + cookie.size() + authority.size() + 64);
+	head.append(method).append(' ').append(path).append(" HTTP/1.1\r\n", 11);
+	if (!hasHost && !authority.isEmpty()) appendField(head, "Host", authority);
+	head.append(fields);
+	if (!cookie.isEmpty()) appendField(head, "Cookie", cookie);
+	head.append("Connection: close\r\n", 19); // One request per connection.
+
+	openStream(streamId, head, hasContentLength, endStream, method == "HEAD");
+	return !_closed;
+}
+
+Http2Stream* Http2Session::openStream(quint32 streamId, const QByteArray& requestHead, bool hasContentLength, bool endStream, bool headRequest)
+{
+	Http2Stream* stream = new Http2Stream(this, streamId);
+	stream->headRequest = headRequest;
+	stream->remoteClosed = endStream;
+	_streams.insert(streamId, stream);
+
+	stream->connection = new HttpConnection(stream);
+	connect(stream->connection, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)), this, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)));
+	connect(stream->connection, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SIGNAL(requestReady(Pillow::HttpConnection*)));
+	connect(stream->connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_closed(Pillow::HttpConnection*)));
+	stream->connection->initialize(stream, stream);
+
+	stream->requestHead = requestHead;
+	if (hasContentLength || endStream)
+		deliverRequestHead(stream);
+	return stream;
+}
+
+void Http2Session::deliverRequestHead(Http2Stream* stream)
+{
+	// Without a content-length, this waits for the end of the stream so that the length of the buffered content is known.
+	QByteArray head; qSwap(head, stream->requestHead);
+	if (stream->remoteClosed && !head.contains("\r\ncontent-length:"))
+		head.append("Content-Length: ", 16).append(QByteArray::number(stream->requestContent.size())).append("\r\n", 2);
+	head.append("\r\n", 2).append(stream->requestContent);
+	stream->requestContent.clear();
+	stream->requestHeadDelivered = true;
+	stream->appendInput(head.constData(), head.size());
+}
+bool Http2Session::applySettings(const char* payload, int size)
+{
+	for (const char* setting = payload, *settingE = payload + size; setting + 6 <= settingE; setting += 6)
+	{
+		const int id = (uchar(setting[0]) << 8) | uchar(setting[1]);
+		const quint32 value = readUInt32(setting + 2);
+		switch (id)
+		{
+		case EnablePushSetting:
+			if (value > 1) { connectionError(ProtocolError); return false; }
+			break;
+		case InitialWindowSizeSetting:
+		{
+			if (value > MaximumWindowSize) { connectionError(FlowControlError); return false; }
+			const qint64 delta = qint64(value) - _peerInitialWindowSize;
+			_peerInitialWindowSize = value;
+			foreach (Http2Stream* stream, _streams)
+				stream->sendWindow += delta;
+			break;
+		}
+		case MaxFrameSizeSetting:
+			if (value < 16384 || value > 16777215) { connectionError(ProtocolError); return false; }
+			_peerMaximumFrameSize = int(value);
+			break;
+		default:
+			break; // The encoder does not use a dynamic table, and there is no limit on concurrent pushes or header list sizes to honor.
+		}
+	}
+	return true;
+}
+
+void Http2Session::writeFrame(int type, int flags, quint32 streamId, const char* payload, int size)
+{
+	if (_closed) return;
+	char header[FrameHeaderSize];
+	header[0] = char(size >> 16); header[1] = char(size >> 8); header[2] = char(size);
+	header[3] = char(type); header[4] = char(flags);
+	appendUInt32(header + 5, streamId);
+	_outputDevice->write(header, FrameHeaderSize);
+	if (size > 0) _outputDevice->write(payload, size);
+}
+
+void Http2Session::writeWindowUpdate(quint32 streamId, quint32 increment)
+{
+	char payload[4]; appendUInt32(payload, increment);
+	writeFrame(WindowUpdateFrame, 0, streamId, payload, sizeof(payload));
+}
+
+void Http2Session::writeHeaders(Http2Stream* stream, const HttpHeaderCollection& headers, bool endStream)
+{
+	if (_closed || stream->reset || stream->localClosed) return;
+
+	QByteArray block; block.reserve(256);
+	HpackEncoder::encode(headers, block);
+
+	// Split in a HEADERS frame and as many CONTINUATION frames as needed, sent back to back.
+	int pos = 0;
+	int type = HeadersFrame;
+	do
+	{
+		const int size = qMin(block.size() - pos, _peerMaximumFrameSize);
+		int flags = (pos + size == block.size()) ? EndHeadersFlag : 0;
+		if (type == HeadersFrame && endStream) flags |= EndStreamFlag;
+		writeFrame(type, flags, stream->id, block.constData() + pos, size);
+		pos += size;
+		type = ContinuationFrame;
+	}
+	while (pos < block.size());
+
+	if (endStream) finishStream(stream);
+}
+
+void Http2Session::flushStream(Http2Stream* stream)
+{
+	while (!_closed && !stream->reset && !stream->localClosed)
+	{
+		const qint64 pending = stream->bytesToWrite();
+		if (pending == 0)
+		{
+			if (stream->pendingEndStream)
+			{
+				writeFrame(DataFrame, EndStreamFlag, stream->id);
+				finishStream(stream);
+			}
+			return;
+		}
+
+		if (_outputDevice->bytesToWrite() >= MaximumOutputBacklog) { _outputBlocked = true; return; }
+		const int size = int(qMin(qMin(pending, qint64(_peerMaximumFrameSize)), qMin(_sendWindow, stream->sendWindow)));
+		if (size <= 0) return; // Waiting for a WINDOW_UPDATE.
+
+		const bool endStream = stream->pendingEndStream && size == pending;
+		writeFrame(DataFrame, endStream ? EndStreamFlag : 0, stream->id, stream->pendingOutput.constData() + stream->pendingOutputPos, size);
+		_sendWindow -= size;
+		stream->sendWindow -= size;
+		stream->takePendingOutput(size);
+		if (endStream) finishStream(stream);
+
+		// Lets the connection know, for its write buffer watermarks and for closing once flushed.
+		stream->notifyBytesWritten(size);
+	}
+}
+
+void Http2Session::flushStreams()
+{
+	// Oldest streams first. Flushing can close streams, so iterate on a copy.
+	const QList<Http2Stream*> streams = _streams.values();
+	foreach (Http2Stream* stream, streams)
+	{
+		if (_closed || _outputBlocked || _sendWindow <= 0) return;
+		if (_streams.contains(stream->id)) flushStream(stream);
+	}
+}
+
+void Http2Session::outputDevice_bytesWritten()
+{
+	if (!_outputBlocked || _outputDevice->bytesToWrite() > MaximumOutputBacklog / 2) return;
+	_outputBlocked = false;
+	flushStreams();
+}
+
+void Http2Session::finishStream(Http2Stream* stream)
+{
+	// The response is complete. The client does not need to send the rest of the request, if any.
+	if (stream->localClosed) return;
+	stream->localClosed = true;
+	if (!stream->remoteClosed)
+	{
+		stream->remoteClosed = true;
+		char code[4]; appendUInt32(code, NoError);
+		writeFrame(RstStreamFrame, 0, stream->id, code, sizeof(code));
+	}
+	_streams.remove(stream->id);
+	deleteStreamIfDone(stream);
+}
+
+void Http2Session::resetStream(Http2Stream* stream, int errorCode, bool sendFrame)
+{
+	if (stream->reset) return;
+	stream->reset = true;
+	if (sendFrame && !stream->localClosed)
+	{
+		char code[4]; appendUInt32(code, quint32(errorCode));
+		writeFrame(RstStreamFrame, 0, stream->id, code, sizeof(code));
+	}
+	stream->pendingOutput.clear();
+	stream->pendingOutputPos = 0;
+	_streams.remove(stream->id);
+
+	if (stream->connection && stream->isOpen())
+		stream->connection->close(); // Gets back to connection_closed.
+	else
+		deleteStreamIfDone(stream);
+}
+
+void Http2Session::streamDeviceClosed(Http2Stream* stream)
+{
+	if (stream->localClosed || stream->reset) return;
+	if (stream->responseState == Http2Stream::ResponseUntilClose)
+	{
+		// A response without length or chunks: closing is what ends it. Its content may still be waiting for flow control.
+		stream->responseState = Http2Stream::ResponseDone;
+		stream->pendingEndStream = true;
+		flushStream(stream);
+	}
+	else if (!stream->pendingEndStream)
+		resetStream(stream, InternalError); // The connection was closed before its response was complete.
+}
+
+void Http2Session::connection_closed(Pillow::HttpConnection* connection)
+{
+	Http2Stream* stream = static_cast<Http2Stream*>(connection->parent());
+	if (!stream->localClosed && !stream->reset && !stream->pendingEndStream)
+		resetStream(stream, InternalError);
+	stream->connection = 0;
+	deleteStreamIfDone(stream);
+}
+
+void Http2Session::deleteStreamIfDone(Http2Stream* stream)
+{
+	if (stream->connection == 0 && (stream->localClosed || stream->reset))
+	{
+		_streams.remove(stream->id);
+		stream->deleteLater(); // Along with its connection. Both may still be on the stack.
+	}
+
+	if (_goingAway && _streams.isEmpty() && !_closed)
+		QMetaObject::invokeMethod(this, "close", Qt::QueuedConnection);
+}
+
+void Http2Session::connectionError(int errorCode)
+{
+	if (_closed) return;
+	char payload[8];
+	appendUInt32(payload, _lastStreamId);
+	appendUInt32(payload + 4, quint32(errorCode));
+	writeFrame(GoAwayFrame, 0, 0, payload, sizeof(payload));
+	close();
+}
+
+void Http2Session::goAway()
+{
+	if (_closed || _goingAway) return;
+	_goingAway = true;
+	char payload[8];
+	appendUInt32(payload, _lastStreamId);
+	appendUInt32(payload + 4, NoError);
+	writeFrame(GoAwayFrame, 0, 0, payload, sizeof(payload));
+	if (_streams.isEmpty()) QMetaObject::invokeMethod(this, "close", Qt::QueuedConnection);
+}
+
+void Http2Session::close()
+{
+	if (_closed) return;
+	_closed = true;
+	disconnect(_inputDevice, 0, this, 0);
+	disconnect(_outputDevice, 0, this, 0);
+
+	const QList<Http2Stream*> streams = _streams.values();
+	foreach (Http2Stream* stream, streams)
+		resetStream(stream, Cancel, false);
+
+	if (_inputDevice->isOpen()) _inputDevice->close();
+	if (_outputDevice != _inputDevice && _outputDevice->isOpen()) _outputDevice->close();
+	emit closed(this);
+}
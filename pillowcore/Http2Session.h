@@ -0,0 +1,132 @@
+#ifndef PILLOW_HTTP2SESSION_H
+#define PILLOW_HTTP2SESSION_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTP2HPACK_H
+#include "Http2Hpack.h"
+#endif // PILLOW_HTTP2HPACK_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QMAP_H
+#include <QtCore/QMap>
+#endif // QMAP_H
+
+class QIODevice;
+
+namespace Pillow
+{
+	class HttpConnection;
+	class Http2Stream;
+
+	//
+	// Pillow::Http2Session
+	//
+	// The server side of an Http/2 connection (RFC 7540), over a transport that was either taken over from
+	// a Pillow::HttpConnection through upgrade() (for "Upgrade: h2c" and prior knowledge requests), or
+	// handed over directly.
+	//
+	// Each stream is served by its own Pillow::HttpConnection, emitted through requestHeadersReady and
+	// requestReady like the connections of a Pillow::HttpServer, so handlers work unchanged. The connection
+	// reads the request as Http/1.1 and its Http/1.1 response gets converted back to HEADERS and DATA frames,
+	// within the flow control windows granted by the client. The connections of streams have no remote address.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT Http2Session : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		enum ErrorCode
+		{
+			NoError = 0x0, ProtocolError = 0x1, InternalError = 0x2, FlowControlError = 0x3, SettingsTimeout = 0x4, StreamClosed = 0x5,
+			FrameSizeError = 0x6, RefusedStream = 0x7, Cancel = 0x8, CompressionError = 0x9, ConnectError = 0xA, EnhanceYourCalm = 0xB,
+			InadequateSecurity = 0xC, Http11Required = 0xD
+		};
+		enum { MaximumConcurrentStreams = 100 };
+		enum { InitialWindowSize = 65535 }; // The receive window of the connection and of each stream.
+		enum { MaximumFrameSize = 16384 };  // The largest frame accepted from the client.
+		enum { MaximumOutputBacklog = 256 * 1024 }; // DATA frames wait while the transport buffers more than this.
+
+	public:
+		// Whether the request is the start of the Http/2 connection preface ("PRI * HTTP/2.0"), sent by clients with prior knowledge.
+		static bool isPriorKnowledgeRequest(Pillow::HttpConnection* connection);
+		// Whether the request asks for an upgrade to cleartext Http/2 ("Upgrade: h2c" along with an HTTP2-Settings header).
+		static bool isUpgradeRequest(Pillow::HttpConnection* connection);
+
+		// Take over a connection whose request is either of the above, which must be in the SendingHeaders state. For an upgrade
+		// request, the 101 response is sent and the request itself gets served as stream 1 once control returns to the event loop.
+		// Returns NULL if the request is neither.
+		static Http2Session* upgrade(Pillow::HttpConnection* connection, QObject* parent = 0);
+
+	public:
+		// Take over a transport on which the client connection preface is expected. The session takes ownership of the devices.
+		Http2Session(QIODevice* inputDevice, QIODevice* outputDevice, const QByteArray& bufferedData = QByteArray(), QObject* parent = 0);
+		~Http2Session();
+
+		inline QIODevice* inputDevice() const { return _inputDevice; }
+		inline QIODevice* outputDevice() const { return _outputDevice; }
+		inline int streamCount() const { return _streams.size(); } // Number of open streams.
+		inline bool isClosed() const { return _closed; }
+
+	public slots:
+		void goAway(); // Refuse new streams, and close once the open ones are done.
+		void close();  // Close the transport right away, resetting the open streams.
+
+	signals:
+		void requestHeadersReady(Pillow::HttpConnection* connection); // The headers of a request with content have been received on a stream.
+		void requestReady(Pillow::HttpConnection* connection); // There is a request ready to be handled on a stream.
+		void closed(Pillow::Http2Session* self);
+
+	private slots:
+		void processInput();
+		void outputDevice_bytesWritten();
+		void connection_closed(Pillow::HttpConnection* connection);
+
+	private:
+		friend class Http2Stream;
+		enum FrameType { DataFrame = 0x0, HeadersFrame = 0x1, PriorityFrame = 0x2, RstStreamFrame = 0x3, SettingsFrame = 0x4, PushPromiseFrame = 0x5,
+						 PingFrame = 0x6, GoAwayFrame = 0x7, WindowUpdateFrame = 0x8, ContinuationFrame = 0x9 };
+		enum FrameFlag { EndStreamFlag = 0x1, AckFlag = 0x1, EndHeadersFlag = 0x4, PaddedFlag = 0x8, PriorityFlag = 0x20 };
+
+		bool processFrame(int type, int flags, quint32 streamId, const char* payload, int size); // Returns false once the session is closed.
+		bool processHeaderBlock(quint32 streamId);
+		bool applySettings(const char* payload, int size);
+		Pillow::Http2Stream* openStream(quint32 streamId, const QByteArray& requestHead, bool hasContentLength, bool endStream, bool headRequest);
+		void deliverRequestHead(Pillow::Http2Stream* stream);
+
+		void writeFrame(int type, int flags, quint32 streamId, const char* payload = 0, int size = 0);
+		void writeWindowUpdate(quint32 streamId, quint32 increment);
+		void writeHeaders(Pillow::Http2Stream* stream, const Pillow::HttpHeaderCollection& headers, bool endStream);
+		void flushStream(Pillow::Http2Stream* stream);
+		void flushStreams();
+		void resetStream(Pillow::Http2Stream* stream, int errorCode, bool sendFrame = true);
+		void finishStream(Pillow::Http2Stream* stream);
+		void streamDeviceClosed(Pillow::Http2Stream* stream);
+		void deleteStreamIfDone(Pillow::Http2Stream* stream);
+		void connectionError(int errorCode);
+
+	private:
+		QIODevice* _inputDevice,* _outputDevice;
+		QByteArray _buffer;                    // Received data that was not parsed yet.
+		Pillow::HpackDecoder _decoder;
+		QMap<quint32, Pillow::Http2Stream*> _streams; // Open streams, by id.
+		quint32 _lastStreamId;
+		quint32 _headerBlockStreamId;          // Stream of the header block being received, while waiting for CONTINUATION frames.
+		QByteArray _headerBlock;
+		bool _headerBlockEndStream;
+		QByteArray _upgradeRequestHead, _upgradeRequestContent; // The request of stream 1, after an h2c upgrade.
+		bool _upgradeHeadRequest;
+		qint64 _sendWindow;                    // Connection level flow control window granted by the client.
+		qint64 _peerInitialWindowSize;
+		int _peerMaximumFrameSize;
+		int _receiveWindow;
+		bool _prefaceReceived, _settingsReceived;
+		bool _processingInput, _outputBlocked, _goingAway, _closed;
+	};
+}
+
+#endif // PILLOW_HTTP2SESSION_H
@@ -24,6 +24,7 @@ namespace Pillow
 		const QByteArray httpOneOneCrlfToken(" HTTP/1.1\r\n");
 		const QByteArray contentLengthColonSpaceToken("Content-Length: ");
 		const QByteArray hostToken("Host");
+		const QByteArray contentLengthToken("Content-Length");
 	}
 
 	class ContentTransformer
@@ -332,12 +333,13 @@ inline void Pillow::HttpResponseParser::pushHeader()
 //
 
 Pillow::HttpClient::HttpClient(QObject *parent)
-	: QObject(parent), _responsePending(false), _error(NoError), _keepAliveTimeout(-1), _contentDecoder(0)
+	: QObject(parent), _responsePending(false), _requestSent(false), _requestContentRemaining(0), _error(NoError), _keepAliveTimeout(-1), _contentDecoder(0), _contentDecoding(true)
 {
 	_device = new QTcpSocket(this);
 	connect(_device, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(device_error(QAbstractSocket::SocketError)));
 	connect(_device, SIGNAL(connected()), this, SLOT(device_connected()));
 	connect(_device, SIGNAL(readyRead()), this, SLOT(device_readyRead()));
+	connect(_device, SIGNAL(bytesWritten(qint64)), this, SLOT(device_bytesWritten()));
 	_requestWriter.setDevice(_device);
 	_keepAliveTimeoutTimer.invalidate();
 }
@@ -362,6 +364,16 @@ void Pillow::HttpClient::setReadBufferSize(qint64 size)
 	_device->setReadBufferSize(size);
 }
 
+bool Pillow::HttpClient::contentDecoding() const
+{
+	return _contentDecoding;
+}
+
+void Pillow::HttpClient::setContentDecoding(bool enabled)
+{
+	_contentDecoding = enabled;
+}
+
 bool Pillow::HttpClient::responsePending() const
 {
 	return _responsePending;
@@ -452,6 +464,10 @@ void Pillow::HttpClient::request(const Pillow::HttpClientRequest &request)
 		return;
 	}
 
+	// Streamed content written from now on belongs to this request, even if it has to wait to be sent.
+	_requestContentRemaining = qMax<qint64>(0, request.contentLength);
+	_requestContentBuffer.clear();
+
 	if (Pillow::HttpResponseParser::isParsing())
 	{
 		// We most likely got cancelled in a callback or got asked for a new request
@@ -461,12 +477,18 @@ void Pillow::HttpClient::request(const Pillow::HttpClientRequest &request)
 		return;
 	}
 
+	startRequest(request);
+}
+
+void Pillow::HttpClient::startRequest(const Pillow::HttpClientRequest &request)
+{
 	// We can reuse an active connection if the request is for the same host and port, so make note of those parameters before they are overwritten.
 	const QString previousHost = _request.url.host();
 	const int previousPort = _request.url.port();
 
 	_request = request;
 	_responsePending = true;
+	_requestSent = false;
 	_error = NoError;
 	clear();
 
@@ -490,8 +512,30 @@ void Pillow::HttpClient::request(const Pillow::HttpClientRequest &request)
 	}
 }
 
+void Pillow::HttpClient::writeContent(const QByteArray &data)
+{
+	// Nothing is expected anymore once the whole content was written or the server answered.
+	if (_requestContentRemaining <= 0) return;
+
+	const int size = int(qMin<qint64>(data.size(), _requestContentRemaining));
+	if (size < data.size())
+		qWarning() << "Pillow::HttpClient::writeContent: writing more than the request content length. Dropping" << (data.size() - size) << "bytes.";
+	_requestContentRemaining -= size;
+
+	if (_requestSent)
+		_device->write(data.constData(), size);
+	else
+		_requestContentBuffer.append(data.constData(), size);
+}
+
+bool Pillow::HttpClient::canWriteContent() const
+{
+	return _requestContentBuffer.size() + _device->bytesToWrite() < RequestContentBufferSize;
+}
+
 void Pillow::HttpClient::abort()
 {
+	_requestContentRemaining = 0;
 	if (_device) _device->abort();
 
 	if (_responsePending)
@@ -525,6 +569,8 @@ void Pillow::HttpClient::device_error(QAbstractSocket::SocketError error)
 		return;
 	}
 
+	_requestContentRemaining = 0;
+
 	switch (error)
 	{
 	case QAbstractSocket::RemoteHostClosedError:
@@ -606,6 +652,7 @@ void Pillow::HttpClient::device_readyRead()
 			_error = ResponseInvalidError;
 			_device->close();
 			_responsePending = false;
+			_requestContentRemaining = 0;
 			emit finished();
 		}
 	}
@@ -622,11 +669,17 @@ void Pillow::HttpClient::device_readyRead()
 		// Plus we got a new request while in callback.
 		Pillow::HttpClientRequest r = _pendingRequest;
 		_pendingRequest = Pillow::HttpClientRequest(); // Clear it.
-		request(r);
+		startRequest(r); // Along with any content written for it meanwhile.
 	}
 
 }
 
+void Pillow::HttpClient::device_bytesWritten()
+{
+	if (_responsePending && _request.contentLength >= 0)
+		emit contentWritten();
+}
+
 void Pillow::HttpClient::sendRequest()
 {
 	if (!responsePending()) return;
@@ -646,12 +699,27 @@ void Pillow::HttpClient::sendRequest()
 	if (!query.isEmpty()) uri.append('?').append(query);
 
 	Pillow::HttpHeaderCollection headers;
-	headers.reserve(_request.headers.size() + 1);
+	headers.reserve(_request.headers.size() + 2);
 	headers << Pillow::HttpHeader(Pillow::HttpClientTokens::hostToken, _hostHeaderValue);
 	for (int i = 0, iE = _request.headers.size(); i < iE; ++i)
 		headers << _request.headers.at(i);
 
-	_requestWriter.write(_request.method, uri, headers, _request.data);
+	if (_request.contentLength < 0)
+	{
+		_requestWriter.write(_request.method, uri, headers, _request.data);
+		_requestSent = true;
+		return;
+	}
+
+	// Streamed content: announce its length, then send what was written of it so far.
+	headers << Pillow::HttpHeader(Pillow::HttpClientTokens::contentLengthToken, QByteArray::number(_request.contentLength));
+	_requestWriter.write(_request.method, uri, headers);
+	_requestSent = true;
+	if (!_requestContentBuffer.isEmpty())
+	{
+		_device->write(_requestContentBuffer);
+		_requestContentBuffer.clear();
+	}
 }
 
 void Pillow::HttpClient::messageBegin()
@@ -672,7 +740,7 @@ void Pillow::HttpClient::headersComplete()
 		pause();
 		messageComplete();
 	}
-	else
+	else if (_contentDecoding)
 	{
 		for (int i = 0, iE = _headers.size(); i < iE; ++i)
 		{
@@ -715,8 +783,8 @@ void Pillow::HttpClient::messageComplete()
 		Pillow::HttpResponseParser::messageComplete();
 		_responsePending = false;
 
-		if (_keepAliveTimeout == 0)
-			_device->close();
+		if (_keepAliveTimeout == 0 || _requestContentRemaining > 0)
+			_device->close(); // Also when the server answered before getting all of the content: the rest of it cannot follow.
 		else
 		{
 			if (!shouldKeepAlive())
@@ -724,6 +792,7 @@ void Pillow::HttpClient::messageComplete()
 
 			_keepAliveTimeoutTimer.start();
 		}
+		_requestContentRemaining = 0;
 
 		emit finished();
 	}
@@ -146,6 +146,9 @@ namespace Pillow
 		QUrl url;
 		Pillow::HttpHeaderCollection headers;
 		QByteArray data;
+		qint64 contentLength; // When 0 or more, data is ignored: the content gets streamed with HttpClient::writeContent().
+
+		HttpClientRequest() : contentLength(-1) {}
 	};
 
 	//
@@ -189,6 +192,13 @@ namespace Pillow
 		qint64 readBufferSize() const;
 		void setReadBufferSize(qint64 size);
 
+		// contentDecoding: Whether the client transparently decodes the response content when the server uses a
+		//                  supported Content-Encoding (gzip). Disable it to receive the content exactly as it
+		//                  was sent, such as when relaying the response to another client.
+		//                  Defaults to true.
+		bool contentDecoding() const;
+		void setContentDecoding(bool enabled);
+
 	public:
 		// Request members.
 		void get(const QUrl& url, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection());
@@ -200,6 +210,14 @@ namespace Pillow
 		void request(const QByteArray& method, const QUrl& url, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QByteArray& data = QByteArray());
 		void request(const Pillow::HttpClientRequest& request);
 
+		// Request content streaming. For requests with a contentLength, write the content as it becomes available, be it
+		// before or after the connection to the server is established. canWriteContent() tells whether the content waiting
+		// to be sent is under RequestContentBufferSize; contentWritten is emitted as the server takes it. Content written
+		// once the server answered is dropped, and the connection is then not reused.
+		void writeContent(const QByteArray& data);
+		bool canWriteContent() const;
+		enum { RequestContentBufferSize = 256 * 1024 };
+
 		void abort(); // Stop any active request and break current server connection. If there was an active request, finished() will be emitted and the error will be set to AbortedError.
 
 		void followRedirection(); // Follow previous request's redirection. Only effective if redirected() is true.
@@ -222,13 +240,16 @@ namespace Pillow
 		void headersCompleted(); // Headers have been fully received and are ready to be checked.
 		void contentReadyRead(); // Some new data is available in the response content.
 		void finished();         // Request finished. Check error() to verify if there was an error.
+		void contentWritten();   // Some streamed request content has been sent; canWriteContent() may have changed.
 
 	private slots:
 		void device_error(QAbstractSocket::SocketError error);
 		void device_connected();
 		void device_readyRead();
+		void device_bytesWritten();
 
 	private:
+		void startRequest(const Pillow::HttpClientRequest& request);
 		void sendRequest();
 
 	protected:
@@ -244,12 +265,16 @@ namespace Pillow
 		Pillow::HttpRequestWriter _requestWriter;
 		Pillow::HttpResponseParser _responseParser;
 		bool _responsePending;
+		bool _requestSent;
+		qint64 _requestContentRemaining; // Streamed content bytes yet to be written.
+		QByteArray _requestContentBuffer; // Streamed content written before the request was sent.
 		Error _error;
 		QByteArray _buffer;
 		int _keepAliveTimeout;
 		QElapsedTimer _keepAliveTimeoutTimer;
 		QByteArray _hostHeaderValue;
 		Pillow::ContentTransformer* _contentDecoder;
+		bool _contentDecoding;
 	};
 
 	//
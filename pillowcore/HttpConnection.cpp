@@ -3,6 +3,7 @@
 #include "private/ByteArray.h"
 #include "parser/parser.h"
 #include <QtCore/QIODevice>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QTimer>
 #include <QtCore/QUrl>
 #include <QtCore/QStringBuilder>
@@ -28,10 +29,12 @@ namespace Pillow
 		DEFINE_TOKEN(httpSlash11, "HTTP/1.1");
 		DEFINE_TOKEN(head, "HEAD");
 		DEFINE_TOKEN(colonSpace, ": ");
+		DEFINE_TOKEN(serverTimingHeadersOut, "Server-Timing: headers;dur=");
+		DEFINE_TOKEN(serverTimingContentOut, ", content;dur=");
+		DEFINE_TOKEN(serverTimingHandlerOut, ", handler;dur=");
 		DEFINE_LOWERCASE_TOKEN(connection, "connection");
 		DEFINE_LOWERCASE_TOKEN(contentLength, "content-length");
 		DEFINE_LOWERCASE_TOKEN(contentType, "content-type");
-		DEFINE_LOWERCASE_TOKEN(expect, "expect");
 		DEFINE_LOWERCASE_TOKEN(hundredDashContinue, "100-continue");
 		DEFINE_LOWERCASE_TOKEN(keepAlive, "keep-alive");
 		DEFINE_LOWERCASE_TOKEN(close, "close");
@@ -48,8 +51,16 @@ namespace Pillow
 			: fieldPos(fieldPos), fieldLength(fieldLength), valuePos(valuePos), valueLength(valueLength) {}
 		inline HttpHeaderRef() {}
 	};
+
+	// Raw offsets of a query string parameter, relative to the start of the query string.
+	struct HttpParamRef
+	{
+		int keyPos, keyLength, valuePos, valueLength; // valuePos is -1 for a key without value.
+		bool keyEncoded, valueEncoded; // Whether percent-encoded sequences are present.
+	};
 }
 Q_DECLARE_TYPEINFO(Pillow::HttpHeaderRef, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(Pillow::HttpParamRef, Q_PRIMITIVE_TYPE);
 
 using namespace Pillow::Tokens;
 using namespace Pillow::ByteArrayHelpers;
@@ -73,12 +84,17 @@ namespace Pillow
 		Q_DECLARE_PUBLIC(HttpConnection)
 		HttpConnection* q_ptr;
 
+	public:
+		enum { StreamedContentChunkSize = 64 * 1024 };
+
 	public:
 		HttpConnectionPrivate(HttpConnection* connection);
 
 	public:
 		Pillow::HttpConnection::State _state;
 		QIODevice* _inputDevice,* _outputDevice;
+		enum OutputDeviceType { OtherOutputDevice, TcpSocketOutputDevice, LocalSocketOutputDevice };
+		OutputDeviceType _outputDeviceType; // Known when the device is set, so that flushing does not need to cast it.
 		http_parser _parser;
 
 		// Request fields.
@@ -89,22 +105,67 @@ namespace Pillow
 		PERCENT_DECODABLE(requestPath)
 		PERCENT_DECODABLE(requestQueryString)
 		QVarLengthArray<Pillow::HttpHeaderRef, 32> _requestHeadersRef;
+		qint16 _requestHeaderIndexes[Pillow::HttpHeaderId::Count]; // Index of the first header for each well-known field name, or -1.
 		Pillow::HttpHeaderCollection _requestHeaders;
-		int _requestContentLength; int _requestContentLengthHeaderIndex;
+		qint64 _requestContentLength; int _requestContentLengthHeaderIndex;
+		bool _requestContentStreamed; // Whether the content is handed over through requestContentReceived rather than buffered.
+		bool _requestContentPaused;   // Whether streamed content is left in the input device for now.
+		qint64 _inputReadBufferSize;  // The read buffer size of the input socket before pausing, to put back when resuming.
+		qint64 _requestContentBytesReceived;
+		QByteArray _requestContentChunk;
 		bool _requestHttp11;
 		Pillow::HttpParamCollection _requestParams;
+		bool _requestParamsParsed; // Whether _requestParams holds all params. Until then, it only holds those set by setRequestParam.
+		QVarLengthArray<Pillow::HttpParamRef, 16> _requestParamRefs;
+		bool _requestParamRefsIndexed;
 
 		// Response fields.
 		Pillow::ByteArray _responseHeadersBuffer;
+		QByteArray _responseChunkSizeBuffer; // The size line of the last chunk written, kept to write the next ones without allocating.
 		int _responseStatusCode;
 		qint64 _responseContentLength, _responseContentBytesSent;
 		bool _responseConnectionKeepAlive;
 		bool _responseChunkedTransferEncoding;
 
+		// Output flow control.
+		qint64 _writeBufferLowWatermark, _writeBufferHighWatermark;
+		bool _writeBufferFull; // Set when the output device buffered up to the high watermark, until it drains to the low watermark.
+
+		bool _closeWhenIdle; // No keep-alive: close once the current request, if any, is answered.
+
+		// Request timing.
+		qint64 _timestamps[Pillow::HttpConnection::TimestampCount];
+		bool _timingStarted; // Whether the first byte of the current request arrived.
+		bool _watchingOutputFlush;
+		bool _serverTimingEnabled;
+
 	public:
+		inline void clearRequestHeaders() { _requestHeadersRef.clear(); memset(_requestHeaderIndexes, 0xff, sizeof(_requestHeaderIndexes)); }
+		inline const QByteArray& requestHeaderValue(Pillow::HttpHeaderId::Id fieldId) const
+		{
+			static const QByteArray null;
+			int index = _requestHeaderIndexes[fieldId];
+			return index >= 0 && index < _requestHeaders.size() ? _requestHeaders.at(index).second : null;
+		}
+
+		inline void clearRequestParams()
+		{
+			if (_requestParams.capacity() > 16) _requestParams.clear();
+			else while(!_requestParams.isEmpty()) _requestParams.pop_back();
+			_requestParamsParsed = false;
+			_requestParamRefs.clear();
+			_requestParamRefsIndexed = false;
+		}
+		void indexRequestParams();
+		int findRequestParamRef(const char* name, int nameLength);
+		int findSetRequestParam(const QString& name) const;
+
 		void initialize();
 		void processInput();
+		void processStreamedContent();
+		void setRequestContentPaused(bool paused);
 		void setupRequestHeaders();
+		void setupRequestFields();
 		void transitionToReceivingHeaders();
 		void transitionToReceivingContent();
 		void transitionToSendingHeaders();
@@ -114,6 +175,12 @@ namespace Pillow
 		void drain();
 		void transitionToFlushing();
 		void transitionToClosed();
+		void checkWriteBufferFull();
+		void checkWriteBufferDrained();
+		void startTiming();
+		void checkOutputFlushed();
+		void stopWatchingOutputFlush();
+		void appendServerTiming();
 		void writeRequestErrorResponse(int statusCode = 400); // Used internally when an error happens while receiving a request. It sends an error response to the client and closes the connection right away.
 
 		static void parser_http_field(void *data, const char *field, size_t flen, const char *value, size_t vlen);
@@ -123,14 +190,23 @@ namespace Pillow
 		void writeResponseString(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QString& content = QString());
 		void writeHeaders(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection());
 		void writeContent(const QByteArray& content);
+		void writeEncodedContent(const QByteArray& encodedContent, qint64 contentSize);
 		void endContent();
+		void writePreparedResponse(const Pillow::HttpPreparedResponse& response);
+		QByteArray upgrade(const Pillow::HttpHeaderCollection* headers); // No response when NULL.
 		void close();
+		void closeWhenIdle();
 	};
 }
 
 Pillow::HttpConnectionPrivate::HttpConnectionPrivate(HttpConnection *connection)
-	: q_ptr(connection), _state(Pillow::HttpConnection::Uninitialized), _inputDevice(0), _outputDevice(0)
+	: q_ptr(connection), _state(Pillow::HttpConnection::Uninitialized), _inputDevice(0), _outputDevice(0), _outputDeviceType(OtherOutputDevice),
+	  _requestContentStreamed(false), _requestContentPaused(false), _inputReadBufferSize(0), _requestContentBytesReceived(0), _requestParamsParsed(false), _requestParamRefsIndexed(false),
+	  _writeBufferLowWatermark(Pillow::HttpConnection::DefaultWriteBufferLowWatermark), _writeBufferHighWatermark(Pillow::HttpConnection::DefaultWriteBufferHighWatermark), _writeBufferFull(false),
+	  _closeWhenIdle(false), _timingStarted(false), _watchingOutputFlush(false), _serverTimingEnabled(false)
 {
+	memset(_timestamps, 0, sizeof(_timestamps));
+	_responseChunkSizeBuffer.reserve(16); // Up to 8 hex digits and the line end; only ever truncated in place afterwards.
 }
 
 inline void Pillow::HttpConnectionPrivate::initialize()
@@ -139,12 +215,14 @@ inline void Pillow::HttpConnectionPrivate::initialize()
 	_parser.data = this;
 	_parser.http_field = &HttpConnectionPrivate::parser_http_field;
 
+	_closeWhenIdle = false;
+	_serverTimingEnabled = false;
+
 	// Clear any leftover data from a previous potentially failed request (that would not have gone though "transitionToCompleted")
 	if (_requestBuffer.capacity() <= Pillow::HttpConnection::MaximumRequestHeaderLength) _requestBuffer.data_ptr()->size = 0;
 	else _requestBuffer.clear();
-	_requestHeadersRef.clear();
-	if (_requestParams.capacity() > 16) _requestParams.clear();
-	else while(!_requestParams.isEmpty()) _requestParams.pop_back();
+	clearRequestHeaders();
+	clearRequestParams();
 
 	// Enter the initial working state and schedule processing of any data already available on the device.
 	transitionToReceivingHeaders();
@@ -154,6 +232,7 @@ inline void Pillow::HttpConnectionPrivate::initialize()
 inline void Pillow::HttpConnectionPrivate::processInput()
 {
 	if (_state != Pillow::HttpConnection::ReceivingHeaders && _state != Pillow::HttpConnection::ReceivingContent) return;
+	if (_requestContentStreamed) return processStreamedContent();
 
 	qint64 bytesAvailable = _inputDevice->bytesAvailable();
 	if (bytesAvailable > 0)
@@ -167,6 +246,8 @@ inline void Pillow::HttpConnectionPrivate::processInput()
 
 	if (_state == Pillow::HttpConnection::ReceivingHeaders)
 	{
+		if (!_timingStarted && !_requestBuffer.isEmpty())
+			startTiming();
 		if (!_requestBuffer.isEmpty())
 			thin_http_parser_execute(&_parser, _requestBuffer.constData(), _requestBuffer.size(), _parser.nread);
 
@@ -182,15 +263,83 @@ inline void Pillow::HttpConnectionPrivate::processInput()
 	}
 }
 
+inline void Pillow::HttpConnectionPrivate::processStreamedContent()
+{
+	// Hand over the content bytes that were read along with the headers first. Any pipelined data
+	// after them gets moved down to the start of the content, so the request buffer never grows.
+	int bufferedBytes = _requestBuffer.size() - int(_parser.body_start);
+	int contentBytes = int(qMin<qint64>(bufferedBytes, _requestContentLength - _requestContentBytesReceived));
+	if (contentBytes > 0)
+	{
+		char* content = _requestBuffer.data() + _parser.body_start;
+		_requestContentChunk = QByteArray::fromRawData(content, contentBytes);
+		_requestContentBytesReceived += contentBytes;
+		emit q_ptr->requestContentReceived(q_ptr, _requestContentChunk);
+		_requestContentChunk = QByteArray();
+		if (_state != Pillow::HttpConnection::ReceivingContent) return;
+
+		memmove(content, content + contentBytes, bufferedBytes - contentBytes);
+		_requestBuffer.data_ptr()->size -= contentBytes;
+		_requestBuffer.data_ptr()->data[_requestBuffer.data_ptr()->size] = 0;
+	}
+
+	// Then read the rest from the device in bounded chunks, never past the end of the content.
+	qint64 remainingBytes;
+	while (!_requestContentPaused && (remainingBytes = _requestContentLength - _requestContentBytesReceived) > 0 && _inputDevice->bytesAvailable() > 0)
+	{
+		_requestContentChunk.resize(int(qMin<qint64>(remainingBytes, StreamedContentChunkSize)));
+		qint64 bytesRead = _inputDevice->read(_requestContentChunk.data(), _requestContentChunk.size());
+		if (bytesRead <= 0) break;
+		_requestContentChunk.resize(int(bytesRead));
+		_requestContentBytesReceived += bytesRead;
+		emit q_ptr->requestContentReceived(q_ptr, _requestContentChunk);
+		if (_state != Pillow::HttpConnection::ReceivingContent) return;
+	}
+
+	if (_requestContentBytesReceived >= _requestContentLength)
+	{
+		if (_requestContentChunk.capacity() > StreamedContentChunkSize) _requestContentChunk.clear();
+		transitionToSendingHeaders(); // Finished receiving the content.
+	}
+}
+
+inline void Pillow::HttpConnectionPrivate::setRequestContentPaused(bool paused)
+{
+	if (_requestContentPaused == paused) return;
+	_requestContentPaused = paused;
+
+	// Keep the socket from reading ahead meanwhile: what it does not read stays in the kernel, which throttles the client.
+	const qint64 pausedReadBufferSize = StreamedContentChunkSize;
+	if (QAbstractSocket* socket = qobject_cast<QAbstractSocket*>(_inputDevice))
+	{
+		if (paused) _inputReadBufferSize = socket->readBufferSize();
+		if (_inputReadBufferSize == 0 || _inputReadBufferSize > pausedReadBufferSize)
+			socket->setReadBufferSize(paused ? pausedReadBufferSize : _inputReadBufferSize);
+	}
+	else if (QLocalSocket* socket = qobject_cast<QLocalSocket*>(_inputDevice))
+	{
+		if (paused) _inputReadBufferSize = socket->readBufferSize();
+		if (_inputReadBufferSize == 0 || _inputReadBufferSize > pausedReadBufferSize)
+			socket->setReadBufferSize(paused ? pausedReadBufferSize : _inputReadBufferSize);
+	}
+
+	if (!paused && _inputDevice != 0 && _inputDevice->bytesAvailable() > 0)
+		QTimer::singleShot(0, q_ptr, SLOT(processInput()));
+}
+
 inline void Pillow::HttpConnectionPrivate::transitionToReceivingHeaders()
 {
 	if (_state == Pillow::HttpConnection::ReceivingHeaders) return;
 	_state = Pillow::HttpConnection::ReceivingHeaders;
+	setRequestContentPaused(false);
 
 	thin_http_parser_init(&_parser);
 	_requestContentLength = 0;
 	_requestContentLengthHeaderIndex = -1;
+	_requestContentStreamed = false;
+	_requestContentBytesReceived = 0;
 	_requestHttp11 = false;
+	_timingStarted = false; // The timestamps of the previous request stay until this one starts.
 }
 
 inline void Pillow::HttpConnectionPrivate::setupRequestHeaders()
@@ -213,31 +362,43 @@ inline void Pillow::HttpConnectionPrivate::transitionToReceivingContent()
 {
 	if (_state == Pillow::HttpConnection::ReceivingContent) return;
 	_state = Pillow::HttpConnection::ReceivingContent;
+	_timestamps[HttpConnection::HeadersReceived] = HttpConnection::now();
 
 	setupRequestHeaders();
 
 	bool contentLengthParseOk = true;
 	if (_requestContentLengthHeaderIndex >= 0)
-		_requestContentLength = _requestHeaders.at(_requestContentLengthHeaderIndex).second.toInt(&contentLengthParseOk);
+		_requestContentLength = _requestHeaders.at(_requestContentLengthHeaderIndex).second.toLongLong(&contentLengthParseOk);
 
 	// Exit early if the client sent an incorrect or unacceptable content-length.
 	if (_requestContentLength < 0)
 		return writeRequestErrorResponse(400); // Invalid request: negative content length does not make sense.
-	else if (_requestContentLength > Pillow::HttpConnection::MaximumRequestContentLength || !contentLengthParseOk)
+	else if (!contentLengthParseOk)
 		return writeRequestErrorResponse(413); // Request entity too large.
 
 	if (_requestContentLength > 0)
 	{
-		if (asciiEqualsCaseInsensitive(_requestHeaders.getFieldValue(expectToken), hundredDashContinueToken))
+		// Give handlers a chance to stream the content rather than having it buffered.
+		setupRequestFields();
+		emit q_ptr->requestHeadersReady(q_ptr);
+		if (_state != Pillow::HttpConnection::ReceivingContent) return; // The request got rejected.
+
+		if (!_requestContentStreamed && _requestContentLength > Pillow::HttpConnection::MaximumRequestContentLength)
+			return writeRequestErrorResponse(413); // Request entity too large.
+
+		if (asciiEqualsCaseInsensitive(requestHeaderValue(HttpHeaderId::Expect), hundredDashContinueToken))
 			_outputDevice->write("HTTP/1.1 100 Continue\r\n\r\n");// The client politely wanted to know if it could proceed with his payload. All clear!
 
-		// Resize the request buffer right away to avoid too many reallocs later.
-		// NOTE: This invalidates the request headers QByteArrays if the reallocation
-		// changes the buffer's address (very likely unless the content-length is tiny).
-		_requestBuffer.reserve(_parser.body_start + _requestContentLength + 1);
+		if (!_requestContentStreamed)
+		{
+			// Resize the request buffer right away to avoid too many reallocs later.
+			// NOTE: This invalidates the request headers QByteArrays if the reallocation
+			// changes the buffer's address (very likely unless the content-length is tiny).
+			_requestBuffer.reserve(_parser.body_start + int(_requestContentLength) + 1);
 
-		// So do invalidate the request headers.
-		if (_requestHeaders.size() > 0) _requestHeaders.pop_back();
+			// So do invalidate the request headers.
+			if (_requestHeaders.size() > 0) _requestHeaders.pop_back();
+		}
 
 		// Pump; the content may already be sitting in the buffers.
 		processInput();
@@ -252,12 +413,26 @@ inline void Pillow::HttpConnectionPrivate::transitionToSendingHeaders()
 {
 	if (_state == Pillow::HttpConnection::SendingHeaders) return;
 	_state = Pillow::HttpConnection::SendingHeaders;
-
-	// Prepare and null terminate the request fields.
+	_timestamps[HttpConnection::ContentReceived] = HttpConnection::now();
 
 	if (_requestHeaders.size() != _requestHeadersRef.size())
 		setupRequestHeaders();
+	setupRequestFields();
 
+	setFromRawData(_requestContent, _requestBuffer.constData(), _parser.body_start, _requestContentStreamed ? 0 : int(_requestContentLength));
+
+	// Reset our known information about the response.
+	_responseContentLength = -1;   // The response content-length is initially unknown.
+	_responseContentBytesSent = 0; // No content bytes transfered yet.
+	_responseConnectionKeepAlive = true;
+	_responseChunkedTransferEncoding = false;
+	emit q_ptr->requestReady(q_ptr);
+}
+
+inline void Pillow::HttpConnectionPrivate::setupRequestFields()
+{
+	// Prepare and null terminate the request fields. They point into the request buffer, so this
+	// needs to be done again whenever the buffer gets reallocated.
 	char* data = _requestBuffer.data();
 
 	if (_parser.query_string_len == 0)
@@ -281,17 +456,9 @@ inline void Pillow::HttpConnectionPrivate::transitionToSendingHeaders()
 	if (!_requestFragmentDecoded.isEmpty())_requestFragmentDecoded = QString();
 	if (!_requestPathDecoded.isEmpty())_requestPathDecoded = QString();
 	if (!_requestQueryStringDecoded.isEmpty())_requestQueryStringDecoded = QString();
+	clearRequestParams(); // The query string has just been set; params get indexed from it on demand.
 
 	_requestHttp11 = _requestHttpVersion == httpSlash11Token;
-
-	setFromRawData(_requestContent, _requestBuffer.constData(), _parser.body_start, _requestContentLength);
-
-	// Reset our known information about the response.
-	_responseContentLength = -1;   // The response content-length is initially unknown.
-	_responseContentBytesSent = 0; // No content bytes transfered yet.
-	_responseConnectionKeepAlive = true;
-	_responseChunkedTransferEncoding = false;
-	emit q_ptr->requestReady(q_ptr);
 }
 
 inline void Pillow::HttpConnectionPrivate::transitionToSendingContent()
@@ -322,25 +489,26 @@ inline void Pillow::HttpConnectionPrivate::transitionToCompleted()
 		qWarning() << "HttpConnection::transitionToCompleted called while the request is in the closed state.";
 	}
 	_state = Pillow::HttpConnection::Completed;
+	_timestamps[HttpConnection::LastByteWritten] = HttpConnection::now();
 	emit q_ptr->requestCompleted(q_ptr);
 
 	// Preserve any existing data in the request buffer that did not belong to the completed request.
 	// Reuse the already allocated buffer if it is not too large.
-	int remainingBytes = _requestBuffer.size() - int(_parser.body_start) - _requestContentLength;
+	int remainingBytes = _requestBuffer.size() - int(_parser.body_start) - (_requestContentStreamed ? 0 : int(_requestContentLength));
 	if (remainingBytes > 0) _requestBuffer = _requestBuffer.right(remainingBytes);
 	else if (_requestBuffer.capacity() <= Pillow::HttpConnection::MaximumRequestHeaderLength) _requestBuffer.data_ptr()->size = 0;
 	else _requestBuffer.clear();
 
-	_requestHeadersRef.clear();
+	clearRequestHeaders();
 
-	if (_requestParams.capacity() > 16) _requestParams.clear();
-	else while(!_requestParams.isEmpty()) _requestParams.pop_back();
+	clearRequestParams();
 
 	_requestContent.data_ptr()->size = 0;
 
-	if (_responseConnectionKeepAlive)
+	if (_responseConnectionKeepAlive && !_closeWhenIdle)
 	{
 		flush(); // Done writing for this request, make sure the data is pushed right away to the client.
+		checkOutputFlushed();
 		transitionToReceivingHeaders();
 		processInput();
 	}
@@ -354,9 +522,9 @@ inline void Pillow::HttpConnectionPrivate::flush()
 {
 	if (_outputDevice != 0 && _outputDevice->bytesToWrite() > 0)
 	{
-		if (qobject_cast<QTcpSocket*>(_outputDevice))
+		if (_outputDeviceType == TcpSocketOutputDevice)
 			static_cast<QTcpSocket*>(_outputDevice)->flush();
-		else if (qobject_cast<QLocalSocket*>(_outputDevice))
+		else if (_outputDeviceType == LocalSocketOutputDevice)
 			static_cast<QLocalSocket*>(_outputDevice)->flush();
 	}
 }
@@ -365,7 +533,11 @@ inline void Pillow::HttpConnectionPrivate::drain()
 {
 	if (_state != Pillow::HttpConnection::Flushing) return;
 	flush();
-	if (_outputDevice != 0 && _outputDevice->bytesToWrite() == 0) transitionToClosed();
+	if (_outputDevice != 0 && _outputDevice->bytesToWrite() == 0)
+	{
+		_timestamps[HttpConnection::OutputFlushed] = HttpConnection::now();
+		transitionToClosed();
+	}
 }
 
 inline void Pillow::HttpConnectionPrivate::transitionToFlushing()
@@ -384,6 +556,9 @@ inline void Pillow::HttpConnectionPrivate::transitionToClosed()
 {
 	if (_state == Pillow::HttpConnection::Closed) return;
 	_state = Pillow::HttpConnection::Closed;
+	_writeBufferFull = false;
+	_requestContentPaused = false; // The devices are let go of below; nothing to put back.
+	_watchingOutputFlush = false; // All the device signals get disconnected below.
 
 	if (_inputDevice && _inputDevice->isOpen()) _inputDevice->close();
 	if (_outputDevice && (_inputDevice != _outputDevice) && _outputDevice->isOpen()) _outputDevice->close();
@@ -395,6 +570,70 @@ inline void Pillow::HttpConnectionPrivate::transitionToClosed()
 	_outputDevice = 0;
 }
 
+inline void Pillow::HttpConnectionPrivate::checkWriteBufferFull()
+{
+	if (_writeBufferFull || _outputDevice == 0 || _outputDevice->bytesToWrite() < _writeBufferHighWatermark) return;
+
+	// Watch the device drain only while it is over the watermark, so that connections with a
+	// small output buffer do not pay for it.
+	_writeBufferFull = true;
+	QObject::connect(_outputDevice, SIGNAL(bytesWritten(qint64)), q_ptr, SLOT(checkWriteBuffer()));
+	emit q_ptr->writeBufferFull(q_ptr);
+}
+
+inline void Pillow::HttpConnectionPrivate::checkWriteBufferDrained()
+{
+	if (!_writeBufferFull || _outputDevice == 0 || _outputDevice->bytesToWrite() > _writeBufferLowWatermark) return;
+
+	_writeBufferFull = false;
+	QObject::disconnect(_outputDevice, SIGNAL(bytesWritten(qint64)), q_ptr, SLOT(checkWriteBuffer()));
+	emit q_ptr->writeBufferDrained(q_ptr);
+}
+
+inline void Pillow::HttpConnectionPrivate::startTiming()
+{
+	if (_watchingOutputFlush) stopWatchingOutputFlush(); // The previous response never got flushed.
+	memset(_timestamps, 0, sizeof(_timestamps));
+	_timestamps[HttpConnection::FirstByteReceived] = HttpConnection::now();
+	_timingStarted = true;
+}
+
+inline void Pillow::HttpConnectionPrivate::checkOutputFlushed()
+{
+	if (_outputDevice == 0) return;
+	if (_outputDevice->bytesToWrite() > 0)
+	{
+		// Only watch the device for responses that did not make it to the kernel right away.
+		if (!_watchingOutputFlush)
+		{
+			_watchingOutputFlush = true;
+			QObject::connect(_outputDevice, SIGNAL(bytesWritten(qint64)), q_ptr, SLOT(checkOutputFlushed()));
+		}
+		return;
+	}
+
+	_timestamps[HttpConnection::OutputFlushed] = HttpConnection::now();
+	if (_watchingOutputFlush) stopWatchingOutputFlush();
+}
+
+inline void Pillow::HttpConnectionPrivate::stopWatchingOutputFlush()
+{
+	_watchingOutputFlush = false;
+	QObject::disconnect(_outputDevice, SIGNAL(bytesWritten(qint64)), q_ptr, SLOT(checkOutputFlushed()));
+}
+
+void Pillow::HttpConnectionPrivate::appendServerTiming()
+{
+	const qint64* t = _timestamps;
+	_responseHeadersBuffer.append(serverTimingHeadersOutToken);
+	_responseHeadersBuffer.append(QByteArray::number((t[HttpConnection::HeadersReceived] - t[HttpConnection::FirstByteReceived]) / 1000.0, 'f', 3));
+	_responseHeadersBuffer.append(serverTimingContentOutToken);
+	_responseHeadersBuffer.append(QByteArray::number((t[HttpConnection::ContentReceived] - t[HttpConnection::HeadersReceived]) / 1000.0, 'f', 3));
+	_responseHeadersBuffer.append(serverTimingHandlerOutToken);
+	_responseHeadersBuffer.append(QByteArray::number((t[HttpConnection::HeadersWritten] - t[HttpConnection::ContentReceived]) / 1000.0, 'f', 3));
+	_responseHeadersBuffer.append(crLfToken);
+}
+
 void Pillow::HttpConnectionPrivate::writeRequestErrorResponse(int statusCode)
 {
 	if (_state == Pillow::HttpConnection::Closed)
@@ -418,9 +657,15 @@ inline void Pillow::HttpConnectionPrivate::parser_http_field(void *data, const c
 {
 	Pillow::HttpConnectionPrivate* request = reinterpret_cast<Pillow::HttpConnectionPrivate*>(data);
 
-	// Find the one request header that interest us, fast.
-	if (flen == 14 && asciiEqualsCaseInsensitive(field, 14, "content-length", 14))
-		request->_requestContentLengthHeaderIndex = request->_requestHeadersRef.size();
+	// Index the well-known headers, so they can be looked up without comparing field names again.
+	Pillow::HttpHeaderId::Id fieldId = Pillow::HttpHeaderId::fromFieldName(field, static_cast<int>(flen));
+	if (fieldId != Pillow::HttpHeaderId::Unknown)
+	{
+		if (request->_requestHeaderIndexes[fieldId] < 0)
+			request->_requestHeaderIndexes[fieldId] = static_cast<qint16>(request->_requestHeadersRef.size());
+		if (fieldId == Pillow::HttpHeaderId::ContentLength)
+			request->_requestContentLengthHeaderIndex = request->_requestHeadersRef.size();
+	}
 
 	const char* begin = request->_requestBuffer.constData();
 	request->_requestHeadersRef.append(HttpHeaderRef(field - begin, flen, value - begin, vlen));
@@ -467,9 +712,16 @@ inline void Pillow::HttpConnectionPrivate::writeHeaders(int statusCode, const Ht
 	const HttpHeader* transferEncodingHeader = 0;
 
 	// Grab headers that are important to us so we can check their values and consistency.
+	// Their field names all have different lengths, which rules out most headers with a single integer compare.
 	for (const HttpHeader* header = headers.constBegin(), *headerE = headers.constEnd(); header != headerE; ++header)
 	{
-		if (asciiEqualsCaseInsensitive(header->first, contentLengthToken))
+		const int fieldLength = header->first.size();
+		if (fieldLength != contentLengthToken.size() && fieldLength != contentTypeToken.size()
+			&& fieldLength != connectionToken.size() && fieldLength != transferEncodingToken.size())
+		{
+			_responseHeadersBuffer.append(*header);
+		}
+		else if (asciiEqualsCaseInsensitive(header->first, contentLengthToken))
 		{
 			bool ok = false;
 			_responseContentLength = header->second.toLongLong(&ok);
@@ -515,15 +767,15 @@ inline void Pillow::HttpConnectionPrivate::writeHeaders(int statusCode, const Ht
 	if (_requestHttp11)
 	{
 		// Keep-Alive by default, unless "close" is specified.
-		clientWantsKeepAlive = !asciiEqualsCaseInsensitive(_requestHeaders.getFieldValue(connectionToken), closeToken);
+		clientWantsKeepAlive = !asciiEqualsCaseInsensitive(requestHeaderValue(HttpHeaderId::Connection), closeToken);
 	}
 	else
 	{
 		// Close by default, unless "keep-alive" is specified.
-		clientWantsKeepAlive = asciiEqualsCaseInsensitive(_requestHeaders.getFieldValue(connectionToken), keepAliveToken);
+		clientWantsKeepAlive = asciiEqualsCaseInsensitive(requestHeaderValue(HttpHeaderId::Connection), keepAliveToken);
 	}
 
-	if (clientWantsKeepAlive)
+	if (clientWantsKeepAlive && !_closeWhenIdle)
 	{
 		// To be able to keep the connection alive, the response length needs to be known, or chunked encoding be used.
 		bool serverWantsKeepAlive = _responseContentLength >= 0 || _responseChunkedTransferEncoding;
@@ -544,9 +796,52 @@ inline void Pillow::HttpConnectionPrivate::writeHeaders(int statusCode, const Ht
 	if (contentTypeHeader) { _responseHeadersBuffer.append(*contentTypeHeader); } else if (_responseContentLength > 0) { _responseHeadersBuffer.append(contentTypeTextPlainTokenHeaderToken); }
 	if (!_requestHttp11 || !_responseConnectionKeepAlive) _responseHeadersBuffer.append(_responseConnectionKeepAlive ? connectionKeepAliveHeaderToken : connectionCloseHeaderToken);
 	if (transferEncodingHeader) { _responseHeadersBuffer.append(*transferEncodingHeader); }
+	_timestamps[HttpConnection::HeadersWritten] = HttpConnection::now();
+	if (_serverTimingEnabled) appendServerTiming();
+	_responseHeadersBuffer.append(crLfToken); // End of headers.
+	_outputDevice->write(_responseHeadersBuffer);
+	transitionToSendingContent();
+}
+
+inline void Pillow::HttpConnectionPrivate::writePreparedResponse(const Pillow::HttpPreparedResponse& response)
+{
+	if (_state != Pillow::HttpConnection::SendingHeaders)
+	{
+		qWarning() << "HttpConnection::writePreparedResponse called while state is not 'SendingHeaders', not proceeding with sending the response.";
+		return;
+	}
+
+	_responseStatusCode = response.statusCode();
+	_responseContentLength = response.content().size();
+
+	// Same keep-alive negotiation as writeHeaders, knowing that the response length is always known.
+	bool clientWantsKeepAlive;
+	if (_requestHttp11)
+		clientWantsKeepAlive = !asciiEqualsCaseInsensitive(requestHeaderValue(HttpHeaderId::Connection), closeToken);
+	else
+		clientWantsKeepAlive = asciiEqualsCaseInsensitive(requestHeaderValue(HttpHeaderId::Connection), keepAliveToken);
+	_responseConnectionKeepAlive = clientWantsKeepAlive && !response.closesConnection() && !_closeWhenIdle;
+
+	const bool sendContent = _responseContentLength > 0 && _requestMethod != headToken;
+	const bool appendContent = sendContent && _responseContentLength <= 4096; // Larger content is written on its own rather than copied.
+
+	if (_responseHeadersBuffer.capacity() == 0)
+		_responseHeadersBuffer.reserve(1024);
+
+	_responseHeadersBuffer.append(_requestHttpVersion).append(response.head());
+	if (!_requestHttp11 || !_responseConnectionKeepAlive) _responseHeadersBuffer.append(_responseConnectionKeepAlive ? connectionKeepAliveHeaderToken : connectionCloseHeaderToken);
+	_timestamps[HttpConnection::HeadersWritten] = HttpConnection::now();
+	if (_serverTimingEnabled) appendServerTiming();
 	_responseHeadersBuffer.append(crLfToken); // End of headers.
+	if (appendContent) _responseHeadersBuffer.append(response.content());
 	_outputDevice->write(_responseHeadersBuffer);
+	if (sendContent && !appendContent) _outputDevice->write(response.content());
+	checkWriteBufferFull();
+
+	// Without content to send, transitionToSendingContent completes the response by itself.
+	if (sendContent) _responseContentBytesSent = _responseContentLength;
 	transitionToSendingContent();
+	if (sendContent) transitionToCompleted();
 }
 
 inline void Pillow::HttpConnectionPrivate::writeContent(const QByteArray &content)
@@ -572,14 +867,41 @@ inline void Pillow::HttpConnectionPrivate::writeContent(const QByteArray &conten
 		_responseContentBytesSent += content.size();
 		if (_responseChunkedTransferEncoding)
 		{
-			QByteArray buffer; appendNumber<int, 16>(buffer, content.size()); buffer.append("\r\n", 2);
-			_outputDevice->write(buffer);
+			_responseChunkSizeBuffer.data_ptr()->size = 0;
+			appendNumber<int, 16>(_responseChunkSizeBuffer, content.size()); _responseChunkSizeBuffer.append("\r\n", 2);
+			_outputDevice->write(_responseChunkSizeBuffer);
 		}
 		_outputDevice->write(content);
 
 		if (_responseChunkedTransferEncoding)
 			_outputDevice->write("\r\n", 2);
 
+		checkWriteBufferFull();
+		if (_responseContentBytesSent == _responseContentLength)
+			transitionToCompleted();
+	}
+}
+
+inline void Pillow::HttpConnectionPrivate::writeEncodedContent(const QByteArray& encodedContent, qint64 contentSize)
+{
+	if (_state != Pillow::HttpConnection::SendingContent)
+	{
+		qWarning() << "HttpConnection::writeEncodedContent called while state is not 'SendingContent'. Not proceeding with sending content of size" << contentSize << "bytes.";
+		return;
+	}
+	else if (_responseContentLength >= 0 && contentSize + _responseContentBytesSent > _responseContentLength)
+	{
+		qWarning() << "HttpConnection::writeEncodedContent called trying to send more data (" << (contentSize + _responseContentBytesSent) << "bytes) than the specified response content-length of" << _responseContentLength << "bytes.";
+		return;
+	}
+
+	if (contentSize > 0 && _requestMethod != headToken)
+	{
+		// The framing was done by the caller: this is a single write of a possibly shared buffer.
+		_responseContentBytesSent += contentSize;
+		_outputDevice->write(encodedContent);
+
+		checkWriteBufferFull();
 		if (_responseContentBytesSent == _responseContentLength)
 			transitionToCompleted();
 	}
@@ -607,11 +929,102 @@ inline void Pillow::HttpConnectionPrivate::endContent()
 	transitionToCompleted();
 }
 
+inline QByteArray Pillow::HttpConnectionPrivate::upgrade(const HttpHeaderCollection* headers)
+{
+	if (_state != Pillow::HttpConnection::SendingHeaders)
+	{
+		qWarning() << "HttpConnection::upgrade called while state is not 'SendingHeaders', not proceeding with the upgrade.";
+		return QByteArray();
+	}
+
+	_responseStatusCode = headers ? 101 : 0;
+	_responseContentLength = 0;
+	_responseConnectionKeepAlive = false;
+	_timestamps[HttpConnection::HeadersWritten] = HttpConnection::now();
+
+	if (headers)
+	{
+		if (_responseHeadersBuffer.capacity() == 0)
+			_responseHeadersBuffer.reserve(1024);
+		const char* statusCodeAndMessage = HttpProtocol::StatusCodes::getStatusCodeAndMessage(101);
+		_responseHeadersBuffer.append(_requestHttpVersion).append(' ').append(statusCodeAndMessage, static_cast<int>(strlen(statusCodeAndMessage))).append(crLfToken);
+		for (const HttpHeader* header = headers->constBegin(), *headerE = headers->constEnd(); header != headerE; ++header)
+			_responseHeadersBuffer.append(*header);
+		_responseHeadersBuffer.append(crLfToken); // End of headers.
+		_outputDevice->write(_responseHeadersBuffer);
+		flush();
+		_responseHeadersBuffer.data_ptr()->size = 0;
+	}
+
+	// Whatever the client sent after the request already belongs to the new protocol.
+	int requestEnd = int(_parser.body_start) + (_requestContentStreamed ? 0 : int(_requestContentLength));
+	QByteArray remainingData = _requestBuffer.size() > requestEnd ? QByteArray(_requestBuffer.constData() + requestEnd, _requestBuffer.size() - requestEnd) : QByteArray();
+
+	_state = Pillow::HttpConnection::Completed;
+	_timestamps[HttpConnection::LastByteWritten] = HttpConnection::now();
+	emit q_ptr->requestCompleted(q_ptr);
+
+	// Let go of the devices without closing them; they now belong to whoever took the connection over.
+	QObject::disconnect(_inputDevice, 0, q_ptr, 0);
+	if (_inputDevice != _outputDevice) QObject::disconnect(_outputDevice, 0, q_ptr, 0);
+	_inputDevice = 0;
+	_outputDevice = 0;
+	_state = Pillow::HttpConnection::Closed;
+	_writeBufferFull = false;
+	_watchingOutputFlush = false;
+	emit q_ptr->closed(q_ptr);
+
+	return remainingData;
+}
+
 inline void Pillow::HttpConnectionPrivate::close()
 {
 	transitionToClosed();
 }
 
+inline void Pillow::HttpConnectionPrivate::closeWhenIdle()
+{
+	if (_state == Pillow::HttpConnection::Uninitialized || _state == Pillow::HttpConnection::Closed) return;
+	_closeWhenIdle = true;
+
+	// Waiting for a request that did not start yet: nothing to finish.
+	if (_state == Pillow::HttpConnection::ReceivingHeaders && _requestBuffer.size() == 0 && _inputDevice->bytesAvailable() == 0)
+		transitionToClosed();
+}
+
+//
+// HttpPreparedResponse
+//
+
+Pillow::HttpPreparedResponse::HttpPreparedResponse(int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content)
+	: _statusCode(statusCode), _headers(headers), _content(content), _closesConnection(false)
+{
+	const char* statusCodeAndMessage = HttpProtocol::StatusCodes::getStatusCodeAndMessage(statusCode);
+	if (statusCodeAndMessage == NULL)
+	{
+		qWarning() << "HttpPreparedResponse:" << statusCode << "is not a valid Http status code. Using 500 Internal Server Error instead.";
+		_statusCode = 500;
+		statusCodeAndMessage = HttpProtocol::StatusCodes::getStatusCodeAndMessage(500);
+	}
+
+	// Same layout as produced by HttpConnection::writeHeaders.
+	Pillow::ByteArray head; head.reserve(256);
+	head.append(' ').append(statusCodeAndMessage, static_cast<int>(strlen(statusCodeAndMessage))).append(crLfToken);
+
+	const HttpHeader* contentTypeHeader = 0;
+	for (const HttpHeader* header = headers.constBegin(), *headerE = headers.constEnd(); header != headerE; ++header)
+	{
+		if (asciiEqualsCaseInsensitive(header->first, contentLengthToken) || asciiEqualsCaseInsensitive(header->first, transferEncodingToken)) continue;
+		else if (asciiEqualsCaseInsensitive(header->first, contentTypeToken)) contentTypeHeader = header;
+		else if (asciiEqualsCaseInsensitive(header->first, connectionToken)) _closesConnection = asciiEqualsCaseInsensitive(header->second, closeToken);
+		else head.append(*header);
+	}
+
+	head.append(contentLengthOutToken); appendNumber<int, 10>(head, content.size()); head.append(crLfToken);
+	if (contentTypeHeader) head.append(*contentTypeHeader); else if (!content.isEmpty()) head.append(contentTypeTextPlainTokenHeaderToken);
+	_head = head;
+}
+
 //
 // HttpConnection
 //
@@ -648,6 +1061,12 @@ void Pillow::HttpConnection::initialize(QIODevice* inputDevice, QIODevice* outpu
 	}
 
 	d_ptr->_outputDevice = outputDevice;
+	if (qobject_cast<QTcpSocket*>(outputDevice))
+		d_ptr->_outputDeviceType = HttpConnectionPrivate::TcpSocketOutputDevice;
+	else if (qobject_cast<QLocalSocket*>(outputDevice))
+		d_ptr->_outputDeviceType = HttpConnectionPrivate::LocalSocketOutputDevice;
+	else
+		d_ptr->_outputDeviceType = HttpConnectionPrivate::OtherOutputDevice;
 	d_ptr->initialize();
 }
 
@@ -701,84 +1120,284 @@ void Pillow::HttpConnection::writeContent(const QByteArray& content)
 	d_ptr->writeContent(content);
 }
 
+void Pillow::HttpConnection::writeEncodedContent(const QByteArray& encodedContent, qint64 contentSize)
+{
+	d_ptr->writeEncodedContent(encodedContent, contentSize);
+}
+
 void Pillow::HttpConnection::endContent()
 {
 	d_ptr->endContent();
 }
 
+void Pillow::HttpConnection::writePreparedResponse(const Pillow::HttpPreparedResponse& response)
+{
+	d_ptr->writePreparedResponse(response);
+}
+
 void Pillow::HttpConnection::close()
 {
 	d_ptr->close();
 }
 
+void Pillow::HttpConnection::closeWhenIdle()
+{
+	d_ptr->closeWhenIdle();
+}
+
+QByteArray Pillow::HttpConnection::upgrade(const Pillow::HttpHeaderCollection& headers)
+{
+	return d_ptr->upgrade(&headers);
+}
+
+QByteArray Pillow::HttpConnection::upgrade()
+{
+	return d_ptr->upgrade(0);
+}
+
+void Pillow::HttpConnection::checkWriteBuffer()
+{
+	d_ptr->checkWriteBufferDrained();
+}
+
+void Pillow::HttpConnection::checkOutputFlushed()
+{
+	d_ptr->checkOutputFlushed();
+}
+
+qint64 Pillow::HttpConnection::timestamp(Timestamp phase) const
+{
+	return phase >= 0 && phase < TimestampCount ? d_ptr->_timestamps[phase] : 0;
+}
+
+namespace
+{
+	struct MonotonicClock
+	{
+		QElapsedTimer timer;
+		MonotonicClock() { timer.start(); }
+	};
+}
+
+qint64 Pillow::HttpConnection::now()
+{
+	static MonotonicClock clock;
+	return clock.timer.nsecsElapsed() / 1000 + 1; // Never 0, which stands for phases not reached.
+}
+
+bool Pillow::HttpConnection::isServerTimingEnabled() const
+{
+	return d_ptr->_serverTimingEnabled;
+}
+
+void Pillow::HttpConnection::setServerTimingEnabled(bool enabled)
+{
+	d_ptr->_serverTimingEnabled = enabled;
+}
+
+bool Pillow::HttpConnection::canWrite() const
+{
+	return !d_ptr->_writeBufferFull;
+}
+
+qint64 Pillow::HttpConnection::writeBufferSize() const
+{
+	return d_ptr->_outputDevice ? d_ptr->_outputDevice->bytesToWrite() : 0;
+}
+
+qint64 Pillow::HttpConnection::writeBufferLowWatermark() const
+{
+	return d_ptr->_writeBufferLowWatermark;
+}
+
+qint64 Pillow::HttpConnection::writeBufferHighWatermark() const
+{
+	return d_ptr->_writeBufferHighWatermark;
+}
+
+void Pillow::HttpConnection::setWriteBufferWatermarks(qint64 lowWatermark, qint64 highWatermark)
+{
+	if (lowWatermark < 0 || highWatermark <= lowWatermark)
+	{
+		qWarning() << "HttpConnection::setWriteBufferWatermarks: the low watermark" << lowWatermark << "must be positive and below the high watermark" << highWatermark << ". Ignoring.";
+		return;
+	}
+	d_ptr->_writeBufferLowWatermark = lowWatermark;
+	d_ptr->_writeBufferHighWatermark = highWatermark;
+	d_ptr->checkWriteBufferDrained();
+	d_ptr->checkWriteBufferFull();
+}
+
 int Pillow::HttpConnection::responseStatusCode() const
 {
 	return d_ptr->_responseStatusCode;
 }
 
+bool Pillow::HttpConnection::isResponseChunked() const
+{
+	return d_ptr->_responseChunkedTransferEncoding;
+}
+
 qint64 Pillow::HttpConnection::responseContentLength() const
 {
 	return d_ptr->_responseContentLength;
 }
 
+qint64 Pillow::HttpConnection::responseContentBytesSent() const
+{
+	return d_ptr->_responseContentBytesSent;
+}
+
 const QByteArray & Pillow::HttpConnection::requestHeaderValue(const QByteArray &field)
 {
+	Pillow::HttpHeaderId::Id fieldId = Pillow::HttpHeaderId::fromFieldName(field);
+	if (fieldId != Pillow::HttpHeaderId::Unknown)
+		return d_ptr->requestHeaderValue(fieldId);
 	return d_ptr->_requestHeaders.getFieldValue(field);
 }
 
-const Pillow::HttpParamCollection& Pillow::HttpConnection::requestParams()
+const QByteArray & Pillow::HttpConnection::requestHeaderValue(Pillow::HttpHeaderId::Id fieldId) const
+{
+	if (fieldId <= Pillow::HttpHeaderId::Unknown || fieldId >= Pillow::HttpHeaderId::Count)
+		return d_ptr->requestHeaderValue(Pillow::HttpHeaderId::Unknown); // Always empty.
+	return d_ptr->requestHeaderValue(fieldId);
+}
+
+inline void Pillow::HttpConnectionPrivate::indexRequestParams()
 {
-	if (d_ptr->_requestParams.isEmpty() && !d_ptr->_requestQueryString.isEmpty())
+	if (_requestParamRefsIndexed) return;
+	_requestParamRefsIndexed = true;
+
+	const char paramDelimiter = '&', keyValueDelimiter = '=';
+	const char* begin = _requestQueryString.constBegin();
+	for (const char* c = begin, *cE = _requestQueryString.constEnd(); c < cE;)
 	{
-		// The params have not yet been initialized. Parse them.
-		const char paramDelimiter = '&', keyValueDelimiter = '=';
-		for (const char* c = d_ptr->_requestQueryString.constBegin(), *cE = d_ptr->_requestQueryString.constEnd(); c < cE;)
+		const char *paramEnd, *keyEnd;
+		for (paramEnd = c; paramEnd < cE; ++paramEnd) if (*paramEnd == paramDelimiter) break; // Find the param delimiter, or the end of string.
+		for (keyEnd = c; keyEnd < paramEnd; ++keyEnd) if (*keyEnd == keyValueDelimiter) break; // Find the key value delimiter, or the end of the param.
+
+		HttpParamRef ref;
+		ref.keyPos = c - begin; ref.keyLength = keyEnd - c;
+		ref.keyEncoded = memchr(c, '%', ref.keyLength) != 0;
+		if (keyEnd < paramEnd)
+		{
+			// Key-value pair.
+			ref.valuePos = keyEnd + 1 - begin; ref.valueLength = paramEnd - (keyEnd + 1);
+			ref.valueEncoded = memchr(keyEnd + 1, '%', ref.valueLength) != 0;
+		}
+		else
 		{
-			const char *paramEnd, *keyEnd;
-			for (paramEnd = c; paramEnd < cE; ++paramEnd) if (*paramEnd == paramDelimiter) break; // Find the param delimiter, or the end of string.
-			for (keyEnd = c; keyEnd < paramEnd; ++keyEnd) if (*keyEnd == keyValueDelimiter) break; // Find the key value delimiter, or the end of the param.
+			// Key without value.
+			ref.valuePos = -1; ref.valueLength = 0; ref.valueEncoded = false;
+		}
+		_requestParamRefs.append(ref);
+		c = paramEnd + 1;
+	}
+}
 
-			if (keyEnd < paramEnd)
-			{
-				// Key-value pair.
-				d_ptr->_requestParams << HttpParam(percentDecode(c, keyEnd - c), percentDecode(keyEnd + 1, paramEnd - (keyEnd + 1)));
-			}
-			else
-			{
-				// Key without value.
-				d_ptr->_requestParams << HttpParam(percentDecode(c, paramEnd - c), QString());
-			}
-			c = paramEnd + 1;
+inline int Pillow::HttpConnectionPrivate::findRequestParamRef(const char* name, int nameLength)
+{
+	indexRequestParams();
+	const char* query = _requestQueryString.constData();
+	for (int i = 0, iE = _requestParamRefs.size(); i < iE; ++i)
+	{
+		const HttpParamRef& ref = _requestParamRefs.at(i);
+		if (!ref.keyEncoded)
+		{
+			// Compare the raw bytes straight from the query string.
+			if (asciiEqualsCaseInsensitive(query + ref.keyPos, ref.keyLength, name, nameLength))
+				return i;
+		}
+		else if (ref.keyLength >= nameLength) // Decoding can only make the key shorter.
+		{
+			QVarLengthArray<char, 128> key(ref.keyLength);
+			memcpy(key.data(), query + ref.keyPos, ref.keyLength);
+			if (asciiEqualsCaseInsensitive(key.constData(), percentDecodeInPlace(key.data(), ref.keyLength), name, nameLength))
+				return i;
 		}
 	}
-	return d_ptr->_requestParams;
+	return -1;
 }
 
-QString Pillow::HttpConnection::requestParamValue(const QString &name)
+inline int Pillow::HttpConnectionPrivate::findSetRequestParam(const QString& name) const
 {
-	requestParams();
-	for (int i = 0, iE = d_ptr->_requestParams.size(); i < iE; ++i)
+	for (int i = 0, iE = _requestParams.size(); i < iE; ++i)
 	{
-		const HttpParam& param = d_ptr->_requestParams.at(i);
-		if (param.first.compare(name, Qt::CaseInsensitive) == 0)
-			return param.second;
+		if (_requestParams.at(i).first.compare(name, Qt::CaseInsensitive) == 0)
+			return i;
 	}
-	return QString();
+	return -1;
 }
 
-void Pillow::HttpConnection::setRequestParam(const QString &name, const QString &value)
+const Pillow::HttpParamCollection& Pillow::HttpConnection::requestParams()
 {
-	requestParams();
-	for (int i = 0, iE = d_ptr->_requestParams.size(); i < iE; ++i)
+	if (!d_ptr->_requestParamsParsed)
 	{
-		const HttpParam& param = d_ptr->_requestParams.at(i);
-		if (param.first.compare(name, Qt::CaseInsensitive) == 0)
+		// Decode all the params from the query string, then re-apply those set by setRequestParam over them.
+		d_ptr->_requestParamsParsed = true;
+		Pillow::HttpParamCollection setParams = d_ptr->_requestParams;
+		d_ptr->_requestParams.clear();
+
+		d_ptr->indexRequestParams();
+		const char* query = d_ptr->_requestQueryString.constData();
+		for (int i = 0, iE = d_ptr->_requestParamRefs.size(); i < iE; ++i)
 		{
-			d_ptr->_requestParams[i] = HttpParam(name, value);
-			return;
+			const HttpParamRef& ref = d_ptr->_requestParamRefs.at(i);
+			d_ptr->_requestParams << HttpParam(percentDecode(query + ref.keyPos, ref.keyLength),
+											   ref.valuePos < 0 ? QString() : percentDecode(query + ref.valuePos, ref.valueLength));
 		}
+
+		for (int i = 0, iE = setParams.size(); i < iE; ++i)
+			setRequestParam(setParams.at(i).first, setParams.at(i).second);
+	}
+	return d_ptr->_requestParams;
+}
+
+QString Pillow::HttpConnection::requestParamValue(const QString &name)
+{
+	int index = d_ptr->findSetRequestParam(name);
+	if (index >= 0 || d_ptr->_requestParamsParsed)
+		return index >= 0 ? d_ptr->_requestParams.at(index).second : QString();
+
+	// Look up the raw query string, and only decode the value that was asked for.
+	const QByteArray utf8Name = name.toUtf8();
+	index = d_ptr->findRequestParamRef(utf8Name.constData(), utf8Name.size());
+	if (index < 0) return QString();
+	const HttpParamRef& ref = d_ptr->_requestParamRefs.at(index);
+	return ref.valuePos < 0 ? QString() : percentDecode(d_ptr->_requestQueryString.constData() + ref.valuePos, ref.valueLength);
+}
+
+QByteArray Pillow::HttpConnection::requestParamValueBytes(const char *name, int nameLength)
+{
+	if (!d_ptr->_requestParams.isEmpty())
+	{
+		int index = d_ptr->findSetRequestParam(QString::fromUtf8(name, nameLength));
+		if (index >= 0 || d_ptr->_requestParamsParsed)
+			return index >= 0 ? d_ptr->_requestParams.at(index).second.toUtf8() : QByteArray();
 	}
-	d_ptr->_requestParams << HttpParam(name, value);
+
+	int index = d_ptr->findRequestParamRef(name, nameLength);
+	if (index < 0) return QByteArray();
+	const HttpParamRef& ref = d_ptr->_requestParamRefs.at(index);
+	if (ref.valuePos < 0) return QByteArray();
+
+	const char* value = d_ptr->_requestQueryString.constData() + ref.valuePos;
+	if (!ref.valueEncoded)
+		return QByteArray::fromRawData(value, ref.valueLength);
+
+	QByteArray decodedValue(value, ref.valueLength);
+	decodedValue.resize(percentDecodeInPlace(decodedValue.data(), decodedValue.size()));
+	return decodedValue;
+}
+
+void Pillow::HttpConnection::setRequestParam(const QString &name, const QString &value)
+{
+	// Until all params get parsed, _requestParams only holds those that were set.
+	int index = d_ptr->findSetRequestParam(name);
+	if (index >= 0)
+		d_ptr->_requestParams[index] = HttpParam(name, value);
+	else
+		d_ptr->_requestParams << HttpParam(name, value);
 }
 
 QHostAddress Pillow::HttpConnection::remoteAddress() const
@@ -806,6 +1425,41 @@ const QByteArray &Pillow::HttpConnection::requestContent() const
 	return d_ptr->_requestContent;
 }
 
+qint64 Pillow::HttpConnection::requestContentLength() const
+{
+	return d_ptr->_requestContentLength;
+}
+
+bool Pillow::HttpConnection::isRequestContentStreamed() const
+{
+	return d_ptr->_requestContentStreamed;
+}
+
+void Pillow::HttpConnection::setRequestContentStreamed(bool streamed)
+{
+	if (d_ptr->_state != ReceivingContent || d_ptr->_requestContentBytesReceived > 0)
+	{
+		qWarning() << "HttpConnection::setRequestContentStreamed: can only be called from a requestHeadersReady handler.";
+		return;
+	}
+	d_ptr->_requestContentStreamed = streamed;
+}
+
+bool Pillow::HttpConnection::isRequestContentPaused() const
+{
+	return d_ptr->_requestContentPaused;
+}
+
+void Pillow::HttpConnection::setRequestContentPaused(bool paused)
+{
+	if (paused && (d_ptr->_state != ReceivingContent || !d_ptr->_requestContentStreamed))
+	{
+		qWarning() << "HttpConnection::setRequestContentPaused: can only pause streamed content while it is being received.";
+		return;
+	}
+	d_ptr->setRequestContentPaused(paused);
+}
+
 const Pillow::HttpHeaderCollection &Pillow::HttpConnection::requestHeaders() const
 {
 	return d_ptr->_requestHeaders;
@@ -21,6 +21,33 @@ namespace Pillow
 	typedef QVector<HttpParam> HttpParamCollection;
 	class HttpConnectionPrivate;
 
+	//
+	// HttpPreparedResponse
+	//
+	// A response that never changes, serialized once so that it can be sent with a single write.
+	// Only the Http version of the status line and the Connection header are adjusted for each request.
+	// The Content-Length header is always computed from the content; Transfer-Encoding headers are ignored.
+	//
+
+	class PILLOWCORE_EXPORT HttpPreparedResponse
+	{
+		int _statusCode;
+		Pillow::HttpHeaderCollection _headers;
+		QByteArray _content;
+		QByteArray _head; // Status line without the Http version, and headers without the Connection header and the final empty line.
+		bool _closesConnection;
+
+	public:
+		HttpPreparedResponse(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QByteArray& content = QByteArray());
+
+		inline int statusCode() const { return _statusCode; }
+		inline const Pillow::HttpHeaderCollection& headers() const { return _headers; }
+		inline const QByteArray& content() const { return _content; }
+
+		inline const QByteArray& head() const { return _head; }
+		inline bool closesConnection() const { return _closesConnection; } // Whether the headers include "Connection: close".
+	};
+
 	//
 	// HttpConnection
 	//
@@ -45,6 +72,8 @@ namespace Pillow
 		enum State { Uninitialized, ReceivingHeaders, ReceivingContent, SendingHeaders, SendingContent, Completed, Flushing, Closed };
 		enum { MaximumRequestHeaderLength = 32 * 1024 };
 		enum { MaximumRequestContentLength = 128 * 1024 * 1024 };
+		enum { DefaultWriteBufferLowWatermark = 128 * 1024, DefaultWriteBufferHighWatermark = 512 * 1024 };
+		enum Timestamp { FirstByteReceived, HeadersReceived, ContentReceived, HeadersWritten, LastByteWritten, OutputFlushed, TimestampCount };
 		Q_ENUMS(State);
 
 	public:
@@ -68,6 +97,19 @@ namespace Pillow
 		const QByteArray& requestQueryString() const;
 		const QByteArray& requestHttpVersion() const;
 		const QByteArray& requestContent() const;
+		qint64 requestContentLength() const;
+
+		// Request content streaming. Calling setRequestContentStreamed(true) from a requestHeadersReady handler hands the content
+		// over through requestContentReceived as it arrives, in bounded chunks, rather than buffering it for requestContent(), which
+		// then remains empty. Streamed content is not subject to MaximumRequestContentLength.
+		bool isRequestContentStreamed() const;
+		void setRequestContentStreamed(bool streamed);
+
+		// Streamed content flow control. While paused, the connection stops reading the content and lets the input device
+		// buffer no more than a chunk of it, so that the client gets throttled by TCP flow control. For consumers that cannot
+		// keep up, such as a proxied upload, to bound their memory. Cleared when the next request starts.
+		bool isRequestContentPaused() const;
+		void setRequestContentPaused(bool paused);
 
 		// Request members, decoded version. Use those rather than manually decoding the raw data returned by the methods
 		// above when decoded values are desired (they are cached).
@@ -80,10 +122,17 @@ namespace Pillow
 		// or closed() signals are emitted.
 		Q_INVOKABLE const Pillow::HttpHeaderCollection& requestHeaders() const;
 		Q_INVOKABLE const QByteArray & requestHeaderValue(const QByteArray& field);
+		const QByteArray & requestHeaderValue(Pillow::HttpHeaderId::Id fieldId) const; // Constant time lookup of well-known headers.
 
-		// Request params.
+		// Request params. Params are looked up in the raw query string and only the requested value is decoded;
+		// requestParams() decodes them all. Names are case insensitive (ASCII only when looked up in the query string).
 		const Pillow::HttpParamCollection& requestParams();
 		Q_INVOKABLE QString requestParamValue(const QString& name);
+		// The decoded UTF-8 bytes of a param value. Unless the value contains percent-encoded sequences, the returned
+		// QByteArray refers to the request data without copying it: it is not null-terminated and, as for the request
+		// members above, remains valid until either the requestCompleted() or closed() signals are emitted.
+		QByteArray requestParamValueBytes(const char* name, int nameLength);
+		inline QByteArray requestParamValueBytes(const QByteArray& name) { return requestParamValueBytes(name.constData(), name.size()); }
 		Q_INVOKABLE void setRequestParam(const QString& name, const QString& value);
 
 	public slots:
@@ -93,23 +142,68 @@ namespace Pillow
 		void writeHeaders(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection());
 		void writeContent(const QByteArray& content);
 		void endContent();
+		void writePreparedResponse(const Pillow::HttpPreparedResponse& response);
+
+		// Write content that already went through the response's transfer encoding: a chunk with its framing when
+		// isResponseChunked(), the bare content otherwise. contentSize is the size of the content before framing.
+		// Lets one buffer, encoded once, be written as is to many connections (see Pillow::HttpEventChannel).
+		void writeEncodedContent(const QByteArray& encodedContent, qint64 contentSize);
 
 		void flush();
 		void close(); // Close communication channels right away, no matter if a response was sent or not.
+		void closeWhenIdle(); // Close once the current request is answered, rather than keeping the connection alive. Right away when waiting for a request.
+
+		// Switch the connection to another protocol, such as WebSocket. Sends a 101 Switching Protocols response with the
+		// given headers, then lets go of the devices without closing them: requestCompleted and closed get emitted and the
+		// server no longer touches the devices. Grab inputDevice() and outputDevice() before calling. Returns the data
+		// the client sent after the request, which was already read from the input device.
+		QByteArray upgrade(const Pillow::HttpHeaderCollection& headers);
+		// Same, for protocols that switch without a response (such as an Http/2 connection preface): the devices are let go as is.
+		QByteArray upgrade();
+
+		// Output flow control. Once the output device buffers highWatermark bytes or more, canWrite() returns false and
+		// writeBufferFull is emitted. Producers writing content should then wait for writeBufferDrained, emitted once the
+		// device drained to lowWatermark bytes, rather than keep writing. The watermarks are kept across requests.
+		bool canWrite() const;
+		qint64 writeBufferSize() const; // Number of bytes the output device has yet to send.
+		qint64 writeBufferLowWatermark() const;
+		qint64 writeBufferHighWatermark() const;
+		void setWriteBufferWatermarks(qint64 lowWatermark, qint64 highWatermark);
 
 		// Information about the currentlly outgoing response. Valid between a call to writeHeaders until
 		// the requestCompleted signal is emitted.
 		int responseStatusCode() const;
 		qint64 responseContentLength() const;
+		qint64 responseContentBytesSent() const; // Content bytes written so far, without the chunked encoding framing.
+		bool isResponseChunked() const; // Whether the response content is sent with the chunked transfer encoding.
+
+	public:
+		// Request timing. When the current request reached each phase, in microseconds on the monotonic clock of now(); 0 for
+		// the phases it did not reach yet. They remain readable after requestCompleted, until the next request starts arriving.
+		// OutputFlushed comes once the output device has handed the whole response over, which may be after requestCompleted.
+		qint64 timestamp(Timestamp phase) const;
+		static qint64 now();
+
+		// Whether responses get a Server-Timing header with the durations, in milliseconds, of receiving the headers ("headers"),
+		// receiving the content ("content") and handling the request until the response headers ("handler"). Disabled by default.
+		// Kept across requests until the connection gets initialized again.
+		bool isServerTimingEnabled() const;
+		void setServerTimingEnabled(bool enabled);
 
 	signals:
+		void requestHeadersReady(Pillow::HttpConnection* self); // The request headers have been received, but not yet the content. Only emitted for requests that have content.
+		void requestContentReceived(Pillow::HttpConnection* self, const QByteArray& data); // A chunk of streamed content. The data is only valid during the emission.
 		void requestReady(Pillow::HttpConnection* self);     // The request is ready to be processed, all request headers and content have been received.
 		void requestCompleted(Pillow::HttpConnection* self); // The response is completed, all response headers and content have been sent.
 		void closed(Pillow::HttpConnection* self);			 // The connection is closing, no further requests will arrive on this object.
+		void writeBufferFull(Pillow::HttpConnection* self);    // The output device buffers at least the high watermark. Stop writing content.
+		void writeBufferDrained(Pillow::HttpConnection* self); // The output device drained to the low watermark after being full. Writing can resume.
 
 	private slots:
 		void processInput();
 		void drain();
+		void checkWriteBuffer();
+		void checkOutputFlushed();
 
 	private:
 		Q_DECLARE_PRIVATE(HttpConnection)
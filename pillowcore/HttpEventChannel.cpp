@@ -0,0 +1,190 @@
+#include "HttpEventChannel.h"
+#include "HttpConnection.h"
+#include "HttpHeader.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QDebug>
+using namespace Pillow;
+
+namespace
+{
+	// A field value may not span lines: keep what comes before the first line break.
+	inline void appendField(QByteArray& target, const char* name, int nameLength, const QByteArray& value)
+	{
+		int length = 0;
+		while (length < value.size() && value.at(length) != '\n' && value.at(length) != '\r') ++length;
+		target.append(name, nameLength).append(value.constData(), length).append('\n');
+	}
+
+	inline QByteArray chunk(const QByteArray& payload)
+	{
+		QByteArray result; result.reserve(payload.size() + 12);
+		Pillow::ByteArrayHelpers::appendNumber<int, 16>(result, payload.size());
+		result.append("\r\n", 2).append(payload).append("\r\n", 2);
+		return result;
+	}
+
+	inline QByteArray chunkPayload(const QByteArray& encodedEvent)
+	{
+		const int headerSize = encodedEvent.indexOf('\n') + 1;
+		return QByteArray::fromRawData(encodedEvent.constData() + headerSize, encodedEvent.size() - headerSize - 2);
+	}
+}
+
+//
+// HttpEventChannel
+//
+
+HttpEventChannel::HttpEventChannel(QObject* parent)
+	: QObject(parent), _slowSubscriberPolicy(DropSlowSubscribers), _maximumBacklog(DefaultMaximumBacklog),
+	  _droppedSubscriberCount(0), _skippedEventCount(0), _broadcasting(false)
+{
+}
+
+HttpEventChannel::~HttpEventChannel()
+{
+	foreach (HttpConnection* connection, _subscribers)
+		if (connection) disconnect(connection, 0, this, 0);
+}
+
+bool HttpEventChannel::subscribe(Pillow::HttpConnection* connection)
+{
+	if (connection->state() != HttpConnection::SendingHeaders)
+	{
+		qWarning() << "HttpEventChannel::subscribe: the connection is not in the SendingHeaders state.";
+		return false;
+	}
+
+	HttpHeaderCollection headers; headers.reserve(3);
+	headers << HttpHeader("Content-Type", "text/event-stream") << HttpHeader("Cache-Control", "no-cache") << HttpHeader("Transfer-Encoding", "chunked");
+	connection->writeHeaders(200, headers);
+	if (connection->state() != HttpConnection::SendingContent) return false; // HEAD request.
+
+	_subscriberIndexes.insert(connection, _subscribers.size());
+	_subscribers.append(connection);
+	connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_closed(Pillow::HttpConnection*)));
+	return true;
+}
+
+void HttpEventChannel::unsubscribe(Pillow::HttpConnection* connection)
+{
+	if (!_subscriberIndexes.contains(connection)) return;
+	removeSubscriber(connection);
+	connection->endContent();
+}
+
+void HttpEventChannel::unsubscribeAll()
+{
+	const QVector<HttpConnection*> subscribers = _subscribers;
+	foreach (HttpConnection* connection, subscribers)
+		if (connection) unsubscribe(connection);
+}
+
+void HttpEventChannel::connection_closed(Pillow::HttpConnection* connection)
+{
+	removeSubscriber(connection);
+}
+
+void HttpEventChannel::removeSubscriber(Pillow::HttpConnection* connection)
+{
+	QHash<HttpConnection*, int>::iterator it = _subscriberIndexes.find(connection);
+	if (it == _subscriberIndexes.end()) return;
+	const int index = it.value();
+	_subscriberIndexes.erase(it);
+	disconnect(connection, 0, this, 0);
+
+	if (_broadcasting)
+	{
+		// Do not move subscribers around while iterating over them.
+		_subscribers[index] = 0;
+	}
+	else
+	{
+		HttpConnection* last = _subscribers.last();
+		_subscribers.removeLast();
+		if (last != connection)
+		{
+			_subscribers[index] = last;
+			_subscriberIndexes[last] = index;
+		}
+	}
+}
+
+QByteArray HttpEventChannel::encodeEvent(const QByteArray& data, const QByteArray& event, const QByteArray& id)
+{
+	QByteArray payload; payload.reserve(data.size() + event.size() + id.size() + 32);
+	if (!event.isEmpty()) appendField(payload, "event: ", 7, event);
+	if (!id.isEmpty()) appendField(payload, "id: ", 4, id);
+
+	const char* p = data.constData(), *e = p + data.size();
+	for (;;)
+	{
+		const char* lineEnd = p;
+		while (lineEnd < e && *lineEnd != '\n' && *lineEnd != '\r') ++lineEnd;
+		payload.append("data: ", 6).append(p, int(lineEnd - p)).append('\n');
+		if (lineEnd == e) break;
+		p = lineEnd + ((*lineEnd == '\r' && lineEnd + 1 < e && lineEnd[1] == '\n') ? 2 : 1);
+	}
+	payload.append('\n'); // End of the event.
+	return chunk(payload);
+}
+
+void HttpEventChannel::send(const QByteArray& data, const QByteArray& event, const QByteArray& id)
+{
+	broadcast(encodeEvent(data, event, id));
+}
+
+void HttpEventChannel::sendComment(const QByteArray& comment)
+{
+	QByteArray payload; payload.reserve(comment.size() + 3);
+	appendField(payload, ": ", comment.isEmpty() ? 1 : 2, comment);
+	broadcast(chunk(payload));
+}
+
+void HttpEventChannel::broadcast(const QByteArray& encodedEvent)
+{
+	if (_subscribers.isEmpty()) return;
+
+	const QByteArray payload = chunkPayload(encodedEvent); // For subscribers that do not get a chunked response (Http/1.0).
+	const qint64 payloadSize = payload.size();
+	bool hasRemovedSubscribers = false;
+
+	_broadcasting = true;
+	for (int i = 0, iE = _subscribers.size(); i < iE; ++i)
+	{
+		HttpConnection* connection = _subscribers.at(i);
+		if (connection == 0) { hasRemovedSubscribers = true; continue; }
+
+		if (connection->writeBufferSize() > _maximumBacklog)
+		{
+			if (_slowSubscriberPolicy == SkipSlowSubscribers)
+			{
+				++_skippedEventCount;
+				continue;
+			}
+
+			++_droppedSubscriberCount;
+			removeSubscriber(connection);
+			hasRemovedSubscribers = true;
+			emit subscriberDropped(connection);
+			connection->close();
+			continue;
+		}
+
+		connection->writeEncodedContent(connection->isResponseChunked() ? encodedEvent : payload, payloadSize);
+	}
+	_broadcasting = false;
+
+	if (hasRemovedSubscribers || _subscribers.size() != _subscriberIndexes.size())
+	{
+		// Compact, keeping the order.
+		int count = 0;
+		for (int i = 0, iE = _subscribers.size(); i < iE; ++i)
+		{
+			HttpConnection* connection = _subscribers.at(i);
+			if (connection == 0) continue;
+			if (count != i) { _subscribers[count] = connection; _subscriberIndexes[connection] = count; }
+			++count;
+		}
+		_subscribers.resize(count);
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef PILLOW_HTTPEVENTCHANNEL_H
+#define PILLOW_HTTPEVENTCHANNEL_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QVECTOR_H
+#include <QtCore/QVector>
+#endif // QVECTOR_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+
+namespace Pillow
+{
+	class HttpConnection;
+
+	//
+	// Pillow::HttpEventChannel
+	//
+	// Broadcasts Server-Sent Events (text/event-stream) to any number of subscribed connections.
+	// Each event is encoded once, along with its chunk framing, into a single buffer that is then
+	// written as is to every subscriber: the cost per subscriber is one write into its output buffer.
+	//
+	// Subscribers whose output buffer holds more than maximumBacklog bytes when an event is sent are
+	// either dropped or skipped for that event, depending on the slowSubscriberPolicy.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpEventChannel : public QObject
+	{
+		Q_OBJECT
+		Q_ENUMS(SlowSubscriberPolicy)
+		Q_PROPERTY(int subscriberCount READ subscriberCount)
+		Q_PROPERTY(qint64 maximumBacklog READ maximumBacklog WRITE setMaximumBacklog)
+
+	public:
+		enum SlowSubscriberPolicy { DropSlowSubscribers, SkipSlowSubscribers };
+		enum { DefaultMaximumBacklog = 1024 * 1024 };
+
+	public:
+		HttpEventChannel(QObject* parent = 0);
+		~HttpEventChannel();
+
+		// Start the event stream on a connection, which must be in the SendingHeaders state (usually from a requestReady handler).
+		// Returns false if the connection could not be subscribed.
+		bool subscribe(Pillow::HttpConnection* connection);
+		// End the event stream of a subscribed connection. The connection may then serve further requests.
+		void unsubscribe(Pillow::HttpConnection* connection);
+		inline bool isSubscribed(Pillow::HttpConnection* connection) const { return _subscriberIndexes.contains(connection); }
+		inline int subscriberCount() const { return _subscriberIndexes.size(); }
+
+		inline SlowSubscriberPolicy slowSubscriberPolicy() const { return _slowSubscriberPolicy; }
+		inline void setSlowSubscriberPolicy(SlowSubscriberPolicy policy) { _slowSubscriberPolicy = policy; }
+		inline qint64 maximumBacklog() const { return _maximumBacklog; }
+		inline void setMaximumBacklog(qint64 bytes) { _maximumBacklog = bytes; }
+
+		// Statistics.
+		inline qint64 droppedSubscriberCount() const { return _droppedSubscriberCount; }
+		inline qint64 skippedEventCount() const { return _skippedEventCount; } // Number of times an event was not sent to a slow subscriber.
+
+		// Encode an event as text/event-stream, along with its chunk framing. Lines of data are split on "\n", "\r\n" and "\r".
+		static QByteArray encodeEvent(const QByteArray& data, const QByteArray& event = QByteArray(), const QByteArray& id = QByteArray());
+
+	public slots:
+		void send(const QByteArray& data, const QByteArray& event = QByteArray(), const QByteArray& id = QByteArray());
+		void sendComment(const QByteArray& comment = QByteArray()); // Clients ignore comments; useful to keep idle connections alive.
+		void unsubscribeAll();
+
+	signals:
+		void subscriberDropped(Pillow::HttpConnection* connection); // A slow subscriber got dropped. The connection is closing.
+
+	private slots:
+		void connection_closed(Pillow::HttpConnection* connection);
+
+	private:
+		void broadcast(const QByteArray& encodedEvent);
+		void removeSubscriber(Pillow::HttpConnection* connection);
+
+	private:
+		QVector<Pillow::HttpConnection*> _subscribers;        // Null entries are removed at the end of a broadcast.
+		QHash<Pillow::HttpConnection*, int> _subscriberIndexes; // Index of each subscriber in _subscribers.
+		SlowSubscriberPolicy _slowSubscriberPolicy;
+		qint64 _maximumBacklog;
+		qint64 _droppedSubscriberCount, _skippedEventCount;
+		bool _broadcasting;
+	};
+}
+
+#endif // PILLOW_HTTPEVENTCHANNEL_H
@@ -4,7 +4,6 @@
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QCryptographicHash>
-#include <QtCore/QElapsedTimer>
 #include <QtCore/QDateTime>
 #include <QtCore/QStringBuilder>
 #include <QtNetwork/QTcpSocket>
@@ -46,7 +45,7 @@ bool HttpHandlerStack::handleRequest(Pillow::HttpConnection *connection)
 //
 
 HttpHandlerFixed::HttpHandlerFixed(int statusCode, const QByteArray& content, QObject *parent)
-	:HttpHandler(parent), _statusCode(statusCode), _content(content)
+	:HttpHandler(parent), _statusCode(statusCode), _content(content), _response(statusCode, HttpHeaderCollection(), content)
 {
 }
 
@@ -54,6 +53,7 @@ void Pillow::HttpHandlerFixed::setStatusCode(int statusCode)
 {
 	if (_statusCode == statusCode) return;
 	_statusCode = statusCode;
+	_response = HttpPreparedResponse(_statusCode, HttpHeaderCollection(), _content);
 	emit changed();
 }
 
@@ -61,12 +61,13 @@ void Pillow::HttpHandlerFixed::setContent(const QByteArray &content)
 {
 	if (_content == content) return;
 	_content = content;
+	_response = HttpPreparedResponse(_statusCode, HttpHeaderCollection(), _content);
 	emit changed();
 }
 
 bool HttpHandlerFixed::handleRequest(Pillow::HttpConnection *connection)
 {
-	connection->writeResponse(_statusCode, HttpHeaderCollection(), _content);
+	connection->writePreparedResponse(_response);
 	return true;
 }
 
@@ -133,21 +134,40 @@ HttpHandlerLog::HttpHandlerLog(QIODevice *device, QObject *parent)
 
 HttpHandlerLog::~HttpHandlerLog()
 {
-	foreach (QElapsedTimer* timer, _requestTimerMap)
-		delete timer;
+}
+
+namespace
+{
+	inline double milliseconds(qint64 from, qint64 to)
+	{
+		return from > 0 && to >= from ? (to - from) / 1000.0 : 0.0;
+	}
+
+	// Where the time of a request went, from the timestamps of its connection.
+	QString phaseDurations(Pillow::HttpConnection* connection)
+	{
+		const qint64 firstByteReceived = connection->timestamp(HttpConnection::FirstByteReceived);
+		const qint64 headersReceived = connection->timestamp(HttpConnection::HeadersReceived);
+		const qint64 contentReceived = connection->timestamp(HttpConnection::ContentReceived);
+		const qint64 headersWritten = connection->timestamp(HttpConnection::HeadersWritten);
+		const qint64 lastByteWritten = connection->timestamp(HttpConnection::LastByteWritten);
+		return QString("headers=%1 content=%2 handler=%3 send=%4")
+				.arg(milliseconds(firstByteReceived, headersReceived), 0, 'f', 3)
+				.arg(milliseconds(headersReceived, contentReceived), 0, 'f', 3)
+				.arg(milliseconds(contentReceived, headersWritten), 0, 'f', 3)
+				.arg(milliseconds(headersWritten, lastByteWritten), 0, 'f', 3);
+	}
 }
 
 bool HttpHandlerLog::handleRequest(Pillow::HttpConnection *connection)
 {
-	QElapsedTimer* timer = _requestTimerMap.value(connection, NULL);
-	if (timer == NULL)
+	if (!_connections.contains(connection))
 	{
-		timer = _requestTimerMap[connection] = new QElapsedTimer();
+		_connections.insert(connection);
 		connect(connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(requestCompleted(Pillow::HttpConnection*)));
 		connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(requestClosed(Pillow::HttpConnection*)));
 		connect(connection, SIGNAL(destroyed(QObject*)), this, SLOT(requestDestroyed(QObject*)));
 	}
-	timer->start();
 
 	if (_mode == LogCompletedRequests)
 	{
@@ -168,18 +188,18 @@ bool HttpHandlerLog::handleRequest(Pillow::HttpConnection *connection)
 
 void HttpHandlerLog::requestCompleted(Pillow::HttpConnection *connection)
 {
-	QElapsedTimer* timer = _requestTimerMap.value(connection, NULL);
-	if (timer)
+	if (_connections.contains(connection))
 	{
-		const char* formatString = (_mode == LogCompletedRequests) ? "%1 - - [%2] \"%3 %4 %5\" %6 %7 %8" : "[ END ] %1 - - [%2] \"%3 %4 %5\" %6 %7 %8";
+		const char* formatString = (_mode == LogCompletedRequests) ? "%1 - - [%2] \"%3 %4 %5\" %6 %7 %8 %9" : "[ END ] %1 - - [%2] \"%3 %4 %5\" %6 %7 %8 %9";
 
-		qint64 elapsed = timer->elapsed();
+		const double elapsed = milliseconds(connection->timestamp(HttpConnection::FirstByteReceived), connection->timestamp(HttpConnection::LastByteWritten));
 		QString logEntry = QString(formatString)
 				.arg(connection->remoteAddress().toString())
 				.arg(QDateTime::currentDateTime().toString("dd/MMM/yyyy hh:mm:ss"))
 				.arg(QString(connection->requestMethod())).arg(QString(connection->requestUri())).arg(QString(connection->requestHttpVersion()))
 				.arg(connection->responseStatusCode()).arg(connection->responseContentLength())
-				.arg(elapsed / 1000.0, 3, 'f', 3);
+				.arg(elapsed / 1000.0, 3, 'f', 3)
+				.arg(phaseDurations(connection));
 
 		log(logEntry);
 	}
@@ -187,12 +207,11 @@ void HttpHandlerLog::requestCompleted(Pillow::HttpConnection *connection)
 
 void HttpHandlerLog::requestClosed(HttpConnection *connection)
 {
-	QElapsedTimer* timer = _requestTimerMap.value(connection, NULL);
-	if (timer && _mode == TraceRequests)
+	if (_connections.contains(connection) && _mode == TraceRequests)
 	{
 		const char* formatString = "[CLOSE] %1 - - [%2] \"%3 %4 %5\" %6 %7 %8";
 
-		qint64 elapsed = timer->elapsed();
+		const double elapsed = milliseconds(connection->timestamp(HttpConnection::FirstByteReceived), HttpConnection::now());
 		QString logEntry = QString(formatString)
 				.arg(connection->remoteAddress().toString())
 				.arg(QDateTime::currentDateTime().toString("dd/MMM/yyyy hh:mm:ss"))
@@ -206,9 +225,7 @@ void HttpHandlerLog::requestClosed(HttpConnection *connection)
 
 void HttpHandlerLog::requestDestroyed(QObject *r)
 {
-	HttpConnection* connection = static_cast<HttpConnection*>(r);
-	delete _requestTimerMap.value(connection, NULL);
-	_requestTimerMap.remove(connection);
+	_connections.remove(static_cast<HttpConnection*>(r));
 }
 
 void HttpHandlerLog::log(const QString &entry)
@@ -355,23 +372,25 @@ HttpHandlerFileTransfer::HttpHandlerFileTransfer(QIODevice *sourceDevice, HttpCo
 	connect(_connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(deleteLater()));
 	connect(_connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(deleteLater()));
 	connect(_connection, SIGNAL(destroyed()), this, SLOT(deleteLater()));
-	connect(_connection->outputDevice(), SIGNAL(bytesWritten(qint64)), this, SLOT(writeNextPayload()), Qt::QueuedConnection);
+	connect(_connection, SIGNAL(writeBufferDrained(Pillow::HttpConnection*)), this, SLOT(writeNextPayload()), Qt::QueuedConnection);
 }
 
 void HttpHandlerFileTransfer::writeNextPayload()
 {
 	if (_sourceDevice == NULL || _connection == NULL || _connection->outputDevice() == NULL) return;
 
-	qint64 bytesToRead = _bufferSize - _connection->outputDevice()->bytesToWrite();
-	if (bytesToRead <= 0) return;
-	qint64 bytesAvailable = _sourceDevice->size() - _sourceDevice->pos();
-	if (bytesToRead > bytesAvailable) bytesToRead = bytesAvailable;
-
-	if (bytesToRead > 0)
+	// Write until the connection's output buffer is full, then wait for it to drain.
+	while (_connection->canWrite() && _connection->state() == HttpConnection::SendingContent)
 	{
+		qint64 bytesToRead = qMin<qint64>(_bufferSize, _sourceDevice->size() - _sourceDevice->pos());
+		if (bytesToRead <= 0) break;
+
 		_connection->writeContent(_sourceDevice->read(bytesToRead));
 
 		if (_sourceDevice->atEnd())
+		{
 			emit finished();
+			break;
+		}
 	}
 }
@@ -13,12 +13,17 @@
 #ifndef QHASH_H
 #include <QtCore/QHash>
 #endif // QHASH_H
+#ifndef QSET_H
+#include <QtCore/QSet>
+#endif // QSET_H
+#ifndef PILLOW_HTTPCONNECTION_H
+#include "HttpConnection.h"
+#endif // PILLOW_HTTPCONNECTION_H
 #ifdef Q_COMPILER_LAMBDA
 #include <functional>
 #endif // Q_COMPILER_LAMBDA
 
 class QIODevice;
-class QElapsedTimer;
 
 namespace Pillow
 {
@@ -67,6 +72,7 @@ namespace Pillow
 	private:
 		int _statusCode;
 		QByteArray _content;
+		Pillow::HttpPreparedResponse _response;
 
 	public:
 		HttpHandlerFixed(int statusCode = 200, const QByteArray& content = QByteArray(), QObject* parent = 0);
@@ -125,7 +131,8 @@ namespace Pillow
 	};
 
 	//
-	// HttpHandlerLog: a handler that logs requests.
+	// HttpHandlerLog: a handler that logs requests. Completed requests end with their total time, in seconds, and where it went,
+	// in milliseconds (see HttpConnection::timestamp): receiving the headers, the content, handling and sending the response.
 	//
 
 	class PILLOWCORE_EXPORT HttpHandlerLog : public HttpHandler
@@ -163,7 +170,7 @@ namespace Pillow
 		void log(const QString& entry);
 
 	private:
-		QHash<Pillow::HttpConnection*, QElapsedTimer*> _requestTimerMap;
+		QSet<Pillow::HttpConnection*> _connections;
 		Mode _mode;
 		QPointer<QIODevice> _device;
 	};
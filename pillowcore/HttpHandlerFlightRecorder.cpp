@@ -0,0 +1,206 @@
+#include "HttpHandlerFlightRecorder.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QtAlgorithms>
+#include <QtCore/QMetaType>
+using namespace Pillow;
+
+namespace
+{
+	// The value of connections whose current request did not go through the recorder.
+	const int NotThroughRecorder = -2;
+
+	inline QByteArray milliseconds(qint64 from, qint64 to)
+	{
+		return QByteArray::number(from > 0 && to >= from ? (to - from) / 1000.0 : 0.0, 'f', 3);
+	}
+
+	bool slowerThan(const HttpFlightRecord& r1, const HttpFlightRecord& r2)
+	{
+		return r1.duration() > r2.duration();
+	}
+
+	inline bool isWithin(const HttpFlightRecord& record, qint64 now, qint64 window)
+	{
+		return now - record.timestamps[HttpConnection::LastByteWritten] <= window;
+	}
+}
+
+//
+// HttpFlightRecord
+//
+
+HttpFlightRecord::HttpFlightRecord()
+	: statusCode(0), requestHeaderCount(0), requestHeaderBytes(0), requestContentBytes(0), responseContentBytes(0)
+{
+	for (int i = 0; i < HttpConnection::TimestampCount; ++i) timestamps[i] = 0;
+}
+
+QByteArray HttpFlightRecord::toByteArray() const
+{
+	QByteArray line;
+	line.append(milliseconds(timestamps[HttpConnection::FirstByteReceived], timestamps[HttpConnection::LastByteWritten])).append("ms ");
+	line.append(method).append(' ').append(uri).append(' ').append(QByteArray::number(statusCode));
+	line.append(" headers=").append(milliseconds(timestamps[HttpConnection::FirstByteReceived], timestamps[HttpConnection::HeadersReceived]));
+	line.append(" content=").append(milliseconds(timestamps[HttpConnection::HeadersReceived], timestamps[HttpConnection::ContentReceived]));
+	line.append(" handler=").append(milliseconds(timestamps[HttpConnection::ContentReceived], timestamps[HttpConnection::HeadersWritten]));
+	line.append(" send=").append(milliseconds(timestamps[HttpConnection::HeadersWritten], timestamps[HttpConnection::LastByteWritten]));
+	line.append(" requestHeaders=").append(QByteArray::number(requestHeaderCount)).append('/').append(QByteArray::number(requestHeaderBytes));
+	line.append(" requestContent=").append(QByteArray::number(requestContentBytes));
+	line.append(" responseContent=").append(QByteArray::number(responseContentBytes));
+	line.append(" handlers=").append(handlers.join(",").toUtf8());
+	return line;
+}
+
+//
+// HttpHandlerFlightRecorder
+//
+
+HttpHandlerFlightRecorder::HttpHandlerFlightRecorder(QObject* parent)
+	: HttpHandlerStack(parent), _capacity(DefaultCapacity), _threshold(qint64(DefaultThreshold) * 1000), _window(qint64(DefaultWindow) * 1000)
+{
+	qRegisterMetaType<Pillow::HttpFlightRecord>("Pillow::HttpFlightRecord");
+}
+
+void HttpHandlerFlightRecorder::setCapacity(int capacity)
+{
+	_capacity = qMax(1, capacity);
+	if (_records.size() > _capacity)
+	{
+		qSort(_records.begin(), _records.end(), slowerThan);
+		_records.resize(_capacity);
+	}
+}
+
+void HttpHandlerFlightRecorder::setThreshold(int milliseconds)
+{
+	_threshold = qMax(0, milliseconds) * qint64(1000);
+}
+
+void HttpHandlerFlightRecorder::setWindow(int milliseconds)
+{
+	_window = qMax(0, milliseconds) * qint64(1000);
+}
+
+void HttpHandlerFlightRecorder::setDumpPath(const QByteArray& dumpPath)
+{
+	_dumpPath = dumpPath;
+}
+
+QList<HttpFlightRecord> HttpHandlerFlightRecorder::records() const
+{
+	const qint64 now = HttpConnection::now();
+	QList<HttpFlightRecord> result;
+	foreach (const HttpFlightRecord& record, _records)
+		if (isWithin(record, now, _window)) result << record;
+	qSort(result.begin(), result.end(), slowerThan);
+	return result;
+}
+
+QByteArray HttpHandlerFlightRecorder::dump() const
+{
+	QByteArray result;
+	foreach (const HttpFlightRecord& record, records())
+		result.append(record.toByteArray()).append('\n');
+	return result;
+}
+
+void HttpHandlerFlightRecorder::clear()
+{
+	_records.clear();
+}
+
+bool HttpHandlerFlightRecorder::handleRequest(Pillow::HttpConnection* connection)
+{
+	if (!_dumpPath.isEmpty() && connection->requestPath() == _dumpPath && connection->requestMethod() == "GET")
+	{
+		connection->writeResponse(200, HttpHeaderCollection() << HttpHeader("Content-Type", "text/plain; charset=utf-8"), dump());
+		return true;
+	}
+
+	QHash<HttpConnection*, int>::iterator handlerIndex = _connections.find(connection);
+	if (handlerIndex == _connections.end())
+	{
+		handlerIndex = _connections.insert(connection, NotThroughRecorder);
+		connect(connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(requestCompleted(Pillow::HttpConnection*)));
+		connect(connection, SIGNAL(destroyed(QObject*)), this, SLOT(requestDestroyed(QObject*)));
+	}
+
+	// Set before trying each child: handlers that respond right away complete the request before returning.
+	const QObjectList& children = this->children();
+	for (int i = 0; i < children.size(); ++i)
+	{
+		HttpHandler* handler = qobject_cast<HttpHandler*>(children.at(i));
+		if (handler == 0) continue;
+		handlerIndex.value() = i;
+		if (handler->handleRequest(connection))
+			return true;
+	}
+
+	handlerIndex.value() = -1;
+	return false;
+}
+
+void HttpHandlerFlightRecorder::requestCompleted(Pillow::HttpConnection* connection)
+{
+	QHash<HttpConnection*, int>::iterator handlerIndex = _connections.find(connection);
+	if (handlerIndex == _connections.end() || handlerIndex.value() == NotThroughRecorder) return;
+	const int index = handlerIndex.value();
+	handlerIndex.value() = NotThroughRecorder;
+
+	const qint64 lastByteWritten = connection->timestamp(HttpConnection::LastByteWritten);
+	if (lastByteWritten - connection->timestamp(HttpConnection::FirstByteReceived) < _threshold) return;
+	record(connection, index, lastByteWritten);
+}
+
+void HttpHandlerFlightRecorder::requestDestroyed(QObject* connection)
+{
+	_connections.remove(static_cast<HttpConnection*>(connection));
+}
+
+void HttpHandlerFlightRecorder::record(Pillow::HttpConnection* connection, int handlerIndex, qint64 now)
+{
+	const qint64 duration = now - connection->timestamp(HttpConnection::FirstByteReceived);
+
+	// Take the place of a record out of the window, or else of the fastest one, if this request was slower.
+	int index = -1;
+	for (int i = 0; i < _records.size(); ++i)
+	{
+		const HttpFlightRecord& record = _records.at(i);
+		if (!isWithin(record, now, _window)) { index = i; break; }
+		if (_records.size() >= _capacity && record.duration() < duration && (index < 0 || record.duration() < _records.at(index).duration()))
+			index = i;
+	}
+	if (index < 0)
+	{
+		if (_records.size() >= _capacity) return;
+		index = _records.size();
+		_records.resize(index + 1);
+	}
+
+	HttpFlightRecord& record = _records[index];
+	record.method = ByteArrayHelpers::detachedCopy(connection->requestMethod());
+	record.uri = ByteArrayHelpers::detachedCopy(connection->requestUri());
+	record.statusCode = connection->responseStatusCode();
+
+	const HttpHeaderCollection& headers = connection->requestHeaders();
+	record.requestHeaderCount = headers.size();
+	record.requestHeaderBytes = 0;
+	for (int i = 0; i < headers.size(); ++i)
+		record.requestHeaderBytes += headers.at(i).first.size() + headers.at(i).second.size() + 4; // ": " and CRLF.
+	record.requestContentBytes = connection->requestContentLength();
+	record.responseContentBytes = connection->responseContentBytesSent();
+
+	for (int i = 0; i < HttpConnection::TimestampCount; ++i)
+		record.timestamps[i] = connection->timestamp(HttpConnection::Timestamp(i));
+
+	record.handlers.clear();
+	const QObjectList& children = this->children();
+	for (int i = 0; i < children.size() && (handlerIndex < 0 || i <= handlerIndex); ++i)
+	{
+		HttpHandler* handler = qobject_cast<HttpHandler*>(children.at(i));
+		if (handler == 0) continue;
+		record.handlers << (handler->objectName().isEmpty() ? QString::fromLatin1(handler->metaObject()->className()) : handler->objectName());
+	}
+
+	emit requestRecorded(record);
+}
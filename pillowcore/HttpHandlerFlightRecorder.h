@@ -0,0 +1,115 @@
+#ifndef PILLOW_HTTPHANDLERFLIGHTRECORDER_H
+#define PILLOW_HTTPHANDLERFLIGHTRECORDER_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHANDLER_H
+#include "HttpHandler.h"
+#endif // PILLOW_HTTPHANDLER_H
+#ifndef PILLOW_HTTPCONNECTION_H
+#include "HttpConnection.h"
+#endif // PILLOW_HTTPCONNECTION_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+#ifndef QVECTOR_H
+#include <QtCore/QVector>
+#endif // QVECTOR_H
+#ifndef QSTRINGLIST_H
+#include <QtCore/QStringList>
+#endif // QSTRINGLIST_H
+
+namespace Pillow
+{
+	//
+	// Pillow::HttpFlightRecord
+	//
+	// What the flight recorder kept of a slow request. Timestamps are those of HttpConnection::timestamp()
+	// when the request completed; OutputFlushed is usually still 0 by then.
+	//
+	struct PILLOWCORE_EXPORT HttpFlightRecord
+	{
+		QByteArray method;
+		QByteArray uri;
+		int statusCode;
+		int requestHeaderCount;
+		int requestHeaderBytes;       // Of the header lines, without the request line.
+		qint64 requestContentBytes;
+		qint64 responseContentBytes;
+		qint64 timestamps[Pillow::HttpConnection::TimestampCount];
+		QStringList handlers;         // The handlers the request went through, in order. The last one handled it, if any did.
+
+		HttpFlightRecord();
+
+		// Microseconds from the first byte received to the last byte written.
+		inline qint64 duration() const { return timestamps[HttpConnection::LastByteWritten] - timestamps[HttpConnection::FirstByteReceived]; }
+		QByteArray toByteArray() const; // A single line, as in the dump.
+	};
+
+	//
+	// Pillow::HttpHandlerFlightRecorder
+	//
+	// A handler stack that keeps the capacity slowest requests of the last window milliseconds that took at
+	// least threshold milliseconds, to find out what went on with them after the fact. It delegates requests
+	// to its children like HttpHandlerStack does, and records which ones each slow request went through.
+	//
+	// Requests under the threshold cost a hash lookup when they arrive and a subtraction when they complete.
+	// The records can be read with records(), written out as text with dump(), followed as they come
+	// with the requestRecorded signal or served by the recorder itself to GET requests for dumpPath.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpHandlerFlightRecorder : public HttpHandlerStack
+	{
+		Q_OBJECT
+		Q_PROPERTY(int capacity READ capacity WRITE setCapacity)
+		Q_PROPERTY(int threshold READ threshold WRITE setThreshold)
+		Q_PROPERTY(int window READ window WRITE setWindow)
+		Q_PROPERTY(QByteArray dumpPath READ dumpPath WRITE setDumpPath)
+		QHash<Pillow::HttpConnection*, int> _connections; // The index of the child that handled their request, -1 if none did.
+		QVector<Pillow::HttpFlightRecord> _records;       // At most capacity, in no particular order.
+		int _capacity;
+		qint64 _threshold, _window;                        // Microseconds.
+		QByteArray _dumpPath;
+
+	public:
+		enum { DefaultCapacity = 16 };
+		enum { DefaultThreshold = 1000 }; // Milliseconds.
+		enum { DefaultWindow = 600000 };  // Milliseconds.
+
+	public:
+		HttpHandlerFlightRecorder(QObject* parent = 0);
+
+		inline int capacity() const { return _capacity; }
+		void setCapacity(int capacity);
+		inline int threshold() const { return int(_threshold / 1000); }
+		void setThreshold(int milliseconds);
+		inline int window() const { return int(_window / 1000); }
+		void setWindow(int milliseconds);
+
+		// The path that answers with the dump. Empty by default: the recorder does not answer any request itself.
+		inline const QByteArray& dumpPath() const { return _dumpPath; }
+		void setDumpPath(const QByteArray& dumpPath);
+
+		QList<Pillow::HttpFlightRecord> records() const; // Those of the current window, slowest first.
+		QByteArray dump() const;                          // The records, one line each.
+		void clear();
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection* connection);
+
+	signals:
+		void requestRecorded(const Pillow::HttpFlightRecord& record);
+
+	private slots:
+		void requestCompleted(Pillow::HttpConnection* connection);
+		void requestDestroyed(QObject* connection);
+
+	private:
+		void record(Pillow::HttpConnection* connection, int handlerIndex, qint64 now);
+	};
+}
+Q_DECLARE_METATYPE(Pillow::HttpFlightRecord);
+
+#endif // PILLOW_HTTPHANDLERFLIGHTRECORDER_H
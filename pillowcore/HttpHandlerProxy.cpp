@@ -1,9 +1,132 @@
 #include "HttpHandlerProxy.h"
 #include "HttpConnection.h"
+#include "HttpClient.h"
+#include "HttpUpstreamGroup.h"
+#include "HttpResponseCache.h"
+#include "HttpHelpers.h"
+#include "ByteArrayHelpers.h"
 #include <QtCore/QBuffer>
+#include <QtCore/QTimer>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkCookieJar>
 
+namespace Pillow
+{
+	//
+	// Pillow::HttpRequestContentDevice
+	//
+	// A sequential device over the streamed content of a request, for QNetworkAccessManager to upload it as it arrives.
+	// Pauses the request while it holds BufferSize bytes or more that were not read yet.
+	//
+
+	class HttpRequestContentDevice : public QIODevice
+	{
+		Q_OBJECT
+		QPointer<Pillow::HttpConnection> _request;
+		QByteArray _buffer;
+		int _readOffset;
+		qint64 _remainingBytes;
+		bool _discarding;
+
+	public:
+		enum { BufferSize = 256 * 1024 };
+
+	public:
+		HttpRequestContentDevice(Pillow::HttpConnection* request)
+			: _request(request), _readOffset(0), _remainingBytes(request->requestContentLength()), _discarding(false)
+		{
+			connect(request, SIGNAL(requestContentReceived(Pillow::HttpConnection*,QByteArray)), this, SLOT(request_contentReceived(Pillow::HttpConnection*,QByteArray)));
+			open(QIODevice::ReadOnly);
+		}
+
+		bool isSequential() const { return true; }
+		qint64 bytesAvailable() const { return _buffer.size() - _readOffset + QIODevice::bytesAvailable(); }
+		bool atEnd() const { return _remainingBytes == 0 && bytesAvailable() == 0; }
+
+	public slots:
+		// Nobody reads anymore: let the rest of the content through without keeping it.
+		void discard()
+		{
+			_discarding = true;
+			_buffer.clear();
+			_readOffset = 0;
+			if (_request && _request->isRequestContentPaused()) _request->setRequestContentPaused(false);
+		}
+
+	protected:
+		qint64 readData(char* data, qint64 maxSize)
+		{
+			const int size = int(qMin<qint64>(maxSize, _buffer.size() - _readOffset));
+			if (size == 0) return _remainingBytes == 0 ? -1 : 0;
+
+			memcpy(data, _buffer.constData() + _readOffset, size);
+			_readOffset += size;
+			if (_readOffset == _buffer.size())
+			{
+				// Keep the memory for the next chunks, unless it is shared, as when the first chunk got appended to the
+				// empty buffer: truncating it in place would truncate the connection's array too.
+				if (_buffer.isDetached()) _buffer.data_ptr()->size = 0;
+				else _buffer.clear();
+				_readOffset = 0;
+			}
+
+			if (_request && _request->isRequestContentPaused() && _buffer.size() - _readOffset < BufferSize / 2)
+				_request->setRequestContentPaused(false);
+			return size;
+		}
+
+		qint64 writeData(const char*, qint64) { return -1; }
+
+	private slots:
+		void request_contentReceived(Pillow::HttpConnection* request, const QByteArray& data)
+		{
+			_remainingBytes -= data.size();
+			if (_discarding) return;
+
+			if (_readOffset > 0)
+			{
+				_buffer.remove(0, _readOffset);
+				_readOffset = 0;
+			}
+			_buffer.append(data);
+
+			if (_buffer.size() >= BufferSize) request->setRequestContentPaused(true);
+			emit readyRead();
+		}
+	};
+
+	namespace HttpHandlerProxyTokens
+	{
+		static const Pillow::LowerCaseToken hostToken("host");
+		static const Pillow::LowerCaseToken contentLengthToken("content-length");
+		static const Pillow::LowerCaseToken transferEncodingToken("transfer-encoding");
+	}
+
+	//
+	// The end-to-end headers of a response from the proxied server, to send to the client. The content reaches the proxy
+	// decoded from its transfer encoding and gets framed again by the client connection: a response that came chunked
+	// goes out chunked, or delimited by the end of the connection for clients that cannot take chunks.
+	//
+	static Pillow::HttpHeaderCollection proxiedResponseHeaders(const Pillow::HttpHeaderCollection& headers)
+	{
+		using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+		bool chunked = false;
+		for (const Pillow::HttpHeader *h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+			if (asciiEqualsCaseInsensitive(h->first, HttpHandlerProxyTokens::transferEncodingToken)) chunked = true;
+
+		Pillow::HttpHeaderCollection result; result.reserve(headers.size());
+		for (const Pillow::HttpHeader *h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+		{
+			if (Pillow::HttpProtocol::Headers::isHopByHopHeader(h->first, headers)) continue;
+			if (chunked && asciiEqualsCaseInsensitive(h->first, HttpHandlerProxyTokens::contentLengthToken)) continue; // Not the length of the message when it is chunked.
+			result << *h;
+		}
+		if (chunked) result << Pillow::HttpHeader("Transfer-Encoding", "chunked");
+		return result;
+	}
+}
+
 //
 // Pillow::HttpHandlerProxy
 //
@@ -30,6 +153,34 @@ bool Pillow::HttpHandlerProxy::handleRequest(Pillow::HttpConnection *request)
 {
 	if (_proxiedUrl.isEmpty()) return false;
 
+	if (request->isRequestContentStreamed() && _streamedRequests.remove(request))
+	{
+		// Already under way since its headers arrived.
+		disconnect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(streamedRequest_closed(Pillow::HttpConnection*)));
+		disconnect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+		return true;
+	}
+
+	proxyRequest(request);
+	return true;
+}
+
+bool Pillow::HttpHandlerProxy::handleRequestHeaders(Pillow::HttpConnection *request)
+{
+	if (_proxiedUrl.isEmpty()) return false;
+
+	request->setRequestContentStreamed(true);
+	if (!request->isRequestContentStreamed()) return false;
+
+	_streamedRequests.insert(request);
+	connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(streamedRequest_closed(Pillow::HttpConnection*)));
+	connect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+	proxyRequest(request);
+	return true;
+}
+
+void Pillow::HttpHandlerProxy::proxyRequest(Pillow::HttpConnection *request)
+{
 	QUrl targetUrl = _proxiedUrl;
 	targetUrl.setEncodedPath(request->requestPath());
 	if (!request->requestQueryString().isEmpty()) targetUrl.setEncodedQuery(request->requestQueryString());
@@ -37,25 +188,50 @@ bool Pillow::HttpHandlerProxy::handleRequest(Pillow::HttpConnection *request)
 
 	QNetworkRequest proxiedRequest(targetUrl);
 	foreach (const Pillow::HttpHeader& header, request->requestHeaders())
-		proxiedRequest.setRawHeader(header.first, header.second);
+	{
+		if (!Pillow::HttpProtocol::Headers::isHopByHopHeader(header.first, request->requestHeaders()))
+			proxiedRequest.setRawHeader(header.first, header.second);
+	}
 
 	createPipe(request, createProxiedReply(request, proxiedRequest));
+}
 
-	return true;
+void Pillow::HttpHandlerProxy::streamedRequest_closed(Pillow::HttpConnection *request)
+{
+	_streamedRequests.remove(request);
+	disconnect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+}
+
+void Pillow::HttpHandlerProxy::streamedRequest_destroyed(QObject *request)
+{
+	_streamedRequests.remove(static_cast<Pillow::HttpConnection*>(request));
 }
 
 QNetworkReply * Pillow::HttpHandlerProxy::createProxiedReply(Pillow::HttpConnection *request, QNetworkRequest proxiedRequest)
 {
-	QBuffer* requestContentBuffer = NULL;
-	if (request->requestContent().size() > 0)
+	QIODevice* requestContentDevice = NULL;
+	if (request->isRequestContentStreamed())
 	{
-		requestContentBuffer = new QBuffer(&(const_cast<QByteArray&>(request->requestContent())));
-		requestContentBuffer->open(QIODevice::ReadOnly);
+		// Upload the content as it arrives rather than having the network access manager buffer it whole first.
+		requestContentDevice = new Pillow::HttpRequestContentDevice(request);
+		proxiedRequest.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
 	}
+	else if (request->requestContent().size() > 0)
+	{
+		requestContentDevice = new QBuffer(&(const_cast<QByteArray&>(request->requestContent())));
+		requestContentDevice->open(QIODevice::ReadOnly);
+	}
+
+	QNetworkReply* proxiedReply = _networkAccessManager->sendCustomRequest(proxiedRequest, request->requestMethod(), requestContentDevice);
 
-	QNetworkReply* proxiedReply = _networkAccessManager->sendCustomRequest(proxiedRequest, request->requestMethod(), requestContentBuffer);
+	proxiedReply->setReadBufferSize(ProxiedReplyReadBufferSize); // Leave the rest to TCP flow control while the request cannot keep up.
 
-	if (requestContentBuffer) requestContentBuffer->setParent(proxiedReply);
+	if (requestContentDevice)
+	{
+		requestContentDevice->setParent(proxiedReply);
+		if (request->isRequestContentStreamed())
+			connect(proxiedReply, SIGNAL(finished()), requestContentDevice, SLOT(discard()));
+	}
 
 	return proxiedReply;
 }
@@ -76,6 +252,9 @@ Pillow::HttpHandlerProxyPipe::HttpHandlerProxyPipe(Pillow::HttpConnection *reque
 	connect(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(teardown()));
 	connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(teardown()));
 	connect(request, SIGNAL(destroyed()), this, SLOT(teardown()));
+	connect(request, SIGNAL(writeBufferDrained(Pillow::HttpConnection*)), this, SLOT(request_writeBufferDrained()));
+	if (request->state() == Pillow::HttpConnection::ReceivingContent)
+		connect(request, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(request_ready())); // The response has to wait for the streamed content.
 	connect(proxiedReply, SIGNAL(readyRead()), this, SLOT(proxiedReply_readyRead()));
 	connect(proxiedReply, SIGNAL(finished()), this, SLOT(proxiedReply_finished()));
 	connect(proxiedReply, SIGNAL(destroyed()), this, SLOT(teardown()));
@@ -110,6 +289,7 @@ void Pillow::HttpHandlerProxyPipe::teardown()
 void Pillow::HttpHandlerProxyPipe::sendHeaders()
 {
 	if (_headersSent || _broken) return;
+	if (_request->state() == Pillow::HttpConnection::ReceivingContent) return; // Wait for the rest of the streamed request content.
 	_headersSent = true;
 
 	// Headers have not been sent yet. Do so now.
@@ -118,7 +298,7 @@ void Pillow::HttpHandlerProxyPipe::sendHeaders()
 	Pillow::HttpHeaderCollection headers; headers.reserve(headerList.size());
 	for (int i = 0, iE = headerList.size(); i < iE; ++i)
 		headers << headerList.at(i);
-	_request->writeHeaders(statusCode, headers);
+	_request->writeHeaders(statusCode, Pillow::proxiedResponseHeaders(headers));
 }
 
 void Pillow::HttpHandlerProxyPipe::pump(const QByteArray &data)
@@ -126,17 +306,41 @@ void Pillow::HttpHandlerProxyPipe::pump(const QByteArray &data)
 	if (_request) _request->writeContent(data);
 }
 
+void Pillow::HttpHandlerProxyPipe::request_ready()
+{
+	if (_broken) return;
+	disconnect(_request, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(request_ready()));
+
+	// Pass on what the proxied server answered while the request content was being received.
+	if (_proxiedReply->isFinished())
+		proxiedReply_finished();
+	else if (_proxiedReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).isValid())
+		proxiedReply_readyRead();
+}
+
+void Pillow::HttpHandlerProxyPipe::request_writeBufferDrained()
+{
+	proxiedReply_readyRead(); // Take what the reply kept meanwhile; it then reads more from the proxied server.
+}
+
 void Pillow::HttpHandlerProxyPipe::proxiedReply_readyRead()
 {
 	sendHeaders();
-	if (!_broken) pump(_proxiedReply->readAll());
+
+	// Leave the content in the reply while the request cannot take more: the reply stops reading once it holds
+	// its read buffer size, and the proxied server gets throttled until writeBufferDrained.
+	if (!_broken && _headersSent && _request->canWrite()) pump(_proxiedReply->readAll());
 }
 
 void Pillow::HttpHandlerProxyPipe::proxiedReply_finished()
 {
+	if (!_broken && _request->state() == Pillow::HttpConnection::ReceivingContent)
+		return; // Answer once the request content is received.
+
 	if (_proxiedReply->error() == QNetworkReply::NoError)
 	{
 		sendHeaders(); // Make sure headers have been sent; can cause the pipe to tear down.
+		if (!_broken && _proxiedReply->bytesAvailable() > 0) pump(_proxiedReply->readAll()); // The last of it, no matter the write buffer.
 
 		if (!_broken && _request->state() == Pillow::HttpConnection::SendingContent)
 		{
@@ -155,6 +359,925 @@ void Pillow::HttpHandlerProxyPipe::proxiedReply_finished()
 	}
 }
 
+//
+// Pillow::HttpHandlerClientProxy
+//
+
+Pillow::HttpHandlerClientProxy::HttpHandlerClientProxy(QObject *parent)
+	: Pillow::HttpHandler(parent), _maximumIdleClients(DefaultMaximumIdleClients)
+{
+}
+
+Pillow::HttpHandlerClientProxy::HttpHandlerClientProxy(const QUrl &proxiedUrl, QObject *parent)
+	: Pillow::HttpHandler(parent), _proxiedUrl(proxiedUrl), _maximumIdleClients(DefaultMaximumIdleClients)
+{
+}
+
+Pillow::HttpHandlerClientProxy::~HttpHandlerClientProxy()
+{
+}
+
+void Pillow::HttpHandlerClientProxy::setProxiedUrl(const QUrl &proxiedUrl)
+{
+	if (_proxiedUrl == proxiedUrl) return;
+	_proxiedUrl = proxiedUrl;
+}
+
+void Pillow::HttpHandlerClientProxy::setMaximumIdleClients(int maximumIdleClients)
+{
+	if (maximumIdleClients < 0) maximumIdleClients = 0;
+	_maximumIdleClients = maximumIdleClients;
+
+	while (_idleClients.size() > _maximumIdleClients)
+		delete _idleClients.takeFirst();
+}
+
+bool Pillow::HttpHandlerClientProxy::handleRequest(Pillow::HttpConnection *request)
+{
+	if (_proxiedUrl.isEmpty()) return false;
+	if (takeStreamedRequest(request)) return true; // Already under way since its headers arrived.
+
+	proxyRequest(request);
+	return true;
+}
+
+bool Pillow::HttpHandlerClientProxy::handleRequestHeaders(Pillow::HttpConnection *request)
+{
+	if (_proxiedUrl.isEmpty()) return false;
+	if (!addStreamedRequest(request)) return false;
+
+	proxyRequest(request);
+	return true;
+}
+
+void Pillow::HttpHandlerClientProxy::proxyRequest(Pillow::HttpConnection *request)
+{
+	Pillow::HttpClientRequest proxiedRequest;
+	prepareProxiedRequest(request, _proxiedUrl, proxiedRequest);
+
+	Pillow::HttpClient* client = takeClient();
+	Pillow::HttpHandlerClientProxyPipe* pipe = createPipe(request, client);
+	connect(pipe, SIGNAL(clientReleased(Pillow::HttpClient*)), this, SLOT(pipe_clientReleased(Pillow::HttpClient*)));
+	client->request(proxiedRequest);
+}
+
+bool Pillow::HttpHandlerClientProxy::addStreamedRequest(Pillow::HttpConnection *request)
+{
+	request->setRequestContentStreamed(true);
+	if (!request->isRequestContentStreamed()) return false;
+
+	_streamedRequests.insert(request);
+	connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(streamedRequest_closed(Pillow::HttpConnection*)));
+	connect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+	return true;
+}
+
+bool Pillow::HttpHandlerClientProxy::takeStreamedRequest(Pillow::HttpConnection *request)
+{
+	if (!request->isRequestContentStreamed() || !_streamedRequests.remove(request)) return false;
+
+	disconnect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(streamedRequest_closed(Pillow::HttpConnection*)));
+	disconnect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+	return true;
+}
+
+void Pillow::HttpHandlerClientProxy::streamedRequest_closed(Pillow::HttpConnection *request)
+{
+	_streamedRequests.remove(request);
+	disconnect(request, SIGNAL(destroyed(QObject*)), this, SLOT(streamedRequest_destroyed(QObject*)));
+}
+
+void Pillow::HttpHandlerClientProxy::streamedRequest_destroyed(QObject *request)
+{
+	_streamedRequests.remove(static_cast<Pillow::HttpConnection*>(request));
+}
+
+void Pillow::HttpHandlerClientProxy::prepareProxiedRequest(Pillow::HttpConnection *request, const QUrl &proxiedUrl, Pillow::HttpClientRequest &proxiedRequest)
+{
+	proxiedRequest.method = request->requestMethod();
+	proxiedRequest.url = proxiedUrl;
+	proxiedRequest.url.setEncodedPath(request->requestPath());
+	if (!request->requestQueryString().isEmpty()) proxiedRequest.url.setEncodedQuery(request->requestQueryString());
+	if (request->isRequestContentStreamed())
+		proxiedRequest.contentLength = request->requestContentLength();
+	else
+		proxiedRequest.data = request->requestContent();
+
+	// Pass the request headers through as they are, except for the hop-by-hop ones, which are specific to the client
+	// connection, and for the ones that the HttpClient will write on its own.
+	const Pillow::HttpHeaderCollection& headers = request->requestHeaders();
+	proxiedRequest.headers.reserve(headers.size());
+	for (const Pillow::HttpHeader *h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+	{
+		if (Pillow::HttpProtocol::Headers::isHopByHopHeader(h->first, headers)
+			|| Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(h->first, Pillow::HttpHandlerProxyTokens::hostToken)
+			|| Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(h->first, Pillow::HttpHandlerProxyTokens::contentLengthToken))
+			continue;
+		proxiedRequest.headers << *h;
+	}
+}
+
+Pillow::HttpClient * Pillow::HttpHandlerClientProxy::takeClient()
+{
+	// Reuse the most recently used client first; it is the most likely to still have a live connection.
+	if (!_idleClients.isEmpty())
+		return _idleClients.takeLast();
+
+	Pillow::HttpClient* client = new Pillow::HttpClient(this);
+	client->setContentDecoding(false); // Relay the content exactly as the proxied server encoded it.
+	client->setReadBufferSize(ClientReadBufferSize); // Leave the rest to TCP flow control while the request cannot keep up.
+	return client;
+}
+
+void Pillow::HttpHandlerClientProxy::putClient(Pillow::HttpClient *client)
+{
+	if (_idleClients.size() >= _maximumIdleClients)
+		client->deleteLater(); // We may be called from one of the client's signals; do not delete it right away.
+	else
+		_idleClients.append(client);
+}
+
+Pillow::HttpHandlerClientProxyPipe * Pillow::HttpHandlerClientProxy::createPipe(Pillow::HttpConnection *request, Pillow::HttpClient *client)
+{
+	return new Pillow::HttpHandlerClientProxyPipe(request, client);
+}
+
+void Pillow::HttpHandlerClientProxy::pipe_clientReleased(Pillow::HttpClient *client)
+{
+	putClient(client);
+}
+
+//
+// Pillow::HttpHandlerBalancingProxy
+//
+
+Pillow::HttpHandlerBalancingProxy::HttpHandlerBalancingProxy(QObject *parent)
+	: Pillow::HttpHandlerClientProxy(parent), _maximumPendingRequests(DefaultMaximumPendingRequests),
+	  _pendingRequestTimeout(DefaultPendingRequestTimeout), _pendingRequestTimer(new QTimer(this))
+{
+	_pendingRequestTimer->setSingleShot(true);
+	connect(_pendingRequestTimer, SIGNAL(timeout()), this, SLOT(pendingRequestTimer_timeout()));
+	setUpstreamGroup(new Pillow::HttpUpstreamGroup(this));
+}
+
+Pillow::HttpHandlerBalancingProxy::HttpHandlerBalancingProxy(Pillow::HttpUpstreamGroup *upstreamGroup, QObject *parent)
+	: Pillow::HttpHandlerClientProxy(parent), _maximumPendingRequests(DefaultMaximumPendingRequests),
+	  _pendingRequestTimeout(DefaultPendingRequestTimeout), _pendingRequestTimer(new QTimer(this))
+{
+	_pendingRequestTimer->setSingleShot(true);
+	connect(_pendingRequestTimer, SIGNAL(timeout()), this, SLOT(pendingRequestTimer_timeout()));
+	setUpstreamGroup(upstreamGroup);
+}
+
+void Pillow::HttpHandlerBalancingProxy::setUpstreamGroup(Pillow::HttpUpstreamGroup *upstreamGroup)
+{
+	if (_upstreamGroup == upstreamGroup) return;
+	if (_upstreamGroup) disconnect(_upstreamGroup, NULL, this, NULL);
+	_upstreamGroup = upstreamGroup;
+	if (_upstreamGroup) connect(_upstreamGroup, SIGNAL(clientReleased()), this, SLOT(upstreamGroup_clientReleased()));
+}
+
+void Pillow::HttpHandlerBalancingProxy::setMaximumPendingRequests(int maximumPendingRequests)
+{
+	if (maximumPendingRequests < 0) maximumPendingRequests = 0;
+	_maximumPendingRequests = maximumPendingRequests; // Requests already waiting keep their place.
+}
+
+void Pillow::HttpHandlerBalancingProxy::setPendingRequestTimeout(int msecs)
+{
+	if (msecs < 0) msecs = 0;
+	_pendingRequestTimeout = msecs;
+	schedulePendingRequestTimeout();
+}
+
+bool Pillow::HttpHandlerBalancingProxy::handleRequest(Pillow::HttpConnection *request)
+{
+	if (_upstreamGroup == NULL || _upstreamGroup->upstreamCount() == 0) return false;
+	if (takeStreamedRequest(request)) return true; // Already under way since its headers arrived.
+
+	QUrl upstreamUrl;
+	Pillow::HttpClient* client = _upstreamGroup->takeClient(request->requestPath(), &upstreamUrl);
+
+	if (client)
+		proxyRequest(request, client, upstreamUrl);
+	else if (_upstreamGroup->hasHealthyUpstream() && _pendingRequests.size() < _maximumPendingRequests)
+	{
+		// All the healthy upstreams are using all of their connections. Wait for one to be released.
+		_pendingRequests.append(PendingRequest(request, Pillow::HttpConnection::now()));
+		connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(pendingRequest_closed(Pillow::HttpConnection*)));
+		connect(request, SIGNAL(destroyed(QObject*)), this, SLOT(pendingRequest_destroyed(QObject*)));
+		if (_pendingRequests.size() == 1) schedulePendingRequestTimeout();
+	}
+	else
+		request->writeResponse(503);
+
+	return true;
+}
+
+bool Pillow::HttpHandlerBalancingProxy::handleRequestHeaders(Pillow::HttpConnection *request)
+{
+	if (_upstreamGroup == NULL || _upstreamGroup->upstreamCount() == 0) return false;
+
+	// Streamed content cannot wait in the queue for a connection: the client would keep sending it meanwhile.
+	// Requests that would have to wait get their content buffered and queued from handleRequest() instead.
+	QUrl upstreamUrl;
+	Pillow::HttpClient* client = _upstreamGroup->takeClient(request->requestPath(), &upstreamUrl);
+	if (client == NULL) return false;
+
+	if (!addStreamedRequest(request))
+	{
+		_upstreamGroup->releaseClient(client);
+		return false;
+	}
+
+	proxyRequest(request, client, upstreamUrl);
+	return true;
+}
+
+void Pillow::HttpHandlerBalancingProxy::proxyRequest(Pillow::HttpConnection *request, Pillow::HttpClient *client, const QUrl &upstreamUrl)
+{
+	Pillow::HttpClientRequest proxiedRequest;
+	prepareProxiedRequest(request, upstreamUrl, proxiedRequest);
+
+	client->setContentDecoding(false); // Relay the content exactly as the upstream encoded it.
+	client->setReadBufferSize(ClientReadBufferSize);
+	Pillow::HttpHandlerClientProxyPipe* pipe = createPipe(request, client);
+	connect(pipe, SIGNAL(clientReleased(Pillow::HttpClient*)), this, SLOT(pipe_upstreamClientReleased(Pillow::HttpClient*)));
+	client->request(proxiedRequest);
+}
+
+void Pillow::HttpHandlerBalancingProxy::pipe_upstreamClientReleased(Pillow::HttpClient *client)
+{
+	if (_upstreamGroup) _upstreamGroup->releaseClient(client);
+}
+
+void Pillow::HttpHandlerBalancingProxy::upstreamGroup_clientReleased()
+{
+	if (_pendingRequests.isEmpty()) return;
+
+	while (!_pendingRequests.isEmpty())
+	{
+		Pillow::HttpConnection* request = _pendingRequests.first().first;
+
+		QUrl upstreamUrl;
+		Pillow::HttpClient* client = _upstreamGroup->takeClient(request->requestPath(), &upstreamUrl);
+		if (client == NULL)
+		{
+			if (_upstreamGroup->hasHealthyUpstream())
+				break; // Still waiting for a connection.
+
+			_pendingRequests.removeFirst();
+			disconnect(request, NULL, this, NULL);
+			request->writeResponse(503);
+			continue;
+		}
+
+		_pendingRequests.removeFirst();
+		disconnect(request, NULL, this, NULL);
+		proxyRequest(request, client, upstreamUrl);
+	}
+
+	schedulePendingRequestTimeout();
+}
+
+void Pillow::HttpHandlerBalancingProxy::removePendingRequest(Pillow::HttpConnection *request)
+{
+	for (int i = 0, iE = _pendingRequests.size(); i < iE; ++i)
+	{
+		if (_pendingRequests.at(i).first == request)
+		{
+			_pendingRequests.removeAt(i);
+			if (i == 0) schedulePendingRequestTimeout();
+			return;
+		}
+	}
+}
+
+void Pillow::HttpHandlerBalancingProxy::schedulePendingRequestTimeout()
+{
+	// Requests are queued in order and share the same timeout: the first one is always the next to expire.
+	if (_pendingRequests.isEmpty())
+	{
+		_pendingRequestTimer->stop();
+		return;
+	}
+
+	const qint64 waited = (Pillow::HttpConnection::now() - _pendingRequests.first().second) / 1000;
+	_pendingRequestTimer->start(static_cast<int>(qMax<qint64>(0, _pendingRequestTimeout - waited)));
+}
+
+void Pillow::HttpHandlerBalancingProxy::pendingRequest_closed(Pillow::HttpConnection *request)
+{
+	removePendingRequest(request);
+}
+
+void Pillow::HttpHandlerBalancingProxy::pendingRequest_destroyed(QObject *request)
+{
+	removePendingRequest(static_cast<Pillow::HttpConnection*>(request));
+}
+
+void Pillow::HttpHandlerBalancingProxy::pendingRequestTimer_timeout()
+{
+	const qint64 expiredBefore = Pillow::HttpConnection::now() - qint64(_pendingRequestTimeout) * 1000;
+	while (!_pendingRequests.isEmpty() && _pendingRequests.first().second <= expiredBefore)
+	{
+		Pillow::HttpConnection* request = _pendingRequests.takeFirst().first;
+		disconnect(request, NULL, this, NULL);
+		request->writeResponse(503);
+	}
+
+	schedulePendingRequestTimeout();
+}
+
+//
+// Pillow::HttpHandlerCachingProxy
+//
+
+namespace Pillow
+{
+	namespace HttpHandlerProxyTokens
+	{
+		static const Pillow::LowerCaseToken ifNoneMatchToken("if-none-match");
+		static const Pillow::LowerCaseToken ifModifiedSinceToken("if-modified-since");
+		static const Pillow::LowerCaseToken rangeToken("range");
+		static const Pillow::LowerCaseToken cacheControlToken("cache-control");
+		static const Pillow::LowerCaseToken contentLocationToken("content-location");
+		static const Pillow::LowerCaseToken dateToken("date");
+		static const Pillow::LowerCaseToken etagToken("etag");
+		static const Pillow::LowerCaseToken expiresToken("expires");
+		static const Pillow::LowerCaseToken varyToken("vary");
+	}
+
+	struct HttpCacheFetch
+	{
+		QByteArray key;
+		QByteArray fetchKey;
+		Pillow::HttpClient* client;
+		QList<Pillow::HttpConnection*> requests;     // Requests waiting for the response. The first one started the fetch.
+		Pillow::HttpHeaderCollection requestHeaders; // Copy of the headers of the first request, to select the variant to store.
+		Pillow::HttpCachedResponse storedResponse;   // The stale stored response being revalidated, if any.
+		QByteArray content;
+		bool revalidating;
+		bool streaming; // The response cannot be stored; it goes straight to the first request only.
+
+		HttpCacheFetch() : client(NULL), revalidating(false), streaming(false) {}
+	};
+}
+
+Pillow::HttpHandlerCachingProxy::HttpHandlerCachingProxy(QObject *parent)
+	: Pillow::HttpHandlerClientProxy(parent), _cache(new Pillow::HttpResponseCache())
+{
+}
+
+Pillow::HttpHandlerCachingProxy::HttpHandlerCachingProxy(const QUrl &proxiedUrl, QObject *parent)
+	: Pillow::HttpHandlerClientProxy(proxiedUrl, parent), _cache(new Pillow::HttpResponseCache())
+{
+}
+
+Pillow::HttpHandlerCachingProxy::~HttpHandlerCachingProxy()
+{
+	foreach (Pillow::HttpCacheFetch* fetch, _fetchesByClient)
+	{
+		disconnect(fetch->client, NULL, this, NULL);
+		foreach (Pillow::HttpConnection* request, fetch->requests)
+			disconnect(request, NULL, this, NULL);
+		delete fetch;
+	}
+	delete _cache;
+}
+
+QByteArray Pillow::HttpHandlerCachingProxy::cacheKey(Pillow::HttpConnection *request) const
+{
+	// Make a deep copy; the request data lives in the connection buffers, which get reused.
+	const QByteArray& path = request->requestPath();
+	const QByteArray& queryString = request->requestQueryString();
+	QByteArray key; key.reserve(path.size() + 1 + queryString.size());
+	key.append(path);
+	if (!queryString.isEmpty()) key.append('?').append(queryString);
+	return key;
+}
+
+bool Pillow::HttpHandlerCachingProxy::handleRequest(Pillow::HttpConnection *request)
+{
+	if (proxiedUrl().isEmpty()) return false;
+	if (takeStreamedRequest(request)) return true; // Already under way since its headers arrived.
+
+	const QByteArray& method = request->requestMethod();
+	const bool isGet = method == "GET";
+	if (!isGet && method != "HEAD")
+	{
+		// Requests with other methods may change the resource; stop serving the stored responses for it.
+		_cache->remove(cacheKey(request));
+		return Pillow::HttpHandlerClientProxy::handleRequest(request);
+	}
+
+	const Pillow::HttpHeaderCollection& headers = request->requestHeaders();
+	if (!Pillow::HttpResponseCache::isStorableRequest(headers) || !headers.getFieldValue(Pillow::HttpHandlerProxyTokens::rangeToken).isEmpty())
+		return Pillow::HttpHandlerClientProxy::handleRequest(request);
+
+	const QByteArray key = cacheKey(request);
+	const Pillow::HttpCachedResponse* storedResponse = _cache->find(key, headers);
+	if (storedResponse != NULL && _cache->isFresh(*storedResponse) && Pillow::HttpResponseCache::acceptsStoredResponse(headers))
+	{
+		writeCachedResponse(request, *storedResponse);
+		return true;
+	}
+
+	// HEAD responses cannot be stored for GET requests; let the misses through.
+	if (!isGet) return Pillow::HttpHandlerClientProxy::handleRequest(request);
+
+	const QByteArray fetchKey = _cache->variantKey(key, headers);
+	Pillow::HttpCacheFetch* fetch = _fetchesByKey.value(fetchKey);
+	if (fetch != NULL)
+		addFetchRequest(fetch, request); // Someone is already getting that response; wait for it.
+	else
+		startFetch(request, key, fetchKey, storedResponse);
+
+	return true;
+}
+
+bool Pillow::HttpHandlerCachingProxy::handleRequestHeaders(Pillow::HttpConnection *request)
+{
+	if (proxiedUrl().isEmpty()) return false;
+
+	// Requests that may be answered from the cache get their (unusual) content buffered as usual.
+	const QByteArray& method = request->requestMethod();
+	if (method == "GET" || method == "HEAD") return false;
+
+	// Requests with other methods may change the resource; stop serving the stored responses for it.
+	_cache->remove(cacheKey(request));
+	return Pillow::HttpHandlerClientProxy::handleRequestHeaders(request);
+}
+
+void Pillow::HttpHandlerCachingProxy::writeCachedResponse(Pillow::HttpConnection *request, const Pillow::HttpCachedResponse &response)
+{
+	if (request->state() != Pillow::HttpConnection::SendingHeaders) return;
+
+	const QByteArray age = QByteArray::number(_cache->age(response));
+
+	if (response.statusCode == 200 && Pillow::HttpResponseCache::isNotModified(response, request->requestHeaders()))
+	{
+		using namespace Pillow::HttpHandlerProxyTokens;
+		using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+		Pillow::HttpHeaderCollection headers;
+		for (const Pillow::HttpHeader *h = response.headers.constBegin(), *hE = response.headers.constEnd(); h < hE; ++h)
+		{
+			if (asciiEqualsCaseInsensitive(h->first, cacheControlToken) || asciiEqualsCaseInsensitive(h->first, contentLocationToken)
+				|| asciiEqualsCaseInsensitive(h->first, dateToken) || asciiEqualsCaseInsensitive(h->first, etagToken)
+				|| asciiEqualsCaseInsensitive(h->first, expiresToken) || asciiEqualsCaseInsensitive(h->first, varyToken))
+				headers << *h;
+		}
+		headers << Pillow::HttpHeader("Age", age);
+		request->writeResponse(304, headers);
+	}
+	else
+	{
+		Pillow::HttpHeaderCollection headers = response.headers;
+		headers << Pillow::HttpHeader("Age", age);
+		request->writeResponse(response.statusCode, headers, response.content);
+	}
+}
+
+void Pillow::HttpHandlerCachingProxy::startFetch(Pillow::HttpConnection *request, const QByteArray &key, const QByteArray &fetchKey, const Pillow::HttpCachedResponse *storedResponse)
+{
+	Pillow::HttpCacheFetch* fetch = new Pillow::HttpCacheFetch();
+	fetch->key = key;
+	fetch->fetchKey = fetchKey;
+	fetch->requestHeaders = request->requestHeaders();
+	fetch->requestHeaders.detach();
+	for (int i = 0, iE = fetch->requestHeaders.size(); i < iE; ++i)
+	{
+		fetch->requestHeaders[i].first.detach();
+		fetch->requestHeaders[i].second.detach();
+	}
+
+	Pillow::HttpClientRequest proxiedRequest;
+	prepareProxiedRequest(request, proxiedUrl(), proxiedRequest);
+
+	// The conditions of the client are checked against the response once it is stored. Only ask
+	// the proxied server to validate what the cache already has, so that it sends full responses otherwise.
+	for (int i = proxiedRequest.headers.size() - 1; i >= 0; --i)
+	{
+		const QByteArray& field = proxiedRequest.headers.at(i).first;
+		if (Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(field, Pillow::HttpHandlerProxyTokens::ifNoneMatchToken)
+			|| Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(field, Pillow::HttpHandlerProxyTokens::ifModifiedSinceToken))
+			proxiedRequest.headers.remove(i);
+	}
+	if (storedResponse != NULL && storedResponse->hasValidators())
+	{
+		fetch->storedResponse = *storedResponse;
+		fetch->revalidating = true;
+		if (!storedResponse->etag.isEmpty()) proxiedRequest.headers << Pillow::HttpHeader("If-None-Match", storedResponse->etag);
+		if (!storedResponse->lastModified.isEmpty()) proxiedRequest.headers << Pillow::HttpHeader("If-Modified-Since", storedResponse->lastModified);
+	}
+
+	fetch->client = takeClient();
+	connect(fetch->client, SIGNAL(headersCompleted()), this, SLOT(fetch_headersCompleted()));
+	connect(fetch->client, SIGNAL(contentReadyRead()), this, SLOT(fetch_contentReadyRead()));
+	connect(fetch->client, SIGNAL(finished()), this, SLOT(fetch_finished()));
+	_fetchesByKey.insert(fetchKey, fetch);
+	_fetchesByClient.insert(fetch->client, fetch);
+	addFetchRequest(fetch, request);
+
+	fetch->client->request(proxiedRequest);
+}
+
+void Pillow::HttpHandlerCachingProxy::startStreaming(Pillow::HttpCacheFetch *fetch)
+{
+	fetch->streaming = true;
+	if (_fetchesByKey.value(fetch->fetchKey) == fetch) _fetchesByKey.remove(fetch->fetchKey);
+	if (fetch->revalidating) _cache->remove(fetch->key); // What the cache had is now obsolete.
+
+	// A response that cannot be stored cannot be shared either. The first request gets it
+	// as it arrives; the ones that were waiting for it get proxied on their own.
+	const QList<Pillow::HttpConnection*> waitingRequests = fetch->requests.mid(1);
+	foreach (Pillow::HttpConnection* request, waitingRequests)
+	{
+		removeFetchRequest(request);
+		Pillow::HttpHandlerClientProxy::handleRequest(request);
+	}
+
+	if (fetch->requests.isEmpty())
+	{
+		// Nobody is interested in the response anymore.
+		if (fetch->client->responsePending())
+		{
+			disconnect(fetch->client, NULL, this, NULL);
+			fetch->client->abort();
+		}
+		releaseFetch(fetch);
+		return;
+	}
+
+	Pillow::HttpConnection* request = fetch->requests.first();
+	connect(request, SIGNAL(writeBufferDrained(Pillow::HttpConnection*)), this, SLOT(fetchRequest_writeBufferDrained(Pillow::HttpConnection*)));
+	request->writeHeaders(fetch->client->statusCode(), Pillow::proxiedResponseHeaders(fetch->client->headers()));
+	if (!fetch->content.isEmpty())
+	{
+		const QByteArray content = fetch->content;
+		fetch->content = QByteArray();
+		request->writeContent(content);
+	}
+}
+
+void Pillow::HttpHandlerCachingProxy::addFetchRequest(Pillow::HttpCacheFetch *fetch, Pillow::HttpConnection *request)
+{
+	fetch->requests.append(request);
+	_fetchesByRequest.insert(request, fetch);
+	connect(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(fetchRequest_completed(Pillow::HttpConnection*)));
+	connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(fetchRequest_closed(Pillow::HttpConnection*)));
+	connect(request, SIGNAL(destroyed(QObject*)), this, SLOT(fetchRequest_destroyed(QObject*)));
+}
+
+void Pillow::HttpHandlerCachingProxy::removeFetchRequest(Pillow::HttpConnection *request)
+{
+	Pillow::HttpCacheFetch* fetch = _fetchesByRequest.take(request);
+	if (fetch == NULL) return;
+	disconnect(request, NULL, this, NULL);
+	fetch->requests.removeOne(request);
+}
+
+void Pillow::HttpHandlerCachingProxy::releaseFetch(Pillow::HttpCacheFetch *fetch)
+{
+	foreach (Pillow::HttpConnection* request, fetch->requests)
+		removeFetchRequest(request);
+	if (_fetchesByKey.value(fetch->fetchKey) == fetch) _fetchesByKey.remove(fetch->fetchKey);
+	_fetchesByClient.remove(fetch->client);
+	disconnect(fetch->client, NULL, this, NULL);
+	putClient(fetch->client);
+	delete fetch;
+}
+
+void Pillow::HttpHandlerCachingProxy::fetch_headersCompleted()
+{
+	Pillow::HttpClient* client = static_cast<Pillow::HttpClient*>(sender());
+	Pillow::HttpCacheFetch* fetch = _fetchesByClient.value(client);
+	if (fetch == NULL) return;
+
+	if (fetch->revalidating && client->statusCode() == 304)
+		return; // The stored response is still good. It gets refreshed once the response is finished.
+
+	bool contentLengthOk = false;
+	const qint64 contentLength = client->headers().getFieldValue(Pillow::HttpHandlerProxyTokens::contentLengthToken).toLongLong(&contentLengthOk);
+
+	if (!Pillow::HttpResponseCache::isStorableResponse(client->statusCode(), client->headers(), fetch->requestHeaders)
+		|| (contentLengthOk && contentLength > _cache->maximumResponseSize()))
+		startStreaming(fetch);
+}
+
+void Pillow::HttpHandlerCachingProxy::fetch_contentReadyRead()
+{
+	Pillow::HttpClient* client = static_cast<Pillow::HttpClient*>(sender());
+	Pillow::HttpCacheFetch* fetch = _fetchesByClient.value(client);
+	if (fetch == NULL) return;
+
+	if (fetch->streaming)
+	{
+		// Leave the content in the client while the request cannot take more; see HttpHandlerClientProxyPipe.
+		if (!fetch->requests.isEmpty() && fetch->requests.first()->canWrite())
+			fetch->requests.first()->writeContent(client->consumeContent());
+	}
+	else
+	{
+		fetch->content.append(client->consumeContent());
+		if (fetch->content.size() > _cache->maximumResponseSize())
+			startStreaming(fetch); // Too large to be stored after all.
+	}
+}
+
+void Pillow::HttpHandlerCachingProxy::fetch_finished()
+{
+	Pillow::HttpClient* client = static_cast<Pillow::HttpClient*>(sender());
+	Pillow::HttpCacheFetch* fetch = _fetchesByClient.value(client);
+	if (fetch == NULL) return;
+
+	// Detach everything before writing any response: completing a request can synchronously
+	// bring the next request of its connection back into handleRequest().
+	const QList<Pillow::HttpConnection*> requests = fetch->requests;
+	foreach (Pillow::HttpConnection* request, requests)
+		removeFetchRequest(request);
+	if (_fetchesByKey.value(fetch->fetchKey) == fetch) _fetchesByKey.remove(fetch->fetchKey);
+	_fetchesByClient.remove(client);
+	disconnect(client, NULL, this, NULL);
+
+	if (client->error() != Pillow::HttpClient::NoError)
+	{
+		foreach (Pillow::HttpConnection* request, requests)
+		{
+			if (request->state() == Pillow::HttpConnection::SendingHeaders)
+				request->writeResponse(503); // Network or transport error before anything was sent.
+			else
+				request->close(); // The response is already under way. The only thing we can do is to break it.
+		}
+	}
+	else if (fetch->streaming)
+	{
+		const QByteArray content = client->consumeContent(); // The last of it, no matter the write buffer.
+		foreach (Pillow::HttpConnection* request, requests)
+		{
+			if (request->state() != Pillow::HttpConnection::SendingContent) continue;
+			if (!content.isEmpty()) request->writeContent(content);
+			if (request->state() != Pillow::HttpConnection::SendingContent) continue;
+
+			// The response content length was not known in advance. End the chunked
+			// content stream, or close the connection to indicate the end of the content.
+			if (request->responseContentLength() < 0)
+				request->endContent();
+			else
+				request->close();
+		}
+	}
+	else
+	{
+		Pillow::HttpCachedResponse response;
+		if (fetch->revalidating && client->statusCode() == 304)
+		{
+			response = fetch->storedResponse;
+			_cache->refreshResponse(response, client->headers());
+		}
+		else
+			response = _cache->createResponse(client->statusCode(), client->headers(), fetch->content);
+
+		_cache->insert(fetch->key, fetch->requestHeaders, response);
+
+		foreach (Pillow::HttpConnection* request, requests)
+			writeCachedResponse(request, response);
+	}
+
+	putClient(client);
+	delete fetch;
+}
+
+void Pillow::HttpHandlerCachingProxy::fetchRequest_writeBufferDrained(Pillow::HttpConnection *request)
+{
+	Pillow::HttpCacheFetch* fetch = _fetchesByRequest.value(request);
+	if (fetch == NULL || !fetch->streaming || fetch->client->content().isEmpty()) return;
+	request->writeContent(fetch->client->consumeContent()); // It then reads more from the proxied server.
+}
+
+void Pillow::HttpHandlerCachingProxy::fetchRequest_completed(Pillow::HttpConnection *request)
+{
+	removeFetchRequest(request);
+}
+
+void Pillow::HttpHandlerCachingProxy::fetchRequest_closed(Pillow::HttpConnection *request)
+{
+	Pillow::HttpCacheFetch* fetch = _fetchesByRequest.value(request);
+	if (fetch == NULL) return;
+	removeFetchRequest(request);
+
+	// A response that gets stored is worth finishing even if nobody waits for it anymore.
+	if (fetch->streaming && fetch->requests.isEmpty())
+	{
+		disconnect(fetch->client, NULL, this, NULL);
+		if (fetch->client->responsePending()) fetch->client->abort();
+		releaseFetch(fetch);
+	}
+}
+
+void Pillow::HttpHandlerCachingProxy::fetchRequest_destroyed(QObject *request)
+{
+	fetchRequest_closed(static_cast<Pillow::HttpConnection*>(request));
+}
+
+//
+// Pillow::HttpHandlerClientProxyPipe
+//
+
+Pillow::HttpHandlerClientProxyPipe::HttpHandlerClientProxyPipe(Pillow::HttpConnection *request, Pillow::HttpClient *client)
+	: _request(request), _client(client), _headersSent(false), _broken(false), _responseHeadersReceived(false), _responseFinished(false)
+{
+	connect(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(request_completed()));
+	connect(request, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(teardown()));
+	connect(request, SIGNAL(destroyed()), this, SLOT(teardown()));
+	connect(request, SIGNAL(writeBufferDrained(Pillow::HttpConnection*)), this, SLOT(request_writeBufferDrained()));
+	if (request->isRequestContentStreamed() && request->state() == Pillow::HttpConnection::ReceivingContent)
+	{
+		// Relay the content as it arrives; the response has to wait for all of it to be received.
+		connect(request, SIGNAL(requestContentReceived(Pillow::HttpConnection*,QByteArray)), this, SLOT(request_contentReceived(Pillow::HttpConnection*,QByteArray)));
+		connect(request, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(request_ready()));
+		connect(client, SIGNAL(contentWritten()), this, SLOT(client_contentWritten()));
+	}
+	connect(client, SIGNAL(headersCompleted()), this, SLOT(client_headersCompleted()));
+	connect(client, SIGNAL(contentReadyRead()), this, SLOT(client_contentReadyRead()));
+	connect(client, SIGNAL(finished()), this, SLOT(client_finished()));
+	connect(client, SIGNAL(destroyed()), this, SLOT(client_destroyed()));
+}
+
+Pillow::HttpHandlerClientProxyPipe::~HttpHandlerClientProxyPipe()
+{
+}
+
+void Pillow::HttpHandlerClientProxyPipe::teardown()
+{
+	_broken = true;
+
+	if (_request)
+	{
+		disconnect(_request, NULL, this, NULL);
+		_request = NULL;
+	}
+
+	if (_client)
+	{
+		if (_client->responsePending())
+		{
+			// Nobody is interested in the rest of the proxied response anymore.
+			disconnect(_client, NULL, this, NULL);
+			_client->abort();
+		}
+		release();
+	}
+
+	deleteLater();
+}
+
+void Pillow::HttpHandlerClientProxyPipe::sendHeaders()
+{
+	if (_headersSent || _broken) return;
+	if (_request->state() == Pillow::HttpConnection::ReceivingContent) return; // Wait for the rest of the streamed request content.
+	_headersSent = true;
+
+	_request->writeHeaders(_client->statusCode(), Pillow::proxiedResponseHeaders(_client->headers()));
+}
+
+void Pillow::HttpHandlerClientProxyPipe::pump(const QByteArray &data)
+{
+	if (_request) _request->writeContent(data);
+}
+
+void Pillow::HttpHandlerClientProxyPipe::release()
+{
+	if (_client == NULL) return;
+
+	Pillow::HttpClient* client = _client;
+	disconnect(client, NULL, this, NULL);
+	_client = NULL;
+	emit clientReleased(client);
+}
+
+void Pillow::HttpHandlerClientProxyPipe::request_contentReceived(Pillow::HttpConnection *request, const QByteArray &data)
+{
+	if (_broken || _client == NULL || _responseFinished) return; // Nobody takes it anymore; let it through.
+
+	_client->writeContent(data);
+	if (!_client->canWriteContent())
+		request->setRequestContentPaused(true); // Until the proxied server takes some of it.
+}
+
+void Pillow::HttpHandlerClientProxyPipe::request_ready()
+{
+	if (_broken) return;
+	disconnect(_request, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(request_ready()));
+
+	// Pass on what the proxied server answered while the request content was being received.
+	if (_responseFinished)
+		finish();
+	else if (_responseHeadersReceived)
+	{
+		sendHeaders();
+		client_contentReadyRead();
+	}
+}
+
+void Pillow::HttpHandlerClientProxyPipe::request_completed()
+{
+	_broken = true;
+
+	if (_request)
+	{
+		disconnect(_request, NULL, this, NULL);
+		_request = NULL;
+	}
+
+	// The client request is complete, but the proxied response is usually still being parsed as we are
+	// called from one of the client's callbacks. Only let go of the client once it has finished.
+	if (_client == NULL || !_client->responsePending())
+	{
+		release();
+		deleteLater();
+	}
+}
+
+void Pillow::HttpHandlerClientProxyPipe::request_writeBufferDrained()
+{
+	client_contentReadyRead(); // Take what the client kept meanwhile; it then reads more from the proxied server.
+}
+
+void Pillow::HttpHandlerClientProxyPipe::client_headersCompleted()
+{
+	_responseHeadersReceived = true;
+	sendHeaders();
+}
+
+void Pillow::HttpHandlerClientProxyPipe::client_contentReadyRead()
+{
+	// Leave the content in the client while the request cannot take more: the client stops reading once it holds
+	// its read buffer size, and the proxied server gets throttled until writeBufferDrained.
+	if (!_broken && _headersSent && _request->canWrite() && !_client->content().isEmpty()) pump(_client->consumeContent());
+}
+
+void Pillow::HttpHandlerClientProxyPipe::client_contentWritten()
+{
+	if (!_broken && _request->isRequestContentPaused() && _client->canWriteContent())
+		_request->setRequestContentPaused(false);
+}
+
+void Pillow::HttpHandlerClientProxyPipe::client_finished()
+{
+	if (!_broken && _request->state() == Pillow::HttpConnection::ReceivingContent)
+	{
+		// The proxied server answered before getting all of the content. Let the client finish
+		// sending it, without relaying it anymore, and answer once it is received.
+		_responseFinished = true;
+		if (_request->isRequestContentPaused()) _request->setRequestContentPaused(false);
+		return;
+	}
+
+	finish();
+}
+
+void Pillow::HttpHandlerClientProxyPipe::finish()
+{
+	if (!_broken)
+	{
+		if (_client->error() == Pillow::HttpClient::NoError)
+		{
+			sendHeaders(); // Make sure headers have been sent; can cause the pipe to tear down.
+			if (!_broken && !_client->content().isEmpty()) pump(_client->consumeContent()); // The last of it, no matter the write buffer.
+
+			if (!_broken && _request->state() == Pillow::HttpConnection::SendingContent)
+			{
+				// The response content length was not known in advance. End the chunked
+				// content stream, or close the connection to indicate the end of the content.
+				if (_request->responseContentLength() < 0)
+					_request->endContent();
+				else
+					_request->close();
+			}
+		}
+		else if (_request->state() == Pillow::HttpConnection::SendingHeaders)
+		{
+			// Finishing before sending headers means that we have a network or transport error. Let the client know about this.
+			_request->writeResponse(503);
+		}
+		else
+		{
+			// The response is already under way. The only thing we can do is to break it.
+			_request->close();
+		}
+	}
+
+	teardown();
+}
+
+void Pillow::HttpHandlerClientProxyPipe::client_destroyed()
+{
+	_client = NULL;
+	teardown();
+}
+
 //
 // Pillow::ElasticNetworkAccessManager
 //
@@ -207,3 +1330,5 @@ QNetworkReply * Pillow::ElasticNetworkAccessManager::createRequest(QNetworkAcces
 
 	return static_cast<NamOpener*>(nam)->doCreateRequest(op, request, outgoingData);
 }
+
+#include "HttpHandlerProxy.moc"
@@ -16,20 +16,54 @@
 #ifndef QNETWORKREQUEST_H
 #include <QtNetwork/QNetworkRequest>
 #endif // QNETWORKREQUEST_H
+#ifndef QPOINTER_H
+#include <QtCore/QPointer>
+#endif // QPOINTER_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+#ifndef QSET_H
+#include <QtCore/QSet>
+#endif // QSET_H
+#ifndef QPAIR_H
+#include <QtCore/QPair>
+#endif // QPAIR_H
+
+class QTimer;
 
 namespace Pillow
 {
 	class ElasticNetworkAccessManager;
 	class HttpHandlerProxyPipe;
+	class HttpHandlerClientProxyPipe;
+	class HttpClient;
+	class HttpUpstreamGroup;
+	class HttpResponseCache;
+	struct HttpClientRequest;
+	struct HttpCachedResponse;
+	struct HttpCacheFetch;
+
+	//
+	// HttpHandlerProxy: a proxy handler that talks to the proxied server through a QNetworkAccessManager.
+	//
+	// Request content gets buffered by the connection before the request is proxied, unless the handler is also
+	// connected to the requestHeadersReady signal of the server: handleRequestHeaders() then sends the request right
+	// away and streams the content to the proxied server as it arrives, so that uploads do not get buffered whole.
+	// Only connect it when this handler is the one that answers every request with content.
+	//
 
 	class PILLOWCORE_EXPORT HttpHandlerProxy : public Pillow::HttpHandler
 	{
 		Q_OBJECT
 		QUrl _proxiedUrl;
+		QSet<Pillow::HttpConnection*> _streamedRequests; // Proxied since their headers arrived, waiting for requestReady.
 
 	protected:
 		ElasticNetworkAccessManager* _networkAccessManager;
 
+	public:
+		enum { ProxiedReplyReadBufferSize = 64 * 1024 }; // What the replies read ahead of a slow request; see QNetworkReply::setReadBufferSize().
+
 	public:
 		HttpHandlerProxy(QObject *parent = 0);
 		HttpHandlerProxy(const QUrl &proxiedUrl, QObject *parent = 0);
@@ -45,6 +79,16 @@ namespace Pillow
 
 	public:
 		virtual bool handleRequest(Pillow::HttpConnection *request);
+
+	public slots:
+		virtual bool handleRequestHeaders(Pillow::HttpConnection *request);
+
+	private:
+		void proxyRequest(Pillow::HttpConnection* request);
+
+	private slots:
+		void streamedRequest_closed(Pillow::HttpConnection* request);
+		void streamedRequest_destroyed(QObject* request);
 	};
 
 	class PILLOWCORE_EXPORT HttpHandlerProxyPipe : public QObject
@@ -70,10 +114,217 @@ namespace Pillow
 		virtual void pump(const QByteArray& data);
 
 	private slots:
+		void request_ready();
+		void request_writeBufferDrained();
 		void proxiedReply_readyRead();
 		void proxiedReply_finished();
 	};
 
+	//
+	// HttpHandlerClientProxy: a proxy handler that talks to the proxied server through a pool of
+	// Pillow::HttpClient instead of a QNetworkAccessManager. Request and response headers and
+	// content are relayed as they are received, without going through the QNetworkReply layer.
+	// As for HttpHandlerProxy, connect handleRequestHeaders() to the requestHeadersReady signal of
+	// the server to have the request content streamed to the proxied server rather than buffered.
+	//
+
+	class PILLOWCORE_EXPORT HttpHandlerClientProxy : public Pillow::HttpHandler
+	{
+		Q_OBJECT
+		QUrl _proxiedUrl;
+		QList<Pillow::HttpClient*> _idleClients;
+		int _maximumIdleClients;
+		QSet<Pillow::HttpConnection*> _streamedRequests; // Proxied since their headers arrived, waiting for requestReady.
+
+	public:
+		enum { DefaultMaximumIdleClients = 64 };
+		enum { ClientReadBufferSize = 64 * 1024 }; // What the clients read ahead of a slow request; see HttpClient::setReadBufferSize().
+
+	public:
+		HttpHandlerClientProxy(QObject *parent = 0);
+		HttpHandlerClientProxy(const QUrl &proxiedUrl, QObject *parent = 0);
+		~HttpHandlerClientProxy();
+
+		const QUrl& proxiedUrl() const { return _proxiedUrl; }
+		void setProxiedUrl(const QUrl& proxiedUrl);
+
+		// Maximum number of idle clients (and their kept-alive connections) to keep around for future requests.
+		inline int maximumIdleClients() const { return _maximumIdleClients; }
+		void setMaximumIdleClients(int maximumIdleClients);
+
+	protected:
+		virtual Pillow::HttpClient* takeClient();
+		virtual void putClient(Pillow::HttpClient* client);
+		virtual Pillow::HttpHandlerClientProxyPipe* createPipe(Pillow::HttpConnection* request, Pillow::HttpClient* client);
+
+		// Fill proxiedRequest with the method, uri, headers and content of request, targeted at proxiedUrl.
+		// For streamed requests, only the content length is set; the pipe writes the content as it arrives.
+		void prepareProxiedRequest(Pillow::HttpConnection* request, const QUrl& proxiedUrl, Pillow::HttpClientRequest& proxiedRequest);
+
+		// Switch request to streamed content and remember it, for handleRequest() to recognize it with takeStreamedRequest()
+		// once its content is received. Returns false if the content cannot be streamed.
+		bool addStreamedRequest(Pillow::HttpConnection* request);
+		bool takeStreamedRequest(Pillow::HttpConnection* request);
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection *request);
+
+	public slots:
+		virtual bool handleRequestHeaders(Pillow::HttpConnection *request);
+
+	private:
+		void proxyRequest(Pillow::HttpConnection* request);
+
+	private slots:
+		void pipe_clientReleased(Pillow::HttpClient* client);
+		void streamedRequest_closed(Pillow::HttpConnection* request);
+		void streamedRequest_destroyed(QObject* request);
+	};
+
+	//
+	// HttpHandlerBalancingProxy: a proxy handler that spreads requests over the upstreams of a Pillow::HttpUpstreamGroup.
+	// Requests that arrive while all healthy upstreams are using all of their connections wait for one to be released,
+	// in a queue of at most maximumPendingRequests, for at most pendingRequestTimeout. Requests that arrive while no
+	// upstream is healthy or the queue is full, or that waited for too long, get a "503 Service Unavailable" response.
+	//
+
+	class PILLOWCORE_EXPORT HttpHandlerBalancingProxy : public Pillow::HttpHandlerClientProxy
+	{
+		Q_OBJECT
+		typedef QPair<Pillow::HttpConnection*, qint64> PendingRequest; // The request, and when it got queued (see HttpConnection::now()).
+		QPointer<Pillow::HttpUpstreamGroup> _upstreamGroup;
+		QList<PendingRequest> _pendingRequests;
+		int _maximumPendingRequests;
+		int _pendingRequestTimeout;
+		QTimer* _pendingRequestTimer;
+
+	public:
+		enum { DefaultMaximumPendingRequests = 1024 };
+		enum { DefaultPendingRequestTimeout = 10 * 1000 };
+
+	public:
+		HttpHandlerBalancingProxy(QObject *parent = 0);
+		HttpHandlerBalancingProxy(Pillow::HttpUpstreamGroup* upstreamGroup, QObject *parent = 0);
+
+		inline Pillow::HttpUpstreamGroup* upstreamGroup() const { return _upstreamGroup; }
+		void setUpstreamGroup(Pillow::HttpUpstreamGroup* upstreamGroup);
+
+		// Maximum number of requests waiting for an upstream connection. Use 0 to answer them with a 503 right away.
+		inline int maximumPendingRequests() const { return _maximumPendingRequests; }
+		void setMaximumPendingRequests(int maximumPendingRequests);
+
+		// Time, in milliseconds, for which a request waits for an upstream connection before getting a 503.
+		inline int pendingRequestTimeout() const { return _pendingRequestTimeout; }
+		void setPendingRequestTimeout(int msecs);
+
+	protected:
+		void proxyRequest(Pillow::HttpConnection* request, Pillow::HttpClient* client, const QUrl& upstreamUrl);
+
+	private:
+		void removePendingRequest(Pillow::HttpConnection* request);
+		void schedulePendingRequestTimeout();
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection *request);
+		virtual bool handleRequestHeaders(Pillow::HttpConnection *request); // Only streams when an upstream connection is available right away.
+
+	private slots:
+		void pipe_upstreamClientReleased(Pillow::HttpClient* client);
+		void upstreamGroup_clientReleased();
+		void pendingRequest_closed(Pillow::HttpConnection* request);
+		void pendingRequest_destroyed(QObject* request);
+		void pendingRequestTimer_timeout();
+	};
+
+	//
+	// HttpHandlerCachingProxy: an HttpHandlerClientProxy that keeps the cacheable responses to GET requests in a Pillow::HttpResponseCache.
+	// Fresh stored responses are served without contacting the proxied server; stale ones get revalidated using their
+	// ETag or Last-Modified validators. Concurrent misses for the same resource are coalesced into a single proxied request.
+	//
+
+	class PILLOWCORE_EXPORT HttpHandlerCachingProxy : public Pillow::HttpHandlerClientProxy
+	{
+		Q_OBJECT
+		Pillow::HttpResponseCache* _cache;
+		QHash<QByteArray, Pillow::HttpCacheFetch*> _fetchesByKey;
+		QHash<Pillow::HttpClient*, Pillow::HttpCacheFetch*> _fetchesByClient;
+		QHash<Pillow::HttpConnection*, Pillow::HttpCacheFetch*> _fetchesByRequest;
+
+	public:
+		HttpHandlerCachingProxy(QObject *parent = 0);
+		HttpHandlerCachingProxy(const QUrl &proxiedUrl, QObject *parent = 0);
+		~HttpHandlerCachingProxy();
+
+		inline Pillow::HttpResponseCache* cache() const { return _cache; }
+
+	protected:
+		virtual QByteArray cacheKey(Pillow::HttpConnection* request) const; // Defaults to the request path and query string.
+		virtual void writeCachedResponse(Pillow::HttpConnection* request, const Pillow::HttpCachedResponse& response);
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection *request);
+		virtual bool handleRequestHeaders(Pillow::HttpConnection *request); // Only streams the requests that are not cached.
+
+	private:
+		void startFetch(Pillow::HttpConnection* request, const QByteArray& key, const QByteArray& fetchKey, const Pillow::HttpCachedResponse* storedResponse);
+		void startStreaming(Pillow::HttpCacheFetch* fetch);
+		void addFetchRequest(Pillow::HttpCacheFetch* fetch, Pillow::HttpConnection* request);
+		void removeFetchRequest(Pillow::HttpConnection* request);
+		void releaseFetch(Pillow::HttpCacheFetch* fetch);
+
+	private slots:
+		void fetch_headersCompleted();
+		void fetch_contentReadyRead();
+		void fetch_finished();
+		void fetchRequest_writeBufferDrained(Pillow::HttpConnection* request);
+		void fetchRequest_completed(Pillow::HttpConnection* request);
+		void fetchRequest_closed(Pillow::HttpConnection* request);
+		void fetchRequest_destroyed(QObject* request);
+	};
+
+	class PILLOWCORE_EXPORT HttpHandlerClientProxyPipe : public QObject
+	{
+		Q_OBJECT
+
+	protected:
+		Pillow::HttpConnection* _request;
+		Pillow::HttpClient* _client;
+		bool _headersSent;
+		bool _broken;
+		bool _responseHeadersReceived;
+		bool _responseFinished; // The proxied response finished while the request content was still being received.
+
+	public:
+		HttpHandlerClientProxyPipe(Pillow::HttpConnection* request, Pillow::HttpClient* client);
+		~HttpHandlerClientProxyPipe();
+
+		Pillow::HttpConnection* request() const { return _request; }
+		Pillow::HttpClient* client() const { return _client; }
+
+	protected slots:
+		virtual void teardown();
+		virtual void sendHeaders();
+		virtual void pump(const QByteArray& data);
+
+	private slots:
+		void request_contentReceived(Pillow::HttpConnection* request, const QByteArray& data);
+		void request_ready();
+		void request_completed();
+		void request_writeBufferDrained();
+		void client_headersCompleted();
+		void client_contentReadyRead();
+		void client_contentWritten();
+		void client_finished();
+		void client_destroyed();
+
+	private:
+		void finish();
+		void release();
+
+	signals:
+		void clientReleased(Pillow::HttpClient* client); // The pipe is done with the client; it can be used for another request.
+	};
+
 	class PILLOWCORE_EXPORT ElasticNetworkAccessManager : public QNetworkAccessManager
 	{
 		Q_OBJECT
@@ -1,11 +1,16 @@
 #include "HttpHandlerQtScript.h"
 #include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
 #include <QtScript/QScriptEngine>
 #include <QtScript/QScriptValueIterator>
 #include <QtCore/QUrl>
 #include <QFile>
-#include <QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDir>
+#include <QtCore/QTimer>
 using namespace Pillow;
+using Pillow::ByteArrayHelpers::detachedCopy;
 
 static QScriptValue toScriptValue(QScriptEngine *engine, const Pillow::HttpHeaderCollection &headers)
 {
@@ -75,28 +80,153 @@ void HttpHandlerQtScript::setScriptFunction(const QScriptValue &scriptFunction)
 		registerMarshallers(scriptFunction.engine());
 }
 
-bool HttpHandlerQtScript::handleRequest(Pillow::HttpConnection *connection)
+//
+// Request script objects
+//
+// The request objects handed to scripts get their fields from getters on a prototype shared by all
+// the requests of an engine, so that a field only gets converted when the script reads it. The
+// converted value is then cached on the request object itself. The connection is the object's data.
+//
+// The connection only holds the fields until the response completes, which can happen while the script
+// still runs, or after it returned and kept the request object. The fields the script did not read by then
+// get read right before the connection lets go of them, so that the request object keeps its values.
+//
+
+namespace Pillow
 {
-	if (!_scriptFunction.isFunction()) return false;
+	// Holds the request prototype of an engine for one type of connection. Child of the engine, named after the connection class.
+	class HttpHandlerQtScriptPrototype : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		QScriptValue prototype;
+		HttpHandlerQtScriptPrototype(QObject* parent, const QString& name) : QObject(parent) { setObjectName(name); }
+	};
+
+	// Reads the fields of a request object that were not read yet, through the getters of its prototype, which cache them.
+	static void cacheRequestFields(const QScriptValue& requestObject)
+	{
+		for (QScriptValueIterator it(requestObject.prototype()); it.hasNext();)
+		{
+			it.next();
+			if (!requestObject.property(it.name(), QScriptValue::ResolveLocal).isValid())
+				requestObject.property(it.name());
+		}
+	}
+
+	// Caches the fields of a request object once its connection completes the response or closes. Child of the connection.
+	class HttpHandlerQtScriptRequestGuard : public QObject
+	{
+		Q_OBJECT
+		QScriptValue _requestObject;
 
-	QScriptEngine* engine = _scriptFunction.engine();
+	public:
+		HttpHandlerQtScriptRequestGuard(Pillow::HttpConnection* connection, const QScriptValue& requestObject)
+			: QObject(connection), _requestObject(requestObject)
+		{
+			connect(connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(connection_done()));
+			connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_done()));
+		}
+
+	private slots:
+		void connection_done()
+		{
+			// The connection may go on with the next request right away: only ever act for this one.
+			disconnect(parent(), 0, this, 0);
+			cacheRequestFields(_requestObject);
+			_requestObject = QScriptValue();
+			deleteLater();
+		}
+	};
+
+	class HttpHandlerQtScriptConnection;
+}
+
+// The fields of a Pillow::HttpConnection remain valid until its response completes, while those of a pooled job only
+// remain valid until the script function returns.
+static void guardRequestFields(Pillow::HttpConnection* connection, const QScriptValue& requestObject) { new HttpHandlerQtScriptRequestGuard(connection, requestObject); }
+static void releaseRequestFields(Pillow::HttpConnection*, const QScriptValue&) {}
+static void guardRequestFields(Pillow::HttpHandlerQtScriptConnection*, const QScriptValue&) {}
+static void releaseRequestFields(Pillow::HttpHandlerQtScriptConnection*, const QScriptValue& requestObject) { cacheRequestFields(requestObject); }
+
+template <typename Connection>
+struct RequestScriptGetters
+{
+	static inline Connection* connection(QScriptContext* context) { return static_cast<Connection*>(context->thisObject().data().toQObject()); }
+
+	static inline QScriptValue cache(QScriptContext* context, const QScriptValue& value)
+	{
+		// Defining the property on the request object shadows the prototype's getter from now on.
+		context->thisObject().setProperty(context->callee().data().toString(), value, QScriptValue::PropertyFlags());
+		return value;
+	}
+
+	static QScriptValue nativeRequest(QScriptContext* context, QScriptEngine*)
+	{
+		return context->thisObject().data();
+	}
+
+	template <const QByteArray& (Connection::*field)() const>
+	static QScriptValue decodedField(QScriptContext* context, QScriptEngine*)
+	{
+		return cache(context, QUrl::fromPercentEncoding((connection(context)->*field)()));
+	}
+
+	static QScriptValue requestHeaders(QScriptContext* context, QScriptEngine* engine)
+	{
+		return cache(context, qScriptValueFromValue(engine, connection(context)->requestHeaders()));
+	}
+
+	static QScriptValue requestQueryParams(QScriptContext* context, QScriptEngine* engine)
+	{
+		QList<QPair<QString, QString> > queryParams = QUrl(connection(context)->requestUri()).queryItems();
+		QScriptValue queryParamsObject = engine->newObject();
+		for (int i = 0, iE = queryParams.size(); i < iE; ++i)
+			queryParamsObject.setProperty(queryParams.at(i).first, queryParams.at(i).second);
+		return cache(context, queryParamsObject);
+	}
+
+	static void addGetter(QScriptEngine* engine, QScriptValue& prototype, const QString& name, QScriptEngine::FunctionSignature getter)
+	{
+		QScriptValue getterFunction = engine->newFunction(getter);
+		getterFunction.setData(name);
+		prototype.setProperty(name, getterFunction, QScriptValue::PropertyGetter);
+	}
+
+	static QScriptValue prototype(QScriptEngine* engine)
+	{
+		const QString name = QLatin1String(Connection::staticMetaObject.className());
+		HttpHandlerQtScriptPrototype* holder = engine->findChild<HttpHandlerQtScriptPrototype*>(name);
+		if (holder) return holder->prototype;
+
+		holder = new HttpHandlerQtScriptPrototype(engine, name);
+		QScriptValue& prototype = holder->prototype = engine->newObject();
+		addGetter(engine, prototype, "nativeRequest", &nativeRequest);
+		addGetter(engine, prototype, "requestMethod", &decodedField<&Connection::requestMethod>);
+		addGetter(engine, prototype, "requestUri", &decodedField<&Connection::requestUri>);
+		addGetter(engine, prototype, "requestFragment", &decodedField<&Connection::requestFragment>);
+		addGetter(engine, prototype, "requestPath", &decodedField<&Connection::requestPath>);
+		addGetter(engine, prototype, "requestQueryString", &decodedField<&Connection::requestQueryString>);
+		addGetter(engine, prototype, "requestHeaders", &requestHeaders);
+		addGetter(engine, prototype, "requestContent", &decodedField<&Connection::requestContent>);
+		addGetter(engine, prototype, "requestQueryParams", &requestQueryParams);
+		return prototype;
+	}
+};
+
+// Connection is either a Pillow::HttpConnection or, for pooled engines, a Pillow::HttpHandlerQtScriptConnection.
+template <typename Connection>
+static bool callScriptFunction(const QScriptValue& scriptFunction, Connection* connection)
+{
+	QScriptEngine* engine = scriptFunction.engine();
 	QScriptValue requestObject = engine->newObject();
-	requestObject.setProperty("nativeRequest", _scriptFunction.engine()->newQObject(connection));
-	requestObject.setProperty("requestMethod", QUrl::fromPercentEncoding(connection->requestMethod()));
-	requestObject.setProperty("requestUri", QUrl::fromPercentEncoding(connection->requestUri()));
-	requestObject.setProperty("requestFragment", QUrl::fromPercentEncoding(connection->requestFragment()));
-	requestObject.setProperty("requestPath", QUrl::fromPercentEncoding(connection->requestPath()));
-	requestObject.setProperty("requestQueryString", QUrl::fromPercentEncoding(connection->requestQueryString()));
-	requestObject.setProperty("requestHeaders", qScriptValueFromValue(engine, connection->requestHeaders()));
-	requestObject.setProperty("requestContent", QUrl::fromPercentEncoding(connection->requestContent()));
-
-	QList<QPair<QString, QString> > queryParams = QUrl(connection->requestUri()).queryItems();
-	QScriptValue queryParamsObject = engine->newObject();
-	for (int i = 0, iE = queryParams.size(); i < iE; ++i)
-		queryParamsObject.setProperty(queryParams.at(i).first, queryParams.at(i).second);
-	requestObject.setProperty("requestQueryParams", queryParamsObject);
-
-	QScriptValue result = _scriptFunction.call(_scriptFunction, QScriptValueList() << requestObject);
+	requestObject.setPrototype(RequestScriptGetters<Connection>::prototype(engine));
+	requestObject.setData(engine->newQObject(connection));
+	guardRequestFields(connection, requestObject);
+
+	QScriptValue result = scriptFunction.call(scriptFunction, QScriptValueList() << requestObject);
+	releaseRequestFields(connection, requestObject);
 
 	if (result.isError())
 	{
@@ -112,77 +242,459 @@ bool HttpHandlerQtScript::handleRequest(Pillow::HttpConnection *connection)
 	return result.toBool();
 }
 
+bool HttpHandlerQtScript::handleRequest(Pillow::HttpConnection *connection)
+{
+	if (!_scriptFunction.isFunction()) return false;
+	return callScriptFunction(_scriptFunction, connection);
+}
+
 //
 // HttpHandlerQtScriptFile
 //
 
 HttpHandlerQtScriptFile::HttpHandlerQtScriptFile(QScriptEngine* engine, const QString &fileName, const QString &functionName, bool autoReload, QObject *parent)
-: HttpHandlerQtScript(parent)
+: HttpHandlerQtScript(parent), _fileName(fileName), _functionName(functionName), _autoReload(false), _loaded(false), _watcher(0), _reloadTimer(0)
 {
 	_scriptObject = engine->newObject();
-	setFileName(fileName);
-	setFunctionName(functionName);
 	setAutoReload(autoReload);
+	load();
 }
 
 void HttpHandlerQtScriptFile::setFileName(const QString &fileName)
 {
 	if (_fileName == fileName) return;
 	_fileName = fileName;
-
-	if (!QFile::exists(fileName))
-		qWarning() << "HttpHandlerQtScriptFile::setFileName: file" << fileName << "does not exist. This handler won't be able to handle requests.";
+	_loaded = false;
+	updateWatcher();
+	load();
 }
 
 void HttpHandlerQtScriptFile::setFunctionName(const QString &functionName)
 {
 	if (_functionName == functionName) return;
 	_functionName = functionName;
+	_loaded = false;
+	load();
+}
+
+void HttpHandlerQtScriptFile::load()
+{
+	if (!reloadScript(&_errorMessage))
+		qWarning() << _errorMessage << "- this handler won't be able to handle requests until the script loads.";
 }
 
 void HttpHandlerQtScriptFile::setAutoReload(bool autoReload)
 {
 	if (_autoReload == autoReload) return;
 	_autoReload = autoReload;
+
+	if (_autoReload && _watcher == 0)
+	{
+		_watcher = new QFileSystemWatcher(this);
+		connect(_watcher, SIGNAL(fileChanged(QString)), this, SLOT(watcher_fileChanged()));
+		connect(_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(watcher_directoryChanged()));
+		_reloadTimer = new QTimer(this);
+		_reloadTimer->setSingleShot(true);
+		_reloadTimer->setInterval(ReloadDelay);
+		connect(_reloadTimer, SIGNAL(timeout()), this, SLOT(reloadTimer_timeout()));
+	}
+	else if (!_autoReload && _watcher != 0)
+	{
+		delete _watcher; _watcher = 0;
+		delete _reloadTimer; _reloadTimer = 0;
+	}
+
+	updateWatcher();
+}
+
+void HttpHandlerQtScriptFile::updateWatcher()
+{
+	if (_watcher == 0) return;
+
+	// The directory tells when the file gets created, or comes back after being deleted, as it then cannot be watched itself.
+	const QString directory = QFileInfo(_fileName).absolutePath();
+	if (_watcher->directories().size() != 1 || _watcher->directories().first() != directory)
+	{
+		if (!_watcher->directories().isEmpty()) _watcher->removePaths(_watcher->directories());
+		if (QDir(directory).exists()) _watcher->addPath(directory);
+	}
+
+	if (_watcher->files().size() == 1 && _watcher->files().first() == _fileName) return;
+
+	if (!_watcher->files().isEmpty()) _watcher->removePaths(_watcher->files());
+	if (QFile::exists(_fileName)) _watcher->addPath(_fileName);
+}
+
+bool HttpHandlerQtScriptFile::loadScript(QString* errorMessage)
+{
+	return _loaded || reloadScript(errorMessage);
+}
+
+bool HttpHandlerQtScriptFile::reloadScript(QString* errorMessage)
+{
+	qDebug() << "HttpHandlerQtScriptFile::reloadScript: (re)loading" << _fileName;
+	updateWatcher(); // The file may have been created or replaced since it was last watched.
+
+	QFile file(_fileName);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		if (errorMessage) *errorMessage = QString("HttpHandlerQtScriptFile::loadScript: Could not read file %1").arg(_fileName);
+		return false;
+	}
+
+	// Evaluate in a new scope object, so that a failed reload leaves the current version of the script untouched.
+	QScriptEngine* engine = _scriptObject.engine();
+	QScriptValue scriptObject = engine->newObject();
+	QScriptContext* context = engine->pushContext();
+	context->setActivationObject(scriptObject);
+	context->setThisObject(scriptObject);
+	QScriptValue result = engine->evaluate(file.readAll(), _fileName);
+	engine->popContext();
+
+	if (result.isError())
+	{
+		if (errorMessage) *errorMessage = QString("HttpHandlerQtScriptFile::loadScript: Error while evaluating script %1: %2").arg(_fileName).arg(objectToString(result));
+		return false;
+	}
+
+	QScriptValue scriptFunction = scriptObject.property(_functionName);
+	if (!scriptFunction.isFunction())
+	{
+		if (errorMessage) *errorMessage = QString("HttpHandlerQtScriptFile::loadScript: Error while evaluating script %1: '%2' is not a function defined in the script").arg(_fileName).arg(_functionName);
+		return false;
+	}
+
+	_scriptObject = scriptObject;
+	_loaded = true;
+	_errorMessage.clear();
+	setScriptFunction(scriptFunction);
+	return true;
+}
+
+void HttpHandlerQtScriptFile::watcher_fileChanged()
+{
+	// Editors tend to write files in several steps, or to replace them: wait for the changes to settle.
+	_reloadTimer->start();
+}
+
+void HttpHandlerQtScriptFile::watcher_directoryChanged()
+{
+	// Only the file matters: it is there, but not watched, when it was missing or got replaced since it was last loaded.
+	if (!_watcher->files().contains(_fileName) && QFile::exists(_fileName))
+		_reloadTimer->start();
+}
+
+void HttpHandlerQtScriptFile::reloadTimer_timeout()
+{
+	if (!_loaded)
+	{
+		load();
+		return;
+	}
+
+	QString errorMessage;
+	if (!reloadScript(&errorMessage))
+		qWarning() << errorMessage << "- keeping the previously loaded version.";
 }
 
 bool HttpHandlerQtScriptFile::handleRequest(Pillow::HttpConnection *request)
 {
-	if (!_lastModified.isValid() || (_autoReload && QFileInfo(_fileName).lastModified() > _lastModified))
+	if (!_loaded)
+	{
+		request->writeResponseString(500, HttpHeaderCollection(), _errorMessage);
+		return true;
+	}
+
+	return HttpHandlerQtScript::handleRequest(request);
+}
+
+//
+// Pillow::HttpHandlerQtScriptJob
+//
+// A request handed to a pooled engine. The request members are deep copies, as the connection
+// may be closed and reused while the script is still running.
+//
+
+namespace Pillow
+{
+	struct HttpHandlerQtScriptJob
 	{
-		// Time to (re)load the script.
-		qDebug() << "HttpHandlerQtScriptFile::handleRequest: (re)loading" << _fileName;
-		QFile file(_fileName);
-		if (!file.open(QIODevice::ReadOnly))
+		Pillow::HttpConnection* connection; // Only used from the pool's thread; null once the request is completed or closed.
+		Pillow::HttpHandlerQtScriptWorker* worker;
+		QByteArray requestMethod, requestUri, requestFragment, requestPath, requestQueryString, requestHttpVersion, requestContent;
+		Pillow::HttpHeaderCollection requestHeaders;
+
+		HttpHandlerQtScriptJob(Pillow::HttpConnection* connection)
+			: connection(connection), worker(0),
+			  requestMethod(detachedCopy(connection->requestMethod())), requestUri(detachedCopy(connection->requestUri())),
+			  requestFragment(detachedCopy(connection->requestFragment())), requestPath(detachedCopy(connection->requestPath())),
+			  requestQueryString(detachedCopy(connection->requestQueryString())), requestHttpVersion(detachedCopy(connection->requestHttpVersion())),
+			  requestContent(detachedCopy(connection->requestContent()))
 		{
-			request->writeResponseString(500, HttpHeaderCollection(), QString("HttpHandlerQtScriptFile::handleRequest: Could not read file %1").arg(_fileName));
-			return true;
+			const Pillow::HttpHeaderCollection& headers = connection->requestHeaders();
+			requestHeaders.reserve(headers.size());
+			for (int i = 0, iE = headers.size(); i < iE; ++i)
+				requestHeaders.append(HttpHeader(detachedCopy(headers.at(i).first), detachedCopy(headers.at(i).second)));
 		}
+	};
+}
+Q_DECLARE_METATYPE(Pillow::HttpHandlerQtScriptJob*)
+
+//
+// Pillow::HttpHandlerQtScriptConnection
+//
+// What the script of a pooled engine sees as request.nativeRequest. It has the request members of a
+// Pillow::HttpConnection and forwards the response calls to the pool's thread.
+//
+
+namespace Pillow
+{
+	class HttpHandlerQtScriptConnection : public QObject
+	{
+		Q_OBJECT
+		Q_PROPERTY(QByteArray requestMethod READ requestMethod)
+		Q_PROPERTY(QByteArray requestUri READ requestUri)
+		Q_PROPERTY(QByteArray requestPath READ requestPath)
+		Q_PROPERTY(QByteArray requestQueryString READ requestQueryString)
+		Q_PROPERTY(QByteArray requestFragment READ requestFragment)
+		Q_PROPERTY(QByteArray requestHttpVersion READ requestHttpVersion)
+		Q_PROPERTY(QByteArray requestContent READ requestContent)
+		Pillow::HttpHandlerQtScriptJob* _job;
+		Pillow::HttpConnection::State _state;
+
+	public:
+		HttpHandlerQtScriptConnection(QObject* parent) : QObject(parent), _job(0), _state(HttpConnection::Uninitialized) {}
 
-		QScriptEngine* engine = _scriptObject.engine();
-		_scriptObject = engine->newObject();
-		QScriptContext* context = engine->pushContext();
-		context->setActivationObject(_scriptObject);
-		context->setThisObject(_scriptObject);
-		QScriptValue result = engine->evaluate(file.readAll(), _fileName);
-		engine->popContext();
+		void setJob(Pillow::HttpHandlerQtScriptJob* job) { _job = job; _state = job ? HttpConnection::SendingHeaders : HttpConnection::Uninitialized; }
 
-		if (result.isError())
+		Pillow::HttpConnection::State state() const { return _state; }
+		const QByteArray& requestMethod() const { return _job->requestMethod; }
+		const QByteArray& requestUri() const { return _job->requestUri; }
+		const QByteArray& requestFragment() const { return _job->requestFragment; }
+		const QByteArray& requestPath() const { return _job->requestPath; }
+		const QByteArray& requestQueryString() const { return _job->requestQueryString; }
+		const QByteArray& requestHttpVersion() const { return _job->requestHttpVersion; }
+		const QByteArray& requestContent() const { return _job->requestContent; }
+		Q_INVOKABLE const Pillow::HttpHeaderCollection& requestHeaders() const { return _job->requestHeaders; }
+		Q_INVOKABLE QByteArray requestHeaderValue(const QByteArray& field) const { return _job->requestHeaders.getFieldValue(field); }
+
+	public slots:
+		void writeResponse(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QByteArray& content = QByteArray())
+		{
+			if (!checkState(HttpConnection::SendingHeaders, "writeResponse")) return;
+			_state = HttpConnection::Completed;
+			emit responseWritten(_job, statusCode, headers, content);
+		}
+
+		void writeResponseString(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QString& content = QString())
+		{
+			writeResponse(statusCode, headers, content.toUtf8());
+		}
+
+		void writeHeaders(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection())
+		{
+			if (!checkState(HttpConnection::SendingHeaders, "writeHeaders")) return;
+			_state = HttpConnection::SendingContent;
+			emit headersWritten(_job, statusCode, headers);
+		}
+
+		void writeContent(const QByteArray& content)
+		{
+			if (!checkState(HttpConnection::SendingContent, "writeContent")) return;
+			emit contentWritten(_job, content);
+		}
+
+		void endContent()
 		{
-			request->writeResponseString(500, HttpHeaderCollection(), QString("HttpHandlerQtScriptFile::handleRequest: Error while evaluating script %1: %2").arg(_fileName).arg(objectToString(result)));
-			return true;
+			if (!checkState(HttpConnection::SendingContent, "endContent")) return;
+			_state = HttpConnection::Completed;
+			emit contentEnded(_job);
 		}
 
-		QScriptValue scriptFunction = _scriptObject.property(_functionName);
-		if (!scriptFunction.isFunction())
+	private:
+		bool checkState(Pillow::HttpConnection::State state, const char* method) const
 		{
-			request->writeResponseString(500, HttpHeaderCollection(), QString("HttpHandlerQtScriptFile::handleRequest: Error while evaluating script %1: '%2' is not a function defined in the script").arg(_fileName).arg(_functionName));
-			return true;
+			if (_state == state) return true;
+			qWarning() << "HttpHandlerQtScriptConnection:" << method << "called in the wrong state (or after the script function returned); ignoring.";
+			return false;
 		}
 
-		_lastModified = QFileInfo(_fileName).lastModified();
-		setScriptFunction(scriptFunction);
+	signals:
+		void responseWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content);
+		void headersWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers);
+		void contentWritten(Pillow::HttpHandlerQtScriptJob* job, const QByteArray& content);
+		void contentEnded(Pillow::HttpHandlerQtScriptJob* job);
+	};
+
+	//
+	// Pillow::HttpHandlerQtScriptWorker
+	//
+	// Owns the engine of one of the threads of a Pillow::HttpHandlerQtScriptPool, and runs the jobs handed to it.
+	//
+
+	class HttpHandlerQtScriptWorker : public QObject
+	{
+		Q_OBJECT
+		QString _fileName, _functionName;
+		bool _autoReload;
+		Pillow::HttpHandlerQtScriptFile* _handler;
+		Pillow::HttpHandlerQtScriptConnection* _connection;
+
+	public:
+		HttpHandlerQtScriptWorker(const QString& fileName, const QString& functionName, bool autoReload)
+			: _fileName(fileName), _functionName(functionName), _autoReload(autoReload), _handler(0), _connection(0)
+		{}
+
+	public slots:
+		void initialize()
+		{
+			// Runs in the worker thread, so that the engine belongs to it.
+			_handler = new HttpHandlerQtScriptFile(new QScriptEngine(this), _fileName, _functionName, _autoReload, this);
+			_connection = new HttpHandlerQtScriptConnection(this);
+			connect(_connection, SIGNAL(responseWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection,QByteArray)), this, SIGNAL(responseWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection,QByteArray)));
+			connect(_connection, SIGNAL(headersWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection)), this, SIGNAL(headersWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection)));
+			connect(_connection, SIGNAL(contentWritten(Pillow::HttpHandlerQtScriptJob*,QByteArray)), this, SIGNAL(contentWritten(Pillow::HttpHandlerQtScriptJob*,QByteArray)));
+			connect(_connection, SIGNAL(contentEnded(Pillow::HttpHandlerQtScriptJob*)), this, SIGNAL(contentEnded(Pillow::HttpHandlerQtScriptJob*)));
+		}
+
+		void run(Pillow::HttpHandlerQtScriptJob* job)
+		{
+			bool handled = true;
+			_connection->setJob(job);
+
+			if (!_handler->isLoaded())
+				_connection->writeResponseString(500, HttpHeaderCollection(), _handler->errorMessage());
+			else
+				handled = callScriptFunction(_handler->scriptFunction(), _connection);
+
+			_connection->setJob(0);
+			emit jobFinished(job, handled);
+		}
+
+	signals:
+		void responseWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content);
+		void headersWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers);
+		void contentWritten(Pillow::HttpHandlerQtScriptJob* job, const QByteArray& content);
+		void contentEnded(Pillow::HttpHandlerQtScriptJob* job);
+		void jobFinished(Pillow::HttpHandlerQtScriptJob* job, bool handled);
+	};
+}
+
+//
+// HttpHandlerQtScriptPool
+//
+
+HttpHandlerQtScriptPool::HttpHandlerQtScriptPool(const QString& fileName, const QString& functionName, int threadCount, bool autoReload, QObject* parent)
+	: HttpHandler(parent), _fileName(fileName), _functionName(functionName), _autoReload(autoReload)
+{
+	qRegisterMetaType<Pillow::HttpHandlerQtScriptJob*>("Pillow::HttpHandlerQtScriptJob*");
+	qRegisterMetaType<Pillow::HttpHeaderCollection>("Pillow::HttpHeaderCollection");
+
+	if (!QFile::exists(fileName))
+		qWarning() << "HttpHandlerQtScriptPool::HttpHandlerQtScriptPool: file" << fileName << "does not exist. This handler won't be able to handle requests.";
+
+	for (int i = 0, iE = qMax(1, threadCount); i < iE; ++i)
+	{
+		QThread* thread = new QThread(this);
+		HttpHandlerQtScriptWorker* worker = new HttpHandlerQtScriptWorker(fileName, functionName, autoReload);
+		worker->moveToThread(thread);
+		connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+		connect(worker, SIGNAL(responseWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection,QByteArray)), this, SLOT(worker_responseWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection,QByteArray)));
+		connect(worker, SIGNAL(headersWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection)), this, SLOT(worker_headersWritten(Pillow::HttpHandlerQtScriptJob*,int,Pillow::HttpHeaderCollection)));
+		connect(worker, SIGNAL(contentWritten(Pillow::HttpHandlerQtScriptJob*,QByteArray)), this, SLOT(worker_contentWritten(Pillow::HttpHandlerQtScriptJob*,QByteArray)));
+		connect(worker, SIGNAL(contentEnded(Pillow::HttpHandlerQtScriptJob*)), this, SLOT(worker_contentEnded(Pillow::HttpHandlerQtScriptJob*)));
+		connect(worker, SIGNAL(jobFinished(Pillow::HttpHandlerQtScriptJob*,bool)), this, SLOT(worker_jobFinished(Pillow::HttpHandlerQtScriptJob*,bool)));
+		thread->start();
+		QMetaObject::invokeMethod(worker, "initialize", Qt::QueuedConnection);
+
+		_threads << thread;
+		_idleWorkers << worker;
 	}
+}
 
-	return HttpHandlerQtScript::handleRequest(request);
+HttpHandlerQtScriptPool::~HttpHandlerQtScriptPool()
+{
+	// Let the running scripts complete; their responses are dropped along with this pool.
+	foreach (QThread* thread, _threads)
+		thread->quit();
+	foreach (QThread* thread, _threads)
+		thread->wait();
+
+	qDeleteAll(_pendingJobs);
+	qDeleteAll(_runningJobs);
+}
+
+bool HttpHandlerQtScriptPool::handleRequest(Pillow::HttpConnection* connection)
+{
+	HttpHandlerQtScriptJob* job = new HttpHandlerQtScriptJob(connection);
+	_jobs.insert(connection, job);
+	connect(connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(connection_finished(Pillow::HttpConnection*)), Qt::UniqueConnection);
+	connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_finished(Pillow::HttpConnection*)), Qt::UniqueConnection);
+
+	if (_idleWorkers.isEmpty())
+		_pendingJobs.enqueue(job);
+	else
+		run(job, _idleWorkers.takeLast());
+
+	return true;
+}
+
+void HttpHandlerQtScriptPool::run(Pillow::HttpHandlerQtScriptJob* job, Pillow::HttpHandlerQtScriptWorker* worker)
+{
+	job->worker = worker;
+	_runningJobs << job;
+	QMetaObject::invokeMethod(worker, "run", Qt::QueuedConnection, Q_ARG(Pillow::HttpHandlerQtScriptJob*, job));
 }
+
+void HttpHandlerQtScriptPool::connection_finished(Pillow::HttpConnection* connection)
+{
+	HttpHandlerQtScriptJob* job = _jobs.take(connection);
+	if (job == 0) return;
+	job->connection = 0; // Anything the script still writes is dropped.
+	if (_pendingJobs.removeOne(job)) delete job;
+}
+
+void HttpHandlerQtScriptPool::worker_responseWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content)
+{
+	if (job->connection) job->connection->writeResponse(statusCode, headers, content);
+}
+
+void HttpHandlerQtScriptPool::worker_headersWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers)
+{
+	if (job->connection) job->connection->writeHeaders(statusCode, headers);
+}
+
+void HttpHandlerQtScriptPool::worker_contentWritten(Pillow::HttpHandlerQtScriptJob* job, const QByteArray& content)
+{
+	if (job->connection) job->connection->writeContent(content);
+}
+
+void HttpHandlerQtScriptPool::worker_contentEnded(Pillow::HttpHandlerQtScriptJob* job)
+{
+	if (job->connection) job->connection->endContent();
+}
+
+void HttpHandlerQtScriptPool::worker_jobFinished(Pillow::HttpHandlerQtScriptJob* job, bool handled)
+{
+	HttpHandlerQtScriptWorker* worker = job->worker;
+	_runningJobs.remove(job);
+
+	if (job->connection)
+	{
+		// The script returned without completing the response.
+		Pillow::HttpConnection* connection = job->connection;
+		_jobs.remove(connection);
+		if (connection->state() == HttpConnection::SendingHeaders)
+			connection->writeResponse(handled ? 500 : 404);
+		else if (connection->state() == HttpConnection::SendingContent)
+			connection->endContent();
+	}
+	delete job;
+
+	if (_pendingJobs.isEmpty())
+		_idleWorkers << worker;
+	else
+		run(_pendingJobs.dequeue(), worker);
+}
+
+#include "HttpHandlerQtScript.moc"
@@ -10,11 +10,22 @@
 #ifndef QSCRIPTVALUE_H
 #include <QtScript/QScriptValue>
 #endif // QSCRIPTVALUE_H
-#ifndef QDATETIME_H
-#include <QtCore/QDateTime>
-#endif // QDATETIME_H
+#ifndef QTHREAD_H
+#include <QtCore/QThread>
+#endif // QTHREAD_H
+#ifndef QQUEUE_H
+#include <QtCore/QQueue>
+#endif // QQUEUE_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+#ifndef QSET_H
+#include <QtCore/QSet>
+#endif // QSET_H
 
 class QScriptEngine;
+class QFileSystemWatcher;
+class QTimer;
 
 namespace Pillow
 {
@@ -35,14 +46,34 @@ namespace Pillow
 		virtual bool handleRequest(Pillow::HttpConnection *request);
 	};
 
+	//
+	// Pillow::HttpHandlerQtScriptFile
+	//
+	// Handles requests with a function defined in a script file. The script gets loaded right away, when the
+	// handler is created or its file or function name changes; until it loads, requests get a 500 response with
+	// the error.
+	//
+	// With autoReload, the file is watched for changes, and its directory for the file being created or replaced,
+	// so that a script missing at first gets loaded once it shows up. A changed script gets evaluated from the event
+	// loop, shortly after the last change, and only replaces the running version once it evaluated successfully.
+	// Requests never trigger a reload. As a QScriptEngine can only be used from its own thread, the evaluation
+	// still happens on the thread of the engine: the connections it serves wait for it to complete. Use
+	// Pillow::HttpHandlerQtScriptPool to keep serving requests from other engines meanwhile.
+	//
 	class PILLOWCORE_EXPORT HttpHandlerQtScriptFile : public HttpHandlerQtScript
 	{
 		Q_OBJECT
 		QString _fileName;
 		QString _functionName;
 		bool _autoReload;
+		bool _loaded;
+		QString _errorMessage;
 		QScriptValue _scriptObject;
-		QDateTime _lastModified;
+		QFileSystemWatcher* _watcher;
+		QTimer* _reloadTimer;
+
+	public:
+		enum { ReloadDelay = 100 }; // Milliseconds to wait for changes to the file to settle before reloading it.
 
 	public:
 		HttpHandlerQtScriptFile(QScriptEngine* engine, const QString& fileName, const QString& functionName, bool autoReload = true, QObject* parent = 0);
@@ -51,13 +82,86 @@ namespace Pillow
 		const QString& fileName() const { return _fileName; }
 		const QString& functionName() const { return _functionName; }
 		bool autoReload() const { return _autoReload; }
+		bool isLoaded() const { return _loaded; }
+		const QString& errorMessage() const { return _errorMessage; } // Why the script could not be loaded, while it is not.
 
 	public:
 		void setFileName(const QString& fileName);
 		void setFunctionName(const QString& functionName);
 		void setAutoReload(bool autoReload);
 
+		// Load the script if it was not successfully loaded yet.
+		// Returns false, and sets errorMessage, if the script could not be loaded.
+		bool loadScript(QString* errorMessage = 0);
+
+		// Evaluate the script file now. The script function only gets replaced if the evaluation succeeds.
+		// Returns false, and sets errorMessage, if the script could not be loaded.
+		bool reloadScript(QString* errorMessage = 0);
+
 		virtual bool handleRequest(Pillow::HttpConnection *request);
+
+	private slots:
+		void watcher_fileChanged();
+		void watcher_directoryChanged();
+		void reloadTimer_timeout();
+
+	private:
+		void updateWatcher();
+		void load();
+	};
+
+	struct HttpHandlerQtScriptJob;
+	class HttpHandlerQtScriptWorker;
+
+	//
+	// Pillow::HttpHandlerQtScriptPool
+	//
+	// Runs a script file on a pool of threads, each with its own QScriptEngine loading the file
+	// through a Pillow::HttpHandlerQtScriptFile. Requests go to the first free engine. The script gets
+	// a copy of the request, and the response methods it calls on request.nativeRequest get applied
+	// to the connection from the pool's thread.
+	//
+	// The script must write its response before returning. As it runs asynchronously, this handler
+	// accepts all requests: it responds with 404 Not Found when the script function returns false
+	// without having written a response.
+	//
+	class PILLOWCORE_EXPORT HttpHandlerQtScriptPool : public HttpHandler
+	{
+		Q_OBJECT
+		QString _fileName;
+		QString _functionName;
+		bool _autoReload;
+		QList<QThread*> _threads;
+		QList<Pillow::HttpHandlerQtScriptWorker*> _idleWorkers;
+		QQueue<Pillow::HttpHandlerQtScriptJob*> _pendingJobs;
+		QHash<Pillow::HttpConnection*, Pillow::HttpHandlerQtScriptJob*> _jobs; // The jobs, pending or running, of requests that are not completed yet.
+		QSet<Pillow::HttpHandlerQtScriptJob*> _runningJobs;
+
+	public:
+		HttpHandlerQtScriptPool(const QString& fileName, const QString& functionName, int threadCount = QThread::idealThreadCount(), bool autoReload = true, QObject* parent = 0);
+		~HttpHandlerQtScriptPool();
+
+		const QString& fileName() const { return _fileName; }
+		const QString& functionName() const { return _functionName; }
+		bool autoReload() const { return _autoReload; }
+		bool isLoaded() const { return _loaded; }
+		const QString& errorMessage() const { return _errorMessage; } // Why the script could not be loaded, while it is not.
+		int threadCount() const { return _threads.size(); }
+		int pendingRequestCount() const { return _pendingJobs.size(); } // Requests waiting for a free engine.
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection *connection);
+
+	private:
+		void run(Pillow::HttpHandlerQtScriptJob* job, Pillow::HttpHandlerQtScriptWorker* worker);
+
+	private slots:
+		void connection_finished(Pillow::HttpConnection* connection);
+		void worker_responseWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content);
+		void worker_headersWritten(Pillow::HttpHandlerQtScriptJob* job, int statusCode, const Pillow::HttpHeaderCollection& headers);
+		void worker_contentWritten(Pillow::HttpHandlerQtScriptJob* job, const QByteArray& content);
+		void worker_contentEnded(Pillow::HttpHandlerQtScriptJob* job);
+		void worker_jobFinished(Pillow::HttpHandlerQtScriptJob* job, bool handled);
 	};
 }
 
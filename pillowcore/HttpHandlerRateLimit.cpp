@@ -0,0 +1,258 @@
+#include "HttpHandlerRateLimit.h"
+#include "HttpConnection.h"
+#include <QtCore/QMutex>
+#include <QtCore/QTimer>
+#include <QtNetwork/QHostAddress>
+#include <math.h>
+#include <string.h>
+using namespace Pillow;
+
+namespace
+{
+	// Final mixing step of splitmix64: spreads the bits, some of which pick the shard and others the slot.
+	inline quint64 mix(quint64 x)
+	{
+		x ^= x >> 30; x *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+		x ^= x >> 27; x *= Q_UINT64_C(0x94d049bb133111eb);
+		x ^= x >> 31;
+		return x;
+	}
+
+	struct Slot
+	{
+		quint64 key; // 0 for free slots.
+		qint64 updatedAt;
+		double tokens;
+	};
+
+	// A bucket that refilled completely is the same as no bucket.
+	inline bool isIdle(const Slot& slot, qint64 now, double rate, int burst)
+	{
+		return slot.tokens + (now - slot.updatedAt) * rate / 1000.0 >= burst;
+	}
+}
+
+//
+// HttpRateLimiter
+//
+
+struct HttpRateLimiter::Shard
+{
+	QMutex mutex;
+	Slot* slots;
+	int capacity; // A power of two.
+	int count;
+
+	Shard() : slots(0), capacity(0), count(0) {}
+	~Shard() { delete[] slots; }
+
+	// The slot of key, or the free slot where it would go. Linear probing; the table is never more than half full.
+	inline Slot* find(quint64 key) const
+	{
+		const int mask = capacity - 1;
+		int index = int(key) & mask;
+		while (slots[index].key != 0 && slots[index].key != key)
+			index = (index + 1) & mask;
+		return slots + index;
+	}
+
+	// Rebuild the table without its idle keys, sized for the remaining ones plus one more. Returns how many went.
+	int rebuild(qint64 now, double rate, int burst)
+	{
+		int activeCount = 0;
+		for (int i = 0; i < capacity; ++i)
+			if (slots[i].key != 0 && !isIdle(slots[i], now, rate, burst)) ++activeCount;
+
+		int newCapacity = HttpRateLimiter::MinimumShardCapacity;
+		while ((activeCount + 1) * 2 > newCapacity) newCapacity *= 2;
+
+		Slot* oldSlots = slots;
+		const int oldCapacity = capacity, oldCount = count;
+		slots = new Slot[newCapacity];
+		memset(slots, 0, sizeof(Slot) * newCapacity);
+		capacity = newCapacity;
+		count = activeCount;
+
+		for (int i = 0; i < oldCapacity; ++i)
+			if (oldSlots[i].key != 0 && !isIdle(oldSlots[i], now, rate, burst))
+				*find(oldSlots[i].key) = oldSlots[i];
+		delete[] oldSlots;
+
+		return oldCount - activeCount;
+	}
+};
+
+HttpRateLimiter::HttpRateLimiter(double rate, int burst)
+	: _shards(new Shard[ShardCount]), _rate(qMax(0.0, rate)), _burst(qMax(1, burst))
+{
+	_clock.start();
+	for (int i = 0; i < ShardCount; ++i)
+	{
+		_shards[i].slots = new Slot[MinimumShardCapacity];
+		memset(_shards[i].slots, 0, sizeof(Slot) * MinimumShardCapacity);
+		_shards[i].capacity = MinimumShardCapacity;
+	}
+}
+
+HttpRateLimiter::~HttpRateLimiter()
+{
+	delete[] _shards;
+}
+
+bool HttpRateLimiter::tryAcquire(quint64 key)
+{
+	if (key == 0) key = 1;
+	const qint64 now = _clock.elapsed();
+	Shard& shard = _shards[(key >> 32) & (ShardCount - 1)]; // The low bits pick the slot.
+
+	QMutexLocker locker(&shard.mutex);
+	Slot* slot = shard.find(key);
+	if (slot->key == 0)
+	{
+		if ((shard.count + 1) * 2 > shard.capacity)
+		{
+			shard.rebuild(now, _rate, _burst);
+			slot = shard.find(key);
+		}
+		slot->key = key;
+		slot->tokens = _burst;
+		++shard.count;
+	}
+	else
+		slot->tokens = qMin(double(_burst), slot->tokens + (now - slot->updatedAt) * _rate / 1000.0);
+	slot->updatedAt = now;
+
+	if (slot->tokens < 1.0) return false;
+	slot->tokens -= 1.0;
+	return true;
+}
+
+int HttpRateLimiter::count() const
+{
+	int count = 0;
+	for (int i = 0; i < ShardCount; ++i)
+	{
+		QMutexLocker locker(&_shards[i].mutex);
+		count += _shards[i].count;
+	}
+	return count;
+}
+
+int HttpRateLimiter::evictIdle()
+{
+	const qint64 now = _clock.elapsed();
+	int evictedCount = 0;
+	for (int i = 0; i < ShardCount; ++i)
+	{
+		QMutexLocker locker(&_shards[i].mutex);
+		evictedCount += _shards[i].rebuild(now, _rate, _burst);
+	}
+	return evictedCount;
+}
+
+quint64 HttpRateLimiter::keyFor(const QHostAddress& address)
+{
+	if (address.protocol() == QAbstractSocket::IPv4Protocol)
+		return mix(address.toIPv4Address() | (Q_UINT64_C(4) << 32));
+	if (address.protocol() == QAbstractSocket::IPv6Protocol)
+	{
+		const Q_IPV6ADDR ipv6Address = address.toIPv6Address();
+		return keyFor(reinterpret_cast<const char*>(ipv6Address.c), 16);
+	}
+	return mix(0); // Local sockets and the like: one client.
+}
+
+quint64 HttpRateLimiter::keyFor(const char* data, int size)
+{
+	// FNV-1a.
+	quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+	for (const char* c = data, *cE = data + size; c < cE; ++c)
+		hash = (hash ^ quint8(*c)) * Q_UINT64_C(0x100000001b3);
+	return mix(hash);
+}
+
+//
+// HttpHandlerRateLimit
+//
+
+HttpHandlerRateLimit::HttpHandlerRateLimit(double requestsPerSecond, int burst, QObject* parent)
+	: HttpHandler(parent), _limiter(new HttpRateLimiter(requestsPerSecond, burst)), _ownsLimiter(true)
+{
+	initialize();
+}
+
+HttpHandlerRateLimit::HttpHandlerRateLimit(Pillow::HttpRateLimiter* limiter, QObject* parent)
+	: HttpHandler(parent), _limiter(limiter), _ownsLimiter(false)
+{
+	initialize();
+}
+
+HttpHandlerRateLimit::~HttpHandlerRateLimit()
+{
+	if (_ownsLimiter) delete _limiter;
+}
+
+void HttpHandlerRateLimit::initialize()
+{
+	const int retryAfter = _limiter->rate() > 0 ? qMax(1, int(ceil(1.0 / _limiter->rate()))) : 3600;
+	_response = HttpPreparedResponse(429, HttpHeaderCollection() << HttpHeader("Retry-After", QByteArray::number(retryAfter)), "Too Many Requests");
+
+	_evictionTimer = new QTimer(this);
+	connect(_evictionTimer, SIGNAL(timeout()), this, SLOT(evictionTimer_timeout()));
+	_evictionTimer->start(EvictionInterval);
+}
+
+void HttpHandlerRateLimit::setKeyHeader(const QByteArray& keyHeader)
+{
+	_keyHeader = keyHeader;
+}
+
+void HttpHandlerRateLimit::setResponse(const Pillow::HttpPreparedResponse& response)
+{
+	_response = response;
+}
+
+bool HttpHandlerRateLimit::handleRequest(Pillow::HttpConnection* connection)
+{
+	quint64 key = 0;
+	if (!_keyHeader.isEmpty())
+	{
+		const QByteArray& value = connection->requestHeaderValue(_keyHeader);
+		if (!value.isEmpty()) key = HttpRateLimiter::keyFor(value);
+	}
+	if (key == 0) key = addressKey(connection);
+
+	if (_limiter->tryAcquire(key)) return false;
+	connection->writePreparedResponse(_response);
+	return true;
+}
+
+quint64 HttpHandlerRateLimit::addressKey(Pillow::HttpConnection* connection)
+{
+	// Getting the remote address builds a QHostAddress, which allocates: do it once per connection, not per request.
+	QHash<Pillow::HttpConnection*, quint64>::const_iterator it = _addressKeys.constFind(connection);
+	if (it != _addressKeys.constEnd()) return it.value();
+
+	const quint64 key = HttpRateLimiter::keyFor(connection->remoteAddress());
+	_addressKeys.insert(connection, key);
+	connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_closed(Pillow::HttpConnection*)));
+	connect(connection, SIGNAL(destroyed(QObject*)), this, SLOT(connection_destroyed(QObject*)));
+	return key;
+}
+
+void HttpHandlerRateLimit::evictionTimer_timeout()
+{
+	_limiter->evictIdle();
+}
+
+void HttpHandlerRateLimit::connection_closed(Pillow::HttpConnection* connection)
+{
+	// The server may reuse the connection object for another client.
+	_addressKeys.remove(connection);
+	disconnect(connection, 0, this, 0);
+}
+
+void HttpHandlerRateLimit::connection_destroyed(QObject* connection)
+{
+	_addressKeys.remove(static_cast<Pillow::HttpConnection*>(connection));
+}
@@ -0,0 +1,115 @@
+#ifndef PILLOW_HTTPHANDLERRATELIMIT_H
+#define PILLOW_HTTPHANDLERRATELIMIT_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHANDLER_H
+#include "HttpHandler.h"
+#endif // PILLOW_HTTPHANDLER_H
+#ifndef QELAPSEDTIMER_H
+#include <QtCore/QElapsedTimer>
+#endif // QELAPSEDTIMER_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+
+class QHostAddress;
+class QTimer;
+
+namespace Pillow
+{
+	//
+	// Pillow::HttpRateLimiter
+	//
+	// Token buckets per client key: each key may do burst requests at once, then rate requests per second.
+	// Buckets refill lazily when their key comes back. A bucket that refilled completely is the same as
+	// no bucket at all, so evictIdle() forgets those keys without changing any outcome.
+	//
+	// Keys are 64 bit hashes (see keyFor()), stored in open-addressing tables split into shards that each
+	// have their own lock, so that servers in several threads can share a limiter without contending much.
+	//
+	// Thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpRateLimiter
+	{
+		Q_DISABLE_COPY(HttpRateLimiter)
+		struct Shard;
+		Shard* _shards;
+		double _rate;
+		int _burst;
+		QElapsedTimer _clock;
+
+	public:
+		enum { ShardCount = 16 };
+		enum { MinimumShardCapacity = 64 }; // Slots; shards grow when half full of active keys.
+
+	public:
+		HttpRateLimiter(double rate, int burst);
+		~HttpRateLimiter();
+
+		inline double rate() const { return _rate; } // Tokens added per second.
+		inline int burst() const { return _burst; }  // Capacity of a bucket.
+
+		// Take a token from the bucket of key. Returns false when it is empty: the request is over the limit.
+		bool tryAcquire(quint64 key);
+		int count() const; // Number of keys with a bucket.
+		int evictIdle();   // Forget the keys whose bucket is full again. Returns how many.
+
+		static quint64 keyFor(const QHostAddress& address);
+		static quint64 keyFor(const char* data, int size);
+		static inline quint64 keyFor(const QByteArray& data) { return keyFor(data.constData(), data.size()); }
+	};
+
+	//
+	// Pillow::HttpHandlerRateLimit
+	//
+	// A handler that answers the requests of clients over their rate limit with a "429 Too Many Requests"
+	// response, and lets the other requests through to the next handlers of the stack. Clients are told
+	// apart by their remote address, or by the value of keyHeader when set (an API key, or the address
+	// a trusted proxy forwards): requests without it fall back to the remote address.
+	//
+	// Reentrant. Not thread safe. The limiter can be shared between handlers of different threads.
+	//
+	class PILLOWCORE_EXPORT HttpHandlerRateLimit : public HttpHandler
+	{
+		Q_OBJECT
+		Q_PROPERTY(QByteArray keyHeader READ keyHeader WRITE setKeyHeader)
+		Pillow::HttpRateLimiter* _limiter;
+		bool _ownsLimiter;
+		QByteArray _keyHeader;
+		Pillow::HttpPreparedResponse _response;
+		QTimer* _evictionTimer;
+		QHash<Pillow::HttpConnection*, quint64> _addressKeys; // Key of the remote address of the connections seen, until they close.
+
+	public:
+		enum { EvictionInterval = 30000 }; // Milliseconds between evictions of idle keys.
+
+	public:
+		HttpHandlerRateLimit(double requestsPerSecond, int burst, QObject* parent = 0);
+		HttpHandlerRateLimit(Pillow::HttpRateLimiter* limiter, QObject* parent = 0); // The limiter must outlive the handler.
+		~HttpHandlerRateLimit();
+
+		inline Pillow::HttpRateLimiter* limiter() const { return _limiter; }
+		inline const QByteArray& keyHeader() const { return _keyHeader; }
+		void setKeyHeader(const QByteArray& keyHeader);
+
+		// The response to requests over the limit. Defaults to a 429 with a Retry-After header.
+		inline const Pillow::HttpPreparedResponse& response() const { return _response; }
+		void setResponse(const Pillow::HttpPreparedResponse& response);
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection* connection);
+
+	private slots:
+		void evictionTimer_timeout();
+		void connection_closed(Pillow::HttpConnection* connection);
+		void connection_destroyed(QObject* connection);
+
+	private:
+		void initialize();
+		quint64 addressKey(Pillow::HttpConnection* connection);
+	};
+}
+
+#endif // PILLOW_HTTPHANDLERRATELIMIT_H
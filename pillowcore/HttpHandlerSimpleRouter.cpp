@@ -1,5 +1,6 @@
 #include "HttpHandlerSimpleRouter.h"
 #include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
 #include <QtCore/QPointer>
 #include <QtCore/QMetaMethod>
 #include <QtCore/QRegExp>
@@ -7,7 +8,7 @@
 #include <QtCore/QUrl>
 using namespace Pillow;
 
-static const QString methodToken("_method");
+static const QByteArray methodToken("_method");
 
 namespace Pillow
 {
@@ -71,13 +72,11 @@ namespace Pillow
 
 	struct StaticRoute : public Route
 	{
-		int statusCode;
-		Pillow::HttpHeaderCollection headers;
-		QByteArray content;
+		Pillow::HttpPreparedResponse response;
 
 		virtual bool invoke(Pillow::HttpConnection *request)
 		{
-			request->writeResponse(statusCode, headers, content);
+			request->writePreparedResponse(response);
 			return true;
 		}
 	};
@@ -171,9 +170,7 @@ void HttpHandlerSimpleRouter::addRoute(const QByteArray& method, const QString&
 	StaticRoute* route = new StaticRoute();
 	route->method = method;
 	route->regExp = pathToRegExp(path, &route->paramNames);
-	route->statusCode = statusCode;
-	route->headers = headers;
-	route->content = content;
+	route->response = HttpPreparedResponse(statusCode, headers, content);
 	d_ptr->routes.append(route);
 }
 
@@ -233,9 +230,9 @@ bool HttpHandlerSimpleRouter::handleRequest(Pillow::HttpConnection *request)
 	QByteArray requestMethod = request->requestMethod();
 	if (d_ptr->acceptMethodParam)
 	{
-		QString methodParam = request->requestParamValue(methodToken);
+		QByteArray methodParam = request->requestParamValueBytes(methodToken);
 		if (!methodParam.isEmpty())
-			requestMethod = methodParam.toAscii();
+			requestMethod = methodParam;
 	}
 
 	QString requestPath = QUrl::fromPercentEncoding(request->requestPath());
@@ -246,7 +243,7 @@ bool HttpHandlerSimpleRouter::handleRequest(Pillow::HttpConnection *request)
 		{
 			matchedRoutes.append(route);
 			if (route->method.isEmpty() ||
-				(route->method.size() == requestMethod.size() && qstricmp(route->method, requestMethod) == 0))
+				Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(route->method, requestMethod))
 			{
 				for (int i = 0, iE = route->paramNames.size(); i < iE; ++i)
 					request->setRequestParam(route->paramNames.at(i), route->regExp.cap(i + 1));
@@ -0,0 +1,257 @@
+#include "HttpHandlerThreadPool.h"
+#include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QThreadPool>
+#include <QtCore/QRunnable>
+using namespace Pillow;
+using Pillow::ByteArrayHelpers::detachedCopy;
+
+//
+// HttpHandlerThreadPool::Operation
+//
+
+struct HttpHandlerThreadPool::Operation
+{
+	enum Type { WriteResponse, WriteHeaders, WriteContent, EndContent, Finish };
+
+	Operation* next;
+	HttpThreadedRequest* request;
+	Type type;
+	int statusCode;
+	HttpHeaderCollection headers;
+	QByteArray content;
+
+	Operation(HttpThreadedRequest* request, Type type, int statusCode = 0, const HttpHeaderCollection& headers = HttpHeaderCollection(), const QByteArray& content = QByteArray())
+		: next(0), request(request), type(type), statusCode(statusCode), headers(headers), content(content)
+	{}
+};
+
+//
+// HttpHandlerThreadPool::Runnable
+//
+
+class HttpHandlerThreadPool::Runnable : public QRunnable
+{
+	HttpHandlerThreadPool* _handler;
+	HttpThreadedRequest* _request;
+
+public:
+	Runnable(HttpHandlerThreadPool* handler, HttpThreadedRequest* request) : _handler(handler), _request(request) {}
+	void run() { _handler->run(_request); }
+};
+
+//
+// HttpThreadedRequest
+//
+
+HttpThreadedRequest::HttpThreadedRequest(HttpHandlerThreadPool* handler, HttpConnection* connection)
+	: _handler(handler), _connection(connection),
+	  _requestMethod(detachedCopy(connection->requestMethod())), _requestUri(detachedCopy(connection->requestUri())), _requestPath(detachedCopy(connection->requestPath())),
+	  _requestQueryString(detachedCopy(connection->requestQueryString())), _requestHttpVersion(detachedCopy(connection->requestHttpVersion())),
+	  _requestContent(detachedCopy(connection->requestContent())), _remoteAddress(connection->remoteAddress()), _cancelled(0)
+{
+	const HttpHeaderCollection& headers = connection->requestHeaders();
+	_requestHeaders.reserve(headers.size());
+	for (int i = 0; i < headers.size(); ++i)
+		_requestHeaders << HttpHeader(detachedCopy(headers.at(i).first), detachedCopy(headers.at(i).second));
+}
+
+bool HttpThreadedRequest::isCancelled() const
+{
+	return _cancelled != 0;
+}
+
+void HttpThreadedRequest::writeResponse(int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content)
+{
+	if (!isCancelled()) _handler->post(new HttpHandlerThreadPool::Operation(this, HttpHandlerThreadPool::Operation::WriteResponse, statusCode, headers, content));
+}
+
+void HttpThreadedRequest::writeHeaders(int statusCode, const Pillow::HttpHeaderCollection& headers)
+{
+	if (!isCancelled()) _handler->post(new HttpHandlerThreadPool::Operation(this, HttpHandlerThreadPool::Operation::WriteHeaders, statusCode, headers));
+}
+
+void HttpThreadedRequest::writeContent(const QByteArray& content)
+{
+	if (!isCancelled()) _handler->post(new HttpHandlerThreadPool::Operation(this, HttpHandlerThreadPool::Operation::WriteContent, 0, HttpHeaderCollection(), content));
+}
+
+void HttpThreadedRequest::endContent()
+{
+	if (!isCancelled()) _handler->post(new HttpHandlerThreadPool::Operation(this, HttpHandlerThreadPool::Operation::EndContent));
+}
+
+//
+// HttpHandlerThreadPool
+//
+
+HttpHandlerThreadPool::HttpHandlerThreadPool(QObject* parent)
+	: HttpHandler(parent), _threadPool(QThreadPool::globalInstance()), _operations(0), _runningCount(0)
+{
+}
+
+#ifdef Q_COMPILER_LAMBDA
+HttpHandlerThreadPool::HttpHandlerThreadPool(const std::function<void(Pillow::HttpThreadedRequest*)>& function, QObject* parent)
+	: HttpHandler(parent), _threadPool(QThreadPool::globalInstance()), _operations(0), _runningCount(0), _function(function)
+{
+}
+#endif // Q_COMPILER_LAMBDA
+
+HttpHandlerThreadPool::~HttpHandlerThreadPool()
+{
+	{
+		QMutexLocker locker(&_runningMutex);
+		while (_runningCount > 0)
+			_runningDone.wait(&_runningMutex);
+	}
+
+	// The workers are done; send what they left behind to the connections that are still around.
+	drain();
+}
+
+void HttpHandlerThreadPool::setThreadPool(QThreadPool* threadPool)
+{
+	_threadPool = threadPool ? threadPool : QThreadPool::globalInstance();
+}
+
+bool HttpHandlerThreadPool::handleRequest(Pillow::HttpConnection* connection)
+{
+	if (!_connections.contains(connection))
+	{
+		_connections.insert(connection);
+		connect(connection, SIGNAL(requestCompleted(Pillow::HttpConnection*)), this, SLOT(requestCompleted(Pillow::HttpConnection*)));
+		connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(requestClosed(Pillow::HttpConnection*)));
+		connect(connection, SIGNAL(destroyed(QObject*)), this, SLOT(requestDestroyed(QObject*)));
+	}
+
+	HttpThreadedRequest* request = new HttpThreadedRequest(this, connection);
+	_requests.insert(connection, request);
+	{
+		QMutexLocker locker(&_runningMutex);
+		++_runningCount;
+	}
+	_threadPool->start(new Runnable(this, request));
+	return true;
+}
+
+void HttpHandlerThreadPool::handleThreadedRequest(Pillow::HttpThreadedRequest* request)
+{
+#ifdef Q_COMPILER_LAMBDA
+	if (_function) _function(request);
+#else
+	Q_UNUSED(request);
+#endif // Q_COMPILER_LAMBDA
+}
+
+void HttpHandlerThreadPool::run(Pillow::HttpThreadedRequest* request)
+{
+	handleThreadedRequest(request);
+	post(new Operation(request, Operation::Finish));
+
+	// Last touch of the handler: the destructor may proceed right after.
+	QMutexLocker locker(&_runningMutex);
+	if (--_runningCount == 0) _runningDone.wakeAll();
+}
+
+void HttpHandlerThreadPool::post(Operation* operation)
+{
+	Operation* head;
+	do
+	{
+		head = _operations;
+		operation->next = head;
+	}
+	while (!_operations.testAndSetRelease(head, operation));
+
+	// Only the push onto an empty queue wakes the handler up; it takes everything that follows with it.
+	if (head == 0)
+		QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+void HttpHandlerThreadPool::drain()
+{
+	Operation* operation = _operations.fetchAndStoreAcquire(0);
+
+	// Most recent first: reverse them, so that each request gets its own in the order they were written.
+	Operation* ordered = 0;
+	while (operation != 0)
+	{
+		Operation* next = operation->next;
+		operation->next = ordered;
+		ordered = operation;
+		operation = next;
+	}
+
+	while (ordered != 0)
+	{
+		Operation* next = ordered->next;
+		apply(ordered);
+		delete ordered;
+		ordered = next;
+	}
+}
+
+void HttpHandlerThreadPool::apply(Operation* operation)
+{
+	HttpThreadedRequest* request = operation->request;
+	HttpConnection* connection = request->isCancelled() ? 0 : request->_connection.data();
+
+	if (operation->type == Operation::Finish)
+	{
+		if (connection != 0)
+		{
+			// The worker returned without finishing its response.
+			if (connection->state() == HttpConnection::SendingHeaders)
+				connection->writeResponse(500);
+			else if (connection->state() == HttpConnection::SendingContent)
+				connection->close();
+		}
+		detach(request);
+		delete request;
+		return;
+	}
+
+	if (connection == 0) return;
+	switch (operation->type)
+	{
+	case Operation::WriteResponse: connection->writeResponse(operation->statusCode, operation->headers, operation->content); break;
+	case Operation::WriteHeaders: connection->writeHeaders(operation->statusCode, operation->headers); break;
+	case Operation::WriteContent: connection->writeContent(operation->content); break;
+	case Operation::EndContent: connection->endContent(); break;
+	default: break;
+	}
+}
+
+void HttpHandlerThreadPool::detach(Pillow::HttpThreadedRequest* request)
+{
+	request->_cancelled = 1;
+	if (request->_connection)
+	{
+		QHash<HttpConnection*, HttpThreadedRequest*>::iterator r = _requests.find(request->_connection.data());
+		if (r != _requests.end() && r.value() == request) _requests.erase(r);
+		request->_connection = 0;
+	}
+}
+
+void HttpHandlerThreadPool::requestCompleted(Pillow::HttpConnection* connection)
+{
+	// The connection moves on to its next request; nothing more of this one may reach it.
+	HttpThreadedRequest* request = _requests.value(connection);
+	if (request) detach(request);
+}
+
+void HttpHandlerThreadPool::requestClosed(Pillow::HttpConnection* connection)
+{
+	HttpThreadedRequest* request = _requests.value(connection);
+	if (request) detach(request);
+}
+
+void HttpHandlerThreadPool::requestDestroyed(QObject* connection)
+{
+	HttpConnection* c = static_cast<HttpConnection*>(connection);
+	_connections.remove(c);
+
+	// The QPointer of the request is already cleared; only the cancellation remains to be said.
+	HttpThreadedRequest* request = _requests.take(c);
+	if (request) request->_cancelled = 1;
+}
@@ -0,0 +1,140 @@
+#ifndef PILLOW_HTTPHANDLERTHREADPOOL_H
+#define PILLOW_HTTPHANDLERTHREADPOOL_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHANDLER_H
+#include "HttpHandler.h"
+#endif // PILLOW_HTTPHANDLER_H
+#ifndef QATOMIC_H
+#include <QtCore/QAtomicPointer>
+#endif // QATOMIC_H
+#ifndef QMUTEX_H
+#include <QtCore/QMutex>
+#endif // QMUTEX_H
+#ifndef QWAITCONDITION_H
+#include <QtCore/QWaitCondition>
+#endif // QWAITCONDITION_H
+
+class QThreadPool;
+
+namespace Pillow
+{
+	class HttpHandlerThreadPool;
+
+	//
+	// Pillow::HttpThreadedRequest
+	//
+	// What a worker thread of HttpHandlerThreadPool gets of a request: a copy of it, taken on the thread of the
+	// connection, and the means to answer it. The write methods mirror those of HttpConnection; they can be called
+	// from any thread and get applied to the connection, in order, by its own thread.
+	//
+	// The request gets cancelled when the connection closes, or once its response is complete. Whatever gets
+	// written after that is dropped, so long running work may check isCancelled() to give up early.
+	//
+	// Thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpThreadedRequest
+	{
+		Q_DISABLE_COPY(HttpThreadedRequest)
+		friend class HttpHandlerThreadPool;
+		Pillow::HttpHandlerThreadPool* _handler;
+		QPointer<Pillow::HttpConnection> _connection; // Only used on the thread of the handler.
+		QByteArray _requestMethod, _requestUri, _requestPath, _requestQueryString, _requestHttpVersion, _requestContent;
+		Pillow::HttpHeaderCollection _requestHeaders;
+		QHostAddress _remoteAddress;
+		QAtomicInt _cancelled;
+
+		HttpThreadedRequest(Pillow::HttpHandlerThreadPool* handler, Pillow::HttpConnection* connection);
+
+	public:
+		inline const QByteArray& requestMethod() const { return _requestMethod; }
+		inline const QByteArray& requestUri() const { return _requestUri; }
+		inline const QByteArray& requestPath() const { return _requestPath; }
+		inline const QByteArray& requestQueryString() const { return _requestQueryString; }
+		inline const QByteArray& requestHttpVersion() const { return _requestHttpVersion; }
+		inline const QByteArray& requestContent() const { return _requestContent; }
+		inline const Pillow::HttpHeaderCollection& requestHeaders() const { return _requestHeaders; }
+		inline const QByteArray& requestHeaderValue(const QByteArray& field) const { return _requestHeaders.getFieldValue(field); }
+		inline const QHostAddress& remoteAddress() const { return _remoteAddress; }
+
+		bool isCancelled() const;
+
+		void writeResponse(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection(), const QByteArray& content = QByteArray());
+		void writeHeaders(int statusCode = 200, const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection());
+		void writeContent(const QByteArray& content);
+		void endContent();
+	};
+
+	//
+	// Pillow::HttpHandlerThreadPool
+	//
+	// A handler that runs blocking work (disk, databases, crypto...) on the workers of a QThreadPool rather than on
+	// the thread of the connections, which then keeps serving other requests meanwhile. Every request it gets is handed
+	// over as a HttpThreadedRequest to handleThreadedRequest(), on a worker: override it, or set a function to call.
+	//
+	// Workers queue what they write without blocking, on a lock-free queue that the thread of the handler empties in
+	// one go, woken by a single queued call whenever the queue goes from empty to not. A worker that returns without
+	// having answered gets a "500 Internal Server Error" sent for it.
+	//
+	// The handler has to live in the thread of its connections. Deleting it waits for its running workers to return.
+	//
+	// Reentrant. Not thread safe, but for handleThreadedRequest().
+	//
+	class PILLOWCORE_EXPORT HttpHandlerThreadPool : public HttpHandler
+	{
+		Q_OBJECT
+		friend class HttpThreadedRequest;
+		struct Operation;
+		class Runnable;
+
+		QThreadPool* _threadPool;
+		QAtomicPointer<Operation> _operations;   // Pushed by any thread, most recent first.
+		QHash<Pillow::HttpConnection*, Pillow::HttpThreadedRequest*> _requests; // The request being answered on each connection.
+		QSet<Pillow::HttpConnection*> _connections;
+		QMutex _runningMutex;
+		QWaitCondition _runningDone;
+		int _runningCount;
+#ifdef Q_COMPILER_LAMBDA
+		std::function<void(Pillow::HttpThreadedRequest*)> _function;
+#endif // Q_COMPILER_LAMBDA
+
+	public:
+		HttpHandlerThreadPool(QObject* parent = 0);
+#ifdef Q_COMPILER_LAMBDA
+		HttpHandlerThreadPool(const std::function<void(Pillow::HttpThreadedRequest*)>& function, QObject* parent = 0);
+#endif // Q_COMPILER_LAMBDA
+		~HttpHandlerThreadPool();
+
+		// The pool the requests run on. QThreadPool::globalInstance() by default.
+		inline QThreadPool* threadPool() const { return _threadPool; }
+		void setThreadPool(QThreadPool* threadPool);
+
+#ifdef Q_COMPILER_LAMBDA
+		inline const std::function<void(Pillow::HttpThreadedRequest*)>& function() const { return _function; }
+		void setFunction(const std::function<void(Pillow::HttpThreadedRequest*)>& function) { _function = function; }
+#endif // Q_COMPILER_LAMBDA
+
+	public:
+		virtual bool handleRequest(Pillow::HttpConnection* connection);
+
+	protected:
+		// Called on a worker thread. Calls the function, if any.
+		virtual void handleThreadedRequest(Pillow::HttpThreadedRequest* request);
+
+	private slots:
+		void drain();
+		void requestCompleted(Pillow::HttpConnection* connection);
+		void requestClosed(Pillow::HttpConnection* connection);
+		void requestDestroyed(QObject* connection);
+
+	private:
+		void post(Operation* operation);
+		void apply(Operation* operation);
+		void detach(Pillow::HttpThreadedRequest* request);
+		void run(Pillow::HttpThreadedRequest* request);
+	};
+}
+
+#endif // PILLOW_HTTPHANDLERTHREADPOOL_H
@@ -8,6 +8,103 @@ namespace
 		static QByteArray null;
 		return null;
 	}
+
+	struct WellKnownFieldName { const char* name; int length; };
+	#define FIELD_NAME(name) { name, sizeof(name) - 1 }
+	static const WellKnownFieldName wellKnownFieldNames[Pillow::HttpHeaderId::Count] =
+	{
+		FIELD_NAME(""),
+		FIELD_NAME("accept"), FIELD_NAME("accept-encoding"), FIELD_NAME("accept-language"), FIELD_NAME("authorization"), FIELD_NAME("cache-control"), FIELD_NAME("connection"),
+		FIELD_NAME("content-length"), FIELD_NAME("content-type"), FIELD_NAME("cookie"), FIELD_NAME("expect"), FIELD_NAME("host"), FIELD_NAME("if-modified-since"), FIELD_NAME("if-none-match"),
+		FIELD_NAME("origin"), FIELD_NAME("range"), FIELD_NAME("referer"), FIELD_NAME("transfer-encoding"), FIELD_NAME("upgrade"), FIELD_NAME("user-agent"), FIELD_NAME("x-forwarded-for")
+	};
+	#undef FIELD_NAME
+
+	inline bool equalsLowerCaseFieldName(const char* fieldName, const WellKnownFieldName& lowerCaseName)
+	{
+		for (int i = 0; i < lowerCaseName.length; ++i)
+		{
+			char f = fieldName[i], s = lowerCaseName.name[i];
+			if (f != s && (f - s != -32 || f < 'A' || f > 'Z')) return false;
+		}
+		return true;
+	}
+}
+
+//
+// Pillow::HttpHeaderId
+//
+
+Pillow::HttpHeaderId::Id Pillow::HttpHeaderId::fromFieldName(const char *fieldName, int fieldNameLength)
+{
+	// Dispatch on the length, then on a letter that tells apart the names of that length, so that a field
+	// name gets compared to at most one well-known name. Keep in sync with wellKnownFieldNames.
+	Id candidate = Unknown;
+	switch (fieldNameLength)
+	{
+	case 4: candidate = Host; break;
+	case 5: candidate = Range; break;
+	case 6:
+		switch (fieldName[0] | 0x20)
+		{
+		case 'a': candidate = Accept; break;
+		case 'c': candidate = Cookie; break;
+		case 'e': candidate = Expect; break;
+		case 'o': candidate = Origin; break;
+		}
+		break;
+	case 7:
+		switch (fieldName[0] | 0x20)
+		{
+		case 'r': candidate = Referer; break;
+		case 'u': candidate = Upgrade; break;
+		}
+		break;
+	case 10:
+		switch (fieldName[0] | 0x20)
+		{
+		case 'c': candidate = Connection; break;
+		case 'u': candidate = UserAgent; break;
+		}
+		break;
+	case 12: candidate = ContentType; break;
+	case 13:
+		switch (fieldName[0] | 0x20)
+		{
+		case 'a': candidate = Authorization; break;
+		case 'c': candidate = CacheControl; break;
+		case 'i': candidate = IfNoneMatch; break;
+		}
+		break;
+	case 14: candidate = ContentLength; break;
+	case 15:
+		switch (fieldName[7] | 0x20)
+		{
+		case 'e': candidate = AcceptEncoding; break;
+		case 'l': candidate = AcceptLanguage; break;
+		case 'r': candidate = XForwardedFor; break;
+		}
+		break;
+	case 17:
+		switch (fieldName[0] | 0x20)
+		{
+		case 'i': candidate = IfModifiedSince; break;
+		case 't': candidate = TransferEncoding; break;
+		}
+		break;
+	}
+
+	return candidate != Unknown && equalsLowerCaseFieldName(fieldName, wellKnownFieldNames[candidate]) ? candidate : Unknown;
+}
+
+const char* Pillow::HttpHeaderId::fieldName(Id id)
+{
+	return id > Unknown && id < Count ? wellKnownFieldNames[id].name : "";
+}
+
+int Pillow::HttpHeaderId::fieldNameLength(Id id)
+{
+	return id > Unknown && id < Count ? wellKnownFieldNames[id].length : 0;
 }
 
 void Pillow::HttpHeader::setFromRawHeader(const char *rawHeader, int len)
@@ -68,7 +165,7 @@ const QByteArray& Pillow::HttpHeaderCollection::getFieldValue(const char *fieldN
 {
 	for (const_iterator it = constBegin(), itE = constEnd(); it != itE; ++it)
 	{
-		if (Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(it->first.constData(), it->first.size(), fieldName, fieldNameLength))
+		if (it->first.size() == fieldNameLength && Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(it->first.constData(), it->first.size(), fieldName, fieldNameLength))
 			return it->second;
 	}
 	return nullByteArray();
@@ -84,6 +181,19 @@ const QByteArray& Pillow::HttpHeaderCollection::getFieldValue(const Pillow::Lowe
 	return nullByteArray();
 }
 
+const QByteArray& Pillow::HttpHeaderCollection::getFieldValue(Pillow::HttpHeaderId::Id fieldId) const
+{
+	if (fieldId <= Pillow::HttpHeaderId::Unknown || fieldId >= Pillow::HttpHeaderId::Count) return nullByteArray();
+
+	const WellKnownFieldName& name = wellKnownFieldNames[fieldId];
+	for (const_iterator it = constBegin(), itE = constEnd(); it != itE; ++it)
+	{
+		if (it->first.size() == name.length && equalsLowerCaseFieldName(it->first.constData(), name))
+			return it->second;
+	}
+	return nullByteArray();
+}
+
 QVector<QByteArray> Pillow::HttpHeaderCollection::getFieldValues(const char *fieldName, int fieldNameLength) const
 {
 	QVector<QByteArray> result;
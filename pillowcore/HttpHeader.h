@@ -21,6 +21,32 @@ namespace Pillow { class Token; class LowerCaseToken; }
 
 namespace Pillow
 {
+	//
+	// Pillow::HttpHeaderId
+	//
+	// Identifiers for the well-known header field names, so that headers can be indexed
+	// and matched with integer compares rather than case insensitive string compares.
+	//
+	namespace HttpHeaderId
+	{
+		enum Id
+		{
+			Unknown = 0,
+			Accept, AcceptEncoding, AcceptLanguage, Authorization, CacheControl, Connection,
+			ContentLength, ContentType, Cookie, Expect, Host, IfModifiedSince, IfNoneMatch,
+			Origin, Range, Referer, TransferEncoding, Upgrade, UserAgent, XForwardedFor,
+			Count
+		};
+
+		// Get the id of a field name (case insensitive), or Unknown if it is not a well-known field name.
+		PILLOWCORE_EXPORT Id fromFieldName(const char* fieldName, int fieldNameLength);
+		inline Id fromFieldName(const QByteArray& fieldName) { return fromFieldName(fieldName.constData(), fieldName.size()); }
+
+		// Get the lowercase field name for an id, or an empty string for Unknown.
+		PILLOWCORE_EXPORT const char* fieldName(Id id);
+		PILLOWCORE_EXPORT int fieldNameLength(Id id);
+	}
+
 	//
 	// Pillow::HttpHeader
 	//
@@ -73,6 +99,7 @@ namespace Pillow
 		template <int N> inline const QByteArray& getFieldValue(const char (&fieldName)[N]) const { return getFieldValue(fieldName, N-1); }
 		template <typename T> inline const QByteArray& getFieldValue(const T &fieldName) const { return getFieldValue(fieldName.data(), fieldName.size()); }
 		const QByteArray& getFieldValue(const Pillow::LowerCaseToken &fieldName) const;
+		const QByteArray& getFieldValue(Pillow::HttpHeaderId::Id fieldId) const;
 
 		// Get values of all headers with the specified field name.
 		// The field name is case insensitive.
@@ -1,5 +1,6 @@
 #include "HttpHelpers.h"
 #include "ByteArrayHelpers.h"
+#include <ctype.h>
 
 namespace Pillow
 {
@@ -63,6 +64,8 @@ namespace Pillow
 					case 415: return "415 Unsupported Media Type";
 					case 416: return "416 Requested Range Not Satisfiable";
 					case 417: return "417 Expectation Failed";
+					case 426: return "426 Upgrade Required";
+					case 429: return "429 Too Many Requests";
 
 					case 500: return "500 Internal Server Error";
 					case 501: return "501 Not Implemented";
@@ -100,6 +103,89 @@ namespace Pillow
 
 				return httpDate;
 			}
+
+			QDateTime parseHttpDate(const QByteArray& httpDate)
+			{
+				static const char monthNames[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+				// Split the date into its alphanumeric fields, ignoring the separators. The leading day name is skipped.
+				//   RFC 1123: Sun, 06 Nov 1994 08:49:37 GMT  =>  06 Nov 1994 08 49 37 GMT
+				//   RFC 850:  Sunday, 06-Nov-94 08:49:37 GMT =>  06 Nov 94 08 49 37 GMT
+				//   asctime:  Sun Nov  6 08:49:37 1994       =>  Nov 6 08 49 37 1994
+				const char* fields[8]; int fieldSizes[8]; int fieldCount = 0;
+				for (const char* c = httpDate.constBegin(), *cE = httpDate.constEnd(); c < cE && fieldCount < 8;)
+				{
+					if (!isalnum(static_cast<uchar>(*c))) { ++c; continue; }
+					const char* fieldStart = c;
+					while (c < cE && isalnum(static_cast<uchar>(*c))) ++c;
+					fields[fieldCount] = fieldStart; fieldSizes[fieldCount] = c - fieldStart; ++fieldCount;
+				}
+				if (fieldCount < 7) return QDateTime();
+
+				int day, month = 0, year, hour, minute, second;
+				bool dayOk, yearOk, hourOk, minuteOk, secondOk;
+				const bool asctime = isalpha(static_cast<uchar>(fields[1][0]));
+				const int monthField = asctime ? 1 : 2, dayField = asctime ? 2 : 1, timeField = asctime ? 3 : 4, yearField = asctime ? 6 : 3;
+
+				if (fieldSizes[monthField] != 3) return QDateTime();
+				for (const char* m = monthNames; *m; m += 3)
+					if (qstrnicmp(m, fields[monthField], 3) == 0) { month = (m - monthNames) / 3 + 1; break; }
+
+				day = QByteArray::fromRawData(fields[dayField], fieldSizes[dayField]).toInt(&dayOk);
+				year = QByteArray::fromRawData(fields[yearField], fieldSizes[yearField]).toInt(&yearOk);
+				hour = QByteArray::fromRawData(fields[timeField], fieldSizes[timeField]).toInt(&hourOk);
+				minute = QByteArray::fromRawData(fields[timeField + 1], fieldSizes[timeField + 1]).toInt(&minuteOk);
+				second = QByteArray::fromRawData(fields[timeField + 2], fieldSizes[timeField + 2]).toInt(&secondOk);
+				if (month == 0 || !dayOk || !yearOk || !hourOk || !minuteOk || !secondOk) return QDateTime();
+
+				if (fieldSizes[yearField] == 2) year += year < 70 ? 2000 : 1900; // RFC 850 two digit years.
+
+				QDateTime dateTime(QDate(year, month, day), QTime(hour, minute, second), Qt::UTC);
+				return dateTime.isValid() ? dateTime : QDateTime();
+			}
+		}
+
+		namespace Headers
+		{
+			static const Pillow::LowerCaseToken connectionToken("connection");
+			static const Pillow::LowerCaseToken keepAliveToken("keep-alive");
+			static const Pillow::LowerCaseToken proxyConnectionToken("proxy-connection");
+			static const Pillow::LowerCaseToken teToken("te");
+			static const Pillow::LowerCaseToken trailerToken("trailer");
+			static const Pillow::LowerCaseToken transferEncodingToken("transfer-encoding");
+			static const Pillow::LowerCaseToken upgradeToken("upgrade");
+
+			bool isHopByHopHeader(const QByteArray& fieldName, const Pillow::HttpHeaderCollection& headers)
+			{
+				using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+				if (asciiEqualsCaseInsensitive(fieldName, connectionToken) || asciiEqualsCaseInsensitive(fieldName, keepAliveToken)
+					|| asciiEqualsCaseInsensitive(fieldName, proxyConnectionToken) || asciiEqualsCaseInsensitive(fieldName, teToken)
+					|| asciiEqualsCaseInsensitive(fieldName, trailerToken) || asciiEqualsCaseInsensitive(fieldName, transferEncodingToken)
+					|| asciiEqualsCaseInsensitive(fieldName, upgradeToken))
+					return true;
+
+				// Then the comma separated field names listed by the Connection headers.
+				for (const Pillow::HttpHeader* h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+				{
+					if (!asciiEqualsCaseInsensitive(h->first, connectionToken)) continue;
+
+					const char* c = h->second.constBegin(), *cE = h->second.constEnd();
+					while (c < cE)
+					{
+						while (c < cE && (*c == ' ' || *c == '\t')) ++c;
+						const char* tokenStart = c;
+						while (c < cE && *c != ',') ++c;
+						const char* tokenEnd = c;
+						while (tokenEnd > tokenStart && (tokenEnd[-1] == ' ' || tokenEnd[-1] == '\t')) --tokenEnd;
+
+						if (tokenEnd > tokenStart && asciiEqualsCaseInsensitive(fieldName.constData(), fieldName.size(), tokenStart, int(tokenEnd - tokenStart)))
+							return true;
+						if (c < cE) ++c; // Skip the comma.
+					}
+				}
+				return false;
+			}
 		}
 	}
 }
@@ -13,6 +13,9 @@
 #ifndef QDATETIME_H
 #include <QDateTime>
 #endif // QDATETIME_H
+#ifndef PILLOW_HTTPHEADER_H
+#include "HttpHeader.h"
+#endif // PILLOW_HTTPHEADER_H
 
 namespace Pillow
 {
@@ -32,6 +35,18 @@ namespace Pillow
 		namespace Dates
 		{
 			PILLOWCORE_EXPORT QByteArray getHttpDate(const QDateTime& dateTime = QDateTime::currentDateTime());
+
+			// Parse a date in any of the three formats allowed by Http (RFC 1123, RFC 850 and asctime).
+			// Returns an invalid QDateTime if the date could not be parsed.
+			PILLOWCORE_EXPORT QDateTime parseHttpDate(const QByteArray& httpDate);
+		}
+
+		namespace Headers
+		{
+			// Whether a header of a message only applies to a single connection and must not be forwarded (RFC 7230, section 6.1):
+			// Connection and the fields it lists in the message's headers, Keep-Alive, Proxy-Connection, TE, Trailer,
+			// Transfer-Encoding and Upgrade.
+			PILLOWCORE_EXPORT bool isHopByHopHeader(const QByteArray& fieldName, const Pillow::HttpHeaderCollection& headers);
 		}
 	}
 }
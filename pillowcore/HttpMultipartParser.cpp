@@ -0,0 +1,311 @@
+#include "HttpMultipartParser.h"
+#include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QIODevice>
+#include <QtCore/QDebug>
+#include <string.h>
+
+using namespace Pillow;
+
+namespace
+{
+	// Index of the empty line that ends a block of headers, or -1.
+	inline int indexOfEmptyLine(const char* data, int size, int from)
+	{
+		for (const char* p = data + from, *e = data + size - 3; p < e; ++p)
+		{
+			p = static_cast<const char*>(memchr(p, '\r', e - p));
+			if (p == NULL) break;
+			if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return int(p - data);
+		}
+		return -1;
+	}
+
+	inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+}
+
+//
+// HttpMultipartParser
+//
+
+HttpMultipartParser::HttpMultipartParser(QObject* parent)
+	: QObject(parent), _state(Failed), _error(NoError), _partContentLength(0), _partDevice(0), _partCount(0), _requestContentRemaining(0)
+{
+}
+
+HttpMultipartParser::HttpMultipartParser(const QByteArray& boundary, QObject* parent)
+	: QObject(parent), _state(Failed), _error(NoError), _partContentLength(0), _partDevice(0), _partCount(0), _requestContentRemaining(0)
+{
+	setBoundary(boundary);
+}
+
+void HttpMultipartParser::setBoundary(const QByteArray& boundary)
+{
+	if (boundary.isEmpty() || boundary.size() > MaximumBoundaryLength)
+		qWarning() << "HttpMultipartParser::setBoundary: invalid boundary" << boundary;
+
+	_boundary = boundary;
+	_delimiter = QByteArray("\r\n--", 4) + boundary;
+	_delimiterMatcher.setPattern(_delimiter);
+	reset();
+}
+
+void HttpMultipartParser::reset()
+{
+	_state = Preamble;
+	_error = NoError;
+	_buffer = QByteArray("\r\n", 2); // So that a delimiter right at the start of the content, without the leading CRLF, gets found.
+	_partHeaders.clear();
+	_partContentLength = 0;
+	_partDevice = 0;
+	_partCount = 0;
+}
+
+bool HttpMultipartParser::parseRequestContent(Pillow::HttpConnection* connection)
+{
+	QByteArray boundary = boundaryFromContentType(connection->requestHeaderValue(Pillow::HttpHeaderId::ContentType));
+	if (boundary.isEmpty()) return false;
+
+	connection->setRequestContentStreamed(true);
+	if (!connection->isRequestContentStreamed()) return false;
+
+	setBoundary(boundary);
+	_requestContentRemaining = connection->requestContentLength();
+	connect(connection, SIGNAL(requestContentReceived(Pillow::HttpConnection*,QByteArray)), this, SLOT(connection_requestContentReceived(Pillow::HttpConnection*,QByteArray)));
+	connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), this, SLOT(connection_closed(Pillow::HttpConnection*)));
+	return true;
+}
+
+void HttpMultipartParser::connection_requestContentReceived(Pillow::HttpConnection* connection, const QByteArray& data)
+{
+	write(data);
+	if ((_requestContentRemaining -= data.size()) <= 0)
+	{
+		disconnect(connection, 0, this, 0);
+		end();
+	}
+}
+
+void HttpMultipartParser::connection_closed(Pillow::HttpConnection* connection)
+{
+	disconnect(connection, 0, this, 0);
+	end();
+}
+
+QByteArray HttpMultipartParser::partName() const
+{
+	return headerParameter(_partHeaders.getFieldValue("Content-Disposition"), QByteArray("name", 4));
+}
+
+QByteArray HttpMultipartParser::partFileName() const
+{
+	return headerParameter(_partHeaders.getFieldValue("Content-Disposition"), QByteArray("filename", 8));
+}
+
+void HttpMultipartParser::write(const QByteArray& data)
+{
+	if (isFinished() || data.isEmpty()) return;
+
+	if (_buffer.isEmpty())
+	{
+		// Common case: parse the data straight, only keeping what is left over.
+		int consumed = parse(data.constData(), data.size());
+		if (!isFinished() && consumed < data.size() && _buffer.isEmpty())
+			_buffer = QByteArray(data.constData() + consumed, data.size() - consumed); // Deep copy: data may be raw data that is about to go away.
+	}
+	else
+	{
+		_buffer.append(data);
+		QByteArray buffer = _buffer; // Keeps the data being parsed alive, should a handler reset the parser.
+		int consumed = parse(buffer.constData(), buffer.size());
+		if (_buffer.constData() != buffer.constData()) return; // A handler did reset the parser.
+		buffer.clear();
+		if (isFinished()) _buffer.clear();
+		else _buffer.remove(0, consumed);
+	}
+}
+
+void HttpMultipartParser::end()
+{
+	if (isFinished()) return;
+	fail(TruncatedContentError);
+}
+
+int HttpMultipartParser::parse(const char* data, int size)
+{
+	int pos = 0;
+	while (pos < size)
+	{
+		switch (_state)
+		{
+		case Preamble:
+		{
+			// Skip everything up to the first delimiter, only keeping what could be its start.
+			int index = _delimiterMatcher.indexIn(data, size, pos);
+			if (index < 0) return qMax(pos, size - (_delimiter.size() - 1));
+			pos = index + _delimiter.size();
+			_state = AfterDelimiter;
+			break;
+		}
+
+		case AfterDelimiter:
+		{
+			if (size - pos < 2) return pos;
+			if (data[pos] == '-' && data[pos + 1] == '-')
+			{
+				// Close delimiter. Whatever follows is the epilogue, which gets ignored.
+				_state = Finished;
+				emit finished();
+				return size;
+			}
+
+			int i = pos;
+			while (i < size && isSpace(data[i])) ++i; // Transport padding.
+			if (i - pos > MaximumBoundaryLength) { fail(MalformedContentError); return size; }
+			if (size - i < 2) return pos;
+			if (data[i] != '\r' || data[i + 1] != '\n') { fail(MalformedContentError); return size; }
+			pos = i + 2;
+			_state = PartHeaders;
+			break;
+		}
+
+		case PartHeaders:
+		{
+			int headersEnd;
+			if (size - pos >= 2 && data[pos] == '\r' && data[pos + 1] == '\n')
+				headersEnd = pos; // A part without headers.
+			else if ((headersEnd = indexOfEmptyLine(data, size, pos)) < 0)
+			{
+				if (size - pos > MaximumPartHeadersLength) { fail(PartHeadersTooLargeError); return size; }
+				return pos;
+			}
+			if (headersEnd - pos > MaximumPartHeadersLength) { fail(PartHeadersTooLargeError); return size; }
+
+			if (!_partHeaders.isEmpty()) _partHeaders.clear();
+			for (const char* line = data + pos, *e = data + headersEnd; line < e; )
+			{
+				const char* lineEnd = static_cast<const char*>(memchr(line, '\r', e - line));
+				if (lineEnd == NULL) lineEnd = e;
+
+				if (isSpace(*line) && !_partHeaders.isEmpty())
+				{
+					// Obsolete line folding: the line continues the previous header value.
+					_partHeaders.last().second.append(' ').append(QByteArray(line, int(lineEnd - line)).trimmed());
+				}
+				else
+				{
+					const char* colon = static_cast<const char*>(memchr(line, ':', lineEnd - line));
+					if (colon == NULL || colon == line) { fail(MalformedContentError); return size; }
+					_partHeaders.append(Pillow::HttpHeader(QByteArray(line, int(colon - line)).trimmed(), QByteArray(colon + 1, int(lineEnd - colon - 1)).trimmed()));
+				}
+				line = lineEnd + 2;
+			}
+
+			pos = headersEnd + (headersEnd == pos ? 2 : 4);
+			_state = PartContent;
+			_partContentLength = 0;
+			++_partCount;
+			emit partStarted();
+			if (isFinished()) return size;
+			break;
+		}
+
+		case PartContent:
+		{
+			int index = _delimiterMatcher.indexIn(data, size, pos);
+			if (index < 0)
+			{
+				// Hand over the content, except what could be the start of the next delimiter.
+				int keepFrom = size;
+				for (int i = qMax(pos, size - (_delimiter.size() - 1)); i < size; ++i)
+				{
+					if (data[i] == '\r') { keepFrom = i; break; }
+				}
+				emitPartContent(data + pos, keepFrom - pos);
+				return isFinished() ? size : keepFrom;
+			}
+
+			emitPartContent(data + pos, index - pos);
+			if (isFinished()) return size;
+			pos = index + _delimiter.size();
+			_state = AfterDelimiter;
+			_partDevice = 0;
+			emit partFinished();
+			if (isFinished()) return size;
+			break;
+		}
+
+		case Finished:
+		case Failed:
+			return size;
+		}
+	}
+	return pos;
+}
+
+void HttpMultipartParser::emitPartContent(const char* data, int size)
+{
+	if (size <= 0) return;
+	_partContentLength += size;
+
+	if (_partDevice == 0)
+		emit partContentReceived(QByteArray::fromRawData(data, size));
+	else if (_partDevice->write(data, size) != size)
+		fail(PartDeviceError);
+}
+
+void HttpMultipartParser::fail(Error error)
+{
+	_state = Failed;
+	_error = error;
+	_partDevice = 0;
+	emit finished();
+}
+
+QByteArray HttpMultipartParser::boundaryFromContentType(const QByteArray& contentType)
+{
+	static const QByteArray multipart("multipart/");
+	if (contentType.size() <= multipart.size() || !Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(contentType.constData(), multipart.constData(), multipart.size()))
+		return QByteArray();
+
+	QByteArray boundary = headerParameter(contentType, QByteArray("boundary", 8));
+	return boundary.size() <= MaximumBoundaryLength ? boundary : QByteArray();
+}
+
+QByteArray HttpMultipartParser::headerParameter(const QByteArray& headerValue, const QByteArray& name)
+{
+	const char* p = headerValue.constData(), *e = p + headerValue.size();
+	while ((p = static_cast<const char*>(memchr(p, ';', e - p))) != NULL)
+	{
+		for (++p; p < e && isSpace(*p); ++p) {}
+		const char* nameBegin = p;
+		while (p < e && *p != '=' && *p != ';') ++p;
+		const char* nameEnd = p;
+		while (nameEnd > nameBegin && isSpace(nameEnd[-1])) --nameEnd;
+		if (p == e || *p == ';') continue; // Parameter without value.
+
+		for (++p; p < e && isSpace(*p); ++p) {}
+		QByteArray value;
+		if (p < e && *p == '"')
+		{
+			for (++p; p < e && *p != '"'; ++p)
+			{
+				if (*p == '\\' && p + 1 < e) ++p;
+				value.append(*p);
+			}
+		}
+		else
+		{
+			const char* valueBegin = p;
+			while (p < e && *p != ';') ++p;
+			const char* valueEnd = p;
+			while (valueEnd > valueBegin && isSpace(valueEnd[-1])) --valueEnd;
+			value = QByteArray(valueBegin, int(valueEnd - valueBegin));
+		}
+
+		if (Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(nameBegin, int(nameEnd - nameBegin), name.constData(), name.size()))
+			return value;
+		if (p == e) break;
+	}
+	return QByteArray();
+}
@@ -0,0 +1,129 @@
+#ifndef PILLOW_HTTPMULTIPARTPARSER_H
+#define PILLOW_HTTPMULTIPARTPARSER_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHEADER_H
+#include "HttpHeader.h"
+#endif // PILLOW_HTTPHEADER_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QBYTEARRAYMATCHER_H
+#include <QtCore/QByteArrayMatcher>
+#endif // QBYTEARRAYMATCHER_H
+
+class QIODevice;
+
+namespace Pillow
+{
+	class HttpConnection;
+
+	//
+	// Pillow::HttpMultipartParser
+	//
+	// Incremental parser for multipart content (RFC 2046), such as the multipart/form-data
+	// request content sent for html form uploads (RFC 7578).
+	//
+	// Content can be fed in chunks of any size. Part headers are reported through partStarted and the
+	// part content through partContentReceived as soon as it is known not to be part of a boundary, so
+	// the parser only ever holds on to a few bytes, or to the headers of the current part.
+	// Use setPartDevice from a partStarted handler to write the part content straight to a file instead.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpMultipartParser : public QObject
+	{
+		Q_OBJECT
+		Q_ENUMS(Error)
+
+	public:
+		enum Error
+		{
+			NoError,
+			MalformedContentError,    // The content is not valid multipart content for the boundary.
+			PartHeadersTooLargeError, // The headers of a part are larger than MaximumPartHeadersLength.
+			TruncatedContentError,    // The content ended before the closing boundary.
+			PartDeviceError           // Writing to the part device failed.
+		};
+
+		enum { MaximumPartHeadersLength = 16 * 1024 };
+		enum { MaximumBoundaryLength = 70 };
+
+	public:
+		HttpMultipartParser(QObject* parent = 0);
+		HttpMultipartParser(const QByteArray& boundary, QObject* parent = 0);
+
+		// boundary: The boundary delimiting the parts, as given by the boundary parameter of the Content-Type.
+		//           Setting it resets the parser.
+		inline const QByteArray& boundary() const { return _boundary; }
+		void setBoundary(const QByteArray& boundary);
+
+		// Stream the content of a request to this parser. Call from a requestHeadersReady handler. Returns
+		// false, and leaves the connection alone, if the request content is not multipart.
+		bool parseRequestContent(Pillow::HttpConnection* connection);
+
+		void reset();
+
+		inline bool isFinished() const { return _state == Finished || _state == Failed; }
+		inline Error error() const { return _error; }
+		inline int partCount() const { return _partCount; }
+
+	public:
+		// The current part. Valid from partStarted until partFinished.
+		inline const Pillow::HttpHeaderCollection& partHeaders() const { return _partHeaders; }
+		QByteArray partName() const;     // The name parameter of the Content-Disposition header.
+		QByteArray partFileName() const; // The filename parameter of the Content-Disposition header. Empty for plain fields.
+		inline qint64 partContentLength() const { return _partContentLength; } // Number of content bytes received so far.
+
+		// partDevice: When set, the content of the current part gets written to device rather than being
+		//             emitted through partContentReceived. Set it from a partStarted handler; it is cleared
+		//             when the part is finished. The parser does not take ownership of the device.
+		inline QIODevice* partDevice() const { return _partDevice; }
+		inline void setPartDevice(QIODevice* device) { _partDevice = device; }
+
+	public:
+		// Get the boundary parameter of a multipart Content-Type, or an empty QByteArray if it is not multipart.
+		static QByteArray boundaryFromContentType(const QByteArray& contentType);
+
+		// Get the (unquoted) value of a parameter in a header value such as 'form-data; name="field"'.
+		static QByteArray headerParameter(const QByteArray& headerValue, const QByteArray& name);
+
+	public slots:
+		void write(const QByteArray& data);
+		void end(); // No more content. Fails with TruncatedContentError unless the closing boundary was found.
+
+	signals:
+		void partStarted(); // The headers of a new part have been received.
+		void partContentReceived(const QByteArray& data); // Some content of the current part. The data is only valid during the emission.
+		void partFinished(); // All the content of the current part has been received.
+		void finished(); // Parsing finished. Check error() to verify if there was an error.
+
+	private slots:
+		void connection_requestContentReceived(Pillow::HttpConnection* connection, const QByteArray& data);
+		void connection_closed(Pillow::HttpConnection* connection);
+
+	private:
+		enum State { Preamble, AfterDelimiter, PartHeaders, PartContent, Finished, Failed };
+
+		int parse(const char* data, int size); // Returns the number of bytes consumed.
+		void emitPartContent(const char* data, int size);
+		void fail(Error error);
+
+	private:
+		State _state;
+		Error _error;
+		QByteArray _boundary;
+		QByteArray _delimiter; // CRLF "--" boundary.
+		QByteArrayMatcher _delimiterMatcher;
+		QByteArray _buffer;    // Unconsumed input: the headers of a part, or what could be the start of a delimiter.
+		Pillow::HttpHeaderCollection _partHeaders;
+		qint64 _partContentLength;
+		QIODevice* _partDevice;
+		int _partCount;
+		qint64 _requestContentRemaining;
+	};
+}
+
+#endif // PILLOW_HTTPMULTIPARTPARSER_H
@@ -0,0 +1,358 @@
+#include "HttpResponseCache.h"
+#include "HttpHelpers.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QDateTime>
+using namespace Pillow;
+
+namespace Pillow
+{
+	namespace HttpResponseCacheTokens
+	{
+		static const Pillow::LowerCaseToken cacheControlToken("cache-control");
+		static const Pillow::LowerCaseToken pragmaToken("pragma");
+		static const Pillow::LowerCaseToken expiresToken("expires");
+		static const Pillow::LowerCaseToken dateToken("date");
+		static const Pillow::LowerCaseToken ageToken("age");
+		static const Pillow::LowerCaseToken etagToken("etag");
+		static const Pillow::LowerCaseToken lastModifiedToken("last-modified");
+		static const Pillow::LowerCaseToken varyToken("vary");
+		static const Pillow::LowerCaseToken authorizationToken("authorization");
+		static const Pillow::LowerCaseToken setCookieToken("set-cookie");
+		static const Pillow::LowerCaseToken ifNoneMatchToken("if-none-match");
+		static const Pillow::LowerCaseToken ifModifiedSinceToken("if-modified-since");
+		static const Pillow::LowerCaseToken noStoreToken("no-store");
+		static const Pillow::LowerCaseToken noCacheToken("no-cache");
+		static const Pillow::LowerCaseToken privateToken("private");
+		static const Pillow::LowerCaseToken publicToken("public");
+		static const Pillow::LowerCaseToken maxAgeToken("max-age");
+		static const Pillow::LowerCaseToken sMaxAgeToken("s-maxage");
+
+		// Headers that get recomputed when serving a stored response.
+		static const Pillow::LowerCaseToken contentLengthToken("content-length");
+	}
+
+	//
+	// Cache-Control directives, gathered from all the Cache-Control headers of a message.
+	//
+	struct HttpCacheControl
+	{
+		bool noStore, noCache, isPrivate, isPublic;
+		int maxAge, sMaxAge; // In seconds, -1 when absent.
+
+		HttpCacheControl(const HttpHeaderCollection& headers)
+			: noStore(false), noCache(false), isPrivate(false), isPublic(false), maxAge(-1), sMaxAge(-1)
+		{
+			using namespace Pillow::HttpResponseCacheTokens;
+			using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+			for (const HttpHeader* h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+			{
+				if (!asciiEqualsCaseInsensitive(h->first, cacheControlToken)) continue;
+
+				foreach (const QByteArray& rawDirective, h->second.split(','))
+				{
+					const QByteArray directive = rawDirective.trimmed();
+					const int equal = directive.indexOf('=');
+					const QByteArray name = equal < 0 ? directive : directive.left(equal).trimmed();
+					QByteArray value = equal < 0 ? QByteArray() : directive.mid(equal + 1).trimmed();
+					if (value.size() >= 2 && value.startsWith('"') && value.endsWith('"')) value = value.mid(1, value.size() - 2);
+
+					if (asciiEqualsCaseInsensitive(name, noStoreToken)) noStore = true;
+					else if (asciiEqualsCaseInsensitive(name, noCacheToken)) noCache = true;
+					else if (asciiEqualsCaseInsensitive(name, privateToken)) isPrivate = true;
+					else if (asciiEqualsCaseInsensitive(name, publicToken)) isPublic = true;
+					else if (asciiEqualsCaseInsensitive(name, maxAgeToken)) maxAge = parseSeconds(value);
+					else if (asciiEqualsCaseInsensitive(name, sMaxAgeToken)) sMaxAge = parseSeconds(value);
+				}
+			}
+		}
+
+		static int parseSeconds(const QByteArray& value)
+		{
+			bool ok = false;
+			const qint64 seconds = value.toLongLong(&ok);
+			if (!ok || seconds < 0) return 0; // Invalid values mean the response is stale.
+			return static_cast<int>(qMin<qint64>(seconds, 0x7fffffff));
+		}
+	};
+
+	struct HttpResponseCache::Entry
+	{
+		QList<QByteArray> varyFieldNames;
+		QList<QByteArray> variantKeys;
+		QList<HttpCachedResponse> variants;
+
+		int cost() const
+		{
+			int cost = 0;
+			for (int i = 0, iE = variants.size(); i < iE; ++i)
+				cost += variants.at(i).cost() + variantKeys.at(i).size();
+			return cost;
+		}
+	};
+
+	static QList<QByteArray> varyFieldNames(const HttpHeaderCollection& responseHeaders)
+	{
+		QList<QByteArray> names;
+		foreach (const QByteArray& vary, responseHeaders.getFieldValues(HttpResponseCacheTokens::varyToken.data(), HttpResponseCacheTokens::varyToken.size()))
+		{
+			foreach (const QByteArray& name, vary.split(','))
+			{
+				const QByteArray trimmedName = name.trimmed().toLower();
+				if (!trimmedName.isEmpty() && !names.contains(trimmedName)) names << trimmedName;
+			}
+		}
+		return names;
+	}
+
+	static QByteArray variantKeyOf(const QList<QByteArray>& varyFieldNames, const HttpHeaderCollection& requestHeaders)
+	{
+		QByteArray key;
+		foreach (const QByteArray& name, varyFieldNames)
+			key.append(requestHeaders.getFieldValue(name)).append('\n');
+		return key;
+	}
+
+	static bool isEndToEndHeader(const QByteArray& fieldName, const HttpHeaderCollection& headers)
+	{
+		using namespace Pillow::HttpResponseCacheTokens;
+		using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+		return !HttpProtocol::Headers::isHopByHopHeader(fieldName, headers)
+			&& !asciiEqualsCaseInsensitive(fieldName, contentLengthToken)
+			&& !asciiEqualsCaseInsensitive(fieldName, ageToken);
+	}
+}
+
+//
+// HttpCachedResponse
+//
+
+int HttpCachedResponse::cost() const
+{
+	int cost = content.size() + etag.size() + lastModified.size() + static_cast<int>(sizeof(HttpCachedResponse));
+	for (const HttpHeader* h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+		cost += h->first.size() + h->second.size() + static_cast<int>(sizeof(HttpHeader));
+	return cost;
+}
+
+//
+// HttpResponseCache
+//
+
+HttpResponseCache::HttpResponseCache(int maximumSize)
+	: _entries(maximumSize), _maximumResponseSize(DefaultMaximumResponseSize)
+{
+	_clock.start();
+}
+
+HttpResponseCache::~HttpResponseCache()
+{
+}
+
+void HttpResponseCache::setMaximumSize(int size)
+{
+	_entries.setMaxCost(size);
+}
+
+int HttpResponseCache::age(const HttpCachedResponse &response) const
+{
+	return response.initialAge + static_cast<int>((now() - response.storedAt) / 1000);
+}
+
+const HttpCachedResponse * HttpResponseCache::find(const QByteArray &key, const HttpHeaderCollection &requestHeaders)
+{
+	const Entry* entry = _entries.object(key);
+	if (entry == NULL) return NULL;
+
+	const int index = entry->variantKeys.indexOf(variantKeyOf(entry->varyFieldNames, requestHeaders));
+	return index < 0 ? NULL : &entry->variants.at(index);
+}
+
+QByteArray HttpResponseCache::variantKey(const QByteArray &key, const HttpHeaderCollection &requestHeaders)
+{
+	const Entry* entry = _entries.object(key);
+	if (entry == NULL || entry->varyFieldNames.isEmpty()) return key;
+
+	QByteArray result = key;
+	return result.append('\n').append(variantKeyOf(entry->varyFieldNames, requestHeaders));
+}
+
+bool HttpResponseCache::insert(const QByteArray &key, const HttpHeaderCollection &requestHeaders, const HttpCachedResponse &response)
+{
+	if (response.content.size() > _maximumResponseSize)
+	{
+		remove(key);
+		return false;
+	}
+
+	Entry* entry = new Entry();
+	entry->varyFieldNames = varyFieldNames(response.headers);
+	const QByteArray variantKey = variantKeyOf(entry->varyFieldNames, requestHeaders);
+
+	// Keep the other variants of the key, as long as they vary on the same request headers.
+	const Entry* previousEntry = _entries.object(key);
+	if (previousEntry != NULL && previousEntry->varyFieldNames == entry->varyFieldNames)
+	{
+		entry->variantKeys = previousEntry->variantKeys;
+		entry->variants = previousEntry->variants;
+		const int index = entry->variantKeys.indexOf(variantKey);
+		if (index >= 0)
+		{
+			entry->variantKeys.removeAt(index);
+			entry->variants.removeAt(index);
+		}
+		while (entry->variants.size() >= MaximumVariants)
+		{
+			entry->variantKeys.removeFirst();
+			entry->variants.removeFirst();
+		}
+	}
+	entry->variantKeys.append(variantKey);
+	entry->variants.append(response);
+
+	// QCache replaces (and deletes) the previous entry for the key, or deletes the new one if it is too large.
+	return _entries.insert(key, entry, entry->cost() + key.size());
+}
+
+void HttpResponseCache::remove(const QByteArray &key)
+{
+	_entries.remove(key);
+}
+
+void HttpResponseCache::clear()
+{
+	_entries.clear();
+}
+
+HttpCachedResponse HttpResponseCache::createResponse(int statusCode, const HttpHeaderCollection &headers, const QByteArray &content) const
+{
+	HttpCachedResponse response;
+	response.statusCode = statusCode;
+	response.content = content;
+	refreshResponse(response, headers);
+	return response;
+}
+
+void HttpResponseCache::refreshResponse(HttpCachedResponse &response, const HttpHeaderCollection &headers) const
+{
+	using namespace Pillow::HttpResponseCacheTokens;
+	using Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive;
+
+	// Headers received now replace the stored ones with the same name.
+	for (const HttpHeader* h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+	{
+		if (!isEndToEndHeader(h->first, headers)) continue;
+		for (int i = response.headers.size() - 1; i >= 0; --i)
+		{
+			if (asciiEqualsCaseInsensitive(response.headers.at(i).first.constData(), response.headers.at(i).first.size(), h->first.constData(), h->first.size()))
+				response.headers.remove(i);
+		}
+	}
+	for (const HttpHeader* h = headers.constBegin(), *hE = headers.constEnd(); h < hE; ++h)
+		if (isEndToEndHeader(h->first, headers)) response.headers << *h;
+
+	response.etag = response.headers.getFieldValue(etagToken);
+	response.lastModified = response.headers.getFieldValue(lastModifiedToken);
+	response.storedAt = now();
+
+	response.initialAge = qMax(0, headers.getFieldValue(ageToken).toInt());
+
+	// Freshness lifetime: s-maxage, then max-age, then Expires relative to Date. No heuristic freshness.
+	const HttpCacheControl cacheControl(response.headers);
+	qint64 lifetime = 0;
+	if (cacheControl.noCache)
+		lifetime = 0;
+	else if (cacheControl.sMaxAge >= 0)
+		lifetime = cacheControl.sMaxAge;
+	else if (cacheControl.maxAge >= 0)
+		lifetime = cacheControl.maxAge;
+	else
+	{
+		const QByteArray& expiresValue = response.headers.getFieldValue(expiresToken);
+		if (!expiresValue.isEmpty())
+		{
+			const QDateTime expires = HttpProtocol::Dates::parseHttpDate(expiresValue);
+			QDateTime date = HttpProtocol::Dates::parseHttpDate(response.headers.getFieldValue(dateToken));
+			if (!date.isValid()) date = QDateTime::currentDateTimeUtc();
+			lifetime = expires.isValid() ? qMax<qint64>(0, date.secsTo(expires)) : 0; // Invalid dates mean already expired.
+		}
+	}
+
+	response.freshUntil = response.storedAt + (lifetime - response.initialAge) * 1000;
+}
+
+bool HttpResponseCache::isStorableRequest(const HttpHeaderCollection &requestHeaders)
+{
+	return !HttpCacheControl(requestHeaders).noStore;
+}
+
+bool HttpResponseCache::acceptsStoredResponse(const HttpHeaderCollection &requestHeaders)
+{
+	const HttpCacheControl cacheControl(requestHeaders);
+	if (cacheControl.noCache || cacheControl.maxAge == 0) return false;
+	return !Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(requestHeaders.getFieldValue(HttpResponseCacheTokens::pragmaToken), HttpResponseCacheTokens::noCacheToken);
+}
+
+bool HttpResponseCache::isStorableResponse(int statusCode, const HttpHeaderCollection &responseHeaders, const HttpHeaderCollection &requestHeaders)
+{
+	using namespace Pillow::HttpResponseCacheTokens;
+
+	switch (statusCode)
+	{
+	case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+		break; // Cacheable by default.
+	default:
+		return false;
+	}
+
+	const HttpCacheControl cacheControl(responseHeaders);
+	if (cacheControl.noStore || cacheControl.isPrivate) return false;
+	if (!isStorableRequest(requestHeaders)) return false;
+
+	// A shared cache may only store responses to authorized requests when explicitly allowed to.
+	if (!requestHeaders.getFieldValue(authorizationToken).isEmpty() && !cacheControl.isPublic && cacheControl.sMaxAge < 0) return false;
+
+	// Cookies are specific to the client that caused them to be set; never hand them to other clients.
+	if (!responseHeaders.getFieldValue(setCookieToken).isEmpty()) return false;
+
+	const QList<QByteArray> vary = varyFieldNames(responseHeaders);
+	if (vary.contains("*")) return false;
+
+	// Responses are worth storing if they have an explicit freshness lifetime, or can be revalidated.
+	return cacheControl.sMaxAge >= 0 || cacheControl.maxAge >= 0
+		|| !responseHeaders.getFieldValue(expiresToken).isEmpty()
+		|| !responseHeaders.getFieldValue(etagToken).isEmpty()
+		|| !responseHeaders.getFieldValue(lastModifiedToken).isEmpty();
+}
+
+bool HttpResponseCache::isNotModified(const HttpCachedResponse &response, const HttpHeaderCollection &requestHeaders)
+{
+	using namespace Pillow::HttpResponseCacheTokens;
+
+	const QByteArray& ifNoneMatch = requestHeaders.getFieldValue(ifNoneMatchToken);
+	if (!ifNoneMatch.isEmpty())
+	{
+		// If-None-Match takes precedence over If-Modified-Since, and uses the weak comparison function.
+		if (response.etag.isEmpty()) return false;
+		const QByteArray etag = response.etag.startsWith("W/") ? response.etag.mid(2) : response.etag;
+		foreach (const QByteArray& rawTag, ifNoneMatch.split(','))
+		{
+			QByteArray tag = rawTag.trimmed();
+			if (tag == "*") return true;
+			if (tag.startsWith("W/")) tag = tag.mid(2);
+			if (tag == etag) return true;
+		}
+		return false;
+	}
+
+	const QByteArray& ifModifiedSince = requestHeaders.getFieldValue(ifModifiedSinceToken);
+	if (!ifModifiedSince.isEmpty() && !response.lastModified.isEmpty())
+	{
+		const QDateTime since = HttpProtocol::Dates::parseHttpDate(ifModifiedSince);
+		const QDateTime lastModified = HttpProtocol::Dates::parseHttpDate(response.lastModified);
+		return since.isValid() && lastModified.isValid() && lastModified <= since;
+	}
+
+	return false;
+}
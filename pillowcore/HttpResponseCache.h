@@ -0,0 +1,123 @@
+#ifndef PILLOW_HTTPRESPONSECACHE_H
+#define PILLOW_HTTPRESPONSECACHE_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef PILLOW_HTTPHEADER_H
+#include "HttpHeader.h"
+#endif // PILLOW_HTTPHEADER_H
+#ifndef QCACHE_H
+#include <QtCore/QCache>
+#endif // QCACHE_H
+#ifndef QELAPSEDTIMER_H
+#include <QtCore/QElapsedTimer>
+#endif // QELAPSEDTIMER_H
+
+namespace Pillow
+{
+	//
+	// Pillow::HttpCachedResponse
+	//
+	// A complete response, as stored in a Pillow::HttpResponseCache. Only the end-to-end
+	// headers are kept; the connection specific ones get recomputed when the response is served.
+	//
+	struct PILLOWCORE_EXPORT HttpCachedResponse
+	{
+		int statusCode;
+		Pillow::HttpHeaderCollection headers;
+		QByteArray content;
+		QByteArray etag;
+		QByteArray lastModified;
+		qint64 storedAt;   // Cache clock time, in msecs, at which the response was stored or last revalidated.
+		qint64 freshUntil; // Cache clock time, in msecs, until which the response may be served without revalidation.
+		int initialAge;    // Age of the response, in seconds, when it was received.
+
+		inline HttpCachedResponse() : statusCode(0), storedAt(0), freshUntil(0), initialAge(0) {}
+
+		inline bool hasValidators() const { return !etag.isEmpty() || !lastModified.isEmpty(); }
+		int cost() const;
+	};
+
+	//
+	// Pillow::HttpResponseCache
+	//
+	// In-memory storage for the responses of a shared Http cache, as per RFC 7234.
+	// Responses are stored per key (usually the request path and query string) and, when the
+	// response has a Vary header, per value of the request headers it names.
+	//
+	// The total size of the stored responses is bounded by maximumSize; the least recently
+	// used keys get evicted first.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpResponseCache
+	{
+		Q_DISABLE_COPY(HttpResponseCache)
+		struct Entry;
+		QCache<QByteArray, Entry> _entries;
+		QElapsedTimer _clock;
+		int _maximumResponseSize;
+
+	public:
+		enum { DefaultMaximumSize = 32 * 1024 * 1024 };
+		enum { DefaultMaximumResponseSize = 1024 * 1024 };
+		enum { MaximumVariants = 8 }; // Maximum number of Vary variants kept per key.
+
+	public:
+		HttpResponseCache(int maximumSize = DefaultMaximumSize);
+		~HttpResponseCache();
+
+		// maximumSize: Budget, in bytes, for all stored responses.
+		inline int maximumSize() const { return _entries.maxCost(); }
+		void setMaximumSize(int size);
+		inline int size() const { return _entries.totalCost(); }
+		inline int count() const { return _entries.count(); }
+
+		// maximumResponseSize: Responses with more content than this are never stored.
+		inline int maximumResponseSize() const { return _maximumResponseSize; }
+		inline void setMaximumResponseSize(int size) { _maximumResponseSize = size; }
+
+		inline qint64 now() const { return _clock.elapsed(); }
+		inline bool isFresh(const Pillow::HttpCachedResponse& response) const { return now() < response.freshUntil; }
+		int age(const Pillow::HttpCachedResponse& response) const; // Current age, in seconds.
+
+	public:
+		// Get the stored response for key that matches the request headers, or NULL if there is none.
+		// The returned pointer is only valid until the cache is next modified.
+		const Pillow::HttpCachedResponse* find(const QByteArray& key, const Pillow::HttpHeaderCollection& requestHeaders);
+
+		// Get the key completed with the values of the request headers that the stored responses vary on.
+		// Requests with the same variant key would get the same stored response.
+		QByteArray variantKey(const QByteArray& key, const Pillow::HttpHeaderCollection& requestHeaders);
+
+		// Store the response for key and the variant selected by the request headers.
+		// Returns false if the response was too large to be stored.
+		bool insert(const QByteArray& key, const Pillow::HttpHeaderCollection& requestHeaders, const Pillow::HttpCachedResponse& response);
+
+		void remove(const QByteArray& key);
+		void clear();
+
+	public:
+		// Build a cached response from a response received now.
+		Pillow::HttpCachedResponse createResponse(int statusCode, const Pillow::HttpHeaderCollection& headers, const QByteArray& content) const;
+
+		// Update a cached response with the headers of a "304 Not Modified" response received now.
+		void refreshResponse(Pillow::HttpCachedResponse& response, const Pillow::HttpHeaderCollection& notModifiedHeaders) const;
+
+		// Whether a request allows its response to be stored (no "Cache-Control: no-store").
+		static bool isStorableRequest(const Pillow::HttpHeaderCollection& requestHeaders);
+
+		// Whether a request may be answered with a fresh stored response without revalidating it first
+		// (no "Cache-Control: no-cache" or "max-age=0", no "Pragma: no-cache").
+		static bool acceptsStoredResponse(const Pillow::HttpHeaderCollection& requestHeaders);
+
+		// Whether a response to a GET request may be stored by a shared cache.
+		static bool isStorableResponse(int statusCode, const Pillow::HttpHeaderCollection& responseHeaders, const Pillow::HttpHeaderCollection& requestHeaders);
+
+		// Whether a stored response satisfies the If-None-Match or If-Modified-Since conditions of a request.
+		static bool isNotModified(const Pillow::HttpCachedResponse& response, const Pillow::HttpHeaderCollection& requestHeaders);
+	};
+}
+
+#endif // PILLOW_HTTPRESPONSECACHE_H
@@ -1,72 +1,31 @@
 #include "HttpServer.h"
 #include "HttpConnection.h"
+#include "Http2Session.h"
+#include "private/HttpServerPrivate.h"
 #include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QLocalSocket>
+#include <QtCore/QSocketNotifier>
+#ifndef PILLOW_NO_UNIX_SERVER
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif // !PILLOW_NO_UNIX_SERVER
 using namespace Pillow;
 
 //
 // HttpServer
 //
 
-namespace Pillow
-{
-	class HttpServerPrivate
-	{
-	public:
-		enum { MaximumReserveCount = 25 };
-
-	public:
-		QObject* q_ptr;
-		QList<HttpConnection*> reservedConnections;
-
-	public:
-		HttpServerPrivate(QObject* server)
-			: q_ptr(server)
-		{
-			for (int i = 0; i < MaximumReserveCount; ++i)
-				reservedConnections << createConnection();
-		}
-
-		~HttpServerPrivate()
-		{
-			while (!reservedConnections.isEmpty())
-				delete reservedConnections.takeLast();
-		}
-
-		HttpConnection* createConnection()
-		{
-			HttpConnection* connection = new HttpConnection(q_ptr);
-			QObject::connect(connection, SIGNAL(requestReady(Pillow::HttpConnection*)), q_ptr, SIGNAL(requestReady(Pillow::HttpConnection*)));
-			QObject::connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), q_ptr, SLOT(connection_closed(Pillow::HttpConnection*)));
-			return connection;
-		}
-
-		HttpConnection* takeConnection()
-		{
-			if (reservedConnections.isEmpty())
-				return createConnection();
-			else
-				return reservedConnections.takeLast();
-		}
-
-		void putConnection(HttpConnection* connection)
-		{
-			while (reservedConnections.size() >= MaximumReserveCount)
-				delete reservedConnections.takeLast();
-
-			reservedConnections.append(connection);
-		}
-	};
-}
-
 HttpServer::HttpServer(QObject *parent)
-: QTcpServer(parent), d_ptr(new HttpServerPrivate(this))
+: QTcpServer(parent), d_ptr(new HttpServerPrivate(this, SLOT(connection_requestReady(Pillow::HttpConnection*))))
 {
 	setMaxPendingConnections(128);
 }
 
 HttpServer::HttpServer(const QHostAddress &serverAddress, quint16 serverPort, QObject *parent)
-:	QTcpServer(parent), d_ptr(new HttpServerPrivate(this))
+:	QTcpServer(parent), d_ptr(new HttpServerPrivate(this, SLOT(connection_requestReady(Pillow::HttpConnection*))))
 {
 	setMaxPendingConnections(128);
 	if (!listen(serverAddress, serverPort))
@@ -96,8 +55,9 @@ void HttpServer::incomingConnection(int socketDescriptor)
 
 void HttpServer::connection_closed(Pillow::HttpConnection *connection)
 {
-	connection->inputDevice()->deleteLater();
+	if (connection->inputDevice()) connection->inputDevice()->deleteLater(); // Unless the connection was upgraded to another protocol.
 	d_ptr->putConnection(connection);
+	if (d_ptr->shuttingDown) QMetaObject::invokeMethod(this, "checkDrained", Qt::QueuedConnection);
 }
 
 HttpConnection* Pillow::HttpServer::createHttpConnection()
@@ -105,19 +65,83 @@ HttpConnection* Pillow::HttpServer::createHttpConnection()
 	return d_ptr->takeConnection();
 }
 
+void HttpServer::connection_requestReady(Pillow::HttpConnection* connection)
+{
+	if (d_ptr->http2Enabled && (Http2Session::isPriorKnowledgeRequest(connection) || Http2Session::isUpgradeRequest(connection)))
+	{
+		Http2Session* session = Http2Session::upgrade(connection, this);
+		if (session)
+		{
+			connect(session, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)), this, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)));
+			connect(session, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SIGNAL(requestReady(Pillow::HttpConnection*)));
+			connect(session, SIGNAL(closed(Pillow::Http2Session*)), session, SLOT(deleteLater()));
+			connect(session, SIGNAL(closed(Pillow::Http2Session*)), this, SLOT(checkDrained()), Qt::QueuedConnection);
+			if (d_ptr->shuttingDown) session->goAway();
+			return;
+		}
+	}
+	emit requestReady(connection);
+}
+
+bool HttpServer::isHttp2Enabled() const
+{
+	return d_ptr->http2Enabled;
+}
+
+void HttpServer::setHttp2Enabled(bool enabled)
+{
+	d_ptr->http2Enabled = enabled;
+}
+
+int HttpServer::connectionCount() const
+{
+	int count = d_ptr->activeConnections.size();
+	foreach (Http2Session* session, findChildren<Http2Session*>())
+		if (!session->isClosed()) ++count;
+	return count;
+}
+
+bool HttpServer::isShuttingDown() const
+{
+	return d_ptr->shuttingDown;
+}
+
+void HttpServer::shutdown()
+{
+	if (d_ptr->shuttingDown) return;
+	d_ptr->shuttingDown = true;
+	close(); // When the listening socket was handed to another process, it keeps accepting there.
+
+	// Closing can put connections back right away.
+	const QList<HttpConnection*> connections = d_ptr->activeConnections.toList();
+	foreach (HttpConnection* connection, connections)
+		connection->closeWhenIdle();
+	foreach (Http2Session* session, findChildren<Http2Session*>())
+		session->goAway();
+
+	QMetaObject::invokeMethod(this, "checkDrained", Qt::QueuedConnection);
+}
+
+void HttpServer::checkDrained()
+{
+	if (!d_ptr->shuttingDown || connectionCount() > 0) return;
+	d_ptr->shuttingDown = false;
+	emit drained();
+}
+
 //
 // HttpLocalServer
 //
 
 HttpLocalServer::HttpLocalServer(QObject *parent)
-	: QLocalServer(parent), d_ptr(new HttpServerPrivate(this))
+	: QLocalServer(parent), d_ptr(new HttpServerPrivate(this)), _socketDescriptor(-1), _acceptNotifier(0)
 {
 	setMaxPendingConnections(128);
 	connect(this, SIGNAL(newConnection()), this, SLOT(this_newConnection()));
 }
 
 HttpLocalServer::HttpLocalServer(const QString& serverName, QObject *parent /*= 0*/)
-	: QLocalServer(parent), d_ptr(new HttpServerPrivate(this))
+	: QLocalServer(parent), d_ptr(new HttpServerPrivate(this)), _socketDescriptor(-1), _acceptNotifier(0)
 {
 	setMaxPendingConnections(128);
 	connect(this, SIGNAL(newConnection()), this, SLOT(this_newConnection()));
@@ -126,14 +150,97 @@ HttpLocalServer::HttpLocalServer(const QString& serverName, QObject *parent /*=
 		qWarning() << QString("HttpLocalServer::HttpLocalServer: could not bind to %1 for listening: %2").arg(serverName).arg(errorString());
 }
 
+HttpLocalServer::~HttpLocalServer()
+{
+	close();
+	delete d_ptr;
+}
+
+bool HttpLocalServer::isListening() const
+{
+	return _socketDescriptor >= 0 || QLocalServer::isListening();
+}
+
+void HttpLocalServer::close()
+{
+	QLocalServer::close();
+	if (_socketDescriptor < 0) return;
+
+	_acceptNotifier->setEnabled(false); _acceptNotifier->deleteLater(); _acceptNotifier = 0;
+#ifndef PILLOW_NO_UNIX_SERVER
+	::close(_socketDescriptor); // Whoever bound the socket owns its file.
+#endif // !PILLOW_NO_UNIX_SERVER
+	_socketDescriptor = -1;
+}
+
+bool HttpLocalServer::setSocketDescriptor(int socketDescriptor)
+{
+#ifndef PILLOW_NO_UNIX_SERVER
+	close();
+
+	int value = 0; socklen_t valueLength = sizeof(value);
+	sockaddr_un address; socklen_t addressLength = sizeof(address);
+	if (::getsockopt(socketDescriptor, SOL_SOCKET, SO_ACCEPTCONN, &value, &valueLength) < 0 || value == 0
+		|| ::getsockname(socketDescriptor, reinterpret_cast<sockaddr*>(&address), &addressLength) < 0 || address.sun_family != AF_UNIX)
+	{
+		qWarning() << "HttpLocalServer::setSocketDescriptor:" << socketDescriptor << "is not a listening AF_UNIX socket";
+		return false;
+	}
+
+	int flags = ::fcntl(socketDescriptor, F_GETFL);
+	if (flags < 0 || ::fcntl(socketDescriptor, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		qWarning() << "HttpLocalServer::setSocketDescriptor: could not make" << socketDescriptor << "non blocking:" << qt_error_string(errno);
+		return false;
+	}
+
+	_socketDescriptor = socketDescriptor;
+	_acceptNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Read, this);
+	connect(_acceptNotifier, SIGNAL(activated(int)), this, SLOT(acceptNotifier_activated()));
+	return true;
+#else
+	Q_UNUSED(socketDescriptor);
+	qWarning() << "HttpLocalServer::setSocketDescriptor: not supported on this platform";
+	return false;
+#endif // !PILLOW_NO_UNIX_SERVER
+}
+
 void HttpLocalServer::this_newConnection()
 {
 	QIODevice* device = nextPendingConnection();
 	d_ptr->takeConnection()->initialize(device, device);
 }
 
+void HttpLocalServer::acceptNotifier_activated()
+{
+#ifndef PILLOW_NO_UNIX_SERVER
+	// Accept all the pending connections at once.
+	forever
+	{
+		int socketDescriptor = ::accept4(_socketDescriptor, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socketDescriptor < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				qWarning() << "HttpLocalServer::acceptNotifier_activated: failed to accept a connection:" << qt_error_string(errno);
+			break;
+		}
+
+		QLocalSocket* socket = new QLocalSocket(this);
+		if (socket->setSocketDescriptor(socketDescriptor))
+			d_ptr->takeConnection()->initialize(socket, socket);
+		else
+		{
+			qWarning() << "HttpLocalServer::acceptNotifier_activated: failed to set socket descriptor" << socketDescriptor << "on socket.";
+			::close(socketDescriptor);
+			delete socket;
+		}
+	}
+#endif // !PILLOW_NO_UNIX_SERVER
+}
+
 void HttpLocalServer::connection_closed(Pillow::HttpConnection *connection)
 {
-	connection->inputDevice()->deleteLater();
+	if (connection->inputDevice()) connection->inputDevice()->deleteLater(); // Unless the connection was upgraded to another protocol.
 	d_ptr->putConnection(connection);
 }
@@ -11,6 +11,8 @@
 #include <QtNetwork/QLocalServer>
 #endif // QLOCALSERVER_H
 
+class QSocketNotifier;
+
 namespace Pillow
 {
 	class HttpConnection;
@@ -32,6 +34,8 @@ namespace Pillow
 
 	private slots:
 		void connection_closed(Pillow::HttpConnection* request);
+		void connection_requestReady(Pillow::HttpConnection* connection);
+		void checkDrained();
 
 	protected:
 		virtual void incomingConnection(int socketDescriptor);
@@ -42,8 +46,25 @@ namespace Pillow
 		HttpServer(const QHostAddress& serverAddress, quint16 serverPort, QObject *parent = 0);
 		~HttpServer();
 
+		// Whether connections switch to Http/2 (see Pillow::Http2Session) on "Upgrade: h2c" requests and for clients
+		// sending the Http/2 connection preface right away. Requests of Http/2 streams come through the same signals.
+		// Disabled by default.
+		bool isHttp2Enabled() const;
+		void setHttp2Enabled(bool enabled);
+
+		// Number of open connections, counting an Http/2 session as one.
+		int connectionCount() const;
+		bool isShuttingDown() const;
+
+	public slots:
+		// Stop listening, then close each connection once it answered its current request: idle connections close right away,
+		// the others answer with "Connection: close". Http/2 sessions are sent GOAWAY. Emits drained once none is left.
+		void shutdown();
+
 	signals:
+		void requestHeadersReady(Pillow::HttpConnection* connection); // The headers of a request with content have been received on this connection.
 		void requestReady(Pillow::HttpConnection* connection); // There is a request ready to be handled on this connection.
+		void drained(); // After shutdown(), the last connection closed.
 	};
 
 	//
@@ -55,16 +76,29 @@ namespace Pillow
 		Q_OBJECT
 		Q_DECLARE_PRIVATE(HttpServer)
 		HttpServerPrivate* d_ptr;
+		int _socketDescriptor;
+		QSocketNotifier* _acceptNotifier;
 
 	private slots:
 		void this_newConnection();
+		void acceptNotifier_activated();
 		void connection_closed(Pillow::HttpConnection* request);
 
 	public:
 		HttpLocalServer(QObject* parent = 0);
 		HttpLocalServer(const QString& serverName, QObject *parent = 0);
+		~HttpLocalServer();
+
+		// Adopt an already listening AF_UNIX stream socket, inherited from a service manager for instance (Linux only).
+		// QLocalServer cannot take a descriptor, so the server accepts on it alongside: these hide the QLocalServer
+		// methods to account for it. Returns false, leaving the descriptor open, on failure.
+		bool setSocketDescriptor(int socketDescriptor);
+		inline int socketDescriptor() const { return _socketDescriptor; } // The adopted descriptor, -1 if none.
+		bool isListening() const;
+		void close();
 
 	signals:
+		void requestHeadersReady(Pillow::HttpConnection* connection); // The headers of a request with content have been received on this connection.
 		void requestReady(Pillow::HttpConnection* connection); // There is a request ready to be handled on this connection.
 	};
 }
@@ -0,0 +1,322 @@
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#include "HttpServerHandover.h"
+#include "HttpServer.h"
+#include "HttpUnixServer.h"
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QTimer>
+#include <QtCore/QDebug>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+using namespace Pillow;
+
+namespace
+{
+	const char acknowledgement = 'A';
+
+	bool toSocketAddress(const QByteArray& path, sockaddr_un* address, socklen_t* addressLength)
+	{
+		if (path.isEmpty()) return false;
+		const bool abstract = path.startsWith('\0');
+		memset(address, 0, sizeof(sockaddr_un));
+		address->sun_family = AF_UNIX;
+		memcpy(address->sun_path, path.constData(), path.size());
+		*addressLength = socklen_t(offsetof(sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1));
+		return true;
+	}
+
+	// The message is the number of descriptors, with the descriptors themselves as ancillary data.
+	bool sendDescriptors(int socketDescriptor, const QList<int>& descriptors)
+	{
+		quint32 count = quint32(descriptors.size());
+		iovec data = { &count, sizeof(count) };
+		char control[CMSG_SPACE(sizeof(int) * HttpServerHandover::MaximumServerCount)];
+		memset(control, 0, sizeof(control));
+
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = CMSG_SPACE(sizeof(int) * descriptors.size());
+
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int) * descriptors.size());
+		int* target = reinterpret_cast<int*>(CMSG_DATA(header));
+		for (int i = 0; i < descriptors.size(); ++i) target[i] = descriptors.at(i);
+
+		ssize_t bytesSent;
+		do bytesSent = ::sendmsg(socketDescriptor, &message, MSG_NOSIGNAL);
+		while (bytesSent < 0 && errno == EINTR);
+		return bytesSent == ssize_t(sizeof(count));
+	}
+
+	QList<int> receiveDescriptors(int socketDescriptor, int msecs)
+	{
+		QList<int> descriptors;
+		pollfd pollDescriptor = { socketDescriptor, POLLIN, 0 };
+		int ready;
+		do ready = ::poll(&pollDescriptor, 1, msecs);
+		while (ready < 0 && errno == EINTR);
+		if (ready <= 0) return descriptors;
+
+		quint32 count = 0;
+		iovec data = { &count, sizeof(count) };
+		char control[CMSG_SPACE(sizeof(int) * HttpServerHandover::MaximumServerCount)];
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		ssize_t bytesReceived;
+		do bytesReceived = ::recvmsg(socketDescriptor, &message, MSG_CMSG_CLOEXEC);
+		while (bytesReceived < 0 && errno == EINTR);
+		if (bytesReceived != ssize_t(sizeof(count))) return descriptors;
+
+		for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != 0; header = CMSG_NXTHDR(&message, header))
+		{
+			if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+			const int* source = reinterpret_cast<const int*>(CMSG_DATA(header));
+			for (int i = 0, iE = int((header->cmsg_len - CMSG_LEN(0)) / sizeof(int)); i < iE; ++i)
+				descriptors << source[i];
+		}
+
+		if (descriptors.size() != int(count) || (message.msg_flags & MSG_CTRUNC))
+		{
+			foreach (int descriptor, descriptors) ::close(descriptor);
+			descriptors.clear();
+		}
+		return descriptors;
+	}
+}
+
+//
+// HttpServerHandover
+//
+
+HttpServerHandover::HttpServerHandover(QObject* parent)
+	: QObject(parent), _socketDescriptor(-1), _acceptNotifier(0), _peer(0), _acknowledgeTimer(0), _drainingServerCount(0), _handedOver(false)
+{
+}
+
+HttpServerHandover::~HttpServerHandover()
+{
+	close();
+}
+
+bool HttpServerHandover::offer(const QString& name, const QList<Pillow::HttpServer*>& servers)
+{
+	close();
+
+	if (servers.isEmpty() || servers.size() > MaximumServerCount)
+	{
+		_errorString = QString("HttpServerHandover::offer: between 1 and %1 servers can be handed over").arg(int(MaximumServerCount));
+		return false;
+	}
+	foreach (HttpServer* server, servers)
+	{
+		if (!server->isListening())
+		{
+			_errorString = "HttpServerHandover::offer: the servers must be listening";
+			return false;
+		}
+	}
+
+	_name = name;
+	_servers = servers;
+	_handedOver = false;
+	if (!listen())
+	{
+		_servers.clear();
+		return false;
+	}
+	return true;
+}
+
+void HttpServerHandover::close()
+{
+	stopListening();
+	dropPeer();
+	_servers.clear();
+}
+
+bool HttpServerHandover::listen()
+{
+	const QByteArray path = UnixSocket::addressForServerName(_name);
+	sockaddr_un address; socklen_t addressLength;
+	if (!toSocketAddress(path, &address, &addressLength))
+	{
+		_errorString = QString("HttpServerHandover::listen: invalid name %1").arg(_name);
+		return false;
+	}
+
+	int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int result = socketDescriptor < 0 ? -1 : ::bind(socketDescriptor, reinterpret_cast<sockaddr*>(&address), addressLength);
+	if (result < 0 && errno == EADDRINUSE && !path.startsWith('\0'))
+	{
+		// A file left behind by a process that did not get to remove it. Unless somebody still accepts on it.
+		int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&address), addressLength) < 0 && errno == ECONNREFUSED)
+		{
+			::unlink(path.constData());
+			result = ::bind(socketDescriptor, reinterpret_cast<sockaddr*>(&address), addressLength);
+		}
+		else
+			errno = EADDRINUSE;
+		if (probe >= 0) { int error = errno; ::close(probe); errno = error; }
+	}
+	if (result < 0 || ::listen(socketDescriptor, 1) < 0)
+	{
+		int error = errno;
+		if (socketDescriptor >= 0) ::close(socketDescriptor);
+		_errorString = qt_error_string(error);
+		return false;
+	}
+
+	_socketDescriptor = socketDescriptor;
+	_errorString.clear();
+	_acceptNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Read, this);
+	connect(_acceptNotifier, SIGNAL(activated(int)), this, SLOT(acceptNotifier_activated()));
+	return true;
+}
+
+void HttpServerHandover::stopListening()
+{
+	if (_socketDescriptor < 0) return;
+
+	_acceptNotifier->setEnabled(false); _acceptNotifier->deleteLater(); _acceptNotifier = 0;
+	::close(_socketDescriptor);
+	_socketDescriptor = -1;
+
+	const QByteArray path = UnixSocket::addressForServerName(_name);
+	if (!path.isEmpty() && !path.startsWith('\0')) ::unlink(path.constData());
+}
+
+void HttpServerHandover::dropPeer()
+{
+	if (_acknowledgeTimer) { _acknowledgeTimer->deleteLater(); _acknowledgeTimer = 0; }
+	if (_peer == 0) return;
+	disconnect(_peer, 0, this, 0);
+	_peer->close();
+	_peer->deleteLater();
+	_peer = 0;
+}
+
+void HttpServerHandover::acceptNotifier_activated()
+{
+	int socketDescriptor;
+	do socketDescriptor = ::accept4(_socketDescriptor, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	while (socketDescriptor < 0 && (errno == EINTR || errno == ECONNABORTED));
+	if (socketDescriptor < 0) return;
+
+	// Free the name right away: the new process offers under it once it took over.
+	stopListening();
+
+	QList<int> descriptors;
+	foreach (HttpServer* server, _servers)
+		descriptors << server->socketDescriptor();
+	if (!sendDescriptors(socketDescriptor, descriptors))
+	{
+		qWarning() << "HttpServerHandover::acceptNotifier_activated: failed to send the descriptors:" << qt_error_string(errno);
+		::close(socketDescriptor);
+		if (!listen()) qWarning() << "HttpServerHandover::acceptNotifier_activated: could not offer again:" << _errorString;
+		return;
+	}
+
+	_peer = new UnixSocket(socketDescriptor, this);
+	connect(_peer, SIGNAL(readyRead()), this, SLOT(peer_readyRead()));
+	connect(_peer, SIGNAL(disconnected()), this, SLOT(peer_disconnected()));
+	_acknowledgeTimer = new QTimer(this);
+	_acknowledgeTimer->setSingleShot(true);
+	connect(_acknowledgeTimer, SIGNAL(timeout()), this, SLOT(peer_disconnected()));
+	_acknowledgeTimer->start(AcknowledgeTimeout);
+}
+
+void HttpServerHandover::peer_readyRead()
+{
+	char c = 0;
+	if (_peer->read(&c, 1) != 1) return;
+	if (c != acknowledgement) return peer_disconnected();
+	dropPeer();
+
+	// The new process accepts on the sockets now. Stop accepting here and finish what is in flight.
+	const QList<HttpServer*> servers = _servers;
+	_servers.clear();
+	_handedOver = true;
+	_drainingServerCount = servers.size();
+	foreach (HttpServer* server, servers)
+	{
+		connect(server, SIGNAL(drained()), this, SLOT(server_drained()));
+		server->shutdown();
+	}
+	emit handedOver();
+}
+
+void HttpServerHandover::peer_disconnected()
+{
+	// The new process went away, or hangs, without adopting the descriptors: keep serving, and offering.
+	qWarning() << "HttpServerHandover::peer_disconnected: the new process did not take over" << _name;
+	dropPeer();
+	if (!listen()) qWarning() << "HttpServerHandover::peer_disconnected: could not offer again:" << _errorString;
+}
+
+void HttpServerHandover::server_drained()
+{
+	disconnect(sender(), SIGNAL(drained()), this, SLOT(server_drained()));
+	if (--_drainingServerCount == 0)
+		emit drained();
+}
+
+bool HttpServerHandover::takeOver(const QString& name, const QList<Pillow::HttpServer*>& servers, int msecs)
+{
+	sockaddr_un address; socklen_t addressLength;
+	if (servers.isEmpty() || servers.size() > MaximumServerCount || !toSocketAddress(UnixSocket::addressForServerName(name), &address, &addressLength))
+		return false;
+
+	int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socketDescriptor < 0) return false;
+	if (::connect(socketDescriptor, reinterpret_cast<sockaddr*>(&address), addressLength) < 0)
+	{
+		::close(socketDescriptor); // Nobody offers: a first start.
+		return false;
+	}
+
+	QList<int> descriptors = receiveDescriptors(socketDescriptor, msecs);
+	bool adopted = descriptors.size() == servers.size();
+	if (!adopted)
+		qWarning() << "HttpServerHandover::takeOver: expected" << servers.size() << "descriptors, received" << descriptors.size();
+
+	for (int i = 0; adopted && i < servers.size(); ++i)
+	{
+		if (!servers.at(i)->setSocketDescriptor(descriptors.at(i)))
+		{
+			qWarning() << "HttpServerHandover::takeOver: failed to adopt descriptor" << descriptors.at(i) << ":" << servers.at(i)->errorString();
+			for (int j = 0; j < i; ++j) servers.at(j)->close();
+			adopted = false;
+		}
+		else
+			descriptors[i] = -1;
+	}
+	foreach (int descriptor, descriptors)
+		if (descriptor >= 0) ::close(descriptor);
+
+	// Without the acknowledgement, the old process keeps serving.
+	if (adopted && ::send(socketDescriptor, &acknowledgement, 1, MSG_NOSIGNAL) != 1)
+	{
+		foreach (HttpServer* server, servers) server->close();
+		adopted = false;
+	}
+	::close(socketDescriptor);
+	return adopted;
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
@@ -0,0 +1,92 @@
+#ifndef PILLOW_HTTPSERVERHANDOVER_H
+#define PILLOW_HTTPSERVERHANDOVER_H
+
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QLIST_H
+#include <QtCore/QList>
+#endif // QLIST_H
+
+class QSocketNotifier;
+class QTimer;
+
+namespace Pillow
+{
+	class HttpServer;
+	class UnixSocket;
+
+	//
+	// Pillow::HttpServerHandover
+	//
+	// Hands the listening sockets of Pillow::HttpServers over to a replacement process (Linux only), for restarts
+	// that refuse no connection. The running process offers its servers under a name (see Pillow::UnixSocket
+	// for server names). The new process calls takeOver() with its own servers, in the same order, before it
+	// would otherwise listen: it receives the listening descriptors over the AF_UNIX socket (SCM_RIGHTS) and
+	// acknowledges. The old process then shuts its servers down, which lets the in-flight requests complete,
+	// and emits drained once they are done: it can exit.
+	//
+	// Both processes share the listening sockets meanwhile, so connections waiting in their backlogs are not lost.
+	// If the new process fails to adopt the sockets, the old one keeps serving and offering.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpServerHandover : public QObject
+	{
+		Q_OBJECT
+		QList<Pillow::HttpServer*> _servers;
+		QString _name;
+		QString _errorString;
+		int _socketDescriptor;
+		QSocketNotifier* _acceptNotifier;
+		Pillow::UnixSocket* _peer;
+		QTimer* _acknowledgeTimer;
+		int _drainingServerCount;
+		bool _handedOver;
+
+	public:
+		enum { MaximumServerCount = 16 };
+		enum { AcknowledgeTimeout = 10000 }; // Milliseconds the new process has to adopt the descriptors.
+
+	public:
+		HttpServerHandover(QObject* parent = 0);
+		~HttpServerHandover();
+
+		// Listen for a new process under the given name. The servers must be listening. Returns false on failure.
+		bool offer(const QString& name, const QList<Pillow::HttpServer*>& servers);
+		void close(); // Stop offering.
+
+		inline bool isOffering() const { return _socketDescriptor >= 0 || _peer != 0; }
+		inline bool isHandedOver() const { return _handedOver; }
+		inline const QString& name() const { return _name; }
+		inline const QString& errorString() const { return _errorString; }
+
+		// Take the listening sockets offered under the given name, waiting up to msecs for them. Each server adopts the
+		// descriptor at its position. Returns false, with the servers left alone, if nobody offers or on a mismatch.
+		static bool takeOver(const QString& name, const QList<Pillow::HttpServer*>& servers, int msecs = 5000);
+
+	signals:
+		void handedOver(); // The new process adopted the sockets. The servers stopped listening and are shutting down.
+		void drained();    // The servers finished their in-flight requests after a handover.
+
+	private slots:
+		void acceptNotifier_activated();
+		void peer_readyRead();
+		void peer_disconnected();
+		void server_drained();
+
+	private:
+		bool listen();
+		void stopListening();
+		void dropPeer();
+	};
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
+
+#endif // PILLOW_HTTPSERVERHANDOVER_H
@@ -0,0 +1,135 @@
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#include "HttpSocketActivation.h"
+#include "HttpServer.h"
+#include "HttpUnixServer.h"
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QDebug>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+using namespace Pillow;
+
+namespace
+{
+	struct InheritedDescriptors
+	{
+		QList<int> descriptors;
+		QStringList names;
+		QSet<int> adopted;
+
+		InheritedDescriptors()
+		{
+			const QByteArray pid = qgetenv("LISTEN_PID"), count = qgetenv("LISTEN_FDS"), names = qgetenv("LISTEN_FDNAMES");
+			::unsetenv("LISTEN_PID");
+			::unsetenv("LISTEN_FDS");
+			::unsetenv("LISTEN_FDNAMES");
+
+			bool ok = false;
+			const int descriptorCount = count.toInt(&ok);
+			if (!ok || descriptorCount <= 0 || pid.toLongLong() != qint64(::getpid())) return;
+
+			const QStringList nameList = QString::fromUtf8(names).split(QLatin1Char(':'));
+			for (int i = 0; i < descriptorCount; ++i)
+			{
+				const int descriptor = HttpSocketActivation::FirstDescriptor + i;
+				int flags = ::fcntl(descriptor, F_GETFD);
+				if (flags < 0) continue; // Not actually open.
+				::fcntl(descriptor, F_SETFD, flags | FD_CLOEXEC);
+
+				descriptors << descriptor;
+				this->names << (i < nameList.size() && !names.isEmpty() ? nameList.at(i) : QString("unknown"));
+			}
+		}
+	};
+
+	InheritedDescriptors& inherited()
+	{
+		static InheritedDescriptors instance;
+		return instance;
+	}
+
+	bool isListeningStreamSocket(int descriptor, bool unixFamily)
+	{
+		int value = 0; socklen_t valueLength = sizeof(value);
+		if (::getsockopt(descriptor, SOL_SOCKET, SO_TYPE, &value, &valueLength) < 0 || value != SOCK_STREAM) return false;
+		valueLength = sizeof(value);
+		if (::getsockopt(descriptor, SOL_SOCKET, SO_ACCEPTCONN, &value, &valueLength) < 0 || value == 0) return false;
+
+		sockaddr_storage address; socklen_t addressLength = sizeof(address);
+		if (::getsockname(descriptor, reinterpret_cast<sockaddr*>(&address), &addressLength) < 0) return false;
+		return unixFamily ? address.ss_family == AF_UNIX : (address.ss_family == AF_INET || address.ss_family == AF_INET6);
+	}
+
+	int nextDescriptor(const QString& name, bool unixFamily)
+	{
+		InheritedDescriptors& i = inherited();
+		for (int index = 0; index < i.descriptors.size(); ++index)
+		{
+			const int descriptor = i.descriptors.at(index);
+			if (i.adopted.contains(descriptor) || (!name.isEmpty() && i.names.at(index) != name)) continue;
+			if (isListeningStreamSocket(descriptor, unixFamily)) return descriptor;
+		}
+		return -1;
+	}
+}
+
+QList<int> HttpSocketActivation::descriptors()
+{
+	return inherited().descriptors;
+}
+
+QList<int> HttpSocketActivation::descriptors(const QString& name)
+{
+	const InheritedDescriptors& i = inherited();
+	QList<int> result;
+	for (int index = 0; index < i.descriptors.size(); ++index)
+		if (i.names.at(index) == name) result << i.descriptors.at(index);
+	return result;
+}
+
+QString HttpSocketActivation::name(int descriptor)
+{
+	const InheritedDescriptors& i = inherited();
+	const int index = i.descriptors.indexOf(descriptor);
+	return index < 0 ? QString() : i.names.at(index);
+}
+
+bool HttpSocketActivation::listen(Pillow::HttpServer* server, const QString& name)
+{
+	const int descriptor = nextDescriptor(name, false);
+	if (descriptor < 0) return false;
+	if (!server->setSocketDescriptor(descriptor))
+	{
+		qWarning() << "HttpSocketActivation::listen: could not adopt descriptor" << descriptor << ":" << server->errorString();
+		return false;
+	}
+	inherited().adopted.insert(descriptor);
+	return true;
+}
+
+bool HttpSocketActivation::listen(Pillow::HttpLocalServer* server, const QString& name)
+{
+	const int descriptor = nextDescriptor(name, true);
+	if (descriptor < 0) return false;
+	if (!server->setSocketDescriptor(descriptor)) return false; // It warns about the reason itself.
+	inherited().adopted.insert(descriptor);
+	return true;
+}
+
+bool HttpSocketActivation::listen(Pillow::HttpUnixServer* server, const QString& name)
+{
+	const int descriptor = nextDescriptor(name, true);
+	if (descriptor < 0) return false;
+	if (!server->setSocketDescriptor(descriptor))
+	{
+		qWarning() << "HttpSocketActivation::listen: could not adopt descriptor" << descriptor << ":" << server->errorString();
+		return false;
+	}
+	inherited().adopted.insert(descriptor);
+	return true;
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
@@ -0,0 +1,56 @@
+#ifndef PILLOW_HTTPSOCKETACTIVATION_H
+#define PILLOW_HTTPSOCKETACTIVATION_H
+
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QLIST_H
+#include <QtCore/QList>
+#endif // QLIST_H
+#ifndef QSTRING_H
+#include <QtCore/QString>
+#endif // QSTRING_H
+
+namespace Pillow
+{
+	class HttpServer;
+	class HttpLocalServer;
+	class HttpUnixServer;
+
+	//
+	// Pillow::HttpSocketActivation
+	//
+	// Listening sockets inherited from a service manager (Linux only), following the systemd LISTEN_FDS protocol:
+	// the manager binds the sockets and queues the connections while the process starts, or starts the process on
+	// the first connection. The descriptors start at 3; LISTEN_PID must be the pid of this process and LISTEN_FDNAMES
+	// optionally names them (FileDescriptorName=), "unknown" otherwise.
+	//
+	// The environment is read on first use, then cleared so that child processes do not take the sockets too.
+	// Explicitly passed descriptors, from the command line for instance, go straight to the setSocketDescriptor
+	// method of the servers instead.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpSocketActivation
+	{
+	public:
+		enum { FirstDescriptor = 3 };
+
+	public:
+		static QList<int> descriptors(); // All the inherited descriptors, in order.
+		static QList<int> descriptors(const QString& name); // Those with the given name in LISTEN_FDNAMES.
+		static QString name(int descriptor);
+
+		// Adopt the first inherited listening socket of a matching family that no server adopted yet, restricted to the
+		// descriptors with the given name unless it is empty. Returns false if there is none: the server can listen itself.
+		static bool listen(Pillow::HttpServer* server, const QString& name = QString()); // AF_INET or AF_INET6.
+		static bool listen(Pillow::HttpLocalServer* server, const QString& name = QString()); // AF_UNIX.
+		static bool listen(Pillow::HttpUnixServer* server, const QString& name = QString()); // AF_UNIX.
+	};
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
+
+#endif // PILLOW_HTTPSOCKETACTIVATION_H
@@ -0,0 +1,393 @@
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#include "HttpUnixServer.h"
+#include "HttpConnection.h"
+#include "private/HttpServerPrivate.h"
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QDebug>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+using namespace Pillow;
+
+namespace
+{
+	// The sun_path of a server name: a leading NUL byte for the abstract namespace, else a file path.
+	QByteArray socketPath(const QString& serverName)
+	{
+		if (serverName.startsWith(QLatin1Char('@')))
+			return QByteArray(1, '\0') + serverName.mid(1).toUtf8();
+		if (!serverName.contains(QLatin1Char('/')))
+			return QFile::encodeName(QDir::tempPath() + QLatin1Char('/') + serverName);
+		return QFile::encodeName(serverName);
+	}
+
+	inline bool isAbstractPath(const QByteArray& path) { return path.startsWith('\0'); }
+
+	bool toSocketAddress(const QByteArray& path, sockaddr_un* address, socklen_t* addressLength)
+	{
+		// Abstract names are not NUL terminated, file paths are.
+		if (path.isEmpty() || path.size() + (isAbstractPath(path) ? 0 : 1) > int(sizeof(address->sun_path))) return false;
+		memset(address, 0, sizeof(sockaddr_un));
+		address->sun_family = AF_UNIX;
+		memcpy(address->sun_path, path.constData(), path.size());
+		*addressLength = socklen_t(offsetof(sockaddr_un, sun_path) + path.size() + (isAbstractPath(path) ? 0 : 1));
+		return true;
+	}
+
+	inline bool wouldBlock(int error) { return error == EAGAIN || error == EWOULDBLOCK; }
+}
+
+//
+// UnixSocket
+//
+
+UnixSocket::UnixSocket(QObject* parent)
+	: QIODevice(parent), _socketDescriptor(-1), _readNotifier(0), _writeNotifier(0), _peerProcessId(-1), _peerUserId(-1), _peerGroupId(-1)
+{
+}
+
+UnixSocket::UnixSocket(int socketDescriptor, QObject* parent)
+	: QIODevice(parent), _socketDescriptor(-1), _readNotifier(0), _writeNotifier(0), _peerProcessId(-1), _peerUserId(-1), _peerGroupId(-1)
+{
+	if (!setSocketDescriptor(socketDescriptor))
+		::close(socketDescriptor);
+}
+
+UnixSocket::~UnixSocket()
+{
+	close();
+}
+
+QByteArray UnixSocket::addressForServerName(const QString& serverName)
+{
+	QByteArray path = socketPath(serverName);
+	sockaddr_un address; socklen_t addressLength;
+	return toSocketAddress(path, &address, &addressLength) ? path : QByteArray();
+}
+
+bool UnixSocket::connectToServer(const QString& serverName)
+{
+	close();
+
+	sockaddr_un address; socklen_t addressLength;
+	if (!toSocketAddress(socketPath(serverName), &address, &addressLength))
+	{
+		setErrorString(QString("UnixSocket::connectToServer: invalid server name %1").arg(serverName));
+		return false;
+	}
+
+	int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socketDescriptor < 0 || ::connect(socketDescriptor, reinterpret_cast<sockaddr*>(&address), addressLength) < 0)
+	{
+		int error = errno;
+		if (socketDescriptor >= 0) ::close(socketDescriptor);
+		setErrorString(qt_error_string(error));
+		return false;
+	}
+
+	if (!setSocketDescriptor(socketDescriptor))
+	{
+		::close(socketDescriptor);
+		return false;
+	}
+	return true;
+}
+
+bool UnixSocket::setSocketDescriptor(int socketDescriptor)
+{
+	int flags = ::fcntl(socketDescriptor, F_GETFL);
+	if (flags < 0 || ::fcntl(socketDescriptor, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		setErrorString(qt_error_string(errno));
+		return false;
+	}
+
+	ucred credentials; socklen_t credentialsLength = sizeof(credentials);
+	if (::getsockopt(socketDescriptor, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) == 0)
+	{
+		_peerProcessId = credentials.pid;
+		_peerUserId = credentials.uid;
+		_peerGroupId = credentials.gid;
+	}
+
+	_socketDescriptor = socketDescriptor;
+	_readNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Read, this);
+	connect(_readNotifier, SIGNAL(activated(int)), this, SLOT(readNotifier_activated()));
+	_writeNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Write, this);
+	_writeNotifier->setEnabled(false);
+	connect(_writeNotifier, SIGNAL(activated(int)), this, SLOT(writeNotifier_activated()));
+
+	return open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+bool UnixSocket::isSequential() const
+{
+	return true;
+}
+
+qint64 UnixSocket::bytesAvailable() const
+{
+	int count = 0;
+	if (_socketDescriptor < 0 || ::ioctl(_socketDescriptor, FIONREAD, &count) < 0) count = 0;
+	return count + QIODevice::bytesAvailable();
+}
+
+qint64 UnixSocket::bytesToWrite() const
+{
+	return _writeBuffer.size();
+}
+
+void UnixSocket::close()
+{
+	if (_socketDescriptor < 0) return;
+
+	// Last chance for the data the kernel did not take yet. Whatever it refuses now is dropped.
+	if (!_writeBuffer.isEmpty())
+		::send(_socketDescriptor, _writeBuffer.constData(), _writeBuffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	QIODevice::close();
+
+	// The notifiers may be the ones that are emitting right now.
+	_readNotifier->setEnabled(false); _readNotifier->deleteLater(); _readNotifier = 0;
+	_writeNotifier->setEnabled(false); _writeNotifier->deleteLater(); _writeNotifier = 0;
+	::close(_socketDescriptor);
+	_socketDescriptor = -1;
+	_writeBuffer.clear();
+}
+
+bool UnixSocket::flush()
+{
+	if (_socketDescriptor < 0 || _writeBuffer.isEmpty()) return false;
+
+	ssize_t bytesSent;
+	do bytesSent = ::send(_socketDescriptor, _writeBuffer.constData(), _writeBuffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	while (bytesSent < 0 && errno == EINTR);
+
+	if (bytesSent < 0)
+	{
+		if (wouldBlock(errno)) return false;
+		setErrorString(qt_error_string(errno));
+		disconnectFromPeer();
+		return false;
+	}
+
+	_writeBuffer.remove(0, int(bytesSent));
+	if (_writeBuffer.isEmpty())
+	{
+		_writeNotifier->setEnabled(false);
+		if (_writeBuffer.capacity() > 64 * 1024) _writeBuffer.clear();
+	}
+	emit bytesWritten(bytesSent);
+	return bytesSent > 0;
+}
+
+qint64 UnixSocket::readData(char* data, qint64 maxSize)
+{
+	if (_socketDescriptor < 0) return -1;
+
+	ssize_t bytesRead;
+	do bytesRead = ::recv(_socketDescriptor, data, size_t(maxSize), MSG_DONTWAIT);
+	while (bytesRead < 0 && errno == EINTR);
+
+	// Reading lets the notifier watch for more data again.
+	_readNotifier->setEnabled(true);
+
+	if (bytesRead > 0) return bytesRead;
+	if (bytesRead < 0 && wouldBlock(errno)) return 0;
+	if (bytesRead < 0) setErrorString(qt_error_string(errno));
+	return -1; // End of the stream. The notifier reports the disconnection.
+}
+
+qint64 UnixSocket::writeData(const char* data, qint64 maxSize)
+{
+	if (_socketDescriptor < 0) return -1;
+
+	ssize_t bytesSent = 0;
+	if (_writeBuffer.isEmpty())
+	{
+		// Straight to the kernel when nothing is waiting ahead of this data.
+		do bytesSent = ::send(_socketDescriptor, data, size_t(maxSize), MSG_DONTWAIT | MSG_NOSIGNAL);
+		while (bytesSent < 0 && errno == EINTR);
+
+		if (bytesSent < 0)
+		{
+			if (!wouldBlock(errno))
+			{
+				setErrorString(qt_error_string(errno));
+				return -1;
+			}
+			bytesSent = 0;
+		}
+	}
+
+	if (bytesSent < maxSize)
+	{
+		_writeBuffer.append(data + bytesSent, int(maxSize - bytesSent));
+		_writeNotifier->setEnabled(true);
+	}
+	return maxSize;
+}
+
+void UnixSocket::readNotifier_activated()
+{
+	// Stay quiet until the data gets read, so that the notifier does not fire in a loop meanwhile.
+	_readNotifier->setEnabled(false);
+
+	char c;
+	ssize_t bytesPeeked;
+	do bytesPeeked = ::recv(_socketDescriptor, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	while (bytesPeeked < 0 && errno == EINTR);
+
+	if (bytesPeeked > 0)
+		emit readyRead();
+	else if (bytesPeeked < 0 && wouldBlock(errno))
+		_readNotifier->setEnabled(true);
+	else
+		disconnectFromPeer();
+}
+
+void UnixSocket::writeNotifier_activated()
+{
+	flush();
+}
+
+void UnixSocket::disconnectFromPeer()
+{
+	_writeBuffer.clear(); // The peer is gone, nothing more can be sent.
+	emit readChannelFinished();
+	emit disconnected();
+	close();
+}
+
+//
+// HttpUnixServer
+//
+
+HttpUnixServer::HttpUnixServer(QObject* parent)
+	: QObject(parent), d_ptr(new HttpServerPrivate(this)), _socketDescriptor(-1), _acceptNotifier(0)
+{
+}
+
+HttpUnixServer::HttpUnixServer(const QString& serverName, QObject* parent)
+	: QObject(parent), d_ptr(new HttpServerPrivate(this)), _socketDescriptor(-1), _acceptNotifier(0)
+{
+	if (!listen(serverName))
+		qWarning() << QString("HttpUnixServer::HttpUnixServer: could not bind to %1 for listening: %2").arg(serverName).arg(errorString());
+}
+
+HttpUnixServer::~HttpUnixServer()
+{
+	close();
+	delete d_ptr;
+}
+
+bool HttpUnixServer::listen(const QString& serverName)
+{
+	close();
+
+	sockaddr_un address; socklen_t addressLength;
+	if (!toSocketAddress(socketPath(serverName), &address, &addressLength))
+	{
+		_errorString = QString("HttpUnixServer::listen: invalid server name %1").arg(serverName);
+		return false;
+	}
+
+	int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (socketDescriptor < 0
+		|| ::bind(socketDescriptor, reinterpret_cast<sockaddr*>(&address), addressLength) < 0
+		|| ::listen(socketDescriptor, 128) < 0)
+	{
+		int error = errno;
+		if (socketDescriptor >= 0) ::close(socketDescriptor);
+		_errorString = qt_error_string(error);
+		return false;
+	}
+
+	_socketDescriptor = socketDescriptor;
+	_serverName = serverName;
+	_errorString.clear();
+	_acceptNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Read, this);
+	connect(_acceptNotifier, SIGNAL(activated(int)), this, SLOT(acceptNotifier_activated()));
+	return true;
+}
+
+bool HttpUnixServer::setSocketDescriptor(int socketDescriptor)
+{
+	close();
+
+	int value = 0; socklen_t valueLength = sizeof(value);
+	sockaddr_un address; socklen_t addressLength = sizeof(address);
+	if (::getsockopt(socketDescriptor, SOL_SOCKET, SO_ACCEPTCONN, &value, &valueLength) < 0 || value == 0
+		|| ::getsockname(socketDescriptor, reinterpret_cast<sockaddr*>(&address), &addressLength) < 0 || address.sun_family != AF_UNIX)
+	{
+		_errorString = QString("HttpUnixServer::setSocketDescriptor: %1 is not a listening AF_UNIX socket").arg(socketDescriptor);
+		return false;
+	}
+
+	int flags = ::fcntl(socketDescriptor, F_GETFL);
+	if (flags < 0 || ::fcntl(socketDescriptor, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		_errorString = qt_error_string(errno);
+		return false;
+	}
+
+	_socketDescriptor = socketDescriptor;
+	_serverName.clear(); // Whoever bound the socket owns its file.
+	_errorString.clear();
+	_acceptNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Read, this);
+	connect(_acceptNotifier, SIGNAL(activated(int)), this, SLOT(acceptNotifier_activated()));
+	return true;
+}
+
+void HttpUnixServer::close()
+{
+	if (_socketDescriptor < 0) return;
+
+	_acceptNotifier->setEnabled(false); _acceptNotifier->deleteLater(); _acceptNotifier = 0;
+	::close(_socketDescriptor);
+	_socketDescriptor = -1;
+
+	if (_serverName.isEmpty()) return;
+	QByteArray path = socketPath(_serverName);
+	if (!isAbstractPath(path)) ::unlink(path.constData());
+}
+
+void HttpUnixServer::acceptNotifier_activated()
+{
+	// Accept all the pending connections at once.
+	forever
+	{
+		int socketDescriptor = ::accept4(_socketDescriptor, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socketDescriptor < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (!wouldBlock(errno))
+				qWarning() << "HttpUnixServer::acceptNotifier_activated: failed to accept a connection:" << qt_error_string(errno);
+			break;
+		}
+
+		UnixSocket* socket = new UnixSocket(socketDescriptor, this);
+		if (socket->isOpen())
+			d_ptr->takeConnection()->initialize(socket, socket);
+		else
+		{
+			qWarning() << "HttpUnixServer::acceptNotifier_activated: failed to set up socket" << socketDescriptor << ":" << socket->errorString();
+			delete socket;
+		}
+	}
+}
+
+void HttpUnixServer::connection_closed(Pillow::HttpConnection* connection)
+{
+	if (connection->inputDevice()) connection->inputDevice()->deleteLater(); // Unless the connection was upgraded to another protocol.
+	d_ptr->putConnection(connection);
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
@@ -0,0 +1,131 @@
+#ifndef PILLOW_HTTPUNIXSERVER_H
+#define PILLOW_HTTPUNIXSERVER_H
+
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QIODEVICE_H
+#include <QtCore/QIODevice>
+#endif // QIODEVICE_H
+
+class QSocketNotifier;
+
+namespace Pillow
+{
+	class HttpConnection;
+	class HttpServerPrivate;
+
+	//
+	// Pillow::UnixSocket
+	//
+	// A connected AF_UNIX stream socket (Linux only), read and written straight through its socket
+	// descriptor. Unlike QLocalSocket, incoming data is not copied into a read buffer first: bytesAvailable
+	// and read go to the kernel. Outgoing data only gets buffered when the kernel does not take it right away.
+	//
+	// Server names starting with '@' are in the abstract namespace, which has no presence on the file system.
+	// Other names without a '/' are taken relative to QDir::tempPath(), like QLocalServer does.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT UnixSocket : public QIODevice
+	{
+		Q_OBJECT
+		int _socketDescriptor;
+		QSocketNotifier* _readNotifier;
+		QSocketNotifier* _writeNotifier;
+		QByteArray _writeBuffer;
+		qint64 _peerProcessId, _peerUserId, _peerGroupId;
+
+	public:
+		UnixSocket(QObject* parent = 0);
+		UnixSocket(int socketDescriptor, QObject* parent = 0); // Takes ownership of an already connected socket descriptor.
+		~UnixSocket();
+
+		// Connect to a Pillow::HttpUnixServer, or to any AF_UNIX stream socket server. Returns false on failure.
+		bool connectToServer(const QString& serverName);
+		inline int socketDescriptor() const { return _socketDescriptor; }
+
+		// Credentials of the peer process as of when the connection was established (SO_PEERCRED). -1 when unknown.
+		inline qint64 peerProcessId() const { return _peerProcessId; }
+		inline qint64 peerUserId() const { return _peerUserId; }
+		inline qint64 peerGroupId() const { return _peerGroupId; }
+
+		// Get the address (sun_path) for a server name. Returns an empty QByteArray if the name is too long.
+		static QByteArray addressForServerName(const QString& serverName);
+
+	public:
+		virtual bool isSequential() const;
+		virtual qint64 bytesAvailable() const;
+		virtual qint64 bytesToWrite() const;
+		virtual void close();
+		bool flush(); // Write as much of the buffered data as the kernel takes without blocking.
+
+	signals:
+		void disconnected(); // The peer closed the connection. The socket closes right after.
+
+	protected:
+		virtual qint64 readData(char* data, qint64 maxSize);
+		virtual qint64 writeData(const char* data, qint64 maxSize);
+
+	private slots:
+		void readNotifier_activated();
+		void writeNotifier_activated();
+
+	private:
+		bool setSocketDescriptor(int socketDescriptor);
+		void disconnectFromPeer();
+	};
+
+	//
+	// Pillow::HttpUnixServer
+	//
+	// Serves Http over AF_UNIX stream sockets (Linux only), for local clients such as sidecar processes.
+	// Accepted connections use a Pillow::UnixSocket device; a handler gets to the credentials of the
+	// client process through qobject_cast<Pillow::UnixSocket*>(connection->inputDevice()).
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpUnixServer : public QObject
+	{
+		Q_OBJECT
+		Q_PROPERTY(QString serverName READ serverName)
+		Q_PROPERTY(bool listening READ isListening)
+		Q_DECLARE_PRIVATE(HttpServer)
+		HttpServerPrivate* d_ptr;
+		int _socketDescriptor;
+		QSocketNotifier* _acceptNotifier;
+		QString _serverName;
+		QString _errorString;
+
+	private slots:
+		void acceptNotifier_activated();
+		void connection_closed(Pillow::HttpConnection* connection);
+
+	public:
+		HttpUnixServer(QObject* parent = 0);
+		HttpUnixServer(const QString& serverName, QObject* parent = 0);
+		~HttpUnixServer();
+
+		bool listen(const QString& serverName);
+		void close();
+
+		// Adopt an already listening AF_UNIX stream socket, inherited from a service manager for instance. Its file is
+		// left in place on close and serverName stays empty. Returns false, leaving the descriptor open, on failure.
+		bool setSocketDescriptor(int socketDescriptor);
+
+		inline bool isListening() const { return _socketDescriptor >= 0; }
+		inline const QString& serverName() const { return _serverName; }
+		inline const QString& errorString() const { return _errorString; }
+		inline int socketDescriptor() const { return _socketDescriptor; }
+
+	signals:
+		void requestHeadersReady(Pillow::HttpConnection* connection); // The headers of a request with content have been received on this connection.
+		void requestReady(Pillow::HttpConnection* connection); // There is a request ready to be handled on this connection.
+	};
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
+
+#endif // PILLOW_HTTPUNIXSERVER_H
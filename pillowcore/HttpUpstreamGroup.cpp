@@ -0,0 +1,442 @@
+#include "HttpUpstreamGroup.h"
+#include "HttpClient.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QPair>
+#include <QtCore/QtAlgorithms>
+#include <QtCore/QDebug>
+using namespace Pillow;
+
+//
+// HttpUpstreamGroup
+//
+
+namespace Pillow
+{
+	struct HttpUpstream
+	{
+		QUrl url;
+		int maximumConnections;
+		int outstandingRequests;
+		int consecutiveFailures;
+		bool healthy;
+		bool removed;
+		QList<HttpClient*> idleClients;
+		QElapsedTimer ejectionTimer;
+		HttpClient* probeClient;
+
+		HttpUpstream(const QUrl& url, int maximumConnections)
+			: url(url), maximumConnections(maximumConnections), outstandingRequests(0), consecutiveFailures(0),
+			  healthy(true), removed(false), probeClient(NULL)
+		{}
+	};
+
+	class HttpUpstreamGroupPrivate
+	{
+	public:
+		enum { HashRingReplicas = 64 }; // Virtual nodes per upstream on the consistent hash ring.
+		typedef QPair<uint, HttpUpstream*> HashRingNode;
+
+	public:
+		HttpUpstreamGroup* q_ptr;
+		HttpUpstreamGroup::Policy policy;
+		int maximumFailures;
+		int ejectionTime;
+		QByteArray healthCheckPath;
+		QTimer healthCheckTimer;
+		QList<HttpUpstream*> upstreams;
+		QVector<HashRingNode> hashRing;
+		QHash<HttpClient*, HttpUpstream*> clientUpstreams;
+		int nextIndex;
+
+	public:
+		HttpUpstreamGroupPrivate(HttpUpstreamGroup* group)
+			: q_ptr(group), policy(HttpUpstreamGroup::RoundRobin),
+			  maximumFailures(HttpUpstreamGroup::DefaultMaximumFailures), ejectionTime(HttpUpstreamGroup::DefaultEjectionTime),
+			  nextIndex(0)
+		{
+			healthCheckTimer.setInterval(HttpUpstreamGroup::DefaultHealthCheckInterval);
+			QObject::connect(&healthCheckTimer, SIGNAL(timeout()), group, SLOT(checkHealth()));
+		}
+
+		~HttpUpstreamGroupPrivate()
+		{
+			// The clients themselves are children of the group and get deleted along with it.
+			QSet<HttpUpstream*> removedUpstreams;
+			foreach (HttpUpstream* upstream, clientUpstreams)
+				if (upstream->removed) removedUpstreams << upstream;
+			qDeleteAll(removedUpstreams);
+			qDeleteAll(upstreams);
+		}
+
+		static inline uint hash(const char* data, int size)
+		{
+			// FNV-1a: qHash(QByteArray) does not spread short, similar keys well enough around the ring.
+			uint h = 2166136261u;
+			for (const char* c = data, *cE = data + size; c < cE; ++c)
+				h = (h ^ static_cast<uchar>(*c)) * 16777619u;
+			return h;
+		}
+
+		HttpUpstream* findUpstream(const QUrl& url) const
+		{
+			foreach (HttpUpstream* upstream, upstreams)
+				if (upstream->url == url) return upstream;
+			return NULL;
+		}
+
+		void rebuildHashRing()
+		{
+			hashRing.clear();
+			hashRing.reserve(upstreams.size() * HashRingReplicas);
+			foreach (HttpUpstream* upstream, upstreams)
+			{
+				QByteArray key = upstream->url.toEncoded();
+				key.append('#');
+				const int keySize = key.size();
+				for (int i = 0; i < HashRingReplicas; ++i)
+				{
+					key.truncate(keySize);
+					key.append(QByteArray::number(i));
+					hashRing.append(HashRingNode(hash(key.constData(), key.size()), upstream));
+				}
+			}
+			qSort(hashRing);
+		}
+
+		bool canRestoreLazily(const HttpUpstream* upstream) const
+		{
+			return healthCheckPath.isEmpty() && upstream->ejectionTimer.hasExpired(ejectionTime);
+		}
+
+		void eject(HttpUpstream* upstream)
+		{
+			upstream->healthy = false;
+			upstream->ejectionTimer.start();
+			emit q_ptr->upstreamEjected(upstream->url);
+		}
+
+		void restore(HttpUpstream* upstream, int consecutiveFailures)
+		{
+			upstream->healthy = true;
+			upstream->consecutiveFailures = consecutiveFailures;
+			emit q_ptr->upstreamRestored(upstream->url);
+		}
+
+		bool isAvailable(HttpUpstream* upstream)
+		{
+			if (!upstream->healthy)
+			{
+				if (!canRestoreLazily(upstream)) return false;
+
+				// Give the upstream another chance; a single new failure ejects it again.
+				restore(upstream, qMax(0, maximumFailures - 1));
+			}
+			return upstream->outstandingRequests < upstream->maximumConnections;
+		}
+
+		HttpUpstream* select(const QByteArray& path)
+		{
+			const int count = upstreams.size();
+			if (count == 0) return NULL;
+
+			switch (policy)
+			{
+			case HttpUpstreamGroup::RoundRobin:
+				for (int i = 0; i < count; ++i)
+				{
+					const int index = (nextIndex + i) % count;
+					if (isAvailable(upstreams.at(index)))
+					{
+						nextIndex = (index + 1) % count;
+						return upstreams.at(index);
+					}
+				}
+				break;
+
+			case HttpUpstreamGroup::LeastOutstandingRequests:
+			{
+				// Start scanning at a rotating index so that ties do not always go to the first upstream.
+				HttpUpstream* best = NULL;
+				for (int i = 0; i < count; ++i)
+				{
+					HttpUpstream* upstream = upstreams.at((nextIndex + i) % count);
+					if (isAvailable(upstream) && (best == NULL || upstream->outstandingRequests < best->outstandingRequests))
+						best = upstream;
+				}
+				nextIndex = (nextIndex + 1) % count;
+				return best;
+			}
+
+			case HttpUpstreamGroup::ConsistentHashOnPath:
+			{
+				const HashRingNode key(hash(path.constData(), path.size()), NULL);
+				const int start = qLowerBound(hashRing.constBegin(), hashRing.constEnd(), key) - hashRing.constBegin();
+				for (int i = 0, iE = hashRing.size(); i < iE; ++i)
+				{
+					HttpUpstream* upstream = hashRing.at((start + i) % iE).second;
+					if (isAvailable(upstream)) return upstream;
+				}
+				break;
+			}
+			}
+
+			return NULL;
+		}
+
+		void dropClient(HttpClient* client)
+		{
+			clientUpstreams.remove(client);
+			client->deleteLater();
+		}
+	};
+}
+
+HttpUpstreamGroup::HttpUpstreamGroup(QObject *parent)
+	: QObject(parent), d_ptr(new HttpUpstreamGroupPrivate(this))
+{
+}
+
+HttpUpstreamGroup::~HttpUpstreamGroup()
+{
+	delete d_ptr;
+}
+
+void HttpUpstreamGroup::addUpstream(const QUrl &url, int maximumConnections)
+{
+	Q_D(HttpUpstreamGroup);
+	if (d->findUpstream(url) != NULL)
+	{
+		qWarning() << "HttpUpstreamGroup::addUpstream: upstream" << url << "is already part of the group.";
+		return;
+	}
+	if (maximumConnections < 1)
+	{
+		qWarning() << "HttpUpstreamGroup::addUpstream: invalid maximum connection count" << maximumConnections << "for upstream" << url;
+		maximumConnections = 1;
+	}
+
+	d->upstreams.append(new HttpUpstream(url, maximumConnections));
+	d->rebuildHashRing();
+}
+
+void HttpUpstreamGroup::removeUpstream(const QUrl &url)
+{
+	Q_D(HttpUpstreamGroup);
+	HttpUpstream* upstream = d->findUpstream(url);
+	if (upstream == NULL) return;
+
+	d->upstreams.removeOne(upstream);
+	d->rebuildHashRing();
+	d->nextIndex = 0;
+
+	while (!upstream->idleClients.isEmpty())
+		d->dropClient(upstream->idleClients.takeLast());
+	if (upstream->probeClient)
+		upstream->probeClient->deleteLater();
+
+	// Clients still under way keep a reference to the upstream until they get released.
+	if (upstream->outstandingRequests == 0)
+		delete upstream;
+	else
+		upstream->removed = true;
+}
+
+QList<QUrl> HttpUpstreamGroup::upstreams() const
+{
+	QList<QUrl> urls;
+	foreach (HttpUpstream* upstream, d_func()->upstreams)
+		urls << upstream->url;
+	return urls;
+}
+
+int HttpUpstreamGroup::upstreamCount() const
+{
+	return d_func()->upstreams.size();
+}
+
+bool HttpUpstreamGroup::isUpstreamHealthy(const QUrl &url) const
+{
+	HttpUpstream* upstream = d_func()->findUpstream(url);
+	return upstream != NULL && upstream->healthy;
+}
+
+int HttpUpstreamGroup::upstreamOutstandingRequests(const QUrl &url) const
+{
+	HttpUpstream* upstream = d_func()->findUpstream(url);
+	return upstream != NULL ? upstream->outstandingRequests : 0;
+}
+
+bool HttpUpstreamGroup::hasHealthyUpstream() const
+{
+	Q_D(const HttpUpstreamGroup);
+	foreach (HttpUpstream* upstream, d->upstreams)
+		if (upstream->healthy || d->canRestoreLazily(upstream)) return true;
+	return false;
+}
+
+HttpUpstreamGroup::Policy HttpUpstreamGroup::policy() const
+{
+	return d_func()->policy;
+}
+
+void HttpUpstreamGroup::setPolicy(Policy policy)
+{
+	d_func()->policy = policy;
+}
+
+int HttpUpstreamGroup::maximumFailures() const
+{
+	return d_func()->maximumFailures;
+}
+
+void HttpUpstreamGroup::setMaximumFailures(int failures)
+{
+	d_func()->maximumFailures = qMax(1, failures);
+}
+
+int HttpUpstreamGroup::ejectionTime() const
+{
+	return d_func()->ejectionTime;
+}
+
+void HttpUpstreamGroup::setEjectionTime(int msecs)
+{
+	d_func()->ejectionTime = msecs;
+}
+
+const QByteArray & HttpUpstreamGroup::healthCheckPath() const
+{
+	return d_func()->healthCheckPath;
+}
+
+void HttpUpstreamGroup::setHealthCheckPath(const QByteArray &path)
+{
+	Q_D(HttpUpstreamGroup);
+	d->healthCheckPath = path;
+	if (path.isEmpty())
+		d->healthCheckTimer.stop();
+	else if (!d->healthCheckTimer.isActive())
+		d->healthCheckTimer.start();
+}
+
+int HttpUpstreamGroup::healthCheckInterval() const
+{
+	return d_func()->healthCheckTimer.interval();
+}
+
+void HttpUpstreamGroup::setHealthCheckInterval(int msecs)
+{
+	d_func()->healthCheckTimer.setInterval(msecs);
+}
+
+HttpClient * HttpUpstreamGroup::takeClient(const QByteArray &path, QUrl *upstreamUrl)
+{
+	Q_D(HttpUpstreamGroup);
+	HttpUpstream* upstream = d->select(path);
+	if (upstream == NULL) return NULL;
+
+	HttpClient* client;
+	if (!upstream->idleClients.isEmpty())
+		client = upstream->idleClients.takeLast();
+	else
+	{
+		client = new HttpClient(this);
+		d->clientUpstreams.insert(client, upstream);
+	}
+
+	++upstream->outstandingRequests;
+	if (upstreamUrl) *upstreamUrl = upstream->url;
+	return client;
+}
+
+void HttpUpstreamGroup::releaseClient(HttpClient *client)
+{
+	Q_D(HttpUpstreamGroup);
+	HttpUpstream* upstream = d->clientUpstreams.value(client);
+	if (upstream == NULL)
+	{
+		qWarning() << "HttpUpstreamGroup::releaseClient: client" << client << "does not belong to this group.";
+		return;
+	}
+
+	--upstream->outstandingRequests;
+
+	switch (client->error())
+	{
+	case HttpClient::AbortedError:
+		break; // Aborted on our side; this says nothing about the upstream.
+
+	case HttpClient::NoError:
+		if (client->statusCode() < 500)
+		{
+			upstream->consecutiveFailures = 0;
+			break;
+		}
+		// The upstream answered, but with a server error: that counts as a failure too.
+
+	default:
+		if (++upstream->consecutiveFailures >= d->maximumFailures && upstream->healthy && !upstream->removed)
+			d->eject(upstream);
+		break;
+	}
+
+	if (upstream->removed)
+	{
+		d->dropClient(client);
+		if (upstream->outstandingRequests == 0)
+			delete upstream;
+	}
+	else
+		upstream->idleClients.append(client);
+
+	emit clientReleased();
+}
+
+void HttpUpstreamGroup::checkHealth()
+{
+	Q_D(HttpUpstreamGroup);
+	if (d->healthCheckPath.isEmpty()) return;
+
+	foreach (HttpUpstream* upstream, d->upstreams)
+	{
+		if (upstream->probeClient == NULL)
+		{
+			upstream->probeClient = new HttpClient(this);
+			connect(upstream->probeClient, SIGNAL(finished()), this, SLOT(probe_finished()));
+		}
+		else if (upstream->probeClient->responsePending())
+			continue; // The previous probe has not completed yet.
+
+		QUrl probeUrl = upstream->url;
+		probeUrl.setEncodedPath(d->healthCheckPath);
+		upstream->probeClient->get(probeUrl);
+	}
+}
+
+void HttpUpstreamGroup::probe_finished()
+{
+	Q_D(HttpUpstreamGroup);
+	HttpClient* probeClient = static_cast<HttpClient*>(sender());
+
+	foreach (HttpUpstream* upstream, d->upstreams)
+	{
+		if (upstream->probeClient != probeClient) continue;
+
+		const bool success = probeClient->error() == HttpClient::NoError && probeClient->statusCode() >= 200 && probeClient->statusCode() < 400;
+		if (success)
+		{
+			if (upstream->healthy)
+				upstream->consecutiveFailures = 0;
+			else
+				d->restore(upstream, 0);
+		}
+		else if (++upstream->consecutiveFailures >= d->maximumFailures && upstream->healthy)
+			d->eject(upstream);
+
+		break;
+	}
+}
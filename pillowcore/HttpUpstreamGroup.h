@@ -0,0 +1,114 @@
+#ifndef PILLOW_HTTPUPSTREAMGROUP_H
+#define PILLOW_HTTPUPSTREAMGROUP_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QURL_H
+#include <QtCore/QUrl>
+#endif // QURL_H
+
+namespace Pillow
+{
+	class HttpClient;
+	class HttpUpstreamGroupPrivate;
+
+	//
+	// Pillow::HttpUpstreamGroup
+	//
+	// A set of equivalent upstream http servers between which requests are spread. Each upstream
+	// has its own pool of Pillow::HttpClient, bounded by its maximum connection count.
+	//
+	// Upstreams that fail maximumFailures times in a row, be it with a transport error or a 5xx response, are
+	// ejected from the group. They come back after ejectionTime, or as soon as an active health probe succeeds
+	// when a healthCheckPath is set.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpUpstreamGroup : public QObject
+	{
+		Q_OBJECT
+		Q_ENUMS(Policy)
+		Q_PROPERTY(Policy policy READ policy WRITE setPolicy)
+		Q_PROPERTY(int maximumFailures READ maximumFailures WRITE setMaximumFailures)
+		Q_PROPERTY(int ejectionTime READ ejectionTime WRITE setEjectionTime)
+		Q_PROPERTY(QByteArray healthCheckPath READ healthCheckPath WRITE setHealthCheckPath)
+		Q_PROPERTY(int healthCheckInterval READ healthCheckInterval WRITE setHealthCheckInterval)
+		Q_DECLARE_PRIVATE(HttpUpstreamGroup)
+		HttpUpstreamGroupPrivate* d_ptr;
+
+	public:
+		enum Policy
+		{
+			RoundRobin,               // Default: Use each upstream in turn.
+			LeastOutstandingRequests, // Use the upstream that currently has the fewest requests under way.
+			ConsistentHashOnPath      // Always use the same upstream for the same request path, as long as it is available.
+		};
+
+		enum { DefaultMaximumConnections = 32 };
+		enum { DefaultMaximumFailures = 3 };
+		enum { DefaultEjectionTime = 10 * 1000 };
+		enum { DefaultHealthCheckInterval = 5 * 1000 };
+
+	public:
+		HttpUpstreamGroup(QObject* parent = 0);
+		~HttpUpstreamGroup();
+
+		void addUpstream(const QUrl& url, int maximumConnections = DefaultMaximumConnections);
+		void removeUpstream(const QUrl& url);
+		QList<QUrl> upstreams() const;
+		int upstreamCount() const;
+
+		bool isUpstreamHealthy(const QUrl& url) const;
+		int upstreamOutstandingRequests(const QUrl& url) const;
+		bool hasHealthyUpstream() const;
+
+		Policy policy() const;
+		void setPolicy(Policy policy);
+
+		// maximumFailures: Number of consecutive failed requests after which an upstream gets ejected. Requests fail when
+		//                  no response could be received, or when it was a 5xx server error.
+		int maximumFailures() const;
+		void setMaximumFailures(int failures);
+
+		// ejectionTime: Time, in milliseconds, after which an ejected upstream gets tried again. Only
+		//               used when active health checks are disabled.
+		int ejectionTime() const;
+		void setEjectionTime(int msecs);
+
+		// healthCheckPath: Path that gets requested periodically on every upstream to check its health.
+		//                  A 2xx or 3xx response means healthy. Use an empty path to disable active health checks.
+		//                  Defaults to an empty path.
+		const QByteArray& healthCheckPath() const;
+		void setHealthCheckPath(const QByteArray& path);
+
+		// healthCheckInterval: Time, in milliseconds, between active health checks.
+		int healthCheckInterval() const;
+		void setHealthCheckInterval(int msecs);
+
+	public:
+		// Take a client connected (or connecting) to the upstream selected for the specified request path.
+		// Returns 0 if no upstream is healthy or if all healthy upstreams are using all of their connections.
+		// The client must be given back with releaseClient() once its request is finished.
+		Pillow::HttpClient* takeClient(const QByteArray& path, QUrl* upstreamUrl = 0);
+
+		// Give back a client taken with takeClient(). The outcome of its last request is used for failure detection.
+		void releaseClient(Pillow::HttpClient* client);
+
+	public slots:
+		void checkHealth(); // Send an health probe to every upstream right away.
+
+	signals:
+		void upstreamEjected(const QUrl& url);
+		void upstreamRestored(const QUrl& url);
+		void clientReleased(); // A client was released; upstreams that were busy may now be available.
+
+	private slots:
+		void probe_finished();
+	};
+}
+
+#endif // PILLOW_HTTPUPSTREAMGROUP_H
@@ -0,0 +1,403 @@
+#include "HttpWebSocket.h"
+#include "HttpConnection.h"
+#include "ByteArrayHelpers.h"
+#include <QtCore/QIODevice>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QTimer>
+#include <QtCore/QDebug>
+#include <string.h>
+
+using namespace Pillow;
+
+namespace
+{
+	const char* const webSocketGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	// Whether a comma separated header value contains a token (case insensitive), such as "Upgrade" in "keep-alive, Upgrade".
+	bool headerHasToken(const QByteArray& headerValue, const char* token, int tokenLength)
+	{
+		const char* p = headerValue.constData(), *e = p + headerValue.size();
+		while (p < e)
+		{
+			while (p < e && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+			const char* tokenBegin = p;
+			while (p < e && *p != ',') ++p;
+			const char* tokenEnd = p;
+			while (tokenEnd > tokenBegin && (tokenEnd[-1] == ' ' || tokenEnd[-1] == '\t')) --tokenEnd;
+			if (Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(tokenBegin, int(tokenEnd - tokenBegin), token, tokenLength))
+				return true;
+		}
+		return false;
+	}
+
+	bool isValidUtf8(const char* data, int size)
+	{
+		const uchar* p = reinterpret_cast<const uchar*>(data), *e = p + size;
+		while (p < e)
+		{
+			// Skip ASCII eight bytes at a time.
+			quint64 word;
+			if (e - p >= 8 && (memcpy(&word, p, 8), (word & Q_UINT64_C(0x8080808080808080)) == 0)) { p += 8; continue; }
+			if (*p < 0x80) { ++p; continue; }
+
+			int continuationCount; uint codePoint, minimum;
+			if ((*p & 0xE0) == 0xC0) { continuationCount = 1; codePoint = *p & 0x1F; minimum = 0x80; }
+			else if ((*p & 0xF0) == 0xE0) { continuationCount = 2; codePoint = *p & 0x0F; minimum = 0x800; }
+			else if ((*p & 0xF8) == 0xF0) { continuationCount = 3; codePoint = *p & 0x07; minimum = 0x10000; }
+			else return false;
+
+			if (e - p <= continuationCount) return false;
+			for (int i = 1; i <= continuationCount; ++i)
+			{
+				if ((p[i] & 0xC0) != 0x80) return false;
+				codePoint = (codePoint << 6) | (p[i] & 0x3F);
+			}
+			if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) return false;
+			p += continuationCount + 1;
+		}
+		return true;
+	}
+
+	inline void unmask(char* data, int size, const uchar* mask)
+	{
+		quint32 mask32; memcpy(&mask32, mask, 4);
+		const quint64 mask64 = (quint64(mask32) << 32) | mask32;
+		int i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			quint64 word; memcpy(&word, data + i, 8);
+			word ^= mask64;
+			memcpy(data + i, &word, 8);
+		}
+		for (; i < size; ++i)
+			data[i] ^= mask[i & 3];
+	}
+
+	inline bool isValidCloseCode(int code)
+	{
+		return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+	}
+}
+
+//
+// HttpWebSocket
+//
+
+bool HttpWebSocket::isUpgradeRequest(Pillow::HttpConnection* connection)
+{
+	return connection->requestMethod() == "GET"
+		&& headerHasToken(connection->requestHeaderValue(HttpHeaderId::Upgrade), "websocket", 9)
+		&& headerHasToken(connection->requestHeaderValue(HttpHeaderId::Connection), "upgrade", 7)
+		&& QByteArray::fromBase64(connection->requestHeaderValue(QByteArray("Sec-WebSocket-Key"))).size() == 16;
+}
+
+HttpWebSocket* HttpWebSocket::upgrade(Pillow::HttpConnection* connection, const QByteArray& protocol, QObject* parent)
+{
+	if (connection->state() != HttpConnection::SendingHeaders)
+	{
+		qWarning() << "HttpWebSocket::upgrade: the connection is not in the SendingHeaders state.";
+		return 0;
+	}
+
+	if (!isUpgradeRequest(connection))
+	{
+		connection->writeResponse(400, HttpHeaderCollection(), "Not a valid WebSocket upgrade request.");
+		return 0;
+	}
+
+	if (connection->requestHeaderValue(QByteArray("Sec-WebSocket-Version")) != "13")
+	{
+		connection->writeResponse(426, HttpHeaderCollection() << HttpHeader("Sec-WebSocket-Version", "13"));
+		return 0;
+	}
+
+	QByteArray accept = QCryptographicHash::hash(connection->requestHeaderValue(QByteArray("Sec-WebSocket-Key")) + webSocketGuid, QCryptographicHash::Sha1).toBase64();
+	HttpHeaderCollection headers; headers.reserve(4);
+	headers << HttpHeader("Upgrade", "websocket") << HttpHeader("Connection", "Upgrade") << HttpHeader("Sec-WebSocket-Accept", accept);
+	if (!protocol.isEmpty()) headers << HttpHeader("Sec-WebSocket-Protocol", protocol);
+
+	QIODevice* inputDevice = connection->inputDevice();
+	QIODevice* outputDevice = connection->outputDevice();
+	QByteArray bufferedData = connection->upgrade(headers);
+	return new HttpWebSocket(inputDevice, outputDevice, bufferedData, parent);
+}
+
+HttpWebSocket::HttpWebSocket(QIODevice* inputDevice, QIODevice* outputDevice, const QByteArray& bufferedData, QObject* parent)
+	: QObject(parent), _state(Open), _inputDevice(inputDevice), _outputDevice(outputDevice ? outputDevice : inputDevice),
+	  _buffer(bufferedData), _messageOpcode(-1), _closeCode(AbnormalClosure)
+{
+	_inputDevice->setParent(this);
+	if (_outputDevice != _inputDevice) _outputDevice->setParent(this);
+
+	connect(_inputDevice, SIGNAL(readyRead()), this, SLOT(processInput()));
+	if (_inputDevice->metaObject()->indexOfSignal("disconnected()") >= 0) // QAbstractSocket, QLocalSocket and Pillow::UnixSocket.
+		connect(_inputDevice, SIGNAL(disconnected()), this, SLOT(abort()));
+	connect(_inputDevice, SIGNAL(readChannelFinished()), this, SLOT(abort()));
+	connect(_inputDevice, SIGNAL(aboutToClose()), this, SLOT(abort()));
+
+	// Handle what was received along with the handshake, or since.
+	if (!_buffer.isEmpty() || _inputDevice->bytesAvailable() > 0)
+		QTimer::singleShot(0, this, SLOT(processInput()));
+}
+
+HttpWebSocket::~HttpWebSocket()
+{
+	if (_state != Closed)
+	{
+		disconnect(_inputDevice, 0, this, 0);
+		_inputDevice->close();
+		if (_outputDevice != _inputDevice) _outputDevice->close();
+	}
+}
+
+void HttpWebSocket::processInput()
+{
+	if (_state == Closed) return;
+
+	qint64 bytesAvailable = _inputDevice->bytesAvailable();
+	if (bytesAvailable > 0)
+	{
+		int oldSize = _buffer.size();
+		_buffer.resize(oldSize + int(bytesAvailable));
+		qint64 bytesRead = _inputDevice->read(_buffer.data() + oldSize, bytesAvailable);
+		_buffer.resize(oldSize + int(qMax<qint64>(bytesRead, 0)));
+	}
+
+	char* data = _buffer.data();
+	int pos = 0;
+	while (_state != Closed)
+	{
+		const int available = _buffer.size() - pos;
+		if (available < 2) break;
+
+		const uchar* header = reinterpret_cast<const uchar*>(data) + pos;
+		const bool final = (header[0] & 0x80) != 0;
+		const int opcode = header[0] & 0x0F;
+		if (header[0] & 0x70) return fail(ProtocolError); // Reserved bits, while no extension was negotiated.
+		if ((header[1] & 0x80) == 0) return fail(ProtocolError); // Frames from the client must be masked.
+
+		quint64 payloadSize = header[1] & 0x7F;
+		int headerSize = 2;
+		if (payloadSize == 126)
+		{
+			if (available < 4) break;
+			payloadSize = (quint64(header[2]) << 8) | header[3];
+			headerSize += 2;
+		}
+		else if (payloadSize == 127)
+		{
+			if (available < 10) break;
+			payloadSize = 0;
+			for (int i = 2; i < 10; ++i) payloadSize = (payloadSize << 8) | header[i];
+			headerSize += 8;
+		}
+		headerSize += 4; // Masking key.
+
+		if (payloadSize > quint64(MaximumMessageSize)) return fail(MessageTooBig);
+		if (quint64(available) < headerSize + payloadSize) break;
+
+		// Unmask in place: the payload gets handed over straight from the read buffer.
+		char* payload = data + pos + headerSize;
+		unmask(payload, int(payloadSize), header + headerSize - 4);
+		pos += headerSize + int(payloadSize);
+
+		if (!processFrame(opcode, final, payload, int(payloadSize))) return;
+	}
+
+	if (pos == _buffer.size())
+	{
+		if (_buffer.capacity() > 64 * 1024) _buffer.clear();
+		else _buffer.data_ptr()->size = 0;
+	}
+	else if (pos > 0)
+		_buffer.remove(0, pos);
+}
+
+bool HttpWebSocket::processFrame(int opcode, bool final, const char* payload, int payloadSize)
+{
+	switch (opcode)
+	{
+	case TextFrame:
+	case BinaryFrame:
+		if (_messageOpcode >= 0) { fail(ProtocolError); return false; } // The previous message is not finished.
+		if (final)
+		{
+			if (_state == Open) emitMessage(opcode, QByteArray::fromRawData(payload, payloadSize));
+		}
+		else
+		{
+			_messageOpcode = opcode;
+			_message = QByteArray(payload, payloadSize);
+		}
+		break;
+
+	case ContinuationFrame:
+		if (_messageOpcode < 0) { fail(ProtocolError); return false; }
+		if (_message.size() + payloadSize > MaximumMessageSize) { fail(MessageTooBig); return false; }
+		_message.append(payload, payloadSize);
+		if (final)
+		{
+			opcode = _messageOpcode;
+			_messageOpcode = -1;
+			QByteArray message; qSwap(message, _message);
+			if (_state == Open) emitMessage(opcode, message);
+		}
+		break;
+
+	case PingFrame:
+	case PongFrame:
+	case CloseFrame:
+		if (!final || payloadSize > 125) { fail(ProtocolError); return false; } // Control frames cannot be fragmented.
+
+		if (opcode == PingFrame)
+		{
+			if (_state == Open) writeFrame(PongFrame, payload, payloadSize);
+		}
+		else if (opcode == PongFrame)
+		{
+			emit pongReceived(QByteArray::fromRawData(payload, payloadSize));
+		}
+		else
+		{
+			int closeCode = NoStatusReceived;
+			if (payloadSize == 1) { fail(ProtocolError); return false; }
+			if (payloadSize >= 2)
+			{
+				closeCode = (uchar(payload[0]) << 8) | uchar(payload[1]);
+				if (!isValidCloseCode(closeCode)) { fail(ProtocolError); return false; }
+				if (!isValidUtf8(payload + 2, payloadSize - 2)) { fail(InvalidPayloadData); return false; }
+			}
+
+			if (_state == Open)
+			{
+				// Peer initiated close: acknowledge with the same code.
+				writeFrame(CloseFrame, payload, qMin(payloadSize, 2));
+				_closeCode = closeCode;
+				_closeReason = QByteArray(payload + qMin(payloadSize, 2), payloadSize - qMin(payloadSize, 2));
+			}
+			abort();
+			return false;
+		}
+		break;
+
+	default:
+		fail(ProtocolError);
+		return false;
+	}
+
+	return _state != Closed;
+}
+
+void HttpWebSocket::emitMessage(int opcode, const QByteArray& message)
+{
+	if (opcode == TextFrame)
+	{
+		if (!isValidUtf8(message.constData(), message.size()))
+			return fail(InvalidPayloadData);
+		emit textMessageReceived(message);
+	}
+	else
+		emit binaryMessageReceived(message);
+}
+
+void HttpWebSocket::writeFrame(int opcode, const char* payload, int payloadSize)
+{
+	if (_state == Closed) return;
+
+	// Server frames are not masked.
+	char frame[10 + 1024];
+	int headerSize = 2;
+	frame[0] = char(0x80 | opcode);
+	if (payloadSize < 126)
+		frame[1] = char(payloadSize);
+	else if (payloadSize <= 0xFFFF)
+	{
+		frame[1] = 126;
+		frame[2] = char(payloadSize >> 8); frame[3] = char(payloadSize);
+		headerSize = 4;
+	}
+	else
+	{
+		frame[1] = 127;
+		const quint64 size = quint64(payloadSize);
+		for (int i = 0; i < 8; ++i) frame[2 + i] = char(size >> (56 - 8 * i));
+		headerSize = 10;
+	}
+
+	if (payloadSize <= 1024)
+	{
+		// Small frames go out in a single write.
+		memcpy(frame + headerSize, payload, payloadSize);
+		_outputDevice->write(frame, headerSize + payloadSize);
+	}
+	else
+	{
+		_outputDevice->write(frame, headerSize);
+		_outputDevice->write(payload, payloadSize);
+	}
+}
+
+void HttpWebSocket::writeTextMessage(const QByteArray& utf8Message)
+{
+	if (_state != Open) { qWarning() << "HttpWebSocket::writeTextMessage: the web socket is not open."; return; }
+	writeFrame(TextFrame, utf8Message.constData(), utf8Message.size());
+}
+
+void HttpWebSocket::writeTextMessage(const QString& message)
+{
+	writeTextMessage(message.toUtf8());
+}
+
+void HttpWebSocket::writeBinaryMessage(const QByteArray& message)
+{
+	if (_state != Open) { qWarning() << "HttpWebSocket::writeBinaryMessage: the web socket is not open."; return; }
+	writeFrame(BinaryFrame, message.constData(), message.size());
+}
+
+void HttpWebSocket::ping(const QByteArray& payload)
+{
+	if (_state != Open) { qWarning() << "HttpWebSocket::ping: the web socket is not open."; return; }
+	writeFrame(PingFrame, payload.constData(), qMin(payload.size(), 125));
+}
+
+void HttpWebSocket::close(int closeCode, const QByteArray& reason)
+{
+	if (_state != Open) return;
+
+	char payload[125];
+	payload[0] = char(closeCode >> 8); payload[1] = char(closeCode);
+	const int reasonSize = qMin(reason.size(), 123);
+	memcpy(payload + 2, reason.constData(), reasonSize);
+	writeFrame(CloseFrame, payload, 2 + reasonSize);
+
+	_state = Closing;
+	_closeCode = closeCode;
+	_closeReason = reason.left(reasonSize);
+	QTimer::singleShot(CloseTimeout, this, SLOT(abort()));
+}
+
+void HttpWebSocket::fail(int closeCode)
+{
+	// Failing the connection (RFC 6455 7.1.7): tell the peer why if the closing handshake did not start yet, then drop it.
+	if (_state == Open)
+	{
+		const char payload[2] = { char(closeCode >> 8), char(closeCode) };
+		writeFrame(CloseFrame, payload, 2);
+		_closeCode = closeCode;
+	}
+	abort();
+}
+
+void HttpWebSocket::abort()
+{
+	if (_state == Closed) return;
+	_state = Closed;
+
+	disconnect(_inputDevice, 0, this, 0);
+	_inputDevice->close();
+	if (_outputDevice != _inputDevice) _outputDevice->close();
+	_message.clear();
+	_messageOpcode = -1;
+
+	emit closed(this);
+}
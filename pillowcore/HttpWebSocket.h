@@ -0,0 +1,108 @@
+#ifndef PILLOW_HTTPWEBSOCKET_H
+#define PILLOW_HTTPWEBSOCKET_H
+
+#ifndef PILLOW_PILLOWCORE_H
+#include "PillowCore.h"
+#endif // PILLOW_PILLOWCORE_H
+#ifndef QOBJECT_H
+#include <QtCore/QObject>
+#endif // QOBJECT_H
+#ifndef QBYTEARRAY_H
+#include <QtCore/QByteArray>
+#endif // QBYTEARRAY_H
+
+class QIODevice;
+
+namespace Pillow
+{
+	class HttpConnection;
+
+	//
+	// Pillow::HttpWebSocket
+	//
+	// The server side of a WebSocket (RFC 6455), taken over from a Pillow::HttpConnection through upgrade().
+	//
+	// Frames are parsed in place in the read buffer: the payload of a message sent in a single frame is
+	// handed over without being copied, and is only valid during the emission of the message signal.
+	// Fragmented messages are assembled before being handed over. Pings are answered automatically.
+	//
+	// Reentrant. Not thread safe.
+	//
+	class PILLOWCORE_EXPORT HttpWebSocket : public QObject
+	{
+		Q_OBJECT
+		Q_ENUMS(State)
+
+	public:
+		enum State { Open, Closing, Closed };
+		enum CloseCode
+		{
+			NormalClosure = 1000, GoingAway = 1001, ProtocolError = 1002, UnsupportedData = 1003, NoStatusReceived = 1005, AbnormalClosure = 1006,
+			InvalidPayloadData = 1007, PolicyViolation = 1008, MessageTooBig = 1009, InternalError = 1011
+		};
+		enum { MaximumMessageSize = 16 * 1024 * 1024 };
+		enum { CloseTimeout = 5000 }; // Milliseconds to wait for the peer to acknowledge a close before dropping the connection.
+
+	public:
+		// Whether the request asks for a WebSocket upgrade (a GET with the Upgrade, Connection and Sec-WebSocket-Key headers).
+		static bool isUpgradeRequest(Pillow::HttpConnection* connection);
+
+		// Accept the WebSocket upgrade request of a connection, which must be in the SendingHeaders state. The connection's
+		// devices get handed over to the returned web socket. When the request is not a valid upgrade request, an error
+		// response is written instead and NULL returned. protocol, if not empty, is sent as the Sec-WebSocket-Protocol.
+		static HttpWebSocket* upgrade(Pillow::HttpConnection* connection, const QByteArray& protocol = QByteArray(), QObject* parent = 0);
+
+	public:
+		// Take over devices that already went through the handshake. bufferedData is what was read past the handshake.
+		// The web socket takes ownership of the devices.
+		HttpWebSocket(QIODevice* inputDevice, QIODevice* outputDevice, const QByteArray& bufferedData = QByteArray(), QObject* parent = 0);
+		~HttpWebSocket();
+
+		inline State state() const { return _state; }
+		inline QIODevice* inputDevice() const { return _inputDevice; }
+		inline QIODevice* outputDevice() const { return _outputDevice; }
+
+		// Valid once closed.
+		inline int closeCode() const { return _closeCode; }
+		inline const QByteArray& closeReason() const { return _closeReason; }
+
+	public slots:
+		void writeTextMessage(const QByteArray& utf8Message);
+		void writeTextMessage(const QString& message);
+		void writeBinaryMessage(const QByteArray& message);
+		void ping(const QByteArray& payload = QByteArray());
+
+		// Start the closing handshake. The closed signal is emitted once the peer acknowledged, or after CloseTimeout.
+		void close(int closeCode = NormalClosure, const QByteArray& reason = QByteArray());
+		void abort(); // Close the devices right away, without a closing handshake.
+
+	signals:
+		// The message data is only valid during the emission. Text messages are valid UTF-8.
+		void textMessageReceived(const QByteArray& utf8Message);
+		void binaryMessageReceived(const QByteArray& message);
+		void pongReceived(const QByteArray& payload);
+		void closed(Pillow::HttpWebSocket* self);
+
+	private slots:
+		void processInput();
+
+	private:
+		enum Opcode { ContinuationFrame = 0x0, TextFrame = 0x1, BinaryFrame = 0x2, CloseFrame = 0x8, PingFrame = 0x9, PongFrame = 0xA };
+
+		bool processFrame(int opcode, bool final, const char* payload, int payloadSize); // Returns false if parsing should stop.
+		void emitMessage(int opcode, const QByteArray& message);
+		void writeFrame(int opcode, const char* payload, int payloadSize);
+		void fail(int closeCode);
+
+	private:
+		State _state;
+		QIODevice* _inputDevice,* _outputDevice;
+		QByteArray _buffer;         // Received data that was not parsed yet.
+		QByteArray _message;        // The fragments of the message being assembled.
+		int _messageOpcode;         // Opcode of the message being assembled, or -1.
+		int _closeCode;
+		QByteArray _closeReason;
+	};
+}
+
+#endif // PILLOW_HTTPWEBSOCKET_H
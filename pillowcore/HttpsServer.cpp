@@ -3,42 +3,254 @@
 #include "HttpsServer.h"
 #include "HttpConnection.h"
 #include <QtNetwork/QSslSocket>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QCoreApplication>
 using namespace Pillow;
 
+//
+// Pillow::HttpsHandshakeWorker
+//
+// Runs the Ssl handshakes of the sockets handed to it on its own thread, then moves
+// the sockets back to the server's thread. Lives in a thread owned by the Pillow::HttpsServer.
+// Sockets whose handshake fails or times out get handed back unencrypted, for the server to drop.
+//
+
+namespace Pillow
+{
+	class HttpsHandshakeWorker : public QObject
+	{
+		Q_OBJECT
+		QThread* _serverThread;
+		QHash<QObject*, QTimer*> _sockets; // The sockets under handshake, and their timeout timers.
+		int _handshakeTimeout;
+		bool _aborted;
+
+	public:
+		HttpsHandshakeWorker(QThread* serverThread, int handshakeTimeout)
+			: _serverThread(serverThread), _handshakeTimeout(handshakeTimeout), _aborted(false)
+		{}
+
+	public slots:
+		void startHandshake(QObject* socket)
+		{
+			QSslSocket* sslSocket = static_cast<QSslSocket*>(socket);
+			if (_aborted) { delete sslSocket; return; }
+
+			QTimer* timer = new QTimer(this);
+			timer->setSingleShot(true);
+			connect(timer, SIGNAL(timeout()), this, SLOT(handshakeTimer_timeout()));
+			timer->start(_handshakeTimeout);
+			_sockets.insert(sslSocket, timer);
+
+			sslSocket->setParent(this);
+			connect(sslSocket, SIGNAL(encrypted()), this, SLOT(sslSocket_handshakeDone()));
+			connect(sslSocket, SIGNAL(disconnected()), this, SLOT(sslSocket_handshakeDone()));
+			connect(sslSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(sslSocket_handshakeDone()));
+			connect(sslSocket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslSocket_handshakeDone()));
+			sslSocket->startServerEncryption();
+		}
+
+		void setHandshakeTimeout(int msecs)
+		{
+			_handshakeTimeout = msecs; // For the next handshakes.
+		}
+
+		void abortHandshakes()
+		{
+			_aborted = true;
+			for (QHash<QObject*, QTimer*>::const_iterator it = _sockets.constBegin(), itE = _sockets.constEnd(); it != itE; ++it)
+			{
+				delete it.key();
+				delete it.value();
+			}
+			_sockets.clear();
+		}
+
+	private slots:
+		void sslSocket_handshakeDone()
+		{
+			// Encrypted, or failed: an error, including unaccepted Ssl errors, does not always disconnect the socket.
+			finishHandshake(sender());
+		}
+
+		void handshakeTimer_timeout()
+		{
+			for (QHash<QObject*, QTimer*>::const_iterator it = _sockets.constBegin(), itE = _sockets.constEnd(); it != itE; ++it)
+			{
+				if (it.value() == sender())
+				{
+					finishHandshake(it.key()); // Not encrypted by now: handed over as failed.
+					return;
+				}
+			}
+		}
+
+		void handOver(QObject* socket)
+		{
+			if (!_sockets.contains(socket)) return; // Aborted, or already handed over.
+			delete _sockets.take(socket);
+
+			QSslSocket* sslSocket = static_cast<QSslSocket*>(socket);
+			bool encrypted = sslSocket->isEncrypted() && sslSocket->state() == QAbstractSocket::ConnectedState;
+			sslSocket->setParent(0);
+			sslSocket->moveToThread(_serverThread);
+			emit handshakeFinished(sslSocket, encrypted);
+		}
+
+	private:
+		void finishHandshake(QObject* socket)
+		{
+			// The socket may still be emitting; hand it over once it has returned to the event loop.
+			disconnect(socket, 0, this, 0);
+			_sockets.value(socket)->stop();
+			QMetaObject::invokeMethod(this, "handOver", Qt::QueuedConnection, Q_ARG(QObject*, socket));
+		}
+
+	signals:
+		void handshakeFinished(QObject* sslSocket, bool encrypted);
+	};
+}
+
 //
 // HttpsServer
 //
 
 HttpsServer::HttpsServer(QObject *parent)
-	: HttpServer(parent)
+	: HttpServer(parent), _handshakeCount(0), _failedHandshakeCount(0), _totalHandshakeTime(0), _nextHandshakeWorker(0),
+	  _handshakeTimeout(DefaultHandshakeTimeout)
 {
+	_handshakeClock.start();
+	updateSslConfiguration();
 }
 
 HttpsServer::HttpsServer(const QSslCertificate& certificate, const QSslKey& privateKey, const QHostAddress &serverAddress, quint16 serverPort, QObject *parent)
-	: HttpServer(serverAddress, serverPort, parent), _certificate(certificate), _privateKey(privateKey)
+	: HttpServer(serverAddress, serverPort, parent), _certificate(certificate), _privateKey(privateKey),
+	  _handshakeCount(0), _failedHandshakeCount(0), _totalHandshakeTime(0), _nextHandshakeWorker(0),
+	  _handshakeTimeout(DefaultHandshakeTimeout)
 {
+	_handshakeClock.start();
+	updateSslConfiguration();
+}
+
+HttpsServer::~HttpsServer()
+{
+	setHandshakeThreadCount(0);
 }
 
 void HttpsServer::setCertificate(const QSslCertificate &certificate)
 {
 	_certificate = certificate;
+	updateSslConfiguration();
 }
 
 void HttpsServer::setPrivateKey(const QSslKey &privateKey)
 {
 	_privateKey = privateKey;
+	updateSslConfiguration();
+}
+
+void HttpsServer::updateSslConfiguration()
+{
+	_sslConfiguration = QSslConfiguration::defaultConfiguration();
+	_sslConfiguration.setLocalCertificate(_certificate);
+	_sslConfiguration.setPrivateKey(_privateKey);
+}
+
+void HttpsServer::resetHandshakeStatistics()
+{
+	_handshakeCount = 0;
+	_failedHandshakeCount = 0;
+	_totalHandshakeTime = 0;
+}
+
+void HttpsServer::setHandshakeThreadCount(int count)
+{
+	if (count < 0) count = 0;
+
+	while (_handshakeThreads.size() > count)
+	{
+		QThread* thread = _handshakeThreads.takeLast();
+		HttpsHandshakeWorker* worker = _handshakeWorkers.takeLast();
+
+		// Drop the handshakes still in progress, and take in the sockets the worker already handed over.
+		QMetaObject::invokeMethod(worker, "abortHandshakes", Qt::BlockingQueuedConnection);
+		QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+		for (QHash<QSslSocket*, HttpsHandshakeWorker*>::iterator it = _pooledHandshakes.begin(); it != _pooledHandshakes.end();)
+		{
+			if (it.value() == worker)
+			{
+				_handshakeStartTimes.remove(it.key());
+				++_failedHandshakeCount;
+				it = _pooledHandshakes.erase(it);
+			}
+			else
+				++it;
+		}
+
+		thread->quit();
+		thread->wait();
+		delete thread;
+	}
+
+	while (_handshakeThreads.size() < count)
+	{
+		QThread* thread = new QThread(this);
+		HttpsHandshakeWorker* worker = new HttpsHandshakeWorker(this->thread(), _handshakeTimeout);
+		worker->moveToThread(thread);
+		connect(worker, SIGNAL(handshakeFinished(QObject*,bool)), this, SLOT(handshakeWorker_handshakeFinished(QObject*,bool)), Qt::QueuedConnection);
+		connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+		_handshakeThreads << thread;
+		_handshakeWorkers << worker;
+		thread->start();
+	}
+
+	if (_nextHandshakeWorker >= _handshakeWorkers.size()) _nextHandshakeWorker = 0;
+}
+
+void HttpsServer::setHandshakeTimeout(int msecs)
+{
+	if (msecs < 0) msecs = 0;
+	_handshakeTimeout = msecs;
+	foreach (HttpsHandshakeWorker* worker, _handshakeWorkers)
+		QMetaObject::invokeMethod(worker, "setHandshakeTimeout", Qt::QueuedConnection, Q_ARG(int, msecs));
 }
 
 void HttpsServer::incomingConnection(int socketDescriptor)
 {
+	if (!_handshakeWorkers.isEmpty())
+	{
+		// The socket gets its handshake done on one of the handshake threads and comes back
+		// through handshakeWorker_handshakeFinished.
+		QSslSocket* sslSocket = new QSslSocket();
+		if (sslSocket->setSocketDescriptor(socketDescriptor))
+		{
+			sslSocket->setSslConfiguration(_sslConfiguration);
+			_handshakeStartTimes.insert(sslSocket, _handshakeClock.elapsed());
+
+			HttpsHandshakeWorker* worker = _handshakeWorkers.at(_nextHandshakeWorker);
+			_nextHandshakeWorker = (_nextHandshakeWorker + 1) % _handshakeWorkers.size();
+			_pooledHandshakes.insert(sslSocket, worker);
+			sslSocket->moveToThread(worker->thread());
+			QMetaObject::invokeMethod(worker, "startHandshake", Qt::QueuedConnection, Q_ARG(QObject*, sslSocket));
+		}
+		else
+		{
+			qWarning() << "HttpsServer::incomingConnection: failed to set socket descriptor '" << socketDescriptor << "' on ssl socket.";
+			delete sslSocket;
+		}
+		return;
+	}
+
 	QSslSocket* sslSocket = new QSslSocket(this);
 	if (sslSocket->setSocketDescriptor(socketDescriptor))
 	{
-		sslSocket->setPrivateKey(privateKey());
-		sslSocket->setLocalCertificate(certificate());
-		sslSocket->startServerEncryption();
+		sslSocket->setSslConfiguration(_sslConfiguration);
+		_handshakeStartTimes.insert(sslSocket, _handshakeClock.elapsed());
 		connect(sslSocket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslSocket_sslErrors(QList<QSslError>)));
 		connect(sslSocket, SIGNAL(encrypted()), this, SLOT(sslSocket_encrypted()));
+		connect(sslSocket, SIGNAL(destroyed(QObject*)), this, SLOT(sslSocket_destroyed(QObject*)));
+		sslSocket->startServerEncryption();
 		addPendingConnection(sslSocket);
 		nextPendingConnection();
 		createHttpConnection()->initialize(sslSocket, sslSocket);
@@ -56,6 +268,44 @@ void HttpsServer::sslSocket_sslErrors(const QList<QSslError>&)
 
 void HttpsServer::sslSocket_encrypted()
 {
+	QHash<QSslSocket*, qint64>::iterator it = _handshakeStartTimes.find(static_cast<QSslSocket*>(sender()));
+	if (it == _handshakeStartTimes.end()) return;
+
+	++_handshakeCount;
+	_totalHandshakeTime += _handshakeClock.elapsed() - it.value();
+	_handshakeStartTimes.erase(it);
+}
+
+void HttpsServer::sslSocket_destroyed(QObject* sslSocket)
+{
+	// The socket is gone without having completed its handshake.
+	if (_handshakeStartTimes.remove(static_cast<QSslSocket*>(sslSocket)) > 0)
+		++_failedHandshakeCount;
 }
 
+void HttpsServer::handshakeWorker_handshakeFinished(QObject* socket, bool encrypted)
+{
+	QSslSocket* sslSocket = static_cast<QSslSocket*>(socket);
+	qint64 startTime = _handshakeStartTimes.take(sslSocket);
+	_pooledHandshakes.remove(sslSocket);
+
+	if (encrypted)
+	{
+		++_handshakeCount;
+		_totalHandshakeTime += _handshakeClock.elapsed() - startTime;
+
+		sslSocket->setParent(this);
+		addPendingConnection(sslSocket);
+		nextPendingConnection();
+		createHttpConnection()->initialize(sslSocket, sslSocket);
+	}
+	else
+	{
+		++_failedHandshakeCount;
+		sslSocket->deleteLater();
+	}
+}
+
+#include "HttpsServer.moc"
+
 #endif // !PILLOW_NO_SSL
@@ -18,32 +18,94 @@
 #ifndef QSSLERROR_H
 #include <QtNetwork/QSslError>
 #endif // QSSLERROR_H
+#ifndef QSSLCONFIGURATION_H
+#include <QtNetwork/QSslConfiguration>
+#endif // QSSLCONFIGURATION_H
+#ifndef QELAPSEDTIMER_H
+#include <QtCore/QElapsedTimer>
+#endif // QELAPSEDTIMER_H
+#ifndef QHASH_H
+#include <QtCore/QHash>
+#endif // QHASH_H
+
+class QSslSocket;
+class QThread;
 
 namespace Pillow
 {
+	class HttpsHandshakeWorker;
+
 	//
 	// HttpsServer
 	//
+	// The Ssl configuration (certificate and private key) is prepared once and shared
+	// by all accepted sockets. Handshake statistics are kept so the cost of accepting
+	// encrypted connections can be monitored.
+	//
+	// With a non-zero handshakeThreadCount, the handshakes of new connections run on a pool
+	// of dedicated threads, so a burst of new clients does not stall the requests already
+	// being served. Only established sessions are handed to the server's thread; handshakes
+	// that fail, or take longer than handshakeTimeout, get their connection dropped.
+	//
 
 	class PILLOWCORE_EXPORT HttpsServer : public Pillow::HttpServer
 	{
 		Q_OBJECT
 		QSslCertificate _certificate;
 		QSslKey _privateKey;
+		QSslConfiguration _sslConfiguration;
+		QElapsedTimer _handshakeClock;
+		QHash<QSslSocket*, qint64> _handshakeStartTimes;
+		qint64 _handshakeCount, _failedHandshakeCount, _totalHandshakeTime;
+		QList<QThread*> _handshakeThreads;
+		QList<HttpsHandshakeWorker*> _handshakeWorkers;
+		QHash<QSslSocket*, HttpsHandshakeWorker*> _pooledHandshakes;
+		int _nextHandshakeWorker;
+		int _handshakeTimeout;
+
+	private:
+		void updateSslConfiguration();
 
 	public slots:
 		void sslSocket_encrypted();
 		void sslSocket_sslErrors(const QList<QSslError>& sslErrors);
+		void sslSocket_destroyed(QObject* sslSocket);
+
+	private slots:
+		void handshakeWorker_handshakeFinished(QObject* sslSocket, bool encrypted);
 
 	protected:
 		virtual void incomingConnection(int socketDescriptor);
 
+	public:
+		enum { DefaultHandshakeTimeout = 10 * 1000 };
+
 	public:
 		HttpsServer(QObject* parent = 0);
 		HttpsServer(const QSslCertificate& certificate, const QSslKey& privateKey, const QHostAddress& serverAddress, quint16 serverPort, QObject *parent = 0);
+		~HttpsServer();
 
 		const QSslCertificate& certificate() const { return _certificate; }
 		const QSslKey& privateKey() const { return _privateKey; }
+		const QSslConfiguration& sslConfiguration() const { return _sslConfiguration; }
+
+		// Handshake statistics, since the server was created or the statistics were last reset.
+		inline qint64 handshakeCount() const { return _handshakeCount; } // Successfully completed handshakes.
+		inline qint64 failedHandshakeCount() const { return _failedHandshakeCount; } // Connections closed before completing their handshake.
+		inline int pendingHandshakeCount() const { return _handshakeStartTimes.size(); }
+		inline qint64 totalHandshakeTime() const { return _totalHandshakeTime; } // Msecs, from accepting connections to completing their handshake.
+		inline qint64 averageHandshakeTime() const { return _handshakeCount > 0 ? _totalHandshakeTime / _handshakeCount : 0; }
+		void resetHandshakeStatistics();
+
+		// handshakeThreadCount: Number of threads running the handshakes of new connections. The default, 0,
+		// runs them on the server's thread. Lowering it drops the handshakes in progress on the removed threads.
+		inline int handshakeThreadCount() const { return _handshakeThreads.size(); }
+		void setHandshakeThreadCount(int count);
+
+		// handshakeTimeout: Time, in milliseconds, that the handshake threads give a new connection to complete its
+		// handshake before dropping it as failed. Applies to the handshakes started after it was changed.
+		inline int handshakeTimeout() const { return _handshakeTimeout; }
+		void setHandshakeTimeout(int msecs);
 
 	public slots:
 		void setCertificate(const QSslCertificate& certificate);
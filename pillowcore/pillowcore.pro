@@ -33,7 +33,20 @@ SOURCES += \
 	HttpConnection.cpp \
 	HttpHandlerProxy.cpp \
 	HttpClient.cpp \
-	HttpHeader.cpp
+	HttpHeader.cpp \
+	HttpUpstreamGroup.cpp \
+	HttpResponseCache.cpp \
+	HttpMultipartParser.cpp \
+	HttpUnixServer.cpp \
+	HttpWebSocket.cpp \
+	HttpEventChannel.cpp \
+	Http2Hpack.cpp \
+	Http2Session.cpp \
+	HttpServerHandover.cpp \
+	HttpSocketActivation.cpp \
+	HttpHandlerRateLimit.cpp \
+	HttpHandlerFlightRecorder.cpp \
+	HttpHandlerThreadPool.cpp
 
 HEADERS += \
 	parser/parser.h \
@@ -51,6 +64,20 @@ HEADERS += \
 	HttpClient.h \
 	pch.h \
 	HttpHeader.h \
+	HttpUpstreamGroup.h \
+	HttpResponseCache.h \
+	HttpMultipartParser.h \
+	HttpUnixServer.h \
+	HttpWebSocket.h \
+	HttpEventChannel.h \
+	Http2Hpack.h \
+	Http2Session.h \
+	HttpServerHandover.h \
+	HttpSocketActivation.h \
+	HttpHandlerRateLimit.h \
+	HttpHandlerFlightRecorder.h \
+	HttpHandlerThreadPool.h \
+	private/HttpServerPrivate.h \
 	PillowCore.h
 
 OTHER_FILES += \
@@ -0,0 +1,74 @@
+#ifndef PILLOW_HTTPSERVERPRIVATE_H
+#define PILLOW_HTTPSERVERPRIVATE_H
+
+#ifndef PILLOW_HTTPCONNECTION_H
+#include "../HttpConnection.h"
+#endif // PILLOW_HTTPCONNECTION_H
+#ifndef QSET_H
+#include <QtCore/QSet>
+#endif // QSET_H
+
+namespace Pillow
+{
+	//
+	// Pillow::HttpServerPrivate
+	//
+	// The pool of reusable connections shared by the server classes. The server (q_ptr) must have the
+	// requestHeadersReady and requestReady signals and a connection_closed(Pillow::HttpConnection*) slot.
+	// The requestReady of connections goes to requestReadyMember, the server's requestReady signal by default.
+	//
+	class HttpServerPrivate
+	{
+	public:
+		enum { MaximumReserveCount = 25 };
+
+	public:
+		QObject* q_ptr;
+		const char* requestReadyMember;
+		QList<HttpConnection*> reservedConnections;
+		QSet<HttpConnection*> activeConnections; // Taken, until they get put back once closed.
+		bool http2Enabled;
+		bool shuttingDown;
+
+	public:
+		HttpServerPrivate(QObject* server, const char* requestReadyMember = SIGNAL(requestReady(Pillow::HttpConnection*)))
+			: q_ptr(server), requestReadyMember(requestReadyMember), http2Enabled(false), shuttingDown(false)
+		{
+			for (int i = 0; i < MaximumReserveCount; ++i)
+				reservedConnections << createConnection();
+		}
+
+		~HttpServerPrivate()
+		{
+			while (!reservedConnections.isEmpty())
+				delete reservedConnections.takeLast();
+		}
+
+		HttpConnection* createConnection()
+		{
+			HttpConnection* connection = new HttpConnection(q_ptr);
+			QObject::connect(connection, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)), q_ptr, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)));
+			QObject::connect(connection, SIGNAL(requestReady(Pillow::HttpConnection*)), q_ptr, requestReadyMember);
+			QObject::connect(connection, SIGNAL(closed(Pillow::HttpConnection*)), q_ptr, SLOT(connection_closed(Pillow::HttpConnection*)));
+			return connection;
+		}
+
+		HttpConnection* takeConnection()
+		{
+			HttpConnection* connection = reservedConnections.isEmpty() ? createConnection() : reservedConnections.takeLast();
+			activeConnections.insert(connection);
+			return connection;
+		}
+
+		void putConnection(HttpConnection* connection)
+		{
+			activeConnections.remove(connection);
+			while (reservedConnections.size() >= MaximumReserveCount)
+				delete reservedConnections.takeLast();
+
+			reservedConnections.append(connection);
+		}
+	};
+}
+
+#endif // PILLOW_HTTPSERVERPRIVATE_H
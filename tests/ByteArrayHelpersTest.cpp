@@ -90,6 +90,22 @@ private slots:
 		QCOMPARE(ba, QByteArray("world"));
 	}
 
+	void test_detachedCopy()
+	{
+		char rawData[] = "hello world!";
+		const QByteArray ba = QByteArray::fromRawData(rawData, 5);
+
+		QByteArray copy = Pillow::ByteArrayHelpers::detachedCopy(ba);
+		QCOMPARE(copy, QByteArray("hello"));
+		QVERIFY(copy.constData() != rawData);
+		QVERIFY(copy.constData()[5] == '\0'); // Null terminated, unlike the raw data.
+		QVERIFY(ba.constData() == rawData); // The original is left alone.
+
+		rawData[0] = 'j';
+		QCOMPARE(copy, QByteArray("hello")); // Not affected by changes to the raw data.
+		QVERIFY(Pillow::ByteArrayHelpers::detachedCopy(QByteArray()).isEmpty());
+	}
+
 	void test_appendNumber()
 	{
 		QByteArray ba;
@@ -147,6 +163,28 @@ private slots:
 		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("hello123", QLatin1Literal("hElLo1234")));
 		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("hello", QLatin1Literal("World")));
 		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("hello", QLatin1Literal("hello\1")));
+
+		// Longer than a vector register, with differences before and after the first 16 bytes.
+		QVERIFY(Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("accept-encoding, x-forwarded-for", QByteArray("Accept-Encoding, X-FORWARDED-FOR")));
+		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("accept-encoding, x-forwarded-for", QByteArray("Accept-Encodinh, X-FORWARDED-FOR")));
+		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("accept-encoding, x-forwarded-for", QByteArray("Accept-Encoding, X-FORWARDED-FOS")));
+		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive("[accept-encoding, x-forwarded-for", QByteArray("{Accept-Encoding, X-FORWARDED-FOR")));
+		QVERIFY(Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(QByteArray("Accept-Encoding, X-FORWARDED-FOR"), Pillow::LowerCaseToken("accept-encoding, x-forwarded-for")));
+		QVERIFY(!Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(QByteArray("Accept-Encoding, X-FORWARDED-FOX"), Pillow::LowerCaseToken("accept-encoding, x-forwarded-for")));
+	}
+
+	void test_asciiEqualsCaseInsensitive_matchesScalar()
+	{
+		const QByteArray first("Accept-Encoding: gzip, deflate, sdch, X-Forwarded-For: 127.0.0.1");
+		QByteArray second = first.toLower();
+		for (int size = 0; size <= first.size(); ++size)
+			QCOMPARE(Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(first.constData(), second.constData(), size),
+					 Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitiveScalar(first.constData(), second.constData(), size));
+
+		second[40] = '_';
+		for (int size = 0; size <= first.size(); ++size)
+			QCOMPARE(Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(first.constData(), second.constData(), size),
+					 Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitiveScalar(first.constData(), second.constData(), size));
 	}
 
 	void test_unhex()
@@ -169,6 +207,33 @@ private slots:
 		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("hello%20world%3F"), QString("hello world?"));
 		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("hello%20%20world100%25"), QString("hello  world100%"));
 		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("hello%20%20world%2f%2F!"), QString("hello  world//!"));
+
+		// Invalid or incomplete escapes are kept as is.
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("100%"), QString("100%"));
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("100%2"), QString("100%2"));
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("100%zz%41"), QString("100%zzA"));
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("%%41"), QString("%A"));
+
+		// Longer than a vector register, with escapes within and across blocks.
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("/some/long/path/without/any/escapes/at/all"), QString("/some/long/path/without/any/escapes/at/all"));
+		QCOMPARE(Pillow::ByteArrayHelpers::percentDecode("/some/long%20path/with%20esc%61pes/%E2%82%AC/at%2Fthe%20end%21"), QString::fromUtf8("/some/long path/with escapes/\xE2\x82\xAC/at/the end!"));
+	}
+
+	void test_percentDecodeInPlace_matchesScalar_data()
+	{
+		QTest::addColumn<QByteArray>("input");
+		QTest::newRow("no escapes") << QByteArray("/api/v1/some/resource/path/index.html?key=value&other=value");
+		QTest::newRow("few escapes") << QByteArray("/api/v1/some%20resource/path/index.html?key=some%20value&other=value");
+		QTest::newRow("escapes across blocks") << QByteArray("/0123456789abc%20def%2/%41%42%43%44%45%46%47%48%49%4A%4B%4C%4D%4E%4F%50%zz%");
+	}
+
+	void test_percentDecodeInPlace_matchesScalar()
+	{
+		QFETCH(QByteArray, input);
+		QByteArray vectorized = input, scalar = input;
+		vectorized.resize(Pillow::ByteArrayHelpers::percentDecodeInPlace(vectorized.data(), vectorized.size()));
+		scalar.resize(Pillow::ByteArrayHelpers::percentDecodeInPlaceScalar(scalar.data(), scalar.size()));
+		QCOMPARE(vectorized, scalar);
 	}
 
 	void test_byteArray_equals_latin1Literal()
@@ -0,0 +1,371 @@
+#include <QtTest/QTest>
+#include "Helpers.h"
+#include <HttpServer.h>
+#include <Http2Hpack.h>
+#include <Http2Session.h>
+
+namespace
+{
+	enum { DataFrame = 0x0, HeadersFrame = 0x1, RstStreamFrame = 0x3, SettingsFrame = 0x4, PingFrame = 0x6, GoAwayFrame = 0x7, WindowUpdateFrame = 0x8 };
+	enum { EndStreamFlag = 0x1, AckFlag = 0x1, EndHeadersFlag = 0x4 };
+
+	struct Frame
+	{
+		int type, flags;
+		quint32 streamId;
+		QByteArray payload;
+	};
+
+	QByteArray frame(int type, int flags, quint32 streamId, const QByteArray& payload = QByteArray())
+	{
+		QByteArray f;
+		f.append(char(payload.size() >> 16)).append(char(payload.size() >> 8)).append(char(payload.size()));
+		f.append(char(type)).append(char(flags));
+		f.append(char(streamId >> 24)).append(char(streamId >> 16)).append(char(streamId >> 8)).append(char(streamId));
+		return f.append(payload);
+	}
+
+	QByteArray uint32(quint32 value)
+	{
+		QByteArray b; b.append(char(value >> 24)).append(char(value >> 16)).append(char(value >> 8)).append(char(value));
+		return b;
+	}
+
+	QByteArray requestFrame(quint32 streamId, const QByteArray& method, const QByteArray& path, bool endStream,
+							const Pillow::HttpHeaderCollection& extraHeaders = Pillow::HttpHeaderCollection())
+	{
+		Pillow::HttpHeaderCollection headers;
+		headers << Pillow::HttpHeader(":method", method) << Pillow::HttpHeader(":scheme", "http")
+				<< Pillow::HttpHeader(":path", path) << Pillow::HttpHeader(":authority", "localhost");
+		headers += extraHeaders;
+		QByteArray block;
+		Pillow::HpackEncoder::encode(headers, block);
+		return frame(HeadersFrame, EndHeadersFlag | (endStream ? EndStreamFlag : 0), streamId, block);
+	}
+}
+
+class Http2TestServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	QList<QByteArray> requestVersions;
+
+	Http2TestServer() : Pillow::HttpServer(QHostAddress::LocalHost, 0)
+	{
+		setHttp2Enabled(true);
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+	}
+
+private slots:
+	void self_requestReady(Pillow::HttpConnection* connection)
+	{
+		requestVersions << connection->requestHttpVersion();
+		if (connection->requestPath() == "/echo")
+			connection->writeResponse(200, Pillow::HttpHeaderCollection(), connection->requestContent());
+		else if (connection->requestPath() == "/big")
+			connection->writeResponse(200, Pillow::HttpHeaderCollection(), QByteArray(100000, 'x'));
+		else if (connection->requestPath() == "/chunked")
+		{
+			connection->writeHeaders(200);
+			connection->writeContent("Hello, ");
+			connection->writeContent("chunks");
+			connection->endContent();
+		}
+		else
+			connection->writeResponse(200, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("X-Host", connection->requestHeaderValue(Pillow::HttpHeaderId::Host)),
+									  connection->requestMethod() + " " + connection->requestUri());
+	}
+};
+
+class Http2Client
+{
+public:
+	QTcpSocket socket;
+	QByteArray buffer;
+	Pillow::HpackDecoder decoder;
+
+	bool connectToServer(quint16 port, bool sendPreface = true)
+	{
+		socket.connectToHost(QHostAddress::LocalHost, port);
+		if (!socket.waitForConnected(1000)) return false;
+		if (sendPreface) socket.write(QByteArray("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") + frame(SettingsFrame, 0, 0));
+		return true;
+	}
+
+	bool readFrame(Frame& f)
+	{
+		if (!waitFor([&]{ buffer += socket.readAll(); return buffer.size() >= 9 && buffer.size() >= 9 + ((uchar(buffer[0]) << 16) | (uchar(buffer[1]) << 8) | uchar(buffer[2])); }))
+			return false;
+		const int size = (uchar(buffer[0]) << 16) | (uchar(buffer[1]) << 8) | uchar(buffer[2]);
+		f.type = uchar(buffer[3]);
+		f.flags = uchar(buffer[4]);
+		f.streamId = (quint32(uchar(buffer[5])) << 24 | quint32(uchar(buffer[6])) << 16 | quint32(uchar(buffer[7])) << 8 | uchar(buffer[8])) & 0x7FFFFFFF;
+		f.payload = buffer.mid(9, size);
+		buffer.remove(0, 9 + size);
+		return true;
+	}
+
+	// Read frames until the end of the given streams, acknowledging SETTINGS on the way.
+	bool readResponses(const QList<quint32>& streamIds, QMap<quint32, Pillow::HttpHeaderCollection>& headers, QMap<quint32, QByteArray>& contents,
+					   bool updateWindows = false)
+	{
+		QList<quint32> open = streamIds;
+		Frame f;
+		while (!open.isEmpty() && readFrame(f))
+		{
+			if (f.type == SettingsFrame && (f.flags & AckFlag) == 0) socket.write(frame(SettingsFrame, AckFlag, 0));
+			else if (f.type == HeadersFrame && !decoder.decode(f.payload.constData(), f.payload.size(), headers[f.streamId])) return false;
+			else if (f.type == DataFrame)
+			{
+				contents[f.streamId] += f.payload;
+				if (updateWindows && !f.payload.isEmpty())
+					socket.write(frame(WindowUpdateFrame, 0, 0, uint32(f.payload.size())) + frame(WindowUpdateFrame, 0, f.streamId, uint32(f.payload.size())));
+			}
+			else if (f.type == RstStreamFrame || f.type == GoAwayFrame) return false;
+			if ((f.type == HeadersFrame || f.type == DataFrame) && (f.flags & EndStreamFlag)) open.removeAll(f.streamId);
+		}
+		return open.isEmpty();
+	}
+
+	bool readResponse(quint32 streamId, Pillow::HttpHeaderCollection& headers, QByteArray& content, bool updateWindows = false)
+	{
+		QMap<quint32, Pillow::HttpHeaderCollection> allHeaders;
+		QMap<quint32, QByteArray> contents;
+		if (!readResponses(QList<quint32>() << streamId, allHeaders, contents, updateWindows)) return false;
+		headers = allHeaders.value(streamId);
+		content = contents.value(streamId);
+		return true;
+	}
+};
+
+class Http2SessionTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void should_decode_rfc_header_block_examples()
+	{
+		// RFC 7541, C.4: requests with Huffman encoding, sharing a dynamic table.
+		Pillow::HpackDecoder decoder;
+		Pillow::HttpHeaderCollection headers;
+		QByteArray block = QByteArray::fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+		QVERIFY(decoder.decode(block.constData(), block.size(), headers));
+		QCOMPARE(headers.size(), 4);
+		QCOMPARE(headers.at(3).first, QByteArray(":authority"));
+		QCOMPARE(headers.at(3).second, QByteArray("www.example.com"));
+		QCOMPARE(decoder.dynamicTableSize(), 57);
+
+		headers.clear();
+		block = QByteArray::fromHex("828684be5886a8eb10649cbf");
+		QVERIFY(decoder.decode(block.constData(), block.size(), headers));
+		QCOMPARE(headers.size(), 5);
+		QCOMPARE(headers.at(4).second, QByteArray("no-cache"));
+		QCOMPARE(decoder.dynamicTableSize(), 110);
+
+		headers.clear();
+		block = QByteArray::fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+		QVERIFY(decoder.decode(block.constData(), block.size(), headers));
+		QCOMPARE(headers.size(), 5);
+		QCOMPARE(headers.at(2).second, QByteArray("/index.html"));
+		QCOMPARE(headers.at(4).first, QByteArray("custom-key"));
+		QCOMPARE(headers.at(4).second, QByteArray("custom-value"));
+		QCOMPARE(decoder.dynamicTableSize(), 164);
+
+		// An index past the end of the tables is a compression error.
+		Pillow::HpackDecoder other;
+		block = QByteArray::fromHex("8287bf");
+		QVERIFY(!other.decode(block.constData(), block.size(), headers));
+	}
+
+	void should_encode_header_blocks_that_decode_back()
+	{
+		Pillow::HttpHeaderCollection headers;
+		headers << Pillow::HttpHeader(":status", "200") << Pillow::HttpHeader("content-type", "text/plain")
+				<< Pillow::HttpHeader("x-long", QByteArray(300, 'a'));
+		QByteArray block;
+		Pillow::HpackEncoder::encode(headers, block);
+		QCOMPARE(block.at(0), char(0x88)); // Indexed, from the static table.
+
+		Pillow::HpackDecoder decoder;
+		Pillow::HttpHeaderCollection decoded;
+		QVERIFY(decoder.decode(block.constData(), block.size(), decoded));
+		QCOMPARE(decoded, headers);
+		QCOMPARE(decoder.dynamicTableCount(), 0);
+	}
+
+	void should_serve_prior_knowledge_requests()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+		client.socket.write(requestFrame(1, "GET", "/hello?a=b", true));
+
+		Pillow::HttpHeaderCollection headers; QByteArray content;
+		QVERIFY(client.readResponse(1, headers, content));
+		QCOMPARE(headers.getFieldValue(":status"), QByteArray("200"));
+		QCOMPARE(headers.getFieldValue("x-host"), QByteArray("localhost"));
+		QCOMPARE(headers.getFieldValue("content-length"), QByteArray("14"));
+		QVERIFY(headers.getFieldValue("connection").isNull());
+		QCOMPARE(content, QByteArray("GET /hello?a=b"));
+		QCOMPARE(server.requestVersions, QList<QByteArray>() << "HTTP/1.1");
+
+		// PING gets acknowledged with the same payload.
+		client.socket.write(frame(PingFrame, 0, 0, "12345678"));
+		Frame f;
+		do QVERIFY(client.readFrame(f)); while (f.type != PingFrame);
+		QCOMPARE(f.flags, int(AckFlag));
+		QCOMPARE(f.payload, QByteArray("12345678"));
+	}
+
+	void should_multiplex_streams()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+		client.socket.write(requestFrame(1, "GET", "/first", true) + requestFrame(3, "GET", "/chunked", true) + requestFrame(5, "HEAD", "/third", true));
+
+		QMap<quint32, Pillow::HttpHeaderCollection> headers;
+		QMap<quint32, QByteArray> contents;
+		QVERIFY(client.readResponses(QList<quint32>() << 1 << 3 << 5, headers, contents));
+		QCOMPARE(contents.value(1), QByteArray("GET /first"));
+		QCOMPARE(contents.value(3), QByteArray("Hello, chunks"));
+		QVERIFY(headers.value(3).getFieldValue("transfer-encoding").isNull());
+		QCOMPARE(headers.value(5).getFieldValue(":status"), QByteArray("200"));
+		QCOMPARE(contents.value(5), QByteArray());
+	}
+
+	void should_serve_request_content()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+
+		// With a content-length, then without one.
+		client.socket.write(requestFrame(1, "POST", "/echo", false, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("content-length", "11")));
+		client.socket.write(frame(DataFrame, 0, 1, "hello ") + frame(DataFrame, EndStreamFlag, 1, "world"));
+		client.socket.write(requestFrame(3, "POST", "/echo", false));
+		client.socket.write(frame(DataFrame, 0, 3, "no ") + frame(DataFrame, EndStreamFlag, 3, "length"));
+
+		QMap<quint32, Pillow::HttpHeaderCollection> headers;
+		QMap<quint32, QByteArray> contents;
+		QVERIFY(client.readResponses(QList<quint32>() << 1 << 3, headers, contents));
+		QCOMPARE(contents.value(1), QByteArray("hello world"));
+		QCOMPARE(contents.value(3), QByteArray("no length"));
+	}
+
+	void should_respect_flow_control()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+		client.socket.write(requestFrame(1, "GET", "/big", true));
+
+		// Without WINDOW_UPDATE frames, the server stops at the initial window of 65535 bytes.
+		QByteArray received;
+		Frame f;
+		while (received.size() < 65535 && client.readFrame(f))
+		{
+			if (f.type == DataFrame) { QVERIFY(f.payload.size() <= 16384); received += f.payload; }
+		}
+		QCOMPARE(received.size(), 65535);
+		QVERIFY(!client.readFrame(f) || f.type != DataFrame);
+
+		client.socket.write(frame(WindowUpdateFrame, 0, 0, uint32(65535)) + frame(WindowUpdateFrame, 0, 1, uint32(65535)));
+		Pillow::HttpHeaderCollection headers; QByteArray content;
+		QVERIFY(client.readResponse(1, headers, content, true));
+		QCOMPARE(received.size() + content.size(), 100000);
+	}
+
+	void should_upgrade_from_http11()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort(), false));
+		client.socket.write("GET /upgraded HTTP/1.1\r\nHost: example.org\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+
+		const QByteArray switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+		QVERIFY(waitFor([&]{ client.buffer += client.socket.readAll(); return client.buffer.size() >= switching.size(); }));
+		QVERIFY(client.buffer.startsWith(switching));
+		client.buffer.remove(0, switching.size());
+		client.socket.write(QByteArray("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") + frame(SettingsFrame, 0, 0));
+
+		// The upgrade request is served as stream 1.
+		Pillow::HttpHeaderCollection headers; QByteArray content;
+		QVERIFY(client.readResponse(1, headers, content));
+		QCOMPARE(headers.getFieldValue("x-host"), QByteArray("example.org"));
+		QCOMPARE(content, QByteArray("GET /upgraded"));
+
+		client.socket.write(requestFrame(3, "GET", "/next", true));
+		QVERIFY(client.readResponse(3, headers, content));
+		QCOMPARE(content, QByteArray("GET /next"));
+	}
+
+	void should_leave_http2_requests_alone_when_disabled()
+	{
+		Http2TestServer server;
+		server.setHttp2Enabled(false);
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		QVERIFY(socket.waitForConnected(1000));
+		socket.write("GET /plain HTTP/1.1\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() > 0; }));
+		QVERIFY(socket.readAll().startsWith("HTTP/1.1 200 OK\r\n"));
+	}
+
+	void should_reject_protocol_errors()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+
+		// A stream without a :path gets reset; the connection stays usable.
+		Pillow::HttpHeaderCollection headers;
+		headers << Pillow::HttpHeader(":method", "GET") << Pillow::HttpHeader(":scheme", "http");
+		QByteArray block;
+		Pillow::HpackEncoder::encode(headers, block);
+		client.socket.write(frame(HeadersFrame, EndHeadersFlag | EndStreamFlag, 1, block));
+		Frame f;
+		do QVERIFY(client.readFrame(f)); while (f.type != RstStreamFrame);
+		QCOMPARE(f.streamId, quint32(1));
+		QCOMPARE(f.payload, uint32(Pillow::Http2Session::ProtocolError));
+
+		// Even stream ids belong to the server: that is a connection error.
+		client.socket.write(requestFrame(2, "GET", "/", true));
+		do QVERIFY(client.readFrame(f)); while (f.type != GoAwayFrame);
+		QCOMPARE(f.payload.mid(4), uint32(Pillow::Http2Session::ProtocolError));
+		QVERIFY(waitFor([&]{ return client.socket.state() == QAbstractSocket::UnconnectedState; }));
+	}
+
+	void should_reset_streams_with_connection_specific_fields()
+	{
+		Http2TestServer server;
+		Http2Client client;
+		QVERIFY(client.connectToServer(server.serverPort()));
+
+		QList<Pillow::HttpHeader> fields;
+		fields << Pillow::HttpHeader("connection", "keep-alive") << Pillow::HttpHeader("keep-alive", "timeout=5")
+			   << Pillow::HttpHeader("proxy-connection", "keep-alive") << Pillow::HttpHeader("transfer-encoding", "chunked")
+			   << Pillow::HttpHeader("upgrade", "websocket") << Pillow::HttpHeader("te", "gzip");
+		quint32 streamId = 1;
+		foreach (const Pillow::HttpHeader& field, fields)
+		{
+			client.socket.write(requestFrame(streamId, "GET", "/", true, Pillow::HttpHeaderCollection() << field));
+			Frame f;
+			do QVERIFY(client.readFrame(f)); while (f.type != RstStreamFrame);
+			QCOMPARE(f.streamId, streamId);
+			QCOMPARE(f.payload, uint32(Pillow::Http2Session::ProtocolError));
+			streamId += 2;
+		}
+		QVERIFY(server.requestVersions.isEmpty());
+
+		// "TE: trailers" is the one allowed.
+		client.socket.write(requestFrame(streamId, "GET", "/trailers", true, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("te", "trailers")));
+		Pillow::HttpHeaderCollection headers; QByteArray content;
+		QVERIFY(client.readResponse(streamId, headers, content));
+		QCOMPARE(content, QByteArray("GET /trailers"));
+	}
+};
+PILLOW_TEST_DECLARE(Http2SessionTest)
+
+#include "Http2SessionTest.moc"
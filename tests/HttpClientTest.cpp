@@ -2366,6 +2366,53 @@ private slots:
 		QCOMPARE(client->content(), QByteArray("1234"));
 		QVERIFY(waitFor([&]{ return s == 0; }));
 	}
+
+	void should_stream_request_content()
+	{
+		Pillow::HttpClientRequest request;
+		request.method = "POST";
+		request.url = testUrl();
+		request.contentLength = 20;
+		client->request(request);
+		client->writeContent("1234567890"); // Before the connection is even established.
+		QVERIFY(client->canWriteContent());
+		QVERIFY(!server.waitForRequest(50));
+
+		client->writeContent("abcdefghij");
+		QVERIFY(server.waitForRequest());
+		QCOMPARE(server.receivedRequests.last()._content, QByteArray("1234567890abcdefghij"));
+		QCOMPARE(server.receivedConnections.last()->requestHeaderValue("Content-Length"), QByteArray("20"));
+
+		server.receivedConnections.last()->writeResponse(200, Pillow::HttpHeaderCollection(), "thanks");
+		QVERIFY(waitForResponse());
+		QCOMPARE(client->content(), QByteArray("thanks"));
+	}
+
+	void should_not_reuse_the_connection_if_answered_before_all_the_content_was_written()
+	{
+		Pillow::HttpClientRequest request;
+		request.method = "PUT";
+		request.url = testUrl();
+		request.contentLength = 1000;
+		client->request(request);
+		client->writeContent("not all of it");
+
+		// The server never gets the whole request; answer as soon as it has the headers.
+		Pillow::HttpConnection* connection = 0;
+		QVERIFY(waitFor([&]
+		{
+			foreach (Pillow::HttpConnection* c, server.findChildren<Pillow::HttpConnection*>())
+				if (c->state() == Pillow::HttpConnection::ReceivingContent) connection = c;
+			return connection != 0;
+		}));
+		QPointer<QTcpSocket> s = qobject_cast<QTcpSocket*>(connection->inputDevice());
+		s->write("HTTP/1.1 413 Request Entity Too Large\r\nContent-Length: 0\r\n\r\n");
+		QVERIFY(waitForResponse());
+		QCOMPARE(client->statusCode(), 413);
+
+		client->writeContent("ignored now"); // Dropped, without a warning.
+		QVERIFY(waitFor([&]{ return s == 0; }));
+	}
 };
 PILLOW_TEST_DECLARE(HttpClientTest)
 
@@ -80,6 +80,9 @@ void HttpConnectionTest::testSimpleGet()
 	QCOMPARE(connection->requestHeaders().at(2).second, QByteArray("DummyValue"));
 	QCOMPARE(connection->requestHeaderValue("x-DUmmY"), QByteArray("DummyValue"));
 	QCOMPARE(connection->requestHeaderValue("missing"), QByteArray());
+	QCOMPARE(connection->requestHeaderValue("HOST"), QByteArray("example.org"));
+	QCOMPARE(connection->requestHeaderValue(Pillow::HttpHeaderId::Host), QByteArray("example.org"));
+	QCOMPARE(connection->requestHeaderValue(Pillow::HttpHeaderId::Connection), QByteArray());
 	QCOMPARE(connection->requestContent(), QByteArray());
 	QCOMPARE(readySpy->size(), 1);
 	QCOMPARE(completedSpy->size(), 0);
@@ -760,6 +763,128 @@ void HttpConnectionTest::testMultipacketResponse()
 	QCOMPARE(receivedData, r);
 }
 
+void HttpConnectionTest::testWritePreparedResponse()
+{
+	const HttpPreparedResponse response(200, HttpHeaderCollection() << HttpHeader("Some-Header", "Some Value") << HttpHeader("Content-Length", "1000"), "response content");
+	QCOMPARE(response.statusCode(), 200);
+	QVERIFY(!response.closesConnection());
+
+	// Same bytes as writeResponse would send.
+	clientWrite("GET / HTTP/1.0\r\n");
+	clientWrite("\r\n"); clientFlush();
+	connection->writePreparedResponse(response);
+	QCOMPARE(clientReadAll(), QByteArray("HTTP/1.0 200 OK\r\nSome-Header: Some Value\r\nContent-Length: 16\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nresponse content"));
+	QCOMPARE(completedSpy->size(), 1);
+	QCOMPARE(connection->responseStatusCode(), 200);
+	QCOMPARE(connection->responseContentLength(), qint64(16));
+
+	// Keep-alive is negotiated for each request.
+	cleanup(); init();
+	clientWrite("GET / HTTP/1.1\r\n");
+	clientWrite("\r\n"); clientFlush();
+	connection->writePreparedResponse(response);
+	QCOMPARE(clientReadAll(), QByteArray("HTTP/1.1 200 OK\r\nSome-Header: Some Value\r\nContent-Length: 16\r\nContent-Type: text/plain\r\n\r\nresponse content"));
+	QCOMPARE(connection->state(), HttpConnection::ReceivingHeaders);
+
+	clientWrite("HEAD / HTTP/1.1\r\n");
+	clientWrite("Connection: close\r\n");
+	clientWrite("\r\n"); clientFlush();
+	QCOMPARE(connection->state(), HttpConnection::SendingHeaders);
+	connection->writePreparedResponse(response);
+	QCOMPARE(clientReadAll(), QByteArray("HTTP/1.1 200 OK\r\nSome-Header: Some Value\r\nContent-Length: 16\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"));
+	QCOMPARE(completedSpy->size(), 2);
+
+	// A "Connection: close" header in the prepared response closes every connection.
+	cleanup(); init();
+	const HttpPreparedResponse closingResponse(204, HttpHeaderCollection() << HttpHeader("Connection", "close"));
+	QVERIFY(closingResponse.closesConnection());
+	clientWrite("GET / HTTP/1.1\r\n");
+	clientWrite("\r\n"); clientFlush();
+	connection->writePreparedResponse(closingResponse);
+	QCOMPARE(clientReadAll(), QByteArray("HTTP/1.1 204 No Content\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	QCOMPARE(completedSpy->size(), 1);
+}
+
+void HttpConnectionTest::testRecordsRequestTimestamps()
+{
+	QCOMPARE(connection->timestamp(HttpConnection::FirstByteReceived), qint64(0));
+
+	clientWrite("POST / HTTP/1.1\r\n");
+	clientWrite("Content-Length: 4\r\n");
+	clientWrite("\r\n"); clientFlush();
+	QCOMPARE(connection->state(), HttpConnection::ReceivingContent);
+	const qint64 firstByteReceived = connection->timestamp(HttpConnection::FirstByteReceived);
+	QVERIFY(firstByteReceived > 0);
+	QVERIFY(connection->timestamp(HttpConnection::HeadersReceived) >= firstByteReceived);
+	QCOMPARE(connection->timestamp(HttpConnection::ContentReceived), qint64(0));
+
+	clientWrite("data"); clientFlush();
+	QCOMPARE(connection->state(), HttpConnection::SendingHeaders);
+	QVERIFY(connection->timestamp(HttpConnection::ContentReceived) >= connection->timestamp(HttpConnection::HeadersReceived));
+	QVERIFY(connection->timestamp(HttpConnection::ContentReceived) <= HttpConnection::now());
+
+	connection->setServerTimingEnabled(true);
+	connection->writeResponse(200, HttpHeaderCollection(), "done");
+	const QByteArray response = clientReadAll();
+	QVERIFY(response.contains("\r\nServer-Timing: headers;dur="));
+	QVERIFY(response.contains(", content;dur="));
+	QVERIFY(response.contains(", handler;dur="));
+	QVERIFY(connection->timestamp(HttpConnection::HeadersWritten) >= connection->timestamp(HttpConnection::ContentReceived));
+	QVERIFY(connection->timestamp(HttpConnection::LastByteWritten) >= connection->timestamp(HttpConnection::HeadersWritten));
+	QVERIFY(waitFor([&]{ return connection->timestamp(HttpConnection::OutputFlushed) > 0; }));
+
+	// They remain until the next request starts arriving.
+	QCOMPARE(connection->state(), HttpConnection::ReceivingHeaders);
+	QCOMPARE(connection->timestamp(HttpConnection::FirstByteReceived), firstByteReceived);
+	clientWrite("GET / HTTP/1.1\r\n");
+	clientWrite("\r\n"); clientFlush();
+	QVERIFY(connection->timestamp(HttpConnection::FirstByteReceived) > firstByteReceived);
+	QCOMPARE(connection->timestamp(HttpConnection::LastByteWritten), qint64(0));
+	QCOMPARE(connection->timestamp(HttpConnection::OutputFlushed), qint64(0));
+	connection->writeResponse(200);
+	QVERIFY(clientReadAll().contains("\r\nServer-Timing: "));
+}
+
+void HttpConnectionTest::testWriteBufferWatermarks()
+{
+	QCOMPARE(connection->writeBufferLowWatermark(), qint64(HttpConnection::DefaultWriteBufferLowWatermark));
+	QCOMPARE(connection->writeBufferHighWatermark(), qint64(HttpConnection::DefaultWriteBufferHighWatermark));
+	connection->setWriteBufferWatermarks(16 * 1024, 64 * 1024);
+	QSignalSpy fullSpy(connection, SIGNAL(writeBufferFull(Pillow::HttpConnection*)));
+	QSignalSpy drainedSpy(connection, SIGNAL(writeBufferDrained(Pillow::HttpConnection*)));
+
+	clientWrite("GET / HTTP/1.1\r\n");
+	clientWrite("\r\n"); clientFlush();
+
+	const QByteArray chunk(32 * 1024, '-');
+	const int chunkCount = 16;
+	connection->writeHeaders(200, HttpHeaderCollection() << HttpHeader("Content-Length", QByteArray::number(chunkCount * chunk.size())));
+	QVERIFY(connection->canWrite());
+
+	// Write as a well behaved producer would, until told to stop.
+	int chunksWritten = 0;
+	while (connection->canWrite() && chunksWritten < chunkCount) { connection->writeContent(chunk); ++chunksWritten; }
+	QVERIFY(chunksWritten < chunkCount);
+	QVERIFY(!connection->canWrite());
+	QCOMPARE(fullSpy.size(), 1);
+	QVERIFY(connection->writeBufferSize() >= 64 * 1024);
+	QVERIFY(drainedSpy.isEmpty());
+
+	QByteArray receivedData;
+	while (drainedSpy.isEmpty()) receivedData.append(clientReadAll());
+	QVERIFY(connection->canWrite());
+	QVERIFY(connection->writeBufferSize() <= 16 * 1024);
+
+	while (chunksWritten < chunkCount) { connection->writeContent(chunk); ++chunksWritten; }
+	while (receivedData.size() < chunkCount * chunk.size()) receivedData.append(clientReadAll());
+	QCOMPARE(completedSpy->size(), 1);
+	QVERIFY(receivedData.endsWith(chunk));
+
+	// Invalid watermarks are ignored.
+	connection->setWriteBufferWatermarks(64 * 1024, 16 * 1024);
+	QCOMPARE(connection->writeBufferLowWatermark(), qint64(16 * 1024));
+}
+
 void HttpConnectionTest::testReadsRequestParams()
 {
 	QVERIFY(connection->requestParams().isEmpty());
@@ -773,6 +898,9 @@ void HttpConnectionTest::testReadsRequestParams()
 	QCOMPARE(connection->requestParamValue("composite[property]"), QString("another+value"));
 	QCOMPARE(connection->requestParamValue("composITe[propERtY]"), QString("another+value"));
 	QCOMPARE(connection->requestParamValue("final"), QString("true"));
+	QCOMPARE(connection->requestParamValueBytes("second"), QByteArray("other value"));
+	QCOMPARE(connection->requestParamValueBytes("FIRST"), QByteArray("value"));
+	QVERIFY(connection->requestParamValueBytes("missing").isNull());
 
 	Pillow::HttpParamCollection params = connection->requestParams();
 	QCOMPARE(params.size(),  6);
@@ -829,6 +957,24 @@ void HttpConnectionTest::testReadsRequestParams()
 	QCOMPARE(connection->requestParams().size(), 1);
 	QCOMPARE(connection->requestParamValue(""), QString("valueonly"));
 
+	// Lookups before all the params are decoded, with encoded names and values.
+	connection->writeResponse(200);
+	QVERIFY(clientReadAll().startsWith("HTTP/1.1 200"));
+	QCOMPARE(connection->state(), HttpConnection::ReceivingHeaders);
+	clientWrite("GET /lazy?na%6De=x%20y&plain=abc&broken=100%&_method=DELETE HTTP/1.1\r\n");
+	clientWrite("\r\n"); clientFlush();
+	QCOMPARE(connection->requestParamValue("NAME"), QString("x y"));
+	QCOMPARE(connection->requestParamValueBytes("name"), QByteArray("x y"));
+	QCOMPARE(connection->requestParamValueBytes("plain"), QByteArray("abc"));
+	QCOMPARE(connection->requestParamValueBytes("broken"), QByteArray("100%"));
+	QCOMPARE(connection->requestParamValueBytes("_method"), QByteArray("DELETE"));
+	connection->setRequestParam("plain", "overridden");
+	QCOMPARE(connection->requestParamValue("plain"), QString("overridden"));
+	QCOMPARE(connection->requestParamValueBytes("plain"), QByteArray("overridden"));
+	QCOMPARE(connection->requestParams().size(), 4);
+	QCOMPARE(connection->requestParams().at(0).first, QString("name"));
+	QCOMPARE(connection->requestParams().at(1).second, QString("overridden"));
+	QCOMPARE(connection->requestParamValue("_method"), QString("DELETE"));
 }
 
 void HttpConnectionTest::testReuseRequest()
@@ -55,7 +55,10 @@ protected slots: // Test methods.
 	void testWriteChunkedResponseContent();
 	void testWriteResponseWithoutRequest();
 	void testMultipacketResponse();
+	void testWritePreparedResponse();
+	void testWriteBufferWatermarks();
 	void testReadsRequestParams();
+	void testRecordsRequestTimestamps();
 	void testReuseRequest();
 
 	void benchmarkSimpleGetClose();
@@ -108,7 +111,10 @@ private slots: // Test methods.
 	void testWriteChunkedResponseContent() { HttpConnectionTest::testWriteChunkedResponseContent(); }
 	void testWriteResponseWithoutRequest() { HttpConnectionTest::testWriteResponseWithoutRequest(); }
 	void testMultipacketResponse() { HttpConnectionTest::testMultipacketResponse(); }
+	void testWritePreparedResponse() { HttpConnectionTest::testWritePreparedResponse(); }
+	void testWriteBufferWatermarks() { HttpConnectionTest::testWriteBufferWatermarks(); }
 	void testReadsRequestParams() { HttpConnectionTest::testReadsRequestParams(); }
+	void testRecordsRequestTimestamps() { HttpConnectionTest::testRecordsRequestTimestamps(); }
 	void testReuseRequest() { HttpConnectionTest::testReuseRequest(); }
 
 	void benchmarkSimpleGetClose() { HttpConnectionTest::benchmarkSimpleGetClose(); }
@@ -166,7 +172,10 @@ private slots: // Test methods.
 	void testWriteIncrementalResponseContent() { HttpConnectionTest::testWriteIncrementalResponseContent(); }
 	void testWriteResponseWithoutRequest() { HttpConnectionTest::testWriteResponseWithoutRequest(); }
 	void testMultipacketResponse() { HttpConnectionTest::testMultipacketResponse(); }
+	void testWritePreparedResponse() { HttpConnectionTest::testWritePreparedResponse(); }
+	void testWriteBufferWatermarks() { HttpConnectionTest::testWriteBufferWatermarks(); }
 	void testReadsRequestParams() { HttpConnectionTest::testReadsRequestParams(); }
+	void testRecordsRequestTimestamps() { HttpConnectionTest::testRecordsRequestTimestamps(); }
 
 	void benchmarkSimpleGetClose() { HttpConnectionTest::benchmarkSimpleGetClose(); }
 	void benchmarkSimpleGetKeepAlive() { HttpConnectionTest::benchmarkSimpleGetKeepAlive(); }
@@ -226,7 +235,10 @@ private slots: // Test methods.
 	void testWriteIncrementalResponseContent() { HttpConnectionTest::testWriteIncrementalResponseContent(); }
 	void testWriteResponseWithoutRequest() { HttpConnectionTest::testWriteResponseWithoutRequest(); }
 	void testMultipacketResponse() { HttpConnectionTest::testMultipacketResponse(); }
+	void testWritePreparedResponse() { HttpConnectionTest::testWritePreparedResponse(); }
+	void testWriteBufferWatermarks() { HttpConnectionTest::testWriteBufferWatermarks(); }
 	void testReadsRequestParams() { HttpConnectionTest::testReadsRequestParams(); }
+	void testRecordsRequestTimestamps() { HttpConnectionTest::testRecordsRequestTimestamps(); }
 
 	void benchmarkSimpleGetClose() { HttpConnectionTest::benchmarkSimpleGetClose(); }
 	void benchmarkSimpleGetKeepAlive() { HttpConnectionTest::benchmarkSimpleGetKeepAlive(); }
@@ -274,7 +286,9 @@ private slots: // Test methods.
 	void testWriteIncrementalResponseContent() { HttpConnectionTest::testWriteIncrementalResponseContent(); }
 	void testWriteResponseWithoutRequest() { HttpConnectionTest::testWriteResponseWithoutRequest(); }
 	void testMultipacketResponse() { HttpConnectionTest::testMultipacketResponse(); }
+	void testWritePreparedResponse() { HttpConnectionTest::testWritePreparedResponse(); }
 	void testReadsRequestParams() { HttpConnectionTest::testReadsRequestParams(); }
+	void testRecordsRequestTimestamps() { HttpConnectionTest::testRecordsRequestTimestamps(); }
 
 	void benchmarkSimpleGetClose() { HttpConnectionTest::benchmarkSimpleGetClose(); }
 	void benchmarkSimpleGetKeepAlive() { HttpConnectionTest::benchmarkSimpleGetKeepAlive(); }
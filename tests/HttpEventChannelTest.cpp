@@ -0,0 +1,131 @@
+#include <QtTest/QTest>
+#include "Helpers.h"
+#include <HttpServer.h>
+#include <HttpEventChannel.h>
+
+class EventChannelServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	Pillow::HttpEventChannel channel;
+	QList<Pillow::HttpConnection*> droppedConnections;
+
+	EventChannelServer() : Pillow::HttpServer(QHostAddress::LocalHost, 0)
+	{
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+		connect(&channel, SIGNAL(subscriberDropped(Pillow::HttpConnection*)), this, SLOT(channel_subscriberDropped(Pillow::HttpConnection*)));
+	}
+
+private slots:
+	void self_requestReady(Pillow::HttpConnection* connection) { channel.subscribe(connection); }
+	void channel_subscriberDropped(Pillow::HttpConnection* connection) { droppedConnections << connection; }
+};
+
+class HttpEventChannelTest : public QObject
+{
+	Q_OBJECT
+
+	bool subscribe(EventChannelServer& server, QTcpSocket& socket, const QByteArray& httpVersion = "HTTP/1.1")
+	{
+		const int subscriberCount = server.channel.subscriberCount();
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		if (!socket.waitForConnected(1000)) return false;
+		socket.write("GET /events " + httpVersion + "\r\n\r\n");
+		if (!waitFor([&]{ return server.channel.subscriberCount() > subscriberCount && socket.bytesAvailable() > 0; })) return false;
+		return socket.readAll().contains("\r\nContent-Type: text/event-stream\r\n");
+	}
+
+private slots:
+	void should_encode_events()
+	{
+		QCOMPARE(Pillow::HttpEventChannel::encodeEvent("hello"), QByteArray("d\r\ndata: hello\n\n\r\n"));
+		QCOMPARE(Pillow::HttpEventChannel::encodeEvent("a\nb\r\nc\rd\n", "update", "42"),
+				 QByteArray("3d\r\nevent: update\nid: 42\ndata: a\ndata: b\ndata: c\ndata: d\ndata: \n\n\r\n"));
+		QCOMPARE(Pillow::HttpEventChannel::encodeEvent("x", "bad\nevent"), QByteArray("14\r\nevent: bad\ndata: x\n\n\r\n"));
+	}
+
+	void should_send_events_to_all_subscribers()
+	{
+		EventChannelServer server;
+		QTcpSocket socket1, socket2, socket10;
+		QVERIFY(subscribe(server, socket1));
+		QVERIFY(subscribe(server, socket2));
+		QVERIFY(subscribe(server, socket10, "HTTP/1.0"));
+		QCOMPARE(server.channel.subscriberCount(), 3);
+
+		server.channel.send("hello", "greeting");
+		server.channel.sendComment("ping");
+		QByteArray expected = Pillow::HttpEventChannel::encodeEvent("hello", "greeting") + "7\r\n: ping\n\r\n";
+		QVERIFY(waitFor([&]{ return socket1.bytesAvailable() >= expected.size() && socket2.bytesAvailable() >= expected.size(); }));
+		QCOMPARE(socket1.readAll(), expected);
+		QCOMPARE(socket2.readAll(), expected);
+
+		// Http/1.0 clients do not get the chunk framing.
+		QVERIFY(waitFor([&]{ return socket10.bytesAvailable() >= 36; }));
+		QCOMPARE(socket10.readAll(), QByteArray("event: greeting\ndata: hello\n\n: ping\n"));
+	}
+
+	void should_forget_closed_subscribers()
+	{
+		EventChannelServer server;
+		QTcpSocket socket1, socket2, socket3;
+		QVERIFY(subscribe(server, socket1));
+		QVERIFY(subscribe(server, socket2));
+		QVERIFY(subscribe(server, socket3));
+
+		socket1.disconnectFromHost();
+		QVERIFY(waitFor([&]{ return server.channel.subscriberCount() == 2; }));
+
+		server.channel.send("still there");
+		QVERIFY(waitFor([&]{ return socket2.bytesAvailable() > 0 && socket3.bytesAvailable() > 0; }));
+		QCOMPARE(socket3.readAll(), Pillow::HttpEventChannel::encodeEvent("still there"));
+
+		server.channel.unsubscribeAll();
+		QCOMPARE(server.channel.subscriberCount(), 0);
+		QByteArray received;
+		QVERIFY(waitFor([&]{ received += socket2.readAll(); return received.endsWith("0\r\n\r\n"); }));
+	}
+
+	void should_drop_slow_subscribers()
+	{
+		EventChannelServer server;
+		QTcpSocket socket1, socket2;
+		QVERIFY(subscribe(server, socket1));
+		QVERIFY(subscribe(server, socket2));
+
+		// Nothing leaves the output buffers until the event loop runs: the second event finds both backlogs non empty.
+		server.channel.setMaximumBacklog(0);
+		server.channel.send("first");
+		server.channel.send("second");
+		QCOMPARE(server.channel.droppedSubscriberCount(), qint64(2));
+		QCOMPARE(server.droppedConnections.size(), 2);
+		QCOMPARE(server.channel.subscriberCount(), 0);
+		QVERIFY(waitFor([&]{ return socket1.state() == QAbstractSocket::UnconnectedState; }));
+	}
+
+	void should_skip_events_for_slow_subscribers()
+	{
+		EventChannelServer server;
+		QTcpSocket socket;
+		QVERIFY(subscribe(server, socket));
+
+		server.channel.setSlowSubscriberPolicy(Pillow::HttpEventChannel::SkipSlowSubscribers);
+		server.channel.setMaximumBacklog(0);
+		server.channel.send("first");
+		server.channel.send("skipped");
+		QCOMPARE(server.channel.skippedEventCount(), qint64(1));
+		QCOMPARE(server.channel.subscriberCount(), 1);
+
+		QByteArray expected = Pillow::HttpEventChannel::encodeEvent("first");
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() >= expected.size(); }));
+		QCOMPARE(socket.readAll(), expected);
+
+		server.channel.send("third");
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() > 0; }));
+		QCOMPARE(socket.readAll(), Pillow::HttpEventChannel::encodeEvent("third"));
+	}
+};
+PILLOW_TEST_DECLARE(HttpEventChannelTest)
+
+#include "HttpEventChannelTest.moc"
@@ -0,0 +1,112 @@
+#include <QtTest/QTest>
+#include "Helpers.h"
+#include "HttpHandlerTest.h"
+#include <HttpHandlerFlightRecorder.h>
+
+class HttpHandlerFlightRecorderTest : public HttpHandlerTestBase
+{
+	Q_OBJECT
+
+	// Answers requests for paths starting with /slow only after the given milliseconds.
+	void addResponder(Pillow::HttpHandlerFlightRecorder* recorder)
+	{
+		Pillow::HttpHandlerStack* declining = new Pillow::HttpHandlerStack(recorder);
+		declining->setObjectName("declining");
+		Pillow::HttpHandlerFunction* responder = new Pillow::HttpHandlerFunction([](Pillow::HttpConnection* request)
+		{
+			if (request->requestPath().startsWith("/slow")) QTest::qSleep(request->requestPath().mid(5).toInt());
+			request->writeResponse(200, Pillow::HttpHeaderCollection(), "done");
+		}, recorder);
+		responder->setObjectName("responder");
+	}
+
+private slots:
+	void should_only_record_requests_over_the_threshold()
+	{
+		Pillow::HttpHandlerFlightRecorder recorder;
+		recorder.setThreshold(20);
+		addResponder(&recorder);
+		QSignalSpy spy(&recorder, SIGNAL(requestRecorded(Pillow::HttpFlightRecord)));
+
+		QVERIFY(recorder.handleRequest(createGetRequest("/fast")));
+		QVERIFY(response.endsWith("done"));
+		QVERIFY(recorder.records().isEmpty());
+		QCOMPARE(spy.size(), 0);
+
+		QVERIFY(recorder.handleRequest(createRequest("GET", "/slow30?q=1", QByteArray(), "1.0", Pillow::HttpHeaderCollection() << Pillow::HttpHeader("Host", "pillow"))));
+		QCOMPARE(spy.size(), 1);
+		QList<Pillow::HttpFlightRecord> records = recorder.records();
+		QCOMPARE(records.size(), 1);
+		const Pillow::HttpFlightRecord& record = records.first();
+		QCOMPARE(record.method, QByteArray("GET"));
+		QCOMPARE(record.uri, QByteArray("/slow30?q=1"));
+		QCOMPARE(record.statusCode, 200);
+		QCOMPARE(record.requestHeaderCount, 1);
+		QCOMPARE(record.requestHeaderBytes, int(sizeof("Host: pillow\r\n") - 1));
+		QCOMPARE(record.responseContentBytes, qint64(4));
+		QVERIFY(record.duration() >= 30000);
+		QVERIFY(record.timestamps[Pillow::HttpConnection::HeadersWritten] - record.timestamps[Pillow::HttpConnection::ContentReceived] >= 30000);
+		QCOMPARE(record.handlers, QStringList() << "declining" << "responder");
+	}
+
+	void should_keep_the_slowest_requests()
+	{
+		Pillow::HttpHandlerFlightRecorder recorder;
+		recorder.setThreshold(5);
+		recorder.setCapacity(2);
+		addResponder(&recorder);
+
+		recorder.handleRequest(createGetRequest("/slow20"));
+		recorder.handleRequest(createGetRequest("/slow10"));
+		recorder.handleRequest(createGetRequest("/slow30"));
+		recorder.handleRequest(createGetRequest("/slow5"));
+
+		QList<Pillow::HttpFlightRecord> records = recorder.records();
+		QCOMPARE(records.size(), 2);
+		QCOMPARE(records.at(0).uri, QByteArray("/slow30"));
+		QCOMPARE(records.at(1).uri, QByteArray("/slow20"));
+
+		recorder.setCapacity(1);
+		QCOMPARE(recorder.records().size(), 1);
+		QCOMPARE(recorder.records().first().uri, QByteArray("/slow30"));
+	}
+
+	void should_forget_requests_out_of_the_window()
+	{
+		Pillow::HttpHandlerFlightRecorder recorder;
+		recorder.setThreshold(5);
+		recorder.setWindow(50);
+		addResponder(&recorder);
+
+		recorder.handleRequest(createGetRequest("/slow30"));
+		QCOMPARE(recorder.records().size(), 1);
+		QTest::qWait(60);
+		QVERIFY(recorder.records().isEmpty());
+
+		recorder.handleRequest(createGetRequest("/slow10"));
+		QCOMPARE(recorder.records().size(), 1);
+		QCOMPARE(recorder.records().first().uri, QByteArray("/slow10"));
+	}
+
+	void should_dump_the_records_on_its_path()
+	{
+		Pillow::HttpHandlerFlightRecorder recorder;
+		recorder.setThreshold(5);
+		recorder.setDumpPath("/_flight");
+		addResponder(&recorder);
+
+		recorder.handleRequest(createGetRequest("/slow10"));
+		QVERIFY(recorder.handleRequest(createGetRequest("/_flight")));
+		QVERIFY(response.startsWith("HTTP/1.0 200 OK"));
+		QVERIFY(response.contains("GET /slow10 200 headers="));
+		QVERIFY(response.contains(" handlers=declining,responder\n"));
+		QCOMPARE(response.mid(response.indexOf("\r\n\r\n") + 4).count('\n'), 1); // One line per record.
+		QVERIFY(recorder.dump().endsWith("handlers=declining,responder\n"));
+
+		// The dump request itself is not recorded, however long it takes.
+		QCOMPARE(recorder.records().size(), 1);
+	}
+};
+PILLOW_TEST_DECLARE(HttpHandlerFlightRecorderTest)
+
+#include "HttpHandlerFlightRecorderTest.moc"
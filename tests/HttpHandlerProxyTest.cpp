@@ -1,10 +1,17 @@
 #include "HttpHandlerProxyTest.h"
 #include <HttpConnection.h>
 #include <HttpHandlerProxy.h>
+#include <HttpClient.h>
+#include <HttpUpstreamGroup.h>
+#include <HttpResponseCache.h>
 #include <HttpServer.h>
 #include <HttpHandlerSimpleRouter.h>
 #include <QtTest/QTest>
 #include <QtTest/QSignalSpy>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QTcpServer>
+#include <QtCore/QElapsedTimer>
+#include "Helpers.h"
 
 class ClosingHandler : public Pillow::HttpHandler
 {
@@ -71,6 +78,17 @@ public:
 	}
 };
 
+static const int largeContentSize = 16 * 1024 * 1024; // More than the kernel buffers of a local connection can hold.
+
+class LargeContentHandler : public Pillow::HttpHandler
+{
+	virtual bool handleRequest(Pillow::HttpConnection *connection)
+	{
+		connection->writeResponse(200, Pillow::HttpHeaderCollection(), QByteArray(largeContentSize, 'x'));
+		return true;
+	}
+};
+
 class HoldingHandler : public Pillow::HttpHandler
 {
 public:
@@ -83,6 +101,38 @@ public:
 	}
 };
 
+class HopByHopHandler : public Pillow::HttpHandler
+{
+	virtual bool handleRequest(Pillow::HttpConnection *connection)
+	{
+		// Written by hand: HttpConnection itself would not send the Connection header as is.
+		connection->outputDevice()->write("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: X-Hop\r\nX-Hop: upstream only\r\n"
+										  "Keep-Alive: timeout=5\r\nX-End: kept\r\n\r\n4\r\nhop \r\n6\r\nby hop\r\n0\r\n\r\n");
+		connection->close();
+		return true;
+	}
+};
+
+class CacheableHandler : public Pillow::HttpHandler
+{
+public:
+	int requestCount;
+	Pillow::HttpHeaderCollection responseHeaders;
+
+	CacheableHandler() : requestCount(0) {}
+
+	virtual bool handleRequest(Pillow::HttpConnection *connection)
+	{
+		++requestCount;
+		const QByteArray etag = responseHeaders.getFieldValue("ETag");
+		if (!etag.isEmpty() && connection->requestHeaderValue("If-None-Match") == etag)
+			connection->writeResponse(304, responseHeaders);
+		else
+			connection->writeResponse(200, responseHeaders, "cacheable content " + QByteArray::number(requestCount));
+		return true;
+	}
+};
+
 HttpHandlerProxyTest::HttpHandlerProxyTest() :
 	HttpHandlerTestBase(), router(NULL)
 {
@@ -105,6 +155,9 @@ void HttpHandlerProxyTest::init()
 	router->addRoute("GET", "/bad_length", new ContentLengthMismatchedHandler());
 	router->addRoute("", "/capturing", capturingHandler = new CapturingHandler());
 	router->addRoute("GET", "/holding", holdingHandler = new HoldingHandler());
+	router->addRoute("GET", "/large", new LargeContentHandler());
+	router->addRoute("", "/cacheable", cacheableHandler = new CacheableHandler());
+	router->addRoute("GET", "/hop_by_hop", new HopByHopHandler());
 
 	connect(server, SIGNAL(requestReady(Pillow::HttpConnection*)), router, SLOT(handleRequest(Pillow::HttpConnection*)));
 }
@@ -363,3 +416,508 @@ void HttpHandlerProxyTest::testCustomProxyPipe()
 	QVERIFY(capturingHandler->requestUri == "/capturing");
 	QVERIFY(capturingHandler->requestContent.isEmpty());
 }
+
+// Gets the large response through a server with proxyHandler, with a client that does not read it for a while. Returns the
+// largest write buffer of the proxy server connection meanwhile, and the size of the content the client eventually got.
+qint64 getLargeResponseWithSlowReader(Pillow::HttpHandler* proxyHandler, int* contentSize)
+{
+	Pillow::HttpServer proxyServer(QHostAddress::LocalHost, 0);
+	QObject::connect(&proxyServer, SIGNAL(requestReady(Pillow::HttpConnection*)), proxyHandler, SLOT(handleRequest(Pillow::HttpConnection*)));
+
+	QTcpSocket socket;
+	socket.setReadBufferSize(16 * 1024);
+	socket.connectToHost(QHostAddress::LocalHost, proxyServer.serverPort());
+	socket.write("GET /large HTTP/1.0\r\n\r\n");
+
+	qint64 maximumWriteBufferSize = 0;
+	QElapsedTimer t; t.start();
+	while (!t.hasExpired(1000))
+	{
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+		foreach (Pillow::HttpConnection* connection, proxyServer.findChildren<Pillow::HttpConnection*>())
+			maximumWriteBufferSize = qMax(maximumWriteBufferSize, connection->writeBufferSize());
+	}
+
+	QByteArray response;
+	waitFor([&]{ response.append(socket.readAll()); return socket.state() == QAbstractSocket::UnconnectedState; }, 10000);
+	response.append(socket.readAll());
+	*contentSize = response.size() - (response.indexOf("\r\n\r\n") + 4);
+	return maximumWriteBufferSize;
+}
+
+class StreamCheckingHandler : public Pillow::HttpHandler
+{
+public:
+	int streamedCount;
+
+	StreamCheckingHandler() : streamedCount(0) {}
+
+	virtual bool handleRequest(Pillow::HttpConnection *connection)
+	{
+		if (connection->isRequestContentStreamed()) ++streamedCount;
+		return false;
+	}
+};
+
+// Posts content to the capturing handler through a server where proxyHandler gets the requests as soon as their headers arrive.
+QByteArray postThroughStreamingProxyServer(Pillow::HttpHandler* proxyHandler, const QByteArray& content, bool* streamed)
+{
+	Pillow::HttpServer proxyServer(QHostAddress::LocalHost, 0);
+	StreamCheckingHandler checkingHandler;
+	QObject::connect(&proxyServer, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)), proxyHandler, SLOT(handleRequestHeaders(Pillow::HttpConnection*)));
+	QObject::connect(&proxyServer, SIGNAL(requestReady(Pillow::HttpConnection*)), &checkingHandler, SLOT(handleRequest(Pillow::HttpConnection*)));
+	QObject::connect(&proxyServer, SIGNAL(requestReady(Pillow::HttpConnection*)), proxyHandler, SLOT(handleRequest(Pillow::HttpConnection*)));
+
+	QTcpSocket socket;
+	socket.connectToHost(QHostAddress::LocalHost, proxyServer.serverPort());
+	socket.write("POST /capturing HTTP/1.0\r\nContent-Length: " + QByteArray::number(content.size()) + "\r\n\r\n");
+	socket.write(content);
+
+	QByteArray response;
+	waitFor([&]{ response.append(socket.readAll()); return socket.state() == QAbstractSocket::UnconnectedState; }, 5000);
+	response.append(socket.readAll());
+	*streamed = checkingHandler.streamedCount == 1;
+	return response;
+}
+
+QByteArray createLargeContent(int size)
+{
+	QByteArray content; content.reserve(size);
+	for (int i = 0; content.size() < size; ++i)
+		content.append(QByteArray::number(i)).append(' ');
+	content.resize(size);
+	return content;
+}
+
+void HttpHandlerProxyTest::testStreamsRequestContent()
+{
+	Pillow::HttpHandlerProxy handler(serverUrl());
+	const QByteArray content = createLargeContent(4 * 1024 * 1024);
+
+	bool streamed = false;
+	QByteArray proxiedResponse = postThroughStreamingProxyServer(&handler, content, &streamed);
+	QVERIFY(proxiedResponse.startsWith("HTTP/1.0 200"));
+	QVERIFY(proxiedResponse.endsWith("\r\n\r\nPOST captured!"));
+	QVERIFY(streamed); // The proxy server never buffered the content.
+	QCOMPARE(capturingHandler->requestContent.size(), content.size());
+	QVERIFY(capturingHandler->requestContent == content);
+}
+
+void HttpHandlerProxyTest::testKeepsWriteBufferBoundedForSlowReaders()
+{
+	Pillow::HttpHandlerProxy handler(serverUrl());
+
+	int contentSize = 0;
+	const qint64 maximumWriteBufferSize = getLargeResponseWithSlowReader(&handler, &contentSize);
+	QVERIFY(maximumWriteBufferSize > 0);
+	// The reply may hold one more network chunk than its read buffer size.
+	QVERIFY(maximumWriteBufferSize <= Pillow::HttpConnection::DefaultWriteBufferHighWatermark + 2 * Pillow::HttpHandlerProxy::ProxiedReplyReadBufferSize);
+	QCOMPARE(contentSize, largeContentSize); // Nothing got lost on the way.
+}
+
+void HttpHandlerProxyTest::testClientProxySuccessfulResponse()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	Pillow::HttpConnection* request = createGetRequest("/capturing?key1=value1&key2=value2%20with%20escaped#and_fragment", "1.1");
+
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request)); // The response should complete successfully.
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QVERIFY(response.endsWith("\r\n\r\nGET captured!"));
+	QVERIFY(capturingHandler->requestMethod == "GET");
+	QVERIFY(capturingHandler->requestUri == "/capturing?key1=value1&key2=value2%20with%20escaped");
+	QVERIFY(capturingHandler->requestContent.isEmpty());
+	QCOMPARE(capturingHandler->requestHeaders.getFieldValues("Host").size(), 1);
+}
+
+void HttpHandlerProxyTest::testClientProxyPrematureClosingResponse()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	Pillow::HttpConnection* request = createGetRequest("/premature_closing");
+
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request)); // The response should still complete sucessfully
+	QVERIFY(response.startsWith("HTTP/1.0 503")); // Service unavailable.
+}
+
+void HttpHandlerProxyTest::testClientProxyInvalidResponse()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	Pillow::HttpConnection* request = createGetRequest("/invalid");
+
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request)); // The response should still complete sucessfully
+	QVERIFY(response.startsWith("HTTP/1.0 503")); // Service unavailable.
+}
+
+void HttpHandlerProxyTest::testClientProxyNonGetRequest()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	Pillow::HttpConnection* request;
+
+	request = createPostRequest("/capturing?key1=value1", "some data");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request)); // The response should complete successfully.
+	QVERIFY(response.startsWith("HTTP/1.0 200"));
+	QVERIFY(response.endsWith("\r\n\r\nPOST captured!"));
+	QVERIFY(capturingHandler->requestMethod == "POST");
+	QVERIFY(capturingHandler->requestUri == "/capturing?key1=value1");
+	QVERIFY(capturingHandler->requestContent == "some data");
+	QCOMPARE(capturingHandler->requestHeaders.getFieldValue("Content-Type"), QByteArray("text/plain"));
+
+	request = createRequest("TEAPOT", "/capturing?key1=value1", QByteArray(), "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request)); // The response should complete successfully.
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QVERIFY(response.endsWith("\r\n\r\nTEAPOT captured!"));
+	QVERIFY(capturingHandler->requestMethod == "TEAPOT");
+	QVERIFY(capturingHandler->requestContent.isEmpty());
+}
+
+QUrl createClientProxyServer(const QUrl& proxiedUrl)
+{
+	Pillow::HttpServer* server = new Pillow::HttpServer(QHostAddress::LocalHost, 0);
+	Pillow::HttpHandlerClientProxy* proxyHandler = new Pillow::HttpHandlerClientProxy(proxiedUrl);
+	QObject::connect(server, SIGNAL(requestReady(Pillow::HttpConnection*)), proxyHandler, SLOT(handleRequest(Pillow::HttpConnection*)));
+	return QString("http://127.0.0.1:%1").arg(server->serverPort());
+}
+
+void HttpHandlerProxyTest::testClientProxyChain()
+{
+	// Request => (Proxy handler) => Server 3 (Proxy 3) => Server 2 (Proxy 2) => Server (Handlers)
+	QUrl outerProxyUrl = createClientProxyServer(createClientProxyServer(serverUrl()));
+
+	Pillow::HttpHandlerClientProxy handler(outerProxyUrl);
+	Pillow::HttpConnection* request;
+
+	request = createGetRequest("/first", "1.0");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.0 200"));
+	QVERIFY(response.endsWith("\r\n\r\nfirst content"));
+
+	request = createGetRequest("/second", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QVERIFY(response.endsWith("\r\n\r\nsecond content"));
+	QVERIFY(request->state() == Pillow::HttpConnection::ReceivingHeaders);
+
+	request = createGetRequest("/explosive", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 500"));
+	QVERIFY(request->state() == Pillow::HttpConnection::ReceivingHeaders);
+
+	request = createGetRequest("/premature_closing", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 503"));
+	QVERIFY(request->state() == Pillow::HttpConnection::ReceivingHeaders);
+}
+
+void HttpHandlerProxyTest::testClientProxyReusesClients()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+
+	for (int i = 0; i < 5; ++i)
+	{
+		Pillow::HttpConnection* request = createGetRequest("/first", "1.1");
+		QVERIFY(handler.handleRequest(request));
+		QVERIFY(waitForResponse(request));
+		QVERIFY(response.endsWith("\r\n\r\nfirst content"));
+	}
+
+	// Sequential requests should all have gone through the same pooled client.
+	QCOMPARE(handler.findChildren<Pillow::HttpClient*>().size(), 1);
+}
+
+void HttpHandlerProxyTest::testClientProxyStreamsRequestContent()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	const QByteArray content = createLargeContent(4 * 1024 * 1024);
+
+	bool streamed = false;
+	QByteArray proxiedResponse = postThroughStreamingProxyServer(&handler, content, &streamed);
+	QVERIFY(proxiedResponse.startsWith("HTTP/1.0 200"));
+	QVERIFY(proxiedResponse.endsWith("\r\n\r\nPOST captured!"));
+	QVERIFY(streamed); // The proxy server never buffered the content.
+	QCOMPARE(capturingHandler->requestContent.size(), content.size());
+	QVERIFY(capturingHandler->requestContent == content);
+	QCOMPARE(capturingHandler->requestHeaders.getFieldValue("Content-Length"), QByteArray::number(content.size()));
+
+	// A request without content goes the usual way.
+	Pillow::HttpConnection* request = createGetRequest("/first", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.endsWith("\r\n\r\nfirst content"));
+}
+
+void HttpHandlerProxyTest::testClientProxyStripsHopByHopHeaders()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+	Pillow::HttpConnection* request = createRequest("GET", "/capturing", QByteArray(), "1.1", Pillow::HttpHeaderCollection()
+													<< Pillow::HttpHeader("Connection", "keep-alive, X-Private") << Pillow::HttpHeader("X-Private", "client only")
+													<< Pillow::HttpHeader("Keep-Alive", "timeout=5") << Pillow::HttpHeader("Proxy-Connection", "keep-alive")
+													<< Pillow::HttpHeader("TE", "trailers") << Pillow::HttpHeader("Upgrade", "example/1") << Pillow::HttpHeader("X-End", "kept"));
+
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QCOMPARE(capturingHandler->requestHeaders.getFieldValue("X-End"), QByteArray("kept"));
+	QVERIFY(capturingHandler->requestHeaders.getFieldValue("X-Private").isEmpty());
+	QVERIFY(capturingHandler->requestHeaders.getFieldValue("Keep-Alive").isEmpty());
+	QVERIFY(capturingHandler->requestHeaders.getFieldValue("Proxy-Connection").isEmpty());
+	QVERIFY(capturingHandler->requestHeaders.getFieldValue("TE").isEmpty());
+	QVERIFY(capturingHandler->requestHeaders.getFieldValue("Upgrade").isEmpty());
+
+	// The proxied server's hop-by-hop headers stay there too, and the content gets chunked once, by the proxy.
+	request = createGetRequest("/hop_by_hop", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QVERIFY(response.contains("\r\nX-End: kept\r\n"));
+	QVERIFY(!response.contains("X-Hop"));
+	QVERIFY(!response.contains("Keep-Alive"));
+	QCOMPARE(response.count("Transfer-Encoding"), 1);
+	QVERIFY(response.endsWith("\r\n0\r\n\r\n"));
+	QVERIFY(request->state() == Pillow::HttpConnection::ReceivingHeaders);
+
+	const QByteArray chunks = response.mid(response.indexOf("\r\n\r\n") + 4);
+	QByteArray content;
+	for (int position = 0; position < chunks.size();)
+	{
+		const int lineEnd = chunks.indexOf("\r\n", position);
+		bool ok = false;
+		const int size = chunks.mid(position, lineEnd - position).toInt(&ok, 16);
+		QVERIFY(ok);
+		content.append(chunks.mid(lineEnd + 2, size));
+		position = lineEnd + 2 + size + 2;
+	}
+	QCOMPARE(content, QByteArray("hop by hop"));
+}
+
+void HttpHandlerProxyTest::testClientProxyKeepsWriteBufferBoundedForSlowReaders()
+{
+	Pillow::HttpHandlerClientProxy handler(serverUrl());
+
+	int contentSize = 0;
+	const qint64 maximumWriteBufferSize = getLargeResponseWithSlowReader(&handler, &contentSize);
+	QVERIFY(maximumWriteBufferSize > 0);
+	QVERIFY(maximumWriteBufferSize <= Pillow::HttpConnection::DefaultWriteBufferHighWatermark + Pillow::HttpHandlerClientProxy::ClientReadBufferSize);
+	QCOMPARE(contentSize, largeContentSize); // Nothing got lost on the way.
+}
+
+void HttpHandlerProxyTest::testBalancingProxySpreadsRequests()
+{
+	Pillow::HttpHandlerBalancingProxy handler;
+	handler.upstreamGroup()->addUpstream(serverUrl());
+	handler.upstreamGroup()->addUpstream(createClientProxyServer(serverUrl()));
+
+	for (int i = 0; i < 4; ++i)
+	{
+		Pillow::HttpConnection* request = createGetRequest("/first", "1.1");
+		QVERIFY(handler.handleRequest(request));
+		QVERIFY(waitForResponse(request));
+		QVERIFY(response.startsWith("HTTP/1.1 200"));
+		QVERIFY(response.endsWith("\r\n\r\nfirst content"));
+	}
+
+	// Round robin: each upstream got its own client, and each client was reused.
+	QCOMPARE(handler.upstreamGroup()->findChildren<Pillow::HttpClient*>().size(), 2);
+	foreach (const QUrl& url, handler.upstreamGroup()->upstreams())
+		QCOMPARE(handler.upstreamGroup()->upstreamOutstandingRequests(url), 0);
+}
+
+void HttpHandlerProxyTest::testBalancingProxyQueuesRequestsWhenUpstreamsAreBusy()
+{
+	Pillow::HttpHandlerBalancingProxy handler;
+	handler.upstreamGroup()->addUpstream(serverUrl(), 1);
+
+	Pillow::HttpConnection* first = createGetRequest("/first", "1.1");
+	Pillow::HttpConnection* second = createGetRequest("/second", "1.1");
+	QSignalSpy secondCompletedSpy(second, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QVERIFY(handler.handleRequest(first));
+	QVERIFY(handler.handleRequest(second));
+	QCOMPARE(handler.upstreamGroup()->upstreamOutstandingRequests(serverUrl()), 1);
+
+	// The second request only gets sent once the single upstream connection is released by the first.
+	QVERIFY(waitForResponse(first));
+	QVERIFY(waitFor([&]{ return secondCompletedSpy.size() > 0; }));
+	QVERIFY(response.endsWith("\r\n\r\nsecond content"));
+	QCOMPARE(handler.upstreamGroup()->findChildren<Pillow::HttpClient*>().size(), 1);
+}
+
+void HttpHandlerProxyTest::testBalancingProxyWithoutHealthyUpstream()
+{
+	const QUrl deadUrl("http://127.0.0.1:4598");
+	Pillow::HttpHandlerBalancingProxy handler;
+	handler.upstreamGroup()->setMaximumFailures(1);
+	handler.upstreamGroup()->addUpstream(deadUrl);
+	QSignalSpy ejectedSpy(handler.upstreamGroup(), SIGNAL(upstreamEjected(QUrl)));
+
+	// The first request fails to connect, which ejects the only upstream.
+	Pillow::HttpConnection* request = createGetRequest("/first", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitForResponse(request));
+	QVERIFY(response.startsWith("HTTP/1.1 503"));
+	QCOMPARE(ejectedSpy.size(), 1);
+	QVERIFY(!handler.upstreamGroup()->isUpstreamHealthy(deadUrl));
+
+	// The next ones are refused right away.
+	request = createGetRequest("/first", "1.1");
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(response.startsWith("HTTP/1.1 503"));
+	QCOMPARE(handler.upstreamGroup()->upstreamOutstandingRequests(deadUrl), 0);
+}
+
+void HttpHandlerProxyTest::testBalancingProxyBoundsItsQueue()
+{
+	QTcpServer silentServer; // Accepts connections, never answers.
+	QVERIFY(silentServer.listen(QHostAddress::LocalHost, 0));
+	const QUrl silentUrl(QString("http://127.0.0.1:%1").arg(silentServer.serverPort()));
+
+	Pillow::HttpHandlerBalancingProxy handler;
+	handler.upstreamGroup()->addUpstream(silentUrl, 1);
+	handler.setMaximumPendingRequests(1);
+	handler.setPendingRequestTimeout(100);
+
+	Pillow::HttpConnection* first = createGetRequest("/first", "1.1");
+	Pillow::HttpConnection* second = createGetRequest("/second", "1.1");
+	Pillow::HttpConnection* third = createGetRequest("/third", "1.1");
+	QSignalSpy firstCompletedSpy(first, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QSignalSpy secondCompletedSpy(second, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QVERIFY(handler.handleRequest(first));  // Takes the only upstream connection.
+	QVERIFY(handler.handleRequest(second)); // Waits for it.
+	QCOMPARE(secondCompletedSpy.size(), 0);
+
+	// The queue is full: refused right away.
+	QVERIFY(handler.handleRequest(third));
+	QVERIFY(response.startsWith("HTTP/1.1 503"));
+
+	// The waiting one gives up after the timeout.
+	QElapsedTimer elapsed; elapsed.start();
+	QVERIFY(waitFor([&]{ return secondCompletedSpy.size() > 0; }, 2000));
+	QVERIFY(elapsed.elapsed() >= 50);
+	QVERIFY(response.startsWith("HTTP/1.1 503"));
+	QCOMPARE(firstCompletedSpy.size(), 0); // Still under way upstream.
+}
+
+bool handleAndWaitForResponse(Pillow::HttpHandler& handler, Pillow::HttpConnection* request)
+{
+	// Responses served from the cache complete synchronously; watch for completion before handling the request.
+	QSignalSpy completedSpy(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	if (!handler.handleRequest(request)) return false;
+	return waitFor([&]{ return completedSpy.size() > 0; });
+}
+
+void HttpHandlerProxyTest::testCachingProxyServesFreshResponsesFromCache()
+{
+	cacheableHandler->responseHeaders << Pillow::HttpHeader("Cache-Control", "max-age=60");
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	for (int i = 0; i < 3; ++i)
+	{
+		QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+		QVERIFY(response.startsWith("HTTP/1.1 200"));
+		QVERIFY(response.endsWith("\r\n\r\ncacheable content 1"));
+	}
+	QCOMPARE(cacheableHandler->requestCount, 1);
+	QVERIFY(response.contains("\r\nAge: 0\r\n"));
+	QCOMPARE(handler.cache()->count(), 1);
+
+	// Other query strings are other resources.
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable?other", "1.1")));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 2"));
+	QCOMPARE(cacheableHandler->requestCount, 2);
+}
+
+void HttpHandlerProxyTest::testCachingProxyRevalidatesStaleResponses()
+{
+	cacheableHandler->responseHeaders << Pillow::HttpHeader("Cache-Control", "max-age=0") << Pillow::HttpHeader("ETag", "\"v1\"");
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 1"));
+
+	// The stored response is stale: the proxied server gets asked whether it changed, says it did not
+	// with a 304, and the client gets the full stored response.
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(response.startsWith("HTTP/1.1 200"));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 1"));
+	QCOMPARE(cacheableHandler->requestCount, 2);
+
+	// Once the resource changes, the new version gets stored.
+	cacheableHandler->responseHeaders.last() = Pillow::HttpHeader("ETag", "\"v2\"");
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 3"));
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 3"));
+	QCOMPARE(cacheableHandler->requestCount, 4);
+}
+
+void HttpHandlerProxyTest::testCachingProxyDoesNotStorePrivateResponses()
+{
+	cacheableHandler->responseHeaders << Pillow::HttpHeader("Cache-Control", "private, max-age=60");
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	for (int i = 1; i <= 3; ++i)
+	{
+		QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+		QVERIFY(response.endsWith("\r\n\r\ncacheable content " + QByteArray::number(i)));
+	}
+	QCOMPARE(cacheableHandler->requestCount, 3);
+	QCOMPARE(handler.cache()->count(), 0);
+}
+
+void HttpHandlerProxyTest::testCachingProxyCoalescesConcurrentMisses()
+{
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	QList<Pillow::HttpConnection*> requests;
+	QList<QSignalSpy*> completedSpies;
+	for (int i = 0; i < 3; ++i)
+	{
+		requests << createGetRequest("/holding", "1.1");
+		completedSpies << new QSignalSpy(requests.last(), SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+		QVERIFY(handler.handleRequest(requests.last()));
+	}
+
+	// A single request reaches the proxied server.
+	QVERIFY(waitFor([&]{ return holdingHandler->connections.size() > 0; }));
+	QTest::qWait(50);
+	QCOMPARE(holdingHandler->connections.size(), 1);
+
+	holdingHandler->connections.first()->writeResponse(200, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("Cache-Control", "max-age=60"), "held content");
+	QVERIFY(waitFor([&]() -> bool { foreach (QSignalSpy* spy, completedSpies) if (spy->isEmpty()) return false; return true; }));
+	QVERIFY(response.endsWith("\r\n\r\nheld content"));
+	qDeleteAll(completedSpies);
+
+	QCOMPARE(holdingHandler->connections.size(), 1);
+}
+
+void HttpHandlerProxyTest::testCachingProxyInvalidatesOnUnsafeMethods()
+{
+	cacheableHandler->responseHeaders << Pillow::HttpHeader("Cache-Control", "max-age=60");
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(handleAndWaitForResponse(handler, createPostRequest("/cacheable", "data", "1.1")));
+	QCOMPARE(handler.cache()->count(), 0);
+
+	QVERIFY(handleAndWaitForResponse(handler, createGetRequest("/cacheable", "1.1")));
+	QVERIFY(response.endsWith("\r\n\r\ncacheable content 3"));
+}
+
+void HttpHandlerProxyTest::testCachingProxyKeepsWriteBufferBoundedForSlowReaders()
+{
+	Pillow::HttpHandlerCachingProxy handler(serverUrl());
+
+	// The large response cannot be stored, so it gets streamed to the request.
+	int contentSize = 0;
+	const qint64 maximumWriteBufferSize = getLargeResponseWithSlowReader(&handler, &contentSize);
+	QVERIFY(maximumWriteBufferSize > 0);
+	QVERIFY(maximumWriteBufferSize <= Pillow::HttpConnection::DefaultWriteBufferHighWatermark + Pillow::HttpHandlerClientProxy::ClientReadBufferSize);
+	QCOMPARE(contentSize, largeContentSize);
+	QCOMPARE(handler.cache()->count(), 0);
+}
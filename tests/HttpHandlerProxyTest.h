@@ -8,6 +8,7 @@
 namespace Pillow { class HttpServer; class HttpHandlerSimpleRouter; }
 class CapturingHandler;
 class HoldingHandler;
+class CacheableHandler;
 
 class HttpHandlerProxyTest : public HttpHandlerTestBase
 {
@@ -16,6 +17,7 @@ class HttpHandlerProxyTest : public HttpHandlerTestBase
 	Pillow::HttpHandlerSimpleRouter* router;
 	CapturingHandler* capturingHandler;
 	HoldingHandler* holdingHandler;
+	CacheableHandler* cacheableHandler;
 	
 public:
 	HttpHandlerProxyTest();
@@ -37,6 +39,30 @@ private slots:
 	void testNonGetRequest();
 	void testHandlesMultipleConcurrentRequests();
 	void testCustomProxyPipe();
+	void testStreamsRequestContent();
+	void testKeepsWriteBufferBoundedForSlowReaders();
+
+	void testClientProxySuccessfulResponse();
+	void testClientProxyPrematureClosingResponse();
+	void testClientProxyInvalidResponse();
+	void testClientProxyNonGetRequest();
+	void testClientProxyChain();
+	void testClientProxyReusesClients();
+	void testClientProxyStreamsRequestContent();
+	void testClientProxyKeepsWriteBufferBoundedForSlowReaders();
+	void testClientProxyStripsHopByHopHeaders();
+
+	void testBalancingProxySpreadsRequests();
+	void testBalancingProxyQueuesRequestsWhenUpstreamsAreBusy();
+	void testBalancingProxyWithoutHealthyUpstream();
+	void testBalancingProxyBoundsItsQueue();
+
+	void testCachingProxyServesFreshResponsesFromCache();
+	void testCachingProxyRevalidatesStaleResponses();
+	void testCachingProxyDoesNotStorePrivateResponses();
+	void testCachingProxyCoalescesConcurrentMisses();
+	void testCachingProxyInvalidatesOnUnsafeMethods();
+	void testCachingProxyKeepsWriteBufferBoundedForSlowReaders();
 };
 
 #endif // HTTPHANDLERPROXYTEST_H
@@ -0,0 +1,117 @@
+#include <QtTest/QTest>
+#include <QtCore/QThread>
+#include "Helpers.h"
+#include "HttpHandlerTest.h"
+#include <HttpHandlerRateLimit.h>
+#include <QtNetwork/QHostAddress>
+
+class HttpHandlerRateLimitTest : public HttpHandlerTestBase
+{
+	Q_OBJECT
+
+	Pillow::HttpConnection* createRequestWithKey(const QByteArray& key)
+	{
+		return createRequest("GET", "/", QByteArray(), "1.0", Pillow::HttpHeaderCollection() << Pillow::HttpHeader("X-Api-Key", key));
+	}
+
+private slots:
+	void should_allow_a_burst_then_the_rate()
+	{
+		Pillow::HttpRateLimiter limiter(50, 2);
+		const quint64 key = Pillow::HttpRateLimiter::keyFor("client");
+		QVERIFY(limiter.tryAcquire(key));
+		QVERIFY(limiter.tryAcquire(key));
+		QVERIFY(!limiter.tryAcquire(key));
+		QVERIFY(!limiter.tryAcquire(key));
+
+		QTest::qWait(30); // Refills one token every 20 ms.
+		QVERIFY(limiter.tryAcquire(key));
+		QVERIFY(!limiter.tryAcquire(key));
+	}
+
+	void should_keep_a_bucket_per_key()
+	{
+		Pillow::HttpRateLimiter limiter(0, 1);
+		QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QHostAddress("10.0.0.1"))));
+		QVERIFY(!limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QHostAddress("10.0.0.1"))));
+		QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QHostAddress("10.0.0.2"))));
+		QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QHostAddress("::1"))));
+		QCOMPARE(limiter.count(), 3);
+
+		for (int i = 0; i < 10000; ++i)
+			QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QByteArray::number(i))));
+		QCOMPARE(limiter.count(), 10003);
+		for (int i = 0; i < 10000; ++i)
+			QVERIFY(!limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QByteArray::number(i))));
+	}
+
+	void should_evict_keys_whose_bucket_refilled()
+	{
+		Pillow::HttpRateLimiter limiter(1000, 5);
+		for (int i = 0; i < 100; ++i)
+			QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor(QByteArray::number(i))));
+		QCOMPARE(limiter.count(), 100);
+
+		QTest::qWait(20);
+		QCOMPARE(limiter.evictIdle(), 100);
+		QCOMPARE(limiter.count(), 0);
+		QVERIFY(limiter.tryAcquire(Pillow::HttpRateLimiter::keyFor("0")));
+		QCOMPARE(limiter.count(), 1);
+	}
+
+	void should_be_shared_between_threads()
+	{
+		struct AcquireThread : public QThread
+		{
+			Pillow::HttpRateLimiter* limiter; int acquiredCount;
+			void run() { for (int i = 0; i < 1000; ++i) if (limiter->tryAcquire(Pillow::HttpRateLimiter::keyFor("shared"))) ++acquiredCount; }
+		} threads[4];
+
+		Pillow::HttpRateLimiter limiter(0, 1500);
+		for (int i = 0; i < 4; ++i) { threads[i].limiter = &limiter; threads[i].acquiredCount = 0; threads[i].start(); }
+		int acquiredCount = 0;
+		for (int i = 0; i < 4; ++i) { QVERIFY(threads[i].wait(5000)); acquiredCount += threads[i].acquiredCount; }
+		QCOMPARE(acquiredCount, 1500);
+	}
+
+	void should_answer_requests_over_the_limit()
+	{
+		Pillow::HttpHandlerRateLimit handler(0.5, 2);
+		QVERIFY(!handler.handleRequest(createGetRequest()));
+		QVERIFY(!handler.handleRequest(createGetRequest()));
+		QVERIFY(handler.handleRequest(createGetRequest()));
+		QVERIFY(response.startsWith("HTTP/1.0 429 Too Many Requests"));
+		QVERIFY(response.contains("\r\nRetry-After: 2\r\n"));
+		QVERIFY(response.endsWith("Too Many Requests"));
+
+		handler.setResponse(Pillow::HttpPreparedResponse(503));
+		QVERIFY(handler.handleRequest(createGetRequest()));
+		QVERIFY(response.startsWith("HTTP/1.0 503"));
+	}
+
+	void should_tell_clients_apart_by_header()
+	{
+		Pillow::HttpHandlerRateLimit handler(0, 1);
+		handler.setKeyHeader("X-Api-Key");
+		QVERIFY(!handler.handleRequest(createRequestWithKey("a")));
+		QVERIFY(handler.handleRequest(createRequestWithKey("a")));
+		QVERIFY(!handler.handleRequest(createRequestWithKey("b")));
+
+		// Without the header, the remote address it is.
+		QVERIFY(!handler.handleRequest(createGetRequest()));
+		QVERIFY(handler.handleRequest(createGetRequest()));
+	}
+
+	void should_keep_limiting_addresses_across_connections()
+	{
+		Pillow::HttpHandlerRateLimit handler(0, 2);
+		Pillow::HttpConnection* connection = createGetRequest();
+		QVERIFY(!handler.handleRequest(connection));
+		connection->close(); // The handler forgets the connection, not the bucket of its address.
+		QVERIFY(!handler.handleRequest(createGetRequest()));
+		QVERIFY(handler.handleRequest(createGetRequest()));
+	}
+};
+PILLOW_TEST_DECLARE(HttpHandlerRateLimitTest)
+
+#include "HttpHandlerRateLimitTest.moc"
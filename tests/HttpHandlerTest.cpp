@@ -1,9 +1,12 @@
 #include <QtTest/QTest>
 #include <QtTest/QSignalSpy>
 #include "HttpHandlerTest.h"
+#include "Helpers.h"
 #include "HttpHandler.h"
 #include "HttpHandlerSimpleRouter.h"
+#include "HttpHandlerQtScript.h"
 #include "HttpConnection.h"
+#include <QtScript/QScriptEngine>
 #include <QtCore/QDir>
 #include <QtCore/QBuffer>
 #include <QtCore/QCoreApplication>
@@ -19,9 +22,11 @@ Pillow::HttpConnection * HttpHandlerTestBase::createPostRequest(const QByteArray
 	return createRequest("POST", path, content, httpVersion);
 }
 
-Pillow::HttpConnection * HttpHandlerTestBase::createRequest(const QByteArray &method, const QByteArray &path, const QByteArray &content, const QByteArray &httpVersion)
+Pillow::HttpConnection * HttpHandlerTestBase::createRequest(const QByteArray &method, const QByteArray &path, const QByteArray &content, const QByteArray &httpVersion, const Pillow::HttpHeaderCollection& headers)
 {
 	QByteArray data = QByteArray().append(method).append(" ").append(path).append(" HTTP/").append(httpVersion).append("\r\n");
+	foreach (const Pillow::HttpHeader& header, headers)
+		data.append(header.first).append(": ").append(header.second).append("\r\n");
 	if (content.size() > 0)
 	{
 		data.append("Content-Length: ").append(QByteArray::number(content.size())).append("\r\n");
@@ -166,7 +171,12 @@ void HttpHandlerTest::testHandlerLog()
 
 	// The log handler should write the log entries as they are completed.
 	buffer.seek(0);
-	QVERIFY(buffer.readLine().contains("GET /third"));
+	const QByteArray line = buffer.readLine();
+	QVERIFY(line.contains("GET /third"));
+	QVERIFY(line.contains(" headers="));
+	QVERIFY(line.contains(" content="));
+	QVERIFY(line.contains(" handler="));
+	QVERIFY(line.contains(" send="));
 	QVERIFY(buffer.readLine().contains("GET /first"));
 	QVERIFY(buffer.readLine().contains("GET /second"));
 	QVERIFY(buffer.readLine().isEmpty());
@@ -207,6 +217,128 @@ void HttpHandlerTest::testHandlerLogTrace()
 	QVERIFY(buffer.readLine().isEmpty());
 }
 
+void HttpHandlerTest::testHandlerQtScript()
+{
+	QScriptEngine engine;
+	HttpHandlerQtScript handler(engine.evaluate(
+		"(function(request) {\n"
+		"	if (request.requestPath == '/skip') return false;\n"
+		"	var path = request.requestPath; request.requestPath = 'ignored';\n"
+		"	request.nativeRequest.writeResponseString(200, {'X-Path': path, 'X-Cached': String(request.hasOwnProperty('requestPath'))},\n"
+		"		request.requestMethod + ' ' + request.requestQueryParams.name + ' ' + request.requestContent);\n"
+		"	return true;\n"
+		"})"));
+	QVERIFY(handler.scriptFunction().isFunction());
+
+	QVERIFY(!handler.handleRequest(createGetRequest("/skip")));
+
+	// Requests share the engine's prototype, but each request object must see its own connection.
+	QVERIFY(handler.handleRequest(createPostRequest("/first%20path?name=a", "some content")));
+	QVERIFY(response.startsWith("HTTP/1.0 200 OK"));
+	QVERIFY(response.contains("X-Path: /first path"));
+	QVERIFY(response.contains("X-Cached: true"));
+	QVERIFY(response.endsWith("\r\n\r\nPOST a some content"));
+
+	QVERIFY(handler.handleRequest(createGetRequest("/second?name=b")));
+	QVERIFY(response.contains("X-Path: /second"));
+	QVERIFY(response.endsWith("\r\n\r\nGET b "));
+}
+
+void HttpHandlerTest::testHandlerQtScriptReadsRequestAfterResponse()
+{
+	QScriptEngine engine;
+	HttpHandlerQtScript handler(engine.evaluate(
+		"(function(request) {\n"
+		"	request.nativeRequest.writeResponseString(200, {}, 'answered');\n"
+		"	seen = request.requestPath + ' ' + request.requestHeaders['X-Test'] + ' ' + request.requestQueryParams.name;\n"
+		"	kept = request;\n"
+		"	return true;\n"
+		"})"));
+
+	// Completing the response lets the connection go on with the next, pipelined, request right away.
+	QBuffer input, output;
+	input.setData("GET /first?name=a HTTP/1.1\r\nX-Test: one\r\n\r\nGET /second?name=b HTTP/1.1\r\nX-Test: two\r\n\r\n");
+	input.open(QIODevice::ReadOnly);
+	output.open(QIODevice::WriteOnly);
+	Pillow::HttpConnection connection;
+	connection.initialize(&input, &output);
+	QVERIFY(waitFor([&]{ return connection.state() == Pillow::HttpConnection::SendingHeaders; }));
+	QVERIFY(connection.requestPath() == "/first");
+
+	QVERIFY(handler.handleRequest(&connection));
+	QCOMPARE(connection.requestPath(), QByteArray("/second"));
+	QCOMPARE(engine.globalObject().property("seen").toString(), QString("/first one a"));
+
+	// Fields that the script did not read before the response still belong to its request.
+	QCOMPARE(engine.evaluate("kept.requestUri").toString(), QString("/first?name=a"));
+	QCOMPARE(engine.evaluate("kept.requestQueryString").toString(), QString("name=a"));
+}
+
+static void writeScriptFile(const QString& path, const QByteArray& body)
+{
+	QFile f(path); f.open(QIODevice::WriteOnly);
+	f.write("function handleRequest(request) { " + body + " }\n");
+}
+
+void HttpHandlerTest::testHandlerQtScriptFileReloads()
+{
+	QString scriptPath = QDir::tempPath() + "/HttpHandlerTest_reload.js";
+	writeScriptFile(scriptPath, "request.nativeRequest.writeResponseString(200, {}, 'first'); return true;");
+
+	QScriptEngine engine;
+	HttpHandlerQtScriptFile handler(&engine, scriptPath, "handleRequest");
+	QVERIFY(handler.isLoaded()); // Before the first request.
+	QVERIFY(handler.handleRequest(createGetRequest()));
+	QVERIFY(response.endsWith("\r\n\r\nfirst"));
+
+	// The change gets picked up from the event loop, not by the requests.
+	writeScriptFile(scriptPath, "request.nativeRequest.writeResponseString(200, {}, 'second'); return true;");
+	QVERIFY(handler.handleRequest(createGetRequest()));
+	QVERIFY(response.endsWith("\r\n\r\nfirst"));
+	QVERIFY(waitFor([&]{ handler.handleRequest(createGetRequest()); return response.endsWith("\r\n\r\nsecond"); }, 5000));
+
+	// A script that fails to evaluate does not replace the running one.
+	writeScriptFile(scriptPath, "syntax error here");
+	QVERIFY(!handler.reloadScript());
+	QVERIFY(handler.handleRequest(createGetRequest()));
+	QVERIFY(response.endsWith("\r\n\r\nsecond"));
+
+	QFile::remove(scriptPath);
+
+	// A script that cannot be loaded gets reported to the requests.
+	HttpHandlerQtScriptFile missingHandler(&engine, scriptPath, "handleRequest", false);
+	QVERIFY(!missingHandler.isLoaded());
+	QVERIFY(!missingHandler.errorMessage().isEmpty());
+	QVERIFY(missingHandler.handleRequest(createGetRequest()));
+	QVERIFY(response.startsWith("HTTP/1.0 500"));
+}
+
+void HttpHandlerTest::testHandlerQtScriptFileLoadsOnceCreated()
+{
+	QString scriptPath = QDir::tempPath() + "/HttpHandlerTest_created.js";
+	QFile::remove(scriptPath);
+
+	QScriptEngine engine;
+	HttpHandlerQtScriptFile handler(&engine, scriptPath, "handleRequest");
+	QVERIFY(!handler.isLoaded());
+	QVERIFY(handler.handleRequest(createGetRequest()));
+	QVERIFY(response.startsWith("HTTP/1.0 500"));
+
+	// Missing at first: the script gets loaded once it shows up.
+	writeScriptFile(scriptPath, "request.nativeRequest.writeResponseString(200, {}, 'created'); return true;");
+	QVERIFY(waitFor([&]{ return handler.isLoaded(); }, 5000));
+	QVERIFY(handler.handleRequest(createGetRequest()));
+	QVERIFY(response.endsWith("\r\n\r\ncreated"));
+
+	// Deleted, then written again: the new version gets loaded too.
+	QFile::remove(scriptPath);
+	QTest::qWait(HttpHandlerQtScriptFile::ReloadDelay * 2);
+	writeScriptFile(scriptPath, "request.nativeRequest.writeResponseString(200, {}, 'recreated'); return true;");
+	QVERIFY(waitFor([&]{ handler.handleRequest(createGetRequest()); return response.endsWith("\r\n\r\nrecreated"); }, 5000));
+
+	QFile::remove(scriptPath);
+}
+
 void HttpHandlerFileTest::initTestCase()
 {
 	testPath = QDir::tempPath() + "/HttpHandlerFileTest";
@@ -247,6 +379,70 @@ void HttpHandlerFileTest::testServesFiles()
 	QVERIFY(response.endsWith(QByteArray(16 * 1024 * 1024, '-')));
 }
 
+void HttpHandlerQtScriptPoolTest::initTestCase()
+{
+	QString testPath = QDir::tempPath() + "/HttpHandlerQtScriptPoolTest";
+	QDir(testPath).mkpath(".");
+	scriptPath = testPath + "/handler.js";
+
+	QFile f(scriptPath); f.open(QIODevice::WriteOnly);
+	f.write("function handleRequest(request)\n"
+			"{\n"
+			"	if (request.requestPath == '/skip') return false;\n"
+			"	if (request.requestPath == '/throw') throw new Error('Oops');\n"
+			"	request.nativeRequest.writeResponseString(200, {'X-Method': request.requestMethod}, 'Hello ' + request.requestQueryParams.name);\n"
+			"	return true;\n"
+			"}\n");
+	f.close();
+	QVERIFY(QFile::exists(scriptPath));
+}
+
+void HttpHandlerQtScriptPoolTest::testHandlesRequests()
+{
+	HttpHandlerQtScriptPool handler(scriptPath, "handleRequest", 2);
+	QCOMPARE(handler.threadCount(), 2);
+
+	Pillow::HttpConnection* request = createGetRequest("/hello?name=World");
+	QSignalSpy completedSpy(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitFor([&]{ return completedSpy.size() > 0; }, 5000));
+	QVERIFY(response.startsWith("HTTP/1.0 200 OK"));
+	QVERIFY(response.contains("X-Method: GET"));
+	QVERIFY(response.endsWith("\r\n\r\nHello World"));
+
+	// The pool accepts all requests, so it answers those that the script does not handle itself.
+	request = createGetRequest("/skip");
+	QSignalSpy skippedSpy(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitFor([&]{ return skippedSpy.size() > 0; }, 5000));
+	QVERIFY(response.startsWith("HTTP/1.0 404 Not Found"));
+
+	request = createGetRequest("/throw");
+	QSignalSpy thrownSpy(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+	QVERIFY(handler.handleRequest(request));
+	QVERIFY(waitFor([&]{ return thrownSpy.size() > 0; }, 5000));
+	QVERIFY(response.startsWith("HTTP/1.0 500 Internal Server Error"));
+	QVERIFY(response.contains("Oops"));
+}
+
+void HttpHandlerQtScriptPoolTest::testQueuesRequestsForFreeEngines()
+{
+	HttpHandlerQtScriptPool handler(scriptPath, "handleRequest", 2);
+
+	QList<QSignalSpy*> completedSpies;
+	for (int i = 0; i < 5; ++i)
+	{
+		Pillow::HttpConnection* request = createGetRequest("/hello?name=" + QByteArray::number(i));
+		completedSpies << new QSignalSpy(request, SIGNAL(requestCompleted(Pillow::HttpConnection*)));
+		QVERIFY(handler.handleRequest(request));
+	}
+	QCOMPARE(handler.pendingRequestCount(), 3);
+
+	QVERIFY(waitFor([&]{ foreach (QSignalSpy* spy, completedSpies) if (spy->isEmpty()) return false; return true; }, 5000));
+	QCOMPARE(handler.pendingRequestCount(), 0);
+	qDeleteAll(completedSpies);
+}
+
 void HttpHandlerSimpleRouterTest::testHandlerRoute()
 {
 	HttpHandlerSimpleRouter handler;
@@ -22,7 +22,7 @@ protected:
 protected:
 	Pillow::HttpConnection* createGetRequest(const QByteArray& path = "/", const QByteArray& httpVersion = "1.0");
 	Pillow::HttpConnection* createPostRequest(const QByteArray& path = "/", const QByteArray& content = QByteArray(), const QByteArray& httpVersion = "1.0");
-	Pillow::HttpConnection* createRequest(const QByteArray& method, const QByteArray& path = "/", const QByteArray& content = QByteArray(), const QByteArray& httpVersion = "1.0");
+	Pillow::HttpConnection* createRequest(const QByteArray& method, const QByteArray& path = "/", const QByteArray& content = QByteArray(), const QByteArray& httpVersion = "1.0", const Pillow::HttpHeaderCollection& headers = Pillow::HttpHeaderCollection());
 
 };
 
@@ -37,6 +37,10 @@ private slots:
 	void testHandlerFunction();
 	void testHandlerLog();
 	void testHandlerLogTrace();
+	void testHandlerQtScript();
+	void testHandlerQtScriptReadsRequestAfterResponse();
+	void testHandlerQtScriptFileReloads();
+	void testHandlerQtScriptFileLoadsOnceCreated();
 };
 
 class HttpHandlerFileTest : public HttpHandlerTestBase
@@ -49,6 +53,17 @@ private slots:
 	void testServesFiles();
 };
 
+class HttpHandlerQtScriptPoolTest : public HttpHandlerTestBase
+{
+	Q_OBJECT
+	QString scriptPath;
+
+private slots:
+	void initTestCase();
+	void testHandlesRequests();
+	void testQueuesRequestsForFreeEngines();
+};
+
 class HttpHandlerSimpleRouterTest : public HttpHandlerTestBase
 {
 	Q_OBJECT
@@ -0,0 +1,125 @@
+#include <QtTest/QTest>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QSemaphore>
+#include "Helpers.h"
+#include "HttpHandlerTest.h"
+#include <HttpHandlerThreadPool.h>
+
+class HttpHandlerThreadPoolTest : public HttpHandlerTestBase
+{
+	Q_OBJECT
+
+private slots:
+	void init()
+	{
+		response.clear();
+	}
+
+	void should_answer_from_a_worker_thread()
+	{
+		QThread* workerThread = 0;
+		Pillow::HttpHandlerThreadPool handler([&](Pillow::HttpThreadedRequest* request)
+		{
+			workerThread = QThread::currentThread();
+			request->writeResponse(200, Pillow::HttpHeaderCollection(), "hello from " + request->requestPath() + "?" + request->requestQueryString());
+		});
+
+		QVERIFY(handler.handleRequest(createGetRequest("/worker?x=1")));
+		QVERIFY(waitFor([&]{ return !response.isEmpty(); }));
+		QVERIFY(response.startsWith("HTTP/1.0 200 OK"));
+		QVERIFY(response.endsWith("hello from /worker?x=1"));
+		QVERIFY(workerThread != 0);
+		QVERIFY(workerThread != QThread::currentThread());
+	}
+
+	void should_keep_the_order_of_the_writes()
+	{
+		Pillow::HttpHandlerThreadPool handler([](Pillow::HttpThreadedRequest* request)
+		{
+			request->writeHeaders(200, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("Content-Length", "1000"));
+			for (int i = 0; i < 100; ++i)
+				request->writeContent(QByteArray::number(i % 10).repeated(10));
+		});
+
+		QVERIFY(handler.handleRequest(createGetRequest()));
+		QVERIFY(waitFor([&]{ return !response.isEmpty(); }));
+		QByteArray expectedContent;
+		for (int i = 0; i < 100; ++i) expectedContent += QByteArray::number(i % 10).repeated(10);
+		QVERIFY(response.endsWith("\r\n\r\n" + expectedContent));
+	}
+
+	void should_not_block_the_connection_thread()
+	{
+		QSemaphore semaphore;
+		Pillow::HttpHandlerThreadPool handler([&](Pillow::HttpThreadedRequest* request)
+		{
+			semaphore.acquire(); // Some blocking work.
+			request->writeResponse(200, Pillow::HttpHeaderCollection(), "done");
+		});
+
+		QVERIFY(handler.handleRequest(createPostRequest("/slow", "some content")));
+		QTest::qWait(20);
+		QVERIFY(response.isEmpty());
+
+		semaphore.release();
+		QVERIFY(waitFor([&]{ return !response.isEmpty(); }));
+		QVERIFY(response.endsWith("done"));
+	}
+
+	void should_answer_for_workers_that_do_not()
+	{
+		Pillow::HttpHandlerThreadPool handler([](Pillow::HttpThreadedRequest*) {});
+
+		QVERIFY(handler.handleRequest(createGetRequest()));
+		QVERIFY(waitFor([&]{ return !response.isEmpty(); }));
+		QVERIFY(response.startsWith("HTTP/1.0 500 Internal Server Error"));
+	}
+
+	void should_cancel_requests_of_closed_connections()
+	{
+		QSemaphore started, closed;
+		bool cancelled = false;
+		Pillow::HttpHandlerThreadPool handler([&](Pillow::HttpThreadedRequest* request)
+		{
+			started.release();
+			closed.acquire();
+			cancelled = request->isCancelled();
+			request->writeResponse(200, Pillow::HttpHeaderCollection(), "too late");
+		});
+
+		Pillow::HttpConnection* connection = createGetRequest();
+		QVERIFY(handler.handleRequest(connection));
+		QVERIFY(started.tryAcquire(1, 1000));
+		connection->close();
+		closed.release();
+
+		QThreadPool::globalInstance()->waitForDone();
+		QTest::qWait(20);
+		QVERIFY(cancelled);
+		QVERIFY(response.isEmpty());
+	}
+
+	void should_wait_for_its_workers_when_deleted()
+	{
+		QSemaphore started;
+		bool finished = false;
+		Pillow::HttpHandlerThreadPool* handler = new Pillow::HttpHandlerThreadPool([&](Pillow::HttpThreadedRequest* request)
+		{
+			started.release();
+			QTest::qSleep(50);
+			finished = true;
+			request->writeResponse(200, Pillow::HttpHeaderCollection(), "answered on the way out");
+		});
+
+		QVERIFY(handler->handleRequest(createGetRequest()));
+		QVERIFY(started.tryAcquire(1, 1000));
+		delete handler;
+		QVERIFY(finished);
+		QVERIFY(waitFor([&]{ return !response.isEmpty(); }));
+		QVERIFY(response.endsWith("answered on the way out"));
+	}
+};
+PILLOW_TEST_DECLARE(HttpHandlerThreadPoolTest)
+
+#include "HttpHandlerThreadPoolTest.moc"
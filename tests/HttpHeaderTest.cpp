@@ -232,6 +232,42 @@ private slots:
 		QCOMPARE(c.getFieldValue(""), QByteArray());
 	}
 
+	void should_allow_finding_well_known_field_value_by_id()
+	{
+		Pillow::HttpHeaderCollection c;
+		c << "Content-TYPE: text/html"
+		  << "Host: example.org"
+		  << "host: second.example.org"
+		  << "X-Custom: custom";
+
+		QCOMPARE(c.getFieldValue(Pillow::HttpHeaderId::ContentType), QByteArray("text/html"));
+		QCOMPARE(c.getFieldValue(Pillow::HttpHeaderId::Host), QByteArray("example.org"));
+		QCOMPARE(c.getFieldValue(Pillow::HttpHeaderId::Connection), QByteArray());
+		QCOMPARE(c.getFieldValue(Pillow::HttpHeaderId::Unknown), QByteArray());
+	}
+
+	void should_identify_well_known_field_names_case_insensitively()
+	{
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Content-Length"), Pillow::HttpHeaderId::ContentLength);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("content-length"), Pillow::HttpHeaderId::ContentLength);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("ACCEPT-ENCODING"), Pillow::HttpHeaderId::AcceptEncoding);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Host"), Pillow::HttpHeaderId::Host);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("X-Forwarded-For"), Pillow::HttpHeaderId::XForwardedFor);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Content-Lengt"), Pillow::HttpHeaderId::Unknown);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Hosts"), Pillow::HttpHeaderId::Unknown);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Accept-Charset"), Pillow::HttpHeaderId::Unknown); // Same length as Content-Length.
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("Set-Cookie"), Pillow::HttpHeaderId::Unknown);     // Same length as Connection.
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName("X-Forwarded-Fox"), Pillow::HttpHeaderId::Unknown);
+		QCOMPARE(Pillow::HttpHeaderId::fromFieldName(""), Pillow::HttpHeaderId::Unknown);
+
+		for (int id = Pillow::HttpHeaderId::Unknown + 1; id < Pillow::HttpHeaderId::Count; ++id)
+		{
+			Pillow::HttpHeaderId::Id fieldId = static_cast<Pillow::HttpHeaderId::Id>(id);
+			QByteArray name(Pillow::HttpHeaderId::fieldName(fieldId), Pillow::HttpHeaderId::fieldNameLength(fieldId));
+			QCOMPARE(Pillow::HttpHeaderId::fromFieldName(name.toUpper()), fieldId);
+		}
+	}
+
 	void should_allow_finding_multiple_field_values_case_insensitively()
 	{
 		Pillow::HttpHeaderCollection c;
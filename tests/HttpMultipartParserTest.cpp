@@ -0,0 +1,222 @@
+#include <QtTest/QTest>
+#include <QtCore/QBuffer>
+#include "Helpers.h"
+#include <HttpMultipartParser.h>
+
+class MultipartRecorder : public QObject
+{
+	Q_OBJECT
+
+public:
+	Pillow::HttpMultipartParser* parser;
+	QList<Pillow::HttpHeaderCollection> headers;
+	QList<QByteArray> names, fileNames, contents;
+	int finishedParts, finishedCount;
+	qint64 contentBytes;
+	bool discardContent;
+	QBuffer* fileDevice;
+
+	MultipartRecorder(Pillow::HttpMultipartParser* parser) : parser(parser), finishedParts(0), finishedCount(0), contentBytes(0), discardContent(false), fileDevice(0)
+	{
+		connect(parser, SIGNAL(partStarted()), this, SLOT(parser_partStarted()));
+		connect(parser, SIGNAL(partContentReceived(QByteArray)), this, SLOT(parser_partContentReceived(QByteArray)));
+		connect(parser, SIGNAL(partFinished()), this, SLOT(parser_partFinished()));
+		connect(parser, SIGNAL(finished()), this, SLOT(parser_finished()));
+	}
+
+private slots:
+	void parser_partStarted()
+	{
+		headers << parser->partHeaders(); names << parser->partName(); fileNames << parser->partFileName(); contents << QByteArray();
+		if (fileDevice && !parser->partFileName().isEmpty()) parser->setPartDevice(fileDevice);
+	}
+	void parser_partContentReceived(const QByteArray& data) { contentBytes += data.size(); if (!discardContent) contents.last().append(data); }
+	void parser_partFinished() { ++finishedParts; }
+	void parser_finished() { ++finishedCount; }
+};
+
+class MultipartServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	Pillow::HttpMultipartParser parser;
+	MultipartRecorder recorder;
+	QByteArray requestContent;
+	int requestCount;
+
+	MultipartServer() : Pillow::HttpServer(QHostAddress::LocalHost, 0), recorder(&parser), requestCount(0)
+	{
+		connect(this, SIGNAL(requestHeadersReady(Pillow::HttpConnection*)), this, SLOT(self_requestHeadersReady(Pillow::HttpConnection*)));
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+	}
+
+private slots:
+	void self_requestHeadersReady(Pillow::HttpConnection* connection) { parser.parseRequestContent(connection); }
+	void self_requestReady(Pillow::HttpConnection* connection)
+	{
+		++requestCount;
+		requestContent = connection->requestContent();
+		connection->writeResponse(parser.isFinished() && parser.error() == Pillow::HttpMultipartParser::NoError ? 200 : 400);
+	}
+};
+
+class HttpMultipartParserTest : public QObject
+{
+	Q_OBJECT
+
+	static QByteArray sampleContent()
+	{
+		return QByteArray("preamble\r\n"
+						  "--boundary\r\n"
+						  "Content-Disposition: form-data; name=\"field\"\r\n"
+						  "\r\n"
+						  "value\r\n"
+						  "--boundary \r\n"
+						  "Content-Disposition: form-data; name=\"file\"; filename=\"a;b.txt\"\r\n"
+						  "Content-Type: text/plain\r\n"
+						  "\r\n"
+						  "line 1\r\n--boundar\r\nline 2\r\n"
+						  "--boundary\r\n"
+						  "\r\n"
+						  "\r\n"
+						  "--boundary--\r\n"
+						  "epilogue");
+	}
+
+	void verifySampleContent(const MultipartRecorder& recorder)
+	{
+		QCOMPARE(recorder.finishedCount, 1);
+		QVERIFY(recorder.parser->error() == Pillow::HttpMultipartParser::NoError);
+		QCOMPARE(recorder.parser->partCount(), 3);
+		QCOMPARE(recorder.finishedParts, 3);
+		QCOMPARE(recorder.names, QList<QByteArray>() << "field" << "file" << QByteArray());
+		QCOMPARE(recorder.fileNames, QList<QByteArray>() << QByteArray() << "a;b.txt" << QByteArray());
+		QCOMPARE(recorder.contents, QList<QByteArray>() << "value" << "line 1\r\n--boundar\r\nline 2" << QByteArray());
+		QCOMPARE(recorder.headers.at(1), Pillow::HttpHeaderCollection()
+				 << Pillow::HttpHeader("Content-Disposition", "form-data; name=\"file\"; filename=\"a;b.txt\"")
+				 << Pillow::HttpHeader("Content-Type", "text/plain"));
+		QVERIFY(recorder.headers.at(2).isEmpty());
+	}
+
+private slots:
+	void should_parse_content_in_one_chunk()
+	{
+		Pillow::HttpMultipartParser parser("boundary");
+		MultipartRecorder recorder(&parser);
+		parser.write(sampleContent());
+		QVERIFY(parser.isFinished());
+		verifySampleContent(recorder);
+	}
+
+	void should_parse_content_byte_by_byte()
+	{
+		Pillow::HttpMultipartParser parser("boundary");
+		MultipartRecorder recorder(&parser);
+		QByteArray content = sampleContent();
+		for (int i = 0; i < content.size(); ++i)
+			parser.write(content.mid(i, 1));
+		verifySampleContent(recorder);
+	}
+
+	void should_write_file_parts_to_the_part_device()
+	{
+		Pillow::HttpMultipartParser parser("boundary");
+		MultipartRecorder recorder(&parser);
+		QBuffer file; file.open(QIODevice::WriteOnly);
+		recorder.fileDevice = &file;
+
+		parser.write(sampleContent());
+		QCOMPARE(recorder.contents, QList<QByteArray>() << "value" << QByteArray() << QByteArray());
+		QCOMPARE(file.data(), QByteArray("line 1\r\n--boundar\r\nline 2"));
+		QVERIFY(parser.partDevice() == NULL);
+	}
+
+	void should_report_errors()
+	{
+		Pillow::HttpMultipartParser parser("boundary");
+		MultipartRecorder recorder(&parser);
+		parser.write("--boundary\r\nContent-Disposition: form-data; name=\"field\"\r\n\r\nval");
+		QVERIFY(!parser.isFinished());
+		parser.end();
+		QVERIFY(parser.isFinished());
+		QVERIFY(parser.error() == Pillow::HttpMultipartParser::TruncatedContentError);
+		QCOMPARE(recorder.finishedCount, 1);
+
+		parser.reset();
+		parser.write("--boundary\r\nno colon\r\n\r\n");
+		QVERIFY(parser.error() == Pillow::HttpMultipartParser::MalformedContentError);
+
+		parser.reset();
+		parser.write("--boundary garbage\r\n");
+		QVERIFY(parser.error() == Pillow::HttpMultipartParser::MalformedContentError);
+
+		parser.reset();
+		parser.write("--boundary\r\nX-Large: ");
+		parser.write(QByteArray(Pillow::HttpMultipartParser::MaximumPartHeadersLength, 'a'));
+		QVERIFY(parser.error() == Pillow::HttpMultipartParser::PartHeadersTooLargeError);
+	}
+
+	void should_read_header_parameters()
+	{
+		QCOMPARE(Pillow::HttpMultipartParser::boundaryFromContentType("multipart/form-data; boundary=----abc"), QByteArray("----abc"));
+		QCOMPARE(Pillow::HttpMultipartParser::boundaryFromContentType("Multipart/Mixed; charset=utf-8; Boundary=\"a b\""), QByteArray("a b"));
+		QCOMPARE(Pillow::HttpMultipartParser::boundaryFromContentType("text/plain; boundary=abc"), QByteArray());
+		QCOMPARE(Pillow::HttpMultipartParser::boundaryFromContentType("multipart/form-data"), QByteArray());
+
+		QCOMPARE(Pillow::HttpMultipartParser::headerParameter("form-data; name=\"a\\\"b\"; filename=c.txt", "name"), QByteArray("a\"b"));
+		QCOMPARE(Pillow::HttpMultipartParser::headerParameter("form-data; name=\"a\\\"b\"; filename=c.txt", "filename"), QByteArray("c.txt"));
+		QCOMPARE(Pillow::HttpMultipartParser::headerParameter("form-data; filename=c.txt", "name"), QByteArray());
+	}
+
+	void should_stream_request_content()
+	{
+		MultipartServer server;
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		QVERIFY(socket.waitForConnected(1000));
+
+		QByteArray content = sampleContent();
+		socket.write("POST /upload HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=boundary\r\nContent-Length: " + QByteArray::number(content.size()) + "\r\n\r\n");
+		socket.write(content.left(content.indexOf("value")));
+		QVERIFY(waitFor([&]{ return server.recorder.headers.size() > 0; }));
+		QCOMPARE(server.requestCount, 0);
+		socket.write(content.mid(content.indexOf("value")));
+
+		QVERIFY(waitFor([&]{ return server.requestCount > 0; }));
+		verifySampleContent(server.recorder);
+		QVERIFY(server.requestContent.isEmpty());
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() > 0; }));
+		QVERIFY(socket.readAll().startsWith("HTTP/1.1 200 OK"));
+	}
+
+	void should_stream_content_larger_than_the_maximum_request_content_length()
+	{
+		MultipartServer server;
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		QVERIFY(socket.waitForConnected(1000));
+
+		const int chunkSize = 1024 * 1024;
+		const qint64 fileSize = qint64(Pillow::HttpConnection::MaximumRequestContentLength) + chunkSize;
+		QByteArray head = "--boundary\r\nContent-Disposition: form-data; name=\"file\"; filename=\"big\"\r\n\r\n";
+		QByteArray tail = "\r\n--boundary--\r\n";
+		socket.write("POST /upload HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=boundary\r\nContent-Length: " + QByteArray::number(head.size() + fileSize + tail.size()) + "\r\n\r\n" + head);
+
+		server.recorder.discardContent = true;
+		const QByteArray chunk(chunkSize, 'x');
+		for (qint64 sent = 0; sent < fileSize; sent += chunkSize)
+		{
+			socket.write(chunk);
+			QVERIFY(waitFor([&]{ return socket.bytesToWrite() == 0; }, 5000));
+		}
+		socket.write(tail);
+
+		QVERIFY(waitFor([&]{ return server.requestCount > 0; }, 5000));
+		QVERIFY(server.parser.error() == Pillow::HttpMultipartParser::NoError);
+		QCOMPARE(server.recorder.contentBytes, fileSize);
+	}
+};
+PILLOW_TEST_DECLARE(HttpMultipartParserTest)
+
+#include "HttpMultipartParserTest.moc"
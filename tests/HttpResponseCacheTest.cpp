@@ -0,0 +1,177 @@
+#include <QtTest/QTest>
+#include "Helpers.h"
+#include <HttpResponseCache.h>
+#include <HttpHelpers.h>
+
+class HttpResponseCacheTest : public QObject
+{
+	Q_OBJECT
+
+	static Pillow::HttpHeaderCollection headers(const Pillow::HttpHeader& h1 = Pillow::HttpHeader(), const Pillow::HttpHeader& h2 = Pillow::HttpHeader())
+	{
+		Pillow::HttpHeaderCollection result;
+		if (!h1.first.isEmpty()) result << h1;
+		if (!h2.first.isEmpty()) result << h2;
+		return result;
+	}
+
+private slots:
+	void should_parse_http_dates()
+	{
+		const QDateTime expected(QDate(1994, 11, 6), QTime(8, 49, 37), Qt::UTC);
+		QCOMPARE(Pillow::HttpProtocol::Dates::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT"), expected);
+		QCOMPARE(Pillow::HttpProtocol::Dates::parseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT"), expected);
+		QCOMPARE(Pillow::HttpProtocol::Dates::parseHttpDate("Sun Nov  6 08:49:37 1994"), expected);
+		QCOMPARE(Pillow::HttpProtocol::Dates::parseHttpDate(Pillow::HttpProtocol::Dates::getHttpDate(expected)), expected);
+		QVERIFY(!Pillow::HttpProtocol::Dates::parseHttpDate("0").isValid());
+		QVERIFY(!Pillow::HttpProtocol::Dates::parseHttpDate("Sun, 06 Foo 1994 08:49:37 GMT").isValid());
+		QVERIFY(!Pillow::HttpProtocol::Dates::parseHttpDate("").isValid());
+	}
+
+	void should_compute_freshness_lifetime()
+	{
+		Pillow::HttpResponseCache cache;
+		Pillow::HttpCachedResponse r;
+
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=60")), "content");
+		QVERIFY(cache.isFresh(r));
+		QCOMPARE(r.freshUntil - r.storedAt, qint64(60 * 1000));
+
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=60, s-maxage=10")), "content");
+		QCOMPARE(r.freshUntil - r.storedAt, qint64(10 * 1000));
+
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=60"), Pillow::HttpHeader("Age", "20")), "content");
+		QCOMPARE(r.freshUntil - r.storedAt, qint64(40 * 1000));
+		QCOMPARE(cache.age(r), 20);
+
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Date", Pillow::HttpProtocol::Dates::getHttpDate(now)),
+											  Pillow::HttpHeader("Expires", Pillow::HttpProtocol::Dates::getHttpDate(now.addSecs(30)))), "content");
+		QCOMPARE(r.freshUntil - r.storedAt, qint64(30 * 1000));
+
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Expires", "0")), "content");
+		QVERIFY(!cache.isFresh(r));
+
+		r = cache.createResponse(200, headers(Pillow::HttpHeader("Cache-Control", "no-cache, max-age=60")), "content");
+		QVERIFY(!cache.isFresh(r));
+	}
+
+	void should_keep_only_end_to_end_headers()
+	{
+		Pillow::HttpResponseCache cache;
+		Pillow::HttpCachedResponse r = cache.createResponse(200, Pillow::HttpHeaderCollection()
+			<< Pillow::HttpHeader("Content-Type", "text/html") << Pillow::HttpHeader("Transfer-Encoding", "chunked")
+			<< Pillow::HttpHeader("Connection", "keep-alive") << Pillow::HttpHeader("Content-Length", "7")
+			<< Pillow::HttpHeader("ETag", "\"abc\""), "content");
+
+		QCOMPARE(r.headers, Pillow::HttpHeaderCollection() << Pillow::HttpHeader("Content-Type", "text/html") << Pillow::HttpHeader("ETag", "\"abc\""));
+		QCOMPARE(r.etag, QByteArray("\"abc\""));
+	}
+
+	void should_refresh_responses_from_not_modified_headers()
+	{
+		Pillow::HttpResponseCache cache;
+		Pillow::HttpCachedResponse r = cache.createResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=0"), Pillow::HttpHeader("ETag", "\"v1\"")), "content");
+		QVERIFY(!cache.isFresh(r));
+
+		cache.refreshResponse(r, headers(Pillow::HttpHeader("Cache-Control", "max-age=60"), Pillow::HttpHeader("Content-Length", "0")));
+		QVERIFY(cache.isFresh(r));
+		QCOMPARE(r.content, QByteArray("content"));
+		QCOMPARE(r.headers, headers(Pillow::HttpHeader("ETag", "\"v1\""), Pillow::HttpHeader("Cache-Control", "max-age=60")));
+	}
+
+	void should_tell_storable_responses()
+	{
+		using Pillow::HttpResponseCache;
+		const Pillow::HttpHeaderCollection none;
+		const Pillow::HttpHeaderCollection maxAge = headers(Pillow::HttpHeader("Cache-Control", "max-age=60"));
+
+		QVERIFY(HttpResponseCache::isStorableResponse(200, maxAge, none));
+		QVERIFY(HttpResponseCache::isStorableResponse(404, maxAge, none));
+		QVERIFY(HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("ETag", "\"x\"")), none));
+		QVERIFY(HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Expires", "0")), none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, none, none)); // Nothing to go by.
+		QVERIFY(!HttpResponseCache::isStorableResponse(302, maxAge, none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(500, maxAge, none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Cache-Control", "no-store, max-age=60")), none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Cache-Control", "private, max-age=60")), none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=60"), Pillow::HttpHeader("Vary", "*")), none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Cache-Control", "max-age=60"), Pillow::HttpHeader("Set-Cookie", "a=b")), none));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, maxAge, headers(Pillow::HttpHeader("Cache-Control", "no-store"))));
+		QVERIFY(!HttpResponseCache::isStorableResponse(200, maxAge, headers(Pillow::HttpHeader("Authorization", "Basic eDp5"))));
+		QVERIFY(HttpResponseCache::isStorableResponse(200, headers(Pillow::HttpHeader("Cache-Control", "public, max-age=60")), headers(Pillow::HttpHeader("Authorization", "Basic eDp5"))));
+
+		QVERIFY(HttpResponseCache::acceptsStoredResponse(none));
+		QVERIFY(!HttpResponseCache::acceptsStoredResponse(headers(Pillow::HttpHeader("Cache-Control", "no-cache"))));
+		QVERIFY(!HttpResponseCache::acceptsStoredResponse(headers(Pillow::HttpHeader("Cache-Control", "max-age=0"))));
+		QVERIFY(!HttpResponseCache::acceptsStoredResponse(headers(Pillow::HttpHeader("Pragma", "no-cache"))));
+	}
+
+	void should_store_variants()
+	{
+		Pillow::HttpResponseCache cache;
+		const Pillow::HttpHeaderCollection gzip = headers(Pillow::HttpHeader("Accept-Encoding", "gzip"));
+		const Pillow::HttpHeaderCollection identity = headers(Pillow::HttpHeader("Accept-Encoding", "identity"));
+		const Pillow::HttpHeaderCollection vary = headers(Pillow::HttpHeader("Cache-Control", "max-age=60"), Pillow::HttpHeader("Vary", "Accept-Encoding"));
+
+		QVERIFY(cache.find("/path", gzip) == NULL);
+		QCOMPARE(cache.variantKey("/path", gzip), QByteArray("/path"));
+
+		QVERIFY(cache.insert("/path", gzip, cache.createResponse(200, vary, "gzipped")));
+		QCOMPARE(cache.find("/path", gzip)->content, QByteArray("gzipped"));
+		QVERIFY(cache.find("/path", identity) == NULL);
+		QVERIFY(cache.variantKey("/path", gzip) != cache.variantKey("/path", identity));
+
+		QVERIFY(cache.insert("/path", identity, cache.createResponse(200, vary, "plain")));
+		QCOMPARE(cache.find("/path", gzip)->content, QByteArray("gzipped"));
+		QCOMPARE(cache.find("/path", headers(Pillow::HttpHeader("accept-encoding", "identity")))->content, QByteArray("plain"));
+		QCOMPARE(cache.count(), 1);
+
+		cache.remove("/path");
+		QVERIFY(cache.find("/path", gzip) == NULL);
+	}
+
+	void should_evict_least_recently_used_responses()
+	{
+		const QByteArray content(1000, 'x');
+		const Pillow::HttpHeaderCollection none, maxAge = headers(Pillow::HttpHeader("Cache-Control", "max-age=60"));
+		Pillow::HttpResponseCache cache(3500);
+
+		QVERIFY(cache.insert("/1", none, cache.createResponse(200, maxAge, content)));
+		QVERIFY(cache.insert("/2", none, cache.createResponse(200, maxAge, content)));
+		QVERIFY(cache.insert("/3", none, cache.createResponse(200, maxAge, content)));
+		QVERIFY(cache.size() <= cache.maximumSize());
+
+		QVERIFY(cache.find("/1", none) != NULL); // "/2" is now the least recently used.
+		QVERIFY(cache.insert("/4", none, cache.createResponse(200, maxAge, content)));
+		QVERIFY(cache.size() <= cache.maximumSize());
+		QVERIFY(cache.find("/2", none) == NULL);
+		QVERIFY(cache.find("/1", none) != NULL);
+		QVERIFY(cache.find("/4", none) != NULL);
+
+		// Responses larger than the whole budget, or than the response size limit, are not stored.
+		QVERIFY(!cache.insert("/5", none, cache.createResponse(200, maxAge, QByteArray(4000, 'x'))));
+		cache.setMaximumResponseSize(100);
+		QVERIFY(!cache.insert("/1", none, cache.createResponse(200, maxAge, content)));
+		QVERIFY(cache.find("/1", none) == NULL);
+	}
+
+	void should_answer_conditional_requests()
+	{
+		Pillow::HttpResponseCache cache;
+		const Pillow::HttpCachedResponse r = cache.createResponse(200, headers(Pillow::HttpHeader("ETag", "W/\"v1\""), Pillow::HttpHeader("Last-Modified", "Sun, 06 Nov 1994 08:49:37 GMT")), "content");
+
+		QVERIFY(!Pillow::HttpResponseCache::isNotModified(r, Pillow::HttpHeaderCollection()));
+		QVERIFY(Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-None-Match", "\"v0\", \"v1\""))));
+		QVERIFY(Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-None-Match", "*"))));
+		QVERIFY(!Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-None-Match", "\"v2\""))));
+		QVERIFY(Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT"))));
+		QVERIFY(!Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-Modified-Since", "Sat, 05 Nov 1994 08:49:37 GMT"))));
+
+		// If-None-Match takes precedence.
+		QVERIFY(!Pillow::HttpResponseCache::isNotModified(r, headers(Pillow::HttpHeader("If-None-Match", "\"v2\""), Pillow::HttpHeader("If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT"))));
+	}
+};
+PILLOW_TEST_DECLARE(HttpResponseCacheTest)
+
+#include "HttpResponseCacheTest.moc"
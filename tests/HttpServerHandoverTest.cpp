@@ -0,0 +1,183 @@
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#include <QtTest/QTest>
+#include <QtCore/QThread>
+#include "Helpers.h"
+#include <HttpServer.h>
+#include <HttpServerHandover.h>
+#include <unistd.h>
+
+class NamedServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	QByteArray serverName;
+	QList<Pillow::HttpConnection*> pendingConnections; // Requests to "/wait" get answered by respond().
+
+	NamedServer(const QByteArray& name) : serverName(name)
+	{
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+	}
+
+	void respond()
+	{
+		foreach (Pillow::HttpConnection* connection, pendingConnections)
+			connection->writeResponse(200, Pillow::HttpHeaderCollection(), serverName);
+		pendingConnections.clear();
+	}
+
+private slots:
+	void self_requestReady(Pillow::HttpConnection* connection)
+	{
+		if (connection->requestPath() == "/wait") pendingConnections << connection;
+		else connection->writeResponse(200, Pillow::HttpHeaderCollection(), serverName);
+	}
+};
+
+// The new process: takes over, then serves from its own event loop.
+class TakeOverThread : public QThread
+{
+public:
+	QString name;
+	bool tookOver;
+
+	TakeOverThread(const QString& name) : name(name), tookOver(false) {}
+
+protected:
+	void run()
+	{
+		NamedServer server("new");
+		tookOver = Pillow::HttpServerHandover::takeOver(name, QList<Pillow::HttpServer*>() << &server, 2000);
+		if (tookOver) exec();
+	}
+};
+
+class HttpServerHandoverTest : public QObject
+{
+	Q_OBJECT
+
+	QString name() const { return QString("@Pillow_HttpServerHandoverTest_%1").arg(getpid()); }
+
+	QByteArray get(QTcpSocket& socket, quint16 port, const QByteArray& path)
+	{
+		if (socket.state() != QAbstractSocket::ConnectedState)
+		{
+			socket.connectToHost(QHostAddress::LocalHost, port);
+			if (!socket.waitForConnected(1000)) return QByteArray();
+		}
+		socket.write("GET " + path + " HTTP/1.1\r\n\r\n");
+		QByteArray response;
+		waitFor([&]{ response += socket.readAll(); return response.contains("\r\n\r\n") && !response.endsWith("\r\n\r\n"); });
+		return response;
+	}
+
+private slots:
+	void should_drain_connections_on_shutdown()
+	{
+		NamedServer server("old");
+		QVERIFY(server.listen(QHostAddress::LocalHost, 0));
+		const quint16 port = server.serverPort();
+
+		QTcpSocket idle, busy;
+		QVERIFY(get(idle, port, "/").endsWith("old"));
+		busy.connectToHost(QHostAddress::LocalHost, port);
+		QVERIFY(busy.waitForConnected(1000));
+		busy.write("GET /wait HTTP/1.1\r\n\r\n");
+		QVERIFY(waitFor([&]{ return server.pendingConnections.size() == 1; }));
+		QCOMPARE(server.connectionCount(), 2);
+
+		QSignalSpy drainedSpy(&server, SIGNAL(drained()));
+		server.shutdown();
+		QVERIFY(!server.isListening());
+		QVERIFY(server.isShuttingDown());
+		QVERIFY(waitFor([&]{ return idle.state() == QAbstractSocket::UnconnectedState; }));
+		QCOMPARE(busy.state(), QAbstractSocket::ConnectedState);
+		QCOMPARE(drainedSpy.size(), 0);
+
+		// The in-flight request still gets its response, then the connection closes.
+		server.respond();
+		QByteArray response;
+		QVERIFY(waitFor([&]{ response += busy.readAll(); return busy.state() == QAbstractSocket::UnconnectedState; }));
+		QVERIFY(response.contains("\r\nConnection: close\r\n"));
+		QVERIFY(response.endsWith("old"));
+		QVERIFY(waitFor([&]{ return drainedSpy.size() == 1; }));
+		QCOMPARE(server.connectionCount(), 0);
+	}
+
+	void should_hand_listening_sockets_over()
+	{
+		NamedServer server("old");
+		QVERIFY(server.listen(QHostAddress::LocalHost, 0));
+		const quint16 port = server.serverPort();
+
+		QTcpSocket busy;
+		busy.connectToHost(QHostAddress::LocalHost, port);
+		QVERIFY(busy.waitForConnected(1000));
+		busy.write("GET /wait HTTP/1.1\r\n\r\n");
+		QVERIFY(waitFor([&]{ return server.pendingConnections.size() == 1; }));
+
+		Pillow::HttpServerHandover handover;
+		QSignalSpy handedOverSpy(&handover, SIGNAL(handedOver()));
+		QSignalSpy drainedSpy(&handover, SIGNAL(drained()));
+		QVERIFY(handover.offer(name(), QList<Pillow::HttpServer*>() << &server));
+		QVERIFY(handover.isOffering());
+
+		TakeOverThread thread(name());
+		thread.start();
+		QVERIFY(waitFor([&]{ return handedOverSpy.size() == 1; }, 3000));
+		QVERIFY(thread.tookOver);
+		QVERIFY(handover.isHandedOver());
+		QVERIFY(!handover.isOffering());
+		QVERIFY(!server.isListening());
+
+		// New connections go to the new server, on the same port.
+		QTcpSocket client;
+		QVERIFY(get(client, port, "/").endsWith("new"));
+
+		// The old one finishes its in-flight request.
+		QCOMPARE(drainedSpy.size(), 0);
+		server.respond();
+		QVERIFY(waitFor([&]{ return drainedSpy.size() == 1; }));
+		QByteArray response;
+		QVERIFY(waitFor([&]{ response += busy.readAll(); return response.endsWith("old"); }));
+
+		thread.quit();
+		QVERIFY(thread.wait(1000));
+	}
+
+	void should_not_take_over_without_an_offer()
+	{
+		NamedServer server("new");
+		QVERIFY(!Pillow::HttpServerHandover::takeOver(name(), QList<Pillow::HttpServer*>() << &server, 100));
+		QVERIFY(!server.isListening());
+	}
+
+	void should_keep_offering_after_a_mismatch()
+	{
+		NamedServer server("old");
+		QVERIFY(server.listen(QHostAddress::LocalHost, 0));
+		Pillow::HttpServerHandover handover;
+		QVERIFY(handover.offer(name(), QList<Pillow::HttpServer*>() << &server));
+
+		// A new process expecting two servers refuses the single descriptor.
+		struct TakeTwoThread : public QThread
+		{
+			QString name; bool tookOver;
+			void run() { NamedServer a("a"), b("b"); tookOver = Pillow::HttpServerHandover::takeOver(name, QList<Pillow::HttpServer*>() << &a << &b, 2000); }
+		} thread;
+		thread.name = name();
+		thread.tookOver = true;
+		thread.start();
+		QVERIFY(waitFor([&]{ return thread.isFinished(); }, 3000));
+		QVERIFY(!thread.tookOver);
+
+		QVERIFY(waitFor([&]{ return handover.isOffering() && !handover.isHandedOver(); }));
+		QVERIFY(server.isListening());
+	}
+};
+PILLOW_TEST_DECLARE(HttpServerHandoverTest)
+
+#include "HttpServerHandoverTest.moc"
+
+#endif // !PILLOW_NO_UNIX_SERVER
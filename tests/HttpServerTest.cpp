@@ -1,10 +1,15 @@
 #include "HttpServerTest.h"
 #include <HttpServer.h>
 #include <HttpConnection.h>
+#include <HttpUnixServer.h>
 #include <QtTest/QTest>
 #include <QtTest/QSignalSpy>
 #include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QLocalSocket>
+#include <QtCore/QDir>
+#ifndef PILLOW_NO_UNIX_SERVER
+#include <unistd.h>
+#endif // !PILLOW_NO_UNIX_SERVER
 
 uint qHash(const QPointer<Pillow::HttpConnection>& ptr)
 {
@@ -185,3 +190,58 @@ QIODevice * HttpLocalServerTest::createClientConnection()
 	return socket;
 }
 
+
+#ifndef PILLOW_NO_UNIX_SERVER
+
+//
+// HttpUnixServerTest
+//
+
+QObject* HttpUnixServerTest::createServer()
+{
+	return new Pillow::HttpUnixServer("@Pillow_HttpUnixServerTest");
+}
+
+QIODevice * HttpUnixServerTest::createClientConnection()
+{
+	Pillow::UnixSocket* socket = new Pillow::UnixSocket(server);
+	if (!socket->connectToServer("@Pillow_HttpUnixServerTest"))
+		qDebug() << "Unexpected UnixSocket error:" << socket->errorString();
+	return socket;
+}
+
+void HttpUnixServerTest::testExposesPeerCredentials()
+{
+	QIODevice* client = createClientConnection();
+	sendRequest(client, "Hello");
+	QCOMPARE(handledRequests.size(), 1);
+
+	Pillow::UnixSocket* socket = qobject_cast<Pillow::UnixSocket*>(handledRequests.first()->inputDevice());
+	QVERIFY(socket != NULL);
+	QCOMPARE(socket->peerProcessId(), qint64(getpid()));
+	QCOMPARE(socket->peerUserId(), qint64(getuid()));
+	QCOMPARE(socket->peerGroupId(), qint64(getgid()));
+}
+
+void HttpUnixServerTest::testListensOnFileSystemPaths()
+{
+	const QString path = QDir::tempPath() + "/Pillow_HttpUnixServerTest.sock";
+	QFile::remove(path);
+
+	Pillow::HttpUnixServer fileServer(path);
+	QVERIFY(fileServer.isListening());
+	QVERIFY(QFile::exists(path));
+	connect(&fileServer, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(requestReady(Pillow::HttpConnection*)));
+
+	Pillow::UnixSocket client;
+	QVERIFY(client.connectToServer(path));
+	sendRequest(&client, "Hello");
+	sendResponses();
+	while (client.bytesAvailable() == 0) QCoreApplication::processEvents();
+	QVERIFY(client.readAll().startsWith("HTTP/1.0 200 OK"));
+
+	fileServer.close();
+	QVERIFY(!QFile::exists(path));
+}
+
+#endif // !PILLOW_NO_UNIX_SERVER
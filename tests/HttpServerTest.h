@@ -82,4 +82,36 @@ protected:
 	virtual QIODevice* createClientConnection();
 };
 
+#ifndef PILLOW_NO_UNIX_SERVER
+
+class HttpUnixServerTest : public HttpServerTestBase
+{
+	Q_OBJECT
+
+private slots: // Test slots.
+	void init() { HttpServerTestBase::init(); }
+	void cleanup() { HttpServerTestBase::cleanup(); }
+
+	void testInit() { HttpServerTestBase::testInit(); }
+	void testHandlesConnectionsAsRequests() { HttpServerTestBase::testHandlesConnectionsAsRequests(); }
+	void testHandlesConcurrentConnections() { HttpServerTestBase::testHandlesConcurrentConnections(); }
+	void testReusesRequests() { HttpServerTestBase::testReusesRequests(); }
+	void testDestroysRequests() { HttpServerTestBase::testDestroysRequests(); }
+	void testExposesPeerCredentials();
+	void testListensOnFileSystemPaths();
+
+protected:
+	virtual QObject* createServer();
+	virtual QIODevice* createClientConnection();
+};
+
+#else
+
+class HttpUnixServerTest : public QObject
+{
+	Q_OBJECT
+};
+
+#endif // !PILLOW_NO_UNIX_SERVER
+
 #endif // HTTPSERVERTEST_H
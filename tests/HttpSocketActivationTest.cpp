@@ -0,0 +1,150 @@
+#ifndef PILLOW_NO_UNIX_SERVER
+
+#include <QtTest/QTest>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtNetwork/QLocalSocket>
+#include "Helpers.h"
+#include <HttpServer.h>
+#include <HttpUnixServer.h>
+#include <HttpSocketActivation.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+class Responder : public QObject
+{
+	Q_OBJECT
+
+public slots:
+	void respond(Pillow::HttpConnection* connection)
+	{
+		connection->writeResponse(200, Pillow::HttpHeaderCollection(), "adopted");
+	}
+};
+
+class HttpSocketActivationTest : public QObject
+{
+	Q_OBJECT
+
+	QString path() const { return QDir::tempPath() + QString("/Pillow_HttpSocketActivationTest_%1.sock").arg(getpid()); }
+
+	// What a service manager would do before starting the process.
+	int bindUnixSocket(const QString& path)
+	{
+		QFile::remove(path);
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		const QByteArray encodedPath = QFile::encodeName(path);
+		memcpy(address.sun_path, encodedPath.constData(), encodedPath.size());
+
+		int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (::bind(socketDescriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(socketDescriptor, 16) < 0)
+		{
+			::close(socketDescriptor);
+			return -1;
+		}
+		return socketDescriptor;
+	}
+
+	QByteArray get(QIODevice* device)
+	{
+		device->write("GET / HTTP/1.1\r\n\r\n");
+		QByteArray response;
+		waitFor([&]{ response += device->readAll(); return response.endsWith("adopted"); });
+		return response;
+	}
+
+private slots:
+	void should_ignore_the_environment_of_another_process()
+	{
+		::setenv("LISTEN_PID", QByteArray::number(qint64(getppid())).constData(), 1);
+		::setenv("LISTEN_FDS", "1", 1);
+		::setenv("LISTEN_FDNAMES", "web", 1);
+
+		QVERIFY(Pillow::HttpSocketActivation::descriptors().isEmpty());
+		QVERIFY(Pillow::HttpSocketActivation::descriptors("web").isEmpty());
+		QVERIFY(Pillow::HttpSocketActivation::name(Pillow::HttpSocketActivation::FirstDescriptor).isEmpty());
+		QVERIFY(qgetenv("LISTEN_PID").isNull());
+		QVERIFY(qgetenv("LISTEN_FDS").isNull());
+		QVERIFY(qgetenv("LISTEN_FDNAMES").isNull());
+
+		Pillow::HttpServer server;
+		QVERIFY(!Pillow::HttpSocketActivation::listen(&server));
+		QVERIFY(!server.isListening());
+	}
+
+	void should_serve_on_an_adopted_unix_server_descriptor()
+	{
+		const int socketDescriptor = bindUnixSocket(path());
+		QVERIFY(socketDescriptor >= 0);
+
+		// Connections queue up while nobody accepts yet.
+		Pillow::UnixSocket client;
+		QVERIFY(client.connectToServer(path()));
+
+		Pillow::HttpUnixServer server;
+		Responder responder;
+		connect(&server, SIGNAL(requestReady(Pillow::HttpConnection*)), &responder, SLOT(respond(Pillow::HttpConnection*)));
+		QVERIFY(server.setSocketDescriptor(socketDescriptor));
+		QVERIFY(server.isListening());
+		QCOMPARE(server.socketDescriptor(), socketDescriptor);
+		QVERIFY(server.serverName().isEmpty());
+		QVERIFY(get(&client).endsWith("adopted"));
+
+		// The socket file belongs to whoever bound it.
+		server.close();
+		QVERIFY(QFile::exists(path()));
+		QFile::remove(path());
+	}
+
+	void should_serve_on_an_adopted_local_server_descriptor()
+	{
+		const int socketDescriptor = bindUnixSocket(path());
+		QVERIFY(socketDescriptor >= 0);
+
+		Pillow::HttpLocalServer server;
+		Responder responder;
+		connect(&server, SIGNAL(requestReady(Pillow::HttpConnection*)), &responder, SLOT(respond(Pillow::HttpConnection*)));
+		QVERIFY(!server.isListening());
+		QVERIFY(server.setSocketDescriptor(socketDescriptor));
+		QVERIFY(server.isListening());
+		QCOMPARE(server.socketDescriptor(), socketDescriptor);
+
+		QLocalSocket client;
+		client.connectToServer(path());
+		QVERIFY(client.waitForConnected(1000));
+		QVERIFY(get(&client).endsWith("adopted"));
+
+		server.close();
+		QVERIFY(!server.isListening());
+		QCOMPARE(server.socketDescriptor(), -1);
+		QVERIFY(QFile::exists(path()));
+		QFile::remove(path());
+	}
+
+	void should_refuse_descriptors_that_do_not_listen()
+	{
+		int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		QVERIFY(socketDescriptor >= 0);
+
+		Pillow::HttpUnixServer unixServer;
+		QVERIFY(!unixServer.setSocketDescriptor(socketDescriptor));
+		QVERIFY(!unixServer.isListening());
+		QVERIFY(!unixServer.errorString().isEmpty());
+
+		Pillow::HttpLocalServer localServer;
+		QVERIFY(!localServer.setSocketDescriptor(socketDescriptor));
+		QVERIFY(!localServer.isListening());
+
+		// Left open for the caller.
+		QCOMPARE(::close(socketDescriptor), 0);
+	}
+};
+PILLOW_TEST_DECLARE(HttpSocketActivationTest)
+
+#include "HttpSocketActivationTest.moc"
+
+#endif // !PILLOW_NO_UNIX_SERVER
@@ -0,0 +1,245 @@
+#include <QtTest/QTest>
+#include <QtTest/QSignalSpy>
+#include "Helpers.h"
+#include <HttpUpstreamGroup.h>
+#include <HttpClient.h>
+#include <HttpServer.h>
+#include <HttpConnection.h>
+
+class HealthCheckServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	int statusCode;
+
+	HealthCheckServer() : Pillow::HttpServer(QHostAddress::LocalHost, 0), statusCode(200)
+	{
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+	}
+
+	QUrl url() const { return QString("http://127.0.0.1:%1").arg(serverPort()); }
+
+private slots:
+	void self_requestReady(Pillow::HttpConnection* request) { request->writeResponse(statusCode); }
+};
+
+class HttpUpstreamGroupTest : public QObject
+{
+	Q_OBJECT
+
+	QUrl a, b, c;
+
+	QUrl take(Pillow::HttpUpstreamGroup& group, const QByteArray& path = "/", Pillow::HttpClient** client = 0)
+	{
+		QUrl url;
+		Pillow::HttpClient* c = group.takeClient(path, &url);
+		if (client) *client = c;
+		return c ? url : QUrl();
+	}
+
+	void failRequest(Pillow::HttpUpstreamGroup& group)
+	{
+		Pillow::HttpClient* client; QUrl url = take(group, "/", &client);
+		QVERIFY(client != NULL);
+		client->get(url);
+		QVERIFY(waitForSignal(client, SIGNAL(finished()), 2000));
+		QVERIFY(client->error() == Pillow::HttpClient::NetworkError);
+		group.releaseClient(client);
+	}
+
+private slots:
+	void initTestCase()
+	{
+		// Nothing listens on these; tests that do not send requests never connect.
+		a = QUrl("http://127.0.0.1:4591"); b = QUrl("http://127.0.0.1:4592"); c = QUrl("http://127.0.0.1:4593");
+	}
+
+	void should_be_initially_empty()
+	{
+		Pillow::HttpUpstreamGroup group;
+		QCOMPARE(group.upstreamCount(), 0);
+		QVERIFY(!group.hasHealthyUpstream());
+		QVERIFY(group.takeClient("/") == NULL);
+		QCOMPARE(group.policy(), Pillow::HttpUpstreamGroup::RoundRobin);
+		QVERIFY(group.healthCheckPath().isEmpty());
+	}
+
+	void should_use_upstreams_in_turn_with_round_robin()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.addUpstream(a); group.addUpstream(b); group.addUpstream(c);
+
+		QCOMPARE(take(group), a);
+		QCOMPARE(take(group), b);
+		QCOMPARE(take(group), c);
+		QCOMPARE(take(group), a);
+		QCOMPARE(group.upstreamOutstandingRequests(a), 2);
+	}
+
+	void should_respect_maximum_connections()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.addUpstream(a, 1);
+		QSignalSpy releasedSpy(&group, SIGNAL(clientReleased()));
+
+		Pillow::HttpClient* client;
+		QCOMPARE(take(group, "/", &client), a);
+		QVERIFY(group.takeClient("/") == NULL);
+		QVERIFY(group.hasHealthyUpstream());
+
+		group.releaseClient(client);
+		QCOMPARE(releasedSpy.size(), 1);
+
+		Pillow::HttpClient* reusedClient;
+		QCOMPARE(take(group, "/", &reusedClient), a);
+		QVERIFY(reusedClient == client);
+	}
+
+	void should_use_least_busy_upstream()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.setPolicy(Pillow::HttpUpstreamGroup::LeastOutstandingRequests);
+		group.addUpstream(a); group.addUpstream(b); group.addUpstream(c);
+
+		Pillow::HttpClient* clientB;
+		QCOMPARE(take(group), a);
+		QCOMPARE(take(group, "/", &clientB), b);
+		QCOMPARE(take(group), c);
+
+		group.releaseClient(clientB);
+		QCOMPARE(take(group), b);
+		QCOMPARE(group.upstreamOutstandingRequests(a), 1);
+		QCOMPARE(group.upstreamOutstandingRequests(b), 1);
+		QCOMPARE(group.upstreamOutstandingRequests(c), 1);
+	}
+
+	void should_keep_paths_on_the_same_upstream_with_consistent_hashing()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.setPolicy(Pillow::HttpUpstreamGroup::ConsistentHashOnPath);
+		group.addUpstream(a); group.addUpstream(b); group.addUpstream(c);
+
+		QHash<QByteArray, QUrl> assignments;
+		QSet<QUrl> used;
+		for (int i = 0; i < 30; ++i)
+		{
+			QByteArray path = "/some/path/" + QByteArray::number(i);
+			assignments.insert(path, take(group, path));
+			used << assignments.value(path);
+			QCOMPARE(take(group, path), assignments.value(path));
+		}
+		QCOMPARE(used.size(), 3);
+
+		// Removing an upstream only moves the paths that were on it.
+		group.removeUpstream(b);
+		for (QHash<QByteArray, QUrl>::const_iterator it = assignments.constBegin(); it != assignments.constEnd(); ++it)
+		{
+			if (it.value() != b)
+				QCOMPARE(take(group, it.key()), it.value());
+			else
+				QVERIFY(take(group, it.key()) != b);
+		}
+	}
+
+	void should_eject_upstream_after_consecutive_failures()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.setMaximumFailures(2);
+		group.addUpstream(a);
+		QSignalSpy ejectedSpy(&group, SIGNAL(upstreamEjected(QUrl)));
+		QSignalSpy restoredSpy(&group, SIGNAL(upstreamRestored(QUrl)));
+
+		failRequest(group);
+		QVERIFY(group.isUpstreamHealthy(a));
+		QCOMPARE(ejectedSpy.size(), 0);
+
+		failRequest(group);
+		QVERIFY(!group.isUpstreamHealthy(a));
+		QCOMPARE(ejectedSpy.size(), 1);
+		QCOMPARE(ejectedSpy.first().first().toUrl(), a);
+		QVERIFY(!group.hasHealthyUpstream());
+		QVERIFY(group.takeClient("/") == NULL);
+
+		// Without active health checks, the upstream gets another chance after the ejection time.
+		group.setEjectionTime(50);
+		QTest::qWait(100);
+		QVERIFY(group.hasHealthyUpstream());
+		QCOMPARE(take(group), a);
+		QCOMPARE(restoredSpy.size(), 1);
+	}
+
+	void should_count_server_errors_as_failures()
+	{
+		HealthCheckServer server;
+
+		Pillow::HttpUpstreamGroup group;
+		group.setMaximumFailures(2);
+		group.addUpstream(server.url());
+
+		for (int i = 0; i < 3; ++i)
+		{
+			server.statusCode = i == 1 ? 200 : 502; // A success in between resets the count.
+			Pillow::HttpClient* client; QUrl url = take(group, "/", &client);
+			QVERIFY(client != NULL);
+			client->get(url);
+			QVERIFY(waitForSignal(client, SIGNAL(finished()), 2000));
+			QVERIFY(client->error() == Pillow::HttpClient::NoError);
+			group.releaseClient(client);
+			QVERIFY(group.isUpstreamHealthy(server.url()));
+		}
+
+		Pillow::HttpClient* client; QUrl url = take(group, "/", &client);
+		QVERIFY(client != NULL);
+		client->get(url);
+		QVERIFY(waitForSignal(client, SIGNAL(finished()), 2000));
+		QCOMPARE(client->statusCode(), 502);
+		group.releaseClient(client);
+		QVERIFY(!group.isUpstreamHealthy(server.url()));
+	}
+
+	void should_restore_upstream_after_successful_health_check()
+	{
+		HealthCheckServer server;
+		server.statusCode = 503;
+
+		Pillow::HttpUpstreamGroup group;
+		group.setMaximumFailures(1);
+		group.setHealthCheckInterval(60 * 1000); // Driven manually.
+		group.setHealthCheckPath("/health");
+		group.addUpstream(server.url());
+		QSignalSpy ejectedSpy(&group, SIGNAL(upstreamEjected(QUrl)));
+		QSignalSpy restoredSpy(&group, SIGNAL(upstreamRestored(QUrl)));
+
+		group.checkHealth();
+		QVERIFY(waitFor([&]{ return ejectedSpy.size() > 0; }));
+		QVERIFY(!group.isUpstreamHealthy(server.url()));
+		QVERIFY(!group.hasHealthyUpstream());
+
+		server.statusCode = 200;
+		group.checkHealth();
+		QVERIFY(waitFor([&]{ return restoredSpy.size() > 0; }));
+		QVERIFY(group.isUpstreamHealthy(server.url()));
+		QCOMPARE(take(group), server.url());
+	}
+
+	void should_forget_removed_upstreams_once_their_clients_are_released()
+	{
+		Pillow::HttpUpstreamGroup group;
+		group.addUpstream(a); group.addUpstream(b);
+
+		Pillow::HttpClient* client;
+		QCOMPARE(take(group, "/", &client), a);
+		group.removeUpstream(a);
+		QCOMPARE(group.upstreams(), QList<QUrl>() << b);
+		QCOMPARE(take(group), b);
+		QCOMPARE(take(group), b);
+
+		QSignalSpy destroyedSpy(client, SIGNAL(destroyed()));
+		group.releaseClient(client);
+		QVERIFY(waitFor([&]{ return destroyedSpy.size() > 0; }));
+	}
+};
+PILLOW_TEST_DECLARE(HttpUpstreamGroupTest)
+
+#include "HttpUpstreamGroupTest.moc"
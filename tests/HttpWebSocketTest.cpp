@@ -0,0 +1,221 @@
+#include <QtTest/QTest>
+#include <QtCore/QCryptographicHash>
+#include "Helpers.h"
+#include <HttpServer.h>
+#include <HttpWebSocket.h>
+
+class WebSocketServer : public Pillow::HttpServer
+{
+	Q_OBJECT
+
+public:
+	Pillow::HttpWebSocket* webSocket;
+	QList<QByteArray> textMessages, binaryMessages;
+	int closedCount;
+
+	WebSocketServer() : Pillow::HttpServer(QHostAddress::LocalHost, 0), webSocket(0), closedCount(0)
+	{
+		connect(this, SIGNAL(requestReady(Pillow::HttpConnection*)), this, SLOT(self_requestReady(Pillow::HttpConnection*)));
+	}
+
+private slots:
+	void self_requestReady(Pillow::HttpConnection* connection)
+	{
+		webSocket = Pillow::HttpWebSocket::upgrade(connection, connection->requestHeaderValue(QByteArray("Sec-WebSocket-Protocol")), this);
+		if (webSocket == 0) return;
+		connect(webSocket, SIGNAL(textMessageReceived(QByteArray)), this, SLOT(webSocket_textMessageReceived(QByteArray)));
+		connect(webSocket, SIGNAL(binaryMessageReceived(QByteArray)), this, SLOT(webSocket_binaryMessageReceived(QByteArray)));
+		connect(webSocket, SIGNAL(closed(Pillow::HttpWebSocket*)), this, SLOT(webSocket_closed()));
+	}
+
+	void webSocket_textMessageReceived(const QByteArray& message)
+	{
+		textMessages << QByteArray(message.constData(), message.size());
+		webSocket->writeTextMessage(message);
+	}
+
+	void webSocket_binaryMessageReceived(const QByteArray& message) { binaryMessages << QByteArray(message.constData(), message.size()); }
+	void webSocket_closed() { ++closedCount; }
+};
+
+class HttpWebSocketTest : public QObject
+{
+	Q_OBJECT
+
+	static QByteArray handshake(const QByteArray& key, const QByteArray& extraHeaders = QByteArray())
+	{
+		return "GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+			   "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n" + extraHeaders + "\r\n";
+	}
+
+	static QByteArray clientFrame(int opcode, const QByteArray& payload, bool final = true)
+	{
+		QByteArray frame;
+		frame.append(char((final ? 0x80 : 0) | opcode));
+		if (payload.size() < 126)
+			frame.append(char(0x80 | payload.size()));
+		else
+		{
+			frame.append(char(0x80 | 126));
+			frame.append(char(payload.size() >> 8)).append(char(payload.size()));
+		}
+		const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+		frame.append(mask, 4);
+		for (int i = 0; i < payload.size(); ++i)
+			frame.append(char(payload.at(i) ^ mask[i & 3]));
+		return frame;
+	}
+
+	static QByteArray serverFrame(int opcode, const QByteArray& payload)
+	{
+		return QByteArray(1, char(0x80 | opcode)) + QByteArray(1, char(payload.size())) + payload;
+	}
+
+	QByteArray connectWebSocket(WebSocketServer& server, QTcpSocket& socket, const QByteArray& extraHeaders = QByteArray())
+	{
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		if (!socket.waitForConnected(1000)) return QByteArray();
+		socket.write(handshake("dGhlIHNhbXBsZSBub25jZQ==", extraHeaders));
+		if (!waitFor([&]{ return socket.bytesAvailable() > 0 && server.webSocket != 0; })) return QByteArray();
+		return socket.readAll();
+	}
+
+private slots:
+	void should_complete_the_handshake()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QByteArray response = connectWebSocket(server, socket, "Sec-WebSocket-Protocol: chat\r\n");
+		QVERIFY(response.startsWith("HTTP/1.1 101 Switching Protocols\r\n"));
+		QVERIFY(response.contains("\r\nUpgrade: websocket\r\n"));
+		QVERIFY(response.contains("\r\nConnection: Upgrade\r\n"));
+		QVERIFY(response.contains("\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")); // From RFC 6455 section 1.3.
+		QVERIFY(response.contains("\r\nSec-WebSocket-Protocol: chat\r\n"));
+		QVERIFY(response.endsWith("\r\n\r\n"));
+		QVERIFY(server.webSocket->state() == Pillow::HttpWebSocket::Open);
+	}
+
+	void should_reject_invalid_upgrade_requests()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		QVERIFY(socket.waitForConnected(1000));
+
+		socket.write("GET /chat HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: short\r\nSec-WebSocket-Version: 13\r\n\r\n");
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() > 0; }));
+		QVERIFY(socket.readAll().startsWith("HTTP/1.1 400"));
+
+		socket.write(QByteArray(handshake("dGhlIHNhbXBsZSBub25jZQ==")).replace("Version: 13", "Version: 8"));
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() > 0; }));
+		QByteArray response = socket.readAll();
+		QVERIFY(response.startsWith("HTTP/1.1 426 Upgrade Required"));
+		QVERIFY(response.contains("\r\nSec-WebSocket-Version: 13\r\n"));
+		QVERIFY(server.webSocket == 0);
+	}
+
+	void should_receive_and_send_messages()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QVERIFY(!connectWebSocket(server, socket).isEmpty());
+
+		socket.write(clientFrame(0x1, "Hello"));
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() >= 7; }));
+		QCOMPARE(socket.readAll(), serverFrame(0x1, "Hello"));
+
+		QByteArray large(1000, 'z');
+		socket.write(clientFrame(0x2, large) + clientFrame(0x2, "\x01\x02"));
+		QVERIFY(waitFor([&]{ return server.binaryMessages.size() == 2; }));
+		QCOMPARE(server.binaryMessages.at(0), large);
+		QCOMPARE(server.binaryMessages.at(1), QByteArray("\x01\x02"));
+	}
+
+	void should_handle_data_sent_along_with_the_handshake()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+		QVERIFY(socket.waitForConnected(1000));
+		socket.write(handshake("dGhlIHNhbXBsZSBub25jZQ==") + clientFrame(0x1, "early"));
+		QVERIFY(waitFor([&]{ return server.textMessages.size() == 1; }));
+		QCOMPARE(server.textMessages.at(0), QByteArray("early"));
+	}
+
+	void should_assemble_fragmented_messages()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QVERIFY(!connectWebSocket(server, socket).isEmpty());
+
+		// A ping between fragments gets answered right away.
+		QByteArray frames = clientFrame(0x1, "Hel", false) + clientFrame(0x9, "ping!") + clientFrame(0x0, "lo", false) + clientFrame(0x0, " world");
+		for (int i = 0; i < frames.size(); ++i)
+		{
+			socket.write(frames.mid(i, 1));
+			socket.flush();
+		}
+
+		QVERIFY(waitFor([&]{ return server.textMessages.size() == 1; }));
+		QCOMPARE(server.textMessages.at(0), QByteArray("Hello world"));
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() >= 7 + 13; }));
+		QCOMPARE(socket.readAll(), serverFrame(0xA, "ping!") + serverFrame(0x1, "Hello world"));
+	}
+
+	void should_complete_the_closing_handshake()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QVERIFY(!connectWebSocket(server, socket).isEmpty());
+
+		socket.write(clientFrame(0x8, QByteArray("\x03\xE8" "bye", 5)));
+		QVERIFY(waitFor([&]{ return server.closedCount == 1; }));
+		QCOMPARE(server.webSocket->closeCode(), 1000);
+		QCOMPARE(server.webSocket->closeReason(), QByteArray("bye"));
+		QVERIFY(waitFor([&]{ return socket.state() == QAbstractSocket::UnconnectedState; }));
+		QCOMPARE(socket.readAll(), serverFrame(0x8, QByteArray("\x03\xE8", 2)));
+	}
+
+	void should_close_from_the_server_side()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QVERIFY(!connectWebSocket(server, socket).isEmpty());
+
+		server.webSocket->close(Pillow::HttpWebSocket::GoingAway, "restart");
+		QVERIFY(server.webSocket->state() == Pillow::HttpWebSocket::Closing);
+		QVERIFY(waitFor([&]{ return socket.bytesAvailable() >= 11; }));
+		QCOMPARE(socket.readAll(), serverFrame(0x8, QByteArray("\x03\xE9" "restart", 9)));
+		QCOMPARE(server.closedCount, 0);
+
+		socket.write(clientFrame(0x8, QByteArray("\x03\xE9", 2)));
+		QVERIFY(waitFor([&]{ return server.closedCount == 1; }));
+		QCOMPARE(server.webSocket->closeCode(), int(Pillow::HttpWebSocket::GoingAway));
+	}
+
+	void should_fail_on_protocol_errors()
+	{
+		WebSocketServer server;
+		QTcpSocket socket;
+		QVERIFY(!connectWebSocket(server, socket).isEmpty());
+
+		// Invalid UTF-8 in a text message.
+		socket.write(clientFrame(0x1, "\xC0\xAF"));
+		QVERIFY(waitFor([&]{ return server.closedCount == 1; }));
+		QCOMPARE(server.webSocket->closeCode(), int(Pillow::HttpWebSocket::InvalidPayloadData));
+		QVERIFY(server.textMessages.isEmpty());
+		QVERIFY(waitFor([&]{ return socket.state() == QAbstractSocket::UnconnectedState; }));
+		QCOMPARE(socket.readAll(), serverFrame(0x8, QByteArray("\x03\xEF", 2)));
+
+		// Unmasked frame.
+		QTcpSocket socket2;
+		server.webSocket = 0;
+		QVERIFY(!connectWebSocket(server, socket2).isEmpty());
+		socket2.write(serverFrame(0x1, "Hello"));
+		QVERIFY(waitFor([&]{ return server.closedCount == 2; }));
+		QCOMPARE(server.webSocket->closeCode(), int(Pillow::HttpWebSocket::ProtocolError));
+	}
+};
+PILLOW_TEST_DECLARE(HttpWebSocketTest)
+
+#include "HttpWebSocketTest.moc"
@@ -1,12 +1,16 @@
 #ifndef PILLOW_NO_SSL
 
 #include "HttpsServerTest.h"
+#include "Helpers.h"
 #include <HttpsServer.h>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
 #include <QtNetwork/QSslSocket>
+#include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QSslKey>
 #include <QtNetwork/QSslCertificate>
+#include <QtNetwork/QSslConfiguration>
+#include <QtTest/QTest>
 
 static QSslCertificate sslCertificate()
 {
@@ -53,4 +57,77 @@ QIODevice * HttpsServerTest::createClientConnection()
 	return socket;
 }
 
+void HttpsServerTest::testCountsHandshakes()
+{
+	Pillow::HttpsServer* httpsServer = static_cast<Pillow::HttpsServer*>(server);
+	QCOMPARE(httpsServer->handshakeCount(), qint64(0));
+
+	createClientConnection();
+	createClientConnection();
+	QVERIFY(waitFor([&]{ return httpsServer->handshakeCount() == 2; }));
+	QCOMPARE(httpsServer->pendingHandshakeCount(), 0);
+	QCOMPARE(httpsServer->failedHandshakeCount(), qint64(0));
+
+	// A plain client never completes the handshake.
+	QTcpSocket* plainSocket = new QTcpSocket(server);
+	plainSocket->connectToHost("127.0.0.1", 4588);
+	QVERIFY(waitFor([&]{ return httpsServer->pendingHandshakeCount() == 1; }));
+	plainSocket->write("GET / HTTP/1.1\r\n\r\n");
+	QVERIFY(waitFor([&]{ return httpsServer->failedHandshakeCount() == 1; }, 2000));
+	QCOMPARE(httpsServer->handshakeCount(), qint64(2));
+
+	httpsServer->resetHandshakeStatistics();
+	QCOMPARE(httpsServer->handshakeCount(), qint64(0));
+	QCOMPARE(httpsServer->failedHandshakeCount(), qint64(0));
+}
+
+void HttpsServerTest::testRunsHandshakesOnHandshakeThreads()
+{
+	Pillow::HttpsServer* httpsServer = static_cast<Pillow::HttpsServer*>(server);
+	httpsServer->setHandshakeThreadCount(2);
+	QCOMPARE(httpsServer->handshakeThreadCount(), 2);
+
+	HttpServerTestBase::testHandlesConcurrentConnections();
+	QCOMPARE(httpsServer->handshakeCount(), qint64(10));
+	QCOMPARE(httpsServer->pendingHandshakeCount(), 0);
+
+	httpsServer->setHandshakeThreadCount(0);
+	QCOMPARE(httpsServer->handshakeThreadCount(), 0);
+}
+
+void HttpsServerTest::testDropsFailedHandshakesOnHandshakeThreads()
+{
+	Pillow::HttpsServer* httpsServer = static_cast<Pillow::HttpsServer*>(server);
+	httpsServer->setHandshakeThreadCount(1);
+	httpsServer->setHandshakeTimeout(200);
+
+	// Have the server verify its clients. The self-signed client certificate fails verification.
+	QSslConfiguration defaultConfiguration = QSslConfiguration::defaultConfiguration();
+	QSslConfiguration verifyingConfiguration = defaultConfiguration;
+	verifyingConfiguration.setPeerVerifyMode(QSslSocket::VerifyPeer);
+	QSslConfiguration::setDefaultConfiguration(verifyingConfiguration);
+	httpsServer->setCertificate(sslCertificate()); // Picks up the default configuration.
+	QSslConfiguration::setDefaultConfiguration(defaultConfiguration);
+
+	QSslSocket* socket = new QSslSocket(server);
+	socket->setLocalCertificate(sslCertificate());
+	socket->setPrivateKey(sslPrivateKey());
+	socket->setPeerVerifyMode(QSslSocket::VerifyNone);
+	socket->connectToHostEncrypted("127.0.0.1", 4588);
+	QVERIFY(waitFor([&]{ return httpsServer->failedHandshakeCount() == 1; }, 2000));
+	QCOMPARE(httpsServer->pendingHandshakeCount(), 0);
+	QCOMPARE(httpsServer->handshakeCount(), qint64(0));
+
+	// A client that never starts its handshake gets dropped after the timeout.
+	httpsServer->setCertificate(sslCertificate());
+	QTcpSocket* silentSocket = new QTcpSocket(server);
+	silentSocket->connectToHost("127.0.0.1", 4588);
+	QVERIFY(waitFor([&]{ return httpsServer->pendingHandshakeCount() == 1; }));
+	QVERIFY(waitFor([&]{ return httpsServer->failedHandshakeCount() == 2; }, 2000));
+	QCOMPARE(httpsServer->pendingHandshakeCount(), 0);
+	QVERIFY(waitFor([&]{ return silentSocket->state() == QAbstractSocket::UnconnectedState; }));
+
+	httpsServer->setHandshakeThreadCount(0);
+}
+
 #endif // !PILLOW_NO_SSL
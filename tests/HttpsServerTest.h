@@ -18,6 +18,9 @@ private slots: // Test slots.
 	void testHandlesConcurrentConnections() { HttpServerTestBase::testHandlesConcurrentConnections(); }
 	void testReusesRequests() { HttpServerTestBase::testReusesRequests(); }
 	void testDestroysRequests() { HttpServerTestBase::testDestroysRequests(); }
+	void testCountsHandshakes();
+	void testRunsHandshakesOnHandshakeThreads();
+	void testDropsFailedHandshakesOnHandshakeThreads();
 
 protected:
 	virtual QObject* createServer();
@@ -0,0 +1,203 @@
+#include <QtTest/QTest>
+#include <QtCore/QIODevice>
+#include <HttpConnection.h>
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+
+//
+// Counts the heap allocations made by HttpConnection while it serves keep-alive requests in a steady state, and fails
+// when a request takes more than its budget. Everything on the heap goes through malloc in the end: Qt's containers
+// directly, operator new (replaced below) otherwise. Hooking malloc itself relies on glibc, so the test is skipped elsewhere.
+//
+
+namespace
+{
+	bool counting = false;
+	qint64 allocationCount = 0;
+	qint64 allocatedBytes = 0;
+
+	inline void countAllocation(size_t size)
+	{
+		if (!counting) return;
+		++allocationCount;
+		allocatedBytes += qint64(size);
+	}
+}
+
+#ifdef __GLIBC__
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* pointer, size_t size);
+	void __libc_free(void* pointer);
+
+	void* malloc(size_t size) throw() { countAllocation(size); return __libc_malloc(size); }
+	void* calloc(size_t count, size_t size) throw() { countAllocation(count * size); return __libc_calloc(count, size); }
+	void* realloc(void* pointer, size_t size) throw() { countAllocation(size); return __libc_realloc(pointer, size); }
+	void free(void* pointer) throw() { __libc_free(pointer); }
+}
+#endif // __GLIBC__
+
+void* operator new(size_t size) { void* pointer = malloc(size); if (pointer == 0) throw std::bad_alloc(); return pointer; }
+void* operator new[](size_t size) { void* pointer = malloc(size); if (pointer == 0) throw std::bad_alloc(); return pointer; }
+void operator delete(void* pointer) throw() { free(pointer); }
+void operator delete[](void* pointer) throw() { free(pointer); }
+
+// A client that keeps sending the same request. Unbuffered, so that QIODevice does not get a buffer of its own in between.
+class ClientDevice : public QIODevice
+{
+	Q_OBJECT
+	const char* _request;
+	qint64 _requestSize, _requestPosition;
+	char _response[4096];
+	int _responseSize;
+
+public:
+	ClientDevice() : _request(0), _requestSize(0), _requestPosition(0), _responseSize(0) { open(QIODevice::ReadWrite | QIODevice::Unbuffered); }
+
+	bool isSequential() const { return true; }
+	qint64 bytesAvailable() const { return _requestSize - _requestPosition + QIODevice::bytesAvailable(); }
+
+	void send(const QByteArray& request)
+	{
+		_request = request.constData(); _requestSize = request.size(); _requestPosition = 0;
+		_responseSize = 0;
+		emit readyRead();
+	}
+
+	QByteArray response() const { return QByteArray(_response, _responseSize); }
+
+protected:
+	qint64 readData(char* data, qint64 maxSize)
+	{
+		const qint64 size = qMin(maxSize, _requestSize - _requestPosition);
+		memcpy(data, _request + _requestPosition, size_t(size));
+		_requestPosition += size;
+		return size;
+	}
+
+	qint64 writeData(const char* data, qint64 size)
+	{
+		const int copySize = int(qMin<qint64>(size, qint64(sizeof(_response)) - _responseSize));
+		memcpy(_response + _responseSize, data, copySize);
+		_responseSize += copySize;
+		return size;
+	}
+};
+
+// Answers with content and headers that are built once, as a handler serving them from memory would.
+class Responder : public QObject
+{
+	Q_OBJECT
+	QByteArray _content;
+	Pillow::HttpHeaderCollection _headers, _chunkedHeaders;
+
+public:
+	bool chunked;
+
+	Responder() : _content("Hello, Pillow!"), chunked(false)
+	{
+		_headers << Pillow::HttpHeader("Content-Type", "text/plain");
+		_chunkedHeaders << Pillow::HttpHeader("Content-Type", "text/plain") << Pillow::HttpHeader("Transfer-Encoding", "chunked");
+	}
+
+public slots:
+	void respond(Pillow::HttpConnection* connection)
+	{
+		if (!chunked)
+			connection->writeResponse(200, _headers, _content);
+		else
+		{
+			connection->writeHeaders(200, _chunkedHeaders);
+			connection->writeContent(_content);
+			connection->writeContent(_content);
+			connection->endContent();
+		}
+	}
+};
+
+class HttpConnectionAllocationTest : public QObject
+{
+	Q_OBJECT
+
+	enum { WarmupRequestCount = 100, RequestCount = 10000 };
+
+private slots:
+	void initTestCase()
+	{
+#ifndef __GLIBC__
+		QSKIP("Counting allocations needs glibc to hook malloc.", SkipAll);
+#endif
+	}
+
+	void allocationsPerRequest_data()
+	{
+		QTest::addColumn<QByteArray>("request");
+		QTest::addColumn<bool>("chunked");
+		QTest::addColumn<int>("maximumAllocations");
+		QTest::addColumn<int>("maximumBytes");
+		QTest::addColumn<QByteArray>("responseEnd");
+
+		const QByteArray content("name=pillow&kind=web+server");
+
+		// Everything lands in the buffers the connection kept from the previous requests.
+		QTest::newRow("GET") << QByteArray("GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\nUser-Agent: allocations\r\n\r\n")
+							 << false << 0 << 0 << QByteArray("\r\n\r\nHello, Pillow!");
+
+		// The request uri gets copied, as the path is null terminated in place where the query string starts: the 23 bytes
+		// of the uri after a 32 bytes QByteArray header.
+		QTest::newRow("GET with query") << QByteArray("GET /search?q=pillow&page=2 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n")
+										<< false << 1 << 55 << QByteArray("\r\n\r\nHello, Pillow!");
+
+		// Receiving the content may move the request buffer, so the last request header is rebuilt from scratch: a
+		// QByteArray header, without data, for each of its field and value.
+		QTest::newRow("POST with body") << (QByteArray("POST /submit HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: ")
+											.append(QByteArray::number(content.size())).append("\r\n\r\n").append(content))
+										<< false << 2 << 64 << QByteArray("\r\n\r\nHello, Pillow!");
+
+		// The size line of each chunk is written from a buffer the connection keeps.
+		QTest::newRow("chunked response") << QByteArray("GET /stream HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n")
+										  << true << 0 << 0 << QByteArray("\r\ne\r\nHello, Pillow!\r\n0\r\n\r\n");
+	}
+
+	void allocationsPerRequest()
+	{
+		QFETCH(QByteArray, request);
+		QFETCH(bool, chunked);
+		QFETCH(int, maximumAllocations);
+		QFETCH(int, maximumBytes);
+		QFETCH(QByteArray, responseEnd);
+
+		ClientDevice client;
+		Responder responder; responder.chunked = chunked;
+		Pillow::HttpConnection connection;
+		connect(&connection, SIGNAL(requestReady(Pillow::HttpConnection*)), &responder, SLOT(respond(Pillow::HttpConnection*)));
+		connection.initialize(&client, &client);
+
+		for (int i = 0; i < WarmupRequestCount; ++i)
+			client.send(request);
+		QVERIFY(client.response().startsWith("HTTP/1.1 200 OK\r\n"));
+		QVERIFY(client.response().endsWith(responseEnd));
+
+		allocationCount = 0; allocatedBytes = 0;
+		counting = true;
+		for (int i = 0; i < RequestCount; ++i)
+			client.send(request);
+		counting = false;
+
+		// Still the same connection, waiting for more.
+		QCOMPARE(connection.state(), Pillow::HttpConnection::ReceivingHeaders);
+		QVERIFY(client.response().endsWith(responseEnd));
+
+		const double allocations = double(allocationCount) / RequestCount, bytes = double(allocatedBytes) / RequestCount;
+		qDebug("%s: %.2f allocations, %.1f bytes per request.", QTest::currentDataTag(), allocations, bytes);
+		QVERIFY2(allocations <= maximumAllocations, qPrintable(QString("%1 allocations per request, for a budget of %2.").arg(allocations).arg(maximumAllocations)));
+		QVERIFY2(bytes <= maximumBytes, qPrintable(QString("%1 bytes allocated per request, for a budget of %2.").arg(bytes).arg(maximumBytes)));
+	}
+};
+
+QTEST_MAIN(HttpConnectionAllocationTest)
+
+#include "HttpConnectionAllocationTest.moc"
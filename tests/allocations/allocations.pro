@@ -0,0 +1,20 @@
+TARGET = allocations
+include(../../config.pri)
+TEMPLATE = app
+
+QT       += core network testlib
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+INCLUDEPATH = . ../../pillowcore
+DEPENDPATH = . ../../pillowcore
+LIBS += -L../../lib -l$${PILLOWCORE_LIB_NAME}
+unix: LIBS += -lz
+POST_TARGETDEPS += ../../lib/$$PILLOWCORE_LIB_FILE
+
+SOURCES += HttpConnectionAllocationTest.cpp
+
+OTHER_FILES += \
+    allocations.qbs
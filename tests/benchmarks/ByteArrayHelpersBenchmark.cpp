@@ -0,0 +1,75 @@
+#include <QtTest/QTest>
+#include <QtCore/QObject>
+#include <ByteArrayHelpers.h>
+#include <string.h>
+
+//
+// Compares the vectorized ByteArrayHelpers with their scalar reference implementations. Not part of the unit tests;
+// run the benchmarks binary on its own, with the usual QTestLib benchmark options (-tickcounter, -iterations, ...).
+//
+
+class ByteArrayHelpersBenchmark : public QObject
+{
+	Q_OBJECT
+
+	enum { CallsPerIteration = 1000 };
+
+private slots:
+	void asciiEqualsCaseInsensitive_data()
+	{
+		QTest::addColumn<bool>("scalar");
+		QTest::newRow("scalar") << true;
+		QTest::newRow("vectorized") << false;
+	}
+
+	void asciiEqualsCaseInsensitive()
+	{
+		QFETCH(bool, scalar);
+		const QByteArray first("Accept-Encoding: gzip, deflate, sdch, X-Forwarded-For: 127.0.0.1");
+		const QByteArray second = first.toLower();
+		int dummy = 0;
+
+		QBENCHMARK
+		{
+			for (int i = 0; i < CallsPerIteration; ++i)
+			{
+				if (scalar) dummy += Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitiveScalar(first.constData(), second.constData(), first.size());
+				else dummy += Pillow::ByteArrayHelpers::asciiEqualsCaseInsensitive(first.constData(), second.constData(), first.size());
+			}
+		}
+		QVERIFY(dummy > 0);
+	}
+
+	void percentDecodeInPlace_data()
+	{
+		QTest::addColumn<bool>("scalar");
+		QTest::addColumn<QByteArray>("input");
+		QTest::newRow("scalar, no escapes") << true << QByteArray("/api/v1/some/resource/path/index.html?key=value&other=value");
+		QTest::newRow("vectorized, no escapes") << false << QByteArray("/api/v1/some/resource/path/index.html?key=value&other=value");
+		QTest::newRow("scalar, few escapes") << true << QByteArray("/api/v1/some%20resource/path/index.html?key=some%20value&other=value");
+		QTest::newRow("vectorized, few escapes") << false << QByteArray("/api/v1/some%20resource/path/index.html?key=some%20value&other=value");
+	}
+
+	void percentDecodeInPlace()
+	{
+		QFETCH(bool, scalar);
+		QFETCH(QByteArray, input);
+		char buffer[256];
+		int dummy = 0;
+
+		QBENCHMARK
+		{
+			for (int i = 0; i < CallsPerIteration; ++i)
+			{
+				memcpy(buffer, input.constData(), input.size());
+				if (scalar) dummy += Pillow::ByteArrayHelpers::percentDecodeInPlaceScalar(buffer, input.size());
+				else dummy += Pillow::ByteArrayHelpers::percentDecodeInPlace(buffer, input.size());
+			}
+		}
+		QVERIFY(dummy > 0);
+	}
+};
+
+QTEST_MAIN(ByteArrayHelpersBenchmark)
+
+#include "ByteArrayHelpersBenchmark.moc"
@@ -23,8 +23,10 @@ int main(int argc, char *argv[])
 	result += execTest<HttpServerTest>();
 	result += execTest<HttpsServerTest>();
 	result += execTest<HttpLocalServerTest>();
+	result += execTest<HttpUnixServerTest>();
 	result += execTest<HttpHandlerTest>();
 	result += execTest<HttpHandlerFileTest>();
+	result += execTest<HttpHandlerQtScriptPoolTest>();
 	result += execTest<HttpHandlerSimpleRouterTest>();
 	result += execTest<HttpHandlerProxyTest>();
 
@@ -35,6 +37,19 @@ int main(int argc, char *argv[])
 	PILLOW_TEST_RUN(NetworkAccessManagerTest, result);
 	PILLOW_TEST_RUN(HttpHeaderTest, result);
 	PILLOW_TEST_RUN(HttpHeaderCollectionTest, result);
+	PILLOW_TEST_RUN(HttpUpstreamGroupTest, result);
+	PILLOW_TEST_RUN(HttpResponseCacheTest, result);
+	PILLOW_TEST_RUN(HttpMultipartParserTest, result);
+	PILLOW_TEST_RUN(HttpWebSocketTest, result);
+	PILLOW_TEST_RUN(HttpEventChannelTest, result);
+	PILLOW_TEST_RUN(Http2SessionTest, result);
+#ifndef PILLOW_NO_UNIX_SERVER
+	PILLOW_TEST_RUN(HttpServerHandoverTest, result);
+	PILLOW_TEST_RUN(HttpSocketActivationTest, result);
+#endif // !PILLOW_NO_UNIX_SERVER
+	PILLOW_TEST_RUN(HttpHandlerRateLimitTest, result);
+	PILLOW_TEST_RUN(HttpHandlerFlightRecorderTest, result);
+	PILLOW_TEST_RUN(HttpHandlerThreadPoolTest, result);
 
 	return result;
 }
@@ -22,7 +22,20 @@ SOURCES += main.cpp \
 	HttpHandlerProxyTest.cpp \
 	ByteArrayHelpersTest.cpp \
 	HttpClientTest.cpp \
-	HttpHeaderTest.cpp
+	HttpHeaderTest.cpp \
+	HttpUpstreamGroupTest.cpp \
+	HttpResponseCacheTest.cpp \
+	HttpMultipartParserTest.cpp \
+	HttpWebSocketTest.cpp \
+	HttpEventChannelTest.cpp \
+	Http2SessionTest.cpp \
+	HttpHandlerRateLimitTest.cpp \
+	HttpHandlerFlightRecorderTest.cpp \
+	HttpHandlerThreadPoolTest.cpp
+
+!contains(DEFINES, PILLOW_NO_UNIX_SERVER): SOURCES += \
+	HttpServerHandoverTest.cpp \
+	HttpSocketActivationTest.cpp
 
 HEADERS += \
 	HttpServerTest.h \